@@ -8,26 +8,30 @@
 
 #include <vector>
 #include <algorithm>
+#include <atomic>
 #ifndef HAVE_OLD_CPP
-# include <unordered_map>
 # include <unordered_set>
 #else
-# include <tr1/unordered_map>
 # include <tr1/unordered_set>
-namespace std { using std::tr1::unordered_map; using std::tr1::unordered_set; }
+namespace std { using std::tr1::unordered_set; }
 #endif
 
-#include <boost/functional/hash.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include "node_state_hash.h"
 #include "verbose.h"
 #include "hg.h"
 #include "ff.h"
 #include "ffset.h"
+#include "decoding_stats.h"
+#include "sentence_metadata.h"
 
 #define NORMAL_CP 1
 #define FAST_CP 2
 #define FAST_CP_2 3
+#define LAZY_CP 4
 
 using namespace std;
 
@@ -36,6 +40,15 @@ typedef SmallVectorInt JVector;
 typedef vector<Candidate*> CandidateHeap;
 typedef vector<Candidate*> CandidateList;
 
+// feature values of an edge in the -LM forest plus the values of the
+// stateless features, which are the same for all candidates built from it
+// (see ModelSet::AddStatelessFeatures)
+struct StatelessEdgeScore {
+  SparseVector<double> feature_values;
+  prob_t estimate;
+};
+typedef vector<StatelessEdgeScore> StatelessEdgeScores;
+
 // default vector size (* sizeof string is memory used)
 static const size_t kRESERVE_NUM_NODES = 500000ul;
 
@@ -56,7 +69,8 @@ struct Candidate {
   const Hypergraph::Edge* in_edge_;    // in -LM forest
   Hypergraph::Edge out_edge_;
   FFState state_;
-  const JVector j_;
+  uint64_t state_hash_;        // models.StateHash(state_)
+  JVector j_;
   prob_t vit_prob_;            // these are fixed until the cand
                                // is popped, then they may be updated
   prob_t est_prob_;
@@ -65,20 +79,39 @@ struct Candidate {
             const JVector& j,
             const Hypergraph& out_hg,
             const vector<CandidateList>& D,
-            const FFStates& node_states,
+            const FFStateStore& node_states,
             const SentenceMetadata& smeta,
             const ModelSet& models,
+            const StatelessEdgeScores& stateless,
             bool is_goal) :
       node_index_(-1),
       in_edge_(&e),
       j_(j) {
-    InitializeCandidate(out_hg, smeta, D, node_states, models, is_goal);
+    InitializeCandidate(out_hg, smeta, D, node_states, models, stateless, is_goal);
   }
 
   // used to query uniqueness
   Candidate(const Hypergraph::Edge& e,
             const JVector& j) : in_edge_(&e), j_(j) {}
 
+  // reinitializes a candidate that is no longer used. out_edge_ and state_
+  // keep their buffers, so this usually doesn't allocate any memory
+  void Reset(const Hypergraph::Edge& e,
+             const JVector& j,
+             const Hypergraph& out_hg,
+             const vector<CandidateList>& D,
+             const FFStateStore& node_states,
+             const SentenceMetadata& smeta,
+             const ModelSet& models,
+             const StatelessEdgeScores& stateless,
+             bool is_goal) {
+    node_index_ = -1;
+    in_edge_ = &e;
+    j_ = j;
+    if (is_goal) state_.clear();  // goal items have no state
+    InitializeCandidate(out_hg, smeta, D, node_states, models, stateless, is_goal);
+  }
+
   bool IsIncorporatedIntoHypergraph() const {
     return node_index_ >= 0;
   }
@@ -86,12 +119,16 @@ struct Candidate {
   void InitializeCandidate(const Hypergraph& out_hg,
                            const SentenceMetadata& smeta,
                            const vector<vector<Candidate*> >& D,
-                           const FFStates& node_states,
+                           const FFStateStore& node_states,
                            const ModelSet& models,
+                           const StatelessEdgeScores& stateless,
                            const bool is_goal) {
     const Hypergraph::Edge& in_edge = *in_edge_;
     out_edge_.rule_ = in_edge.rule_;
-    out_edge_.feature_values_ = in_edge.feature_values_;
+    if (is_goal)
+      out_edge_.feature_values_ = in_edge.feature_values_;
+    else
+      out_edge_.feature_values_ = stateless[in_edge.id_].feature_values;
     out_edge_.i_ = in_edge.i_;
     out_edge_.j_ = in_edge.j_;
     out_edge_.prev_i_ = in_edge.prev_i_;
@@ -109,11 +146,14 @@ struct Candidate {
     prob_t edge_estimate = prob_t::One();
     if (is_goal) {
       assert(tail.size() == 1);
-      const FFState& ant_state = node_states[tail.front()];
+      FFState ant_state;
+      node_states.GetState(tail.front(), &ant_state);
       models.AddFinalFeatures(ant_state, &out_edge_, smeta);
     } else {
-      models.AddFeaturesToEdge(smeta, out_hg, node_states, &out_edge_, &state_, &edge_estimate);
+      models.AddStatefulFeaturesToEdge(smeta, out_hg, node_states, &out_edge_, &state_, &edge_estimate);
+      edge_estimate *= stateless[in_edge.id_].estimate;
     }
+    state_hash_ = models.StateHash(state_);
     vit_prob_ = out_edge_.edge_prob_ * p;
     est_prob_ = vit_prob_ * edge_estimate;
   }
@@ -166,7 +206,130 @@ struct CandidateUniquenessEquals {
 };
 
 typedef unordered_set<const Candidate*, CandidateUniquenessHash, CandidateUniquenessEquals> UniqueCandidateSet;
-typedef unordered_map<FFState, Candidate*, boost::hash<FFState> > State2Node;
+
+// Candidates are created and discarded at a very high rate during cube
+// pruning, so rather than new/delete-ing each one, they are constructed in
+// large blocks owned by the pool. Discarded candidates are kept on a free list
+// and reinitialized by the next call to New(), which reuses their state and
+// feature buffers. All memory is released at once when the pool is destroyed.
+class CandidatePool {
+ public:
+  CandidatePool() : used_(kBLOCK_SIZE) {}
+  ~CandidatePool() {
+    for (unsigned i = 0; i < blocks_.size(); ++i) {
+      const unsigned n = (i + 1 == blocks_.size() ? used_ : kBLOCK_SIZE);
+      for (unsigned j = 0; j < n; ++j)
+        blocks_[i][j].~Candidate();
+      ::operator delete(blocks_[i]);
+    }
+  }
+
+  Candidate* New(const Hypergraph::Edge& e,
+                 const JVector& j,
+                 const Hypergraph& out_hg,
+                 const vector<CandidateList>& D,
+                 const FFStateStore& node_states,
+                 const SentenceMetadata& smeta,
+                 const ModelSet& models,
+                 const StatelessEdgeScores& stateless,
+                 bool is_goal) {
+    if (!free_.empty()) {
+      Candidate* c = free_.back();
+      free_.pop_back();
+      c->Reset(e, j, out_hg, D, node_states, smeta, models, stateless, is_goal);
+      return c;
+    }
+    if (used_ == kBLOCK_SIZE) {
+      blocks_.push_back(static_cast<Candidate*>(::operator new(kBLOCK_SIZE * sizeof(Candidate))));
+      used_ = 0;
+    }
+    Candidate* c = new (&blocks_.back()[used_]) Candidate(e, j, out_hg, D, node_states, smeta, models, stateless, is_goal);
+    ++used_;
+    return c;
+  }
+
+  // c may be returned by a subsequent call to New()
+  void Delete(Candidate* c) { free_.push_back(c); }
+
+ private:
+  static const unsigned kBLOCK_SIZE = 4096;
+  vector<Candidate*> blocks_;
+  unsigned used_;  // number of constructed candidates in blocks_.back()
+  CandidateList free_;
+};
+
+// Maps the states of the +LM nodes built for one -LM node to values (the
+// candidate or node index representing each state). This is an
+// open-addressing table with linear probing keyed by ModelSet::StateHash(),
+// which callers compute once per state; states are only compared (up to
+// their ignored bytes) when the hashes are equal. Entries are numbered in the
+// order they were added.
+template <typename T>
+class StateMap {
+ public:
+  explicit StateMap(const ModelSet& models) : models_(models), slots_(16) {}
+
+  // returns the value of state, which is T() if state was not in the map
+  T& Find(const FFState& state, uint64_t hash) {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+      Slot& slot = slots_[i];
+      if (!slot.entry) {
+        if (2 * (keys_.size() + 1) > slots_.size()) {
+          Grow();
+          return Find(state, hash);
+        }
+        slot.hash = hash;
+        keys_.push_back(state);
+        values_.push_back(T());
+        slot.entry = keys_.size();
+        return values_.back();
+      }
+      if (slot.hash == hash && models_.StatesEqual(keys_[slot.entry - 1], state))
+        return values_[slot.entry - 1];
+    }
+  }
+
+  size_t size() const { return values_.size(); }
+  const T& value(size_t i) const { return values_[i]; }
+
+ private:
+  struct Slot {
+    Slot() : hash(), entry() {}
+    uint64_t hash;
+    uint32_t entry;  // index into keys_ and values_ + 1, 0 if empty
+  };
+
+  void Grow() {
+    vector<Slot> old(slots_.size() * 2);
+    old.swap(slots_);
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = 0; i < old.size(); ++i) {
+      if (!old[i].entry) continue;
+      size_t j = old[i].hash & mask;
+      while (slots_[j].entry) j = (j + 1) & mask;
+      slots_[j] = old[i];
+    }
+  }
+
+  const ModelSet& models_;
+  vector<Slot> slots_;  // the size is a power of 2
+  FFStates keys_;
+  vector<T> values_;
+};
+
+typedef StateMap<Candidate*> State2Node;
+
+// +LM nodes and edges created for one -LM node that have not been added to
+// the output forest yet. The node_index_ of the candidates in D and the
+// head_node_ of the edges are indices into states until the buffer is
+// committed.
+struct NodeBuffer {
+  vector<Hypergraph::Edge> edges;
+  FFStates states;
+  vector<size_t> hashes;
+  void clear() { edges.clear(); states.clear(); hashes.clear(); }
+};
 
 class CubePruningRescorer {
 
@@ -176,16 +339,27 @@ public:
                       const Hypergraph& i,
                       int pop_limit,
                       Hypergraph* o,
-                      int s = NORMAL_CP ) :
+                      int s = NORMAL_CP,
+                      int num_threads = 1) :
       models(m),
       smeta(sm),
       in(i),
       out(*o),
       D(in.nodes_.size()),
+      node_states_(m),
+      stateless_(in.edges_.size()),
       pop_limit_(pop_limit),
-      strategy_(s){
-    if (!SILENT) cerr << "  Applying feature functions (cube pruning, pop_limit = " << pop_limit_ << ')' << endl;
-    node_states_.reserve(kRESERVE_NUM_NODES);
+      strategy_(s),
+      num_threads_(num_threads),
+      pops_(0),
+      pushes_(0) {
+    if (!SILENT) {
+      cerr << "  Applying feature functions (cube pruning, pop_limit = " << pop_limit_;
+      if (num_threads_ > 1) cerr << ", threads = " << num_threads_;
+      cerr << ')' << endl;
+    }
+    // each -LM node is split into at most pop_limit +LM nodes
+    node_states_.reserve(min(kRESERVE_NUM_NODES, in.nodes_.size() * pop_limit_));
   }
 
   void Apply() {
@@ -194,74 +368,90 @@ public:
     int goal_id = num_nodes - 1;
     int pregoal = goal_id - 1;
     assert(in.nodes_[pregoal].out_edges_.size() == 1);
-    if (!SILENT) cerr << "    ";
-    int has = 0;
-    for (int i = 0; i < in.nodes_.size(); ++i) {
-      if (!SILENT) {
-        int needs = (50 * i / in.nodes_.size());
-        while (has < needs) { cerr << '.'; ++has; }
-      }
-      if (strategy_==NORMAL_CP){
-        KBest(i, i == goal_id);
-      }
-      if (strategy_==FAST_CP){
-        KBestFast(i, i == goal_id);
-      }
-      if (strategy_==FAST_CP_2){
-        KBestFast2(i, i == goal_id);
+    if (num_threads_ > 1) {
+      KBestParallel(goal_id);
+      KBest(goal_id, true, &pool_, NULL);
+    } else if (strategy_ == LAZY_CP) {
+      KBestLazy(goal_id);
+    } else {
+      if (!SILENT) cerr << "    ";
+      int has = 0;
+      for (int i = 0; i < in.nodes_.size(); ++i) {
+        if (!SILENT) {
+          int needs = (50 * i / in.nodes_.size());
+          while (has < needs) { cerr << '.'; ++has; }
+        }
+        if (strategy_==NORMAL_CP){
+          KBest(i, i == goal_id, &pool_, NULL);
+        }
+        if (strategy_==FAST_CP){
+          KBestFast(i, i == goal_id);
+        }
+        if (strategy_==FAST_CP_2){
+          KBestFast2(i, i == goal_id);
+        }
       }
+      if (!SILENT) cerr << endl;
     }
     if (!SILENT) {
-      cerr << endl;
       cerr << "  Best path: " << log(D[goal_id].front()->vit_prob_)
            << "\t" << log(D[goal_id].front()->est_prob_) << endl;
     }
     out.PruneUnreachable(D[goal_id].front()->node_index_);
     FreeAll();
+    if (smeta.GetStats()) {
+      smeta.GetStats()->AddCount("cube_pops", pops_);
+      smeta.GetStats()->AddCount("cube_pushes", pushes_);
+    }
   }
 
  private:
   void FreeAll() {
-    for (int i = 0; i < D.size(); ++i) {
-      CandidateList& D_i = D[i];
-      for (int j = 0; j < D_i.size(); ++j)
-        delete D_i[j];
-    }
-    D.clear();
-  }
-
-  void IncorporateIntoPlusLMForest(size_t head_node_hash, Candidate* item, State2Node* s2n, CandidateList* freelist) {
-    Hypergraph::Edge* new_edge = out.AddEdge(item->out_edge_);
-    new_edge->edge_prob_ = item->out_edge_.edge_prob_;
-
-    Candidate** o_item_ptr = nullptr;
-    if (item->state_.size() && models.NeedsStateErasure()) {
-      // When erasure of certain state bytes is needed, we must make a copy of
-      // the state instead of doing the erasure in-place because future
-      // candidates may require the information in the bytes to be erased.
-      FFState state(item->state_);
-      models.EraseIgnoredBytes(&state);
-      o_item_ptr = &(*s2n)[state];
+    D.clear();  // the candidates themselves are owned by pool_
+    lazy_.clear();
+  }
+
+  // if buf is not NULL, the new nodes and edges are added to it instead of
+  // the output forest (see CommitNodeBuffer)
+  void IncorporateIntoPlusLMForest(size_t head_node_hash, Candidate* item, State2Node* s2n, CandidateList* freelist, NodeBuffer* buf) {
+    Hypergraph::Edge* new_edge = NULL;
+    if (buf) {
+      buf->edges.push_back(item->out_edge_);
     } else {
-      o_item_ptr = &(*s2n)[item->state_];
+      new_edge = out.AddEdge(item->out_edge_);
+      new_edge->edge_prob_ = item->out_edge_.edge_prob_;
     }
-    Candidate*& o_item = *o_item_ptr;
+
+    // the ignored bytes of the states are not compared, so items whose
+    // states only differ in them are recombined
+    Candidate*& o_item = s2n->Find(item->state_, item->state_hash_);
 
     if (!o_item) o_item = item;
 
     int& node_id = o_item->node_index_;
     if (node_id < 0) {
-      Hypergraph::Node* new_node = out.AddNode(in.nodes_[item->in_edge_->head_node_].cat_);
-      new_node->node_hash = cdec::HashNode(head_node_hash, item->state_); // ID is combination of existing state + residual state
-      node_states_.push_back(item->state_);
-      node_id = new_node->id_;
+      const size_t node_hash = cdec::HashNode(head_node_hash, item->state_hash_); // ID is combination of existing state + residual state
+      if (buf) {
+        node_id = buf->states.size();
+        buf->states.push_back(item->state_);
+        buf->hashes.push_back(node_hash);
+      } else {
+        Hypergraph::Node* new_node = out.AddNode(in.nodes_[item->in_edge_->head_node_].cat_);
+        new_node->node_hash = node_hash;
+        node_states_.AddNode(item->state_);
+        node_id = new_node->id_;
+      }
     }
+    if (buf) {
+      buf->edges.back().head_node_ = node_id;
+    } else {
 #if 0
-    Hypergraph::Node* node = &out.nodes_[node_id];
-    out.ConnectEdgeToHeadNode(new_edge, node);
+      Hypergraph::Node* node = &out.nodes_[node_id];
+      out.ConnectEdgeToHeadNode(new_edge, node);
 #else
-    out.ConnectEdgeToHeadNode(new_edge, node_id);
+      out.ConnectEdgeToHeadNode(new_edge, node_id);
 #endif
+    }
     // update candidate if we have a better derivation
     // note: the difference between the vit score and the estimated
     // score is the same for all items with a common residual DP
@@ -269,12 +459,11 @@ public:
     if (item->vit_prob_ > o_item->vit_prob_) {
       if (item->state_.size() && models.NeedsStateErasure()) {
         // node_states_ should still point to the unerased state.
-        node_states_[o_item->node_index_] = item->state_;
-        // sanity check!
-        FFState item_state(item->state_), o_item_state(o_item->state_);
-        models.EraseIgnoredBytes(&item_state);
-        models.EraseIgnoredBytes(&o_item_state);
-        assert(item_state == o_item_state);
+        if (buf)
+          buf->states[o_item->node_index_] = item->state_;
+        else
+          node_states_.SetState(o_item->node_index_, item->state_);
+        assert(models.StatesEqual(item->state_, o_item->state_));  // sanity check!
       } else {
         assert(o_item->state_ == item->state_);  // sanity check!
       }
@@ -285,11 +474,15 @@ public:
     if (item != o_item) freelist->push_back(item);
   }
 
-  void KBest(const int vert_index, const bool is_goal) {
+  // candidates are allocated from pool, which must only be used by the
+  // calling thread. If buf is not NULL, the +LM nodes and edges are added to
+  // it rather than to the output forest.
+  void KBest(const int vert_index, const bool is_goal, CandidatePool* pool, NodeBuffer* buf) {
     // cerr << "KBest(" << vert_index << ")\n";
     CandidateList& D_v = D[vert_index];
     assert(D_v.empty());
     const Hypergraph::Node& v = in.nodes_[vert_index];
+    ScoreStatelessFeatures(v, is_goal);
     // cerr << "  has " << v.in_edges_.size() << " in-coming edges\n";
     const vector<int>& in_edges = v.in_edges_;
     CandidateHeap cand;
@@ -299,36 +492,131 @@ public:
     for (int i = 0; i < in_edges.size(); ++i) {
       const Hypergraph::Edge& edge = in.edges_[in_edges[i]];
       const JVector j(edge.tail_nodes_.size(), 0);
-      cand.push_back(new Candidate(edge, j, out, D, node_states_, smeta, models, is_goal));
+      cand.push_back(pool->New(edge, j, out, D, node_states_, smeta, models, stateless_, is_goal));
       bool is_new = unique_cands.insert(cand.back()).second;
       assert(is_new);  // these should all be unique!
     }
 //    cerr << "  making heap of " << cand.size() << " candidates\n";
     make_heap(cand.begin(), cand.end(), HeapCandCompare());
-    State2Node state2node;   // "buf" in Figure 2
+    State2Node state2node(models);   // "buf" in Figure 2
     int pops = 0;
     while(!cand.empty() && pops < pop_limit_) {
       pop_heap(cand.begin(), cand.end(), HeapCandCompare());
       Candidate* item = cand.back();
       cand.pop_back();
       // cerr << "POPPED: " << *item << endl;
-      PushSucc(*item, is_goal, &cand, &unique_cands);
-      IncorporateIntoPlusLMForest(v.node_hash, item, &state2node, &freelist);
+      PushSucc(*item, is_goal, &cand, &unique_cands, pool);
+      IncorporateIntoPlusLMForest(v.node_hash, item, &state2node, &freelist, buf);
       ++pops;
     }
     D_v.resize(state2node.size());
-    int c = 0;
-    for (State2Node::iterator i = state2node.begin(); i != state2node.end(); ++i)
-      D_v[c++] = i->second;
+    for (int c = 0; c < D_v.size(); ++c)
+      D_v[c] = state2node.value(c);
     sort(D_v.begin(), D_v.end(), EstProbSorter());
     // cerr << "  expanded to " << D_v.size() << " nodes\n";
 
+    // every candidate that was pushed has either been popped or is still in
+    // the heap
+    CountCandidates(pops, cand.size());
     for (int i = 0; i < cand.size(); ++i)
-      delete cand[i];
+      pool->Delete(cand[i]);
     // freelist is necessary since even after an item merged, it still stays in
-    // the unique set so it can't be deleted til now
+    // the unique set so it can't be recycled til now
     for (int i = 0; i < freelist.size(); ++i)
-      delete freelist[i];
+      pool->Delete(freelist[i]);
+  }
+
+  // computes stateless_ for the in-coming edges of v
+  void ScoreStatelessFeatures(const Hypergraph::Node& v, const bool is_goal) {
+    if (is_goal) return;  // the goal edge only gets the final features
+    for (int i = 0; i < v.in_edges_.size(); ++i) {
+      const Hypergraph::Edge& edge = in.edges_[v.in_edges_[i]];
+      StatelessEdgeScore& score = stateless_[edge.id_];
+      score.feature_values = edge.feature_values_;
+      models.AddStatelessFeatures(smeta, edge, &score.feature_values, &score.estimate);
+    }
+  }
+
+  // work shared by the threads of KBestParallel
+  struct ParallelSchedule {
+    explicit ParallelSchedule(int num_threads) : barrier(num_threads), next(0) {}
+    vector<vector<int> > levels;
+    vector<boost::shared_ptr<CandidatePool> > pools;  // one per thread
+    vector<NodeBuffer> buffers;    // one per node of the current level
+    boost::barrier barrier;
+    std::atomic<unsigned> next;    // next node of the current level
+  };
+
+  // runs KBest on all nodes except the goal node with num_threads_ threads.
+  // Nodes are grouped into levels such that every node is in a higher level
+  // than its antecedents (span length alone is not enough because of unary
+  // rules), so the nodes of one level can be processed independently. Each
+  // thread takes the next unprocessed node of the level until there are none
+  // left. The results are added to the output forest after the level is
+  // complete, in node order, so the output does not depend on the thread
+  // schedule. The feature functions must be thread safe.
+  void KBestParallel(const int goal_id) {
+    ParallelSchedule s(num_threads_);
+    vector<int> level(goal_id, 0);
+    for (int i = 0; i < goal_id; ++i) {
+      const vector<int>& in_edges = in.nodes_[i].in_edges_;
+      for (int j = 0; j < in_edges.size(); ++j) {
+        const Hypergraph::TailNodeVector& tail = in.edges_[in_edges[j]].tail_nodes_;
+        for (int k = 0; k < tail.size(); ++k)
+          level[i] = max(level[i], level[tail[k]] + 1);
+      }
+      if (level[i] >= s.levels.size()) s.levels.resize(level[i] + 1);
+      s.levels[level[i]].push_back(i);
+    }
+    size_t max_width = 0;
+    for (int i = 0; i < s.levels.size(); ++i)
+      max_width = max(max_width, s.levels[i].size());
+    if (!SILENT) cerr << "    " << s.levels.size() << " levels, at most " << max_width << " nodes per level\n";
+    s.buffers.resize(max_width);
+    for (int i = 0; i < num_threads_; ++i)
+      s.pools.push_back(boost::shared_ptr<CandidatePool>(new CandidatePool));
+    boost::thread_group threads;
+    for (int i = 1; i < num_threads_; ++i)
+      threads.create_thread(boost::bind(&CubePruningRescorer::KBestParallelWorker, this, i, &s));
+    KBestParallelWorker(0, &s);
+    threads.join_all();
+    parallel_pools_.swap(s.pools);  // the candidates in D must outlive s
+  }
+
+  void KBestParallelWorker(const int thread_id, ParallelSchedule* s) {
+    CandidatePool* pool = s->pools[thread_id].get();
+    for (int l = 0; l < s->levels.size(); ++l) {
+      const vector<int>& nodes = s->levels[l];
+      for (unsigned i = s->next++; i < nodes.size(); i = s->next++)
+        KBest(nodes[i], false, pool, &s->buffers[i]);
+      s->barrier.wait();
+      if (thread_id == 0) {
+        for (int i = 0; i < nodes.size(); ++i)
+          CommitNodeBuffer(nodes[i], &s->buffers[i]);
+        s->next = 0;
+      }
+      s->barrier.wait();
+    }
+  }
+
+  // adds the nodes and edges created by KBest(vert_index, ..., buf) to the
+  // output forest
+  void CommitNodeBuffer(const int vert_index, NodeBuffer* buf) {
+    const int first_node = out.nodes_.size();
+    const WordID cat = in.nodes_[vert_index].cat_;
+    for (int i = 0; i < buf->states.size(); ++i) {
+      Hypergraph::Node* new_node = out.AddNode(cat);
+      new_node->node_hash = buf->hashes[i];
+      node_states_.AddNode(buf->states[i]);
+    }
+    for (int i = 0; i < buf->edges.size(); ++i) {
+      Hypergraph::Edge* new_edge = out.AddEdge(buf->edges[i]);
+      out.ConnectEdgeToHeadNode(new_edge, first_node + buf->edges[i].head_node_);
+    }
+    CandidateList& D_v = D[vert_index];
+    for (int i = 0; i < D_v.size(); ++i)
+      D_v[i]->node_index_ += first_node;
+    buf->clear();
   }
 
   void KBestFast(const int vert_index, const bool is_goal) {
@@ -336,6 +624,7 @@ public:
     CandidateList& D_v = D[vert_index];
     assert(D_v.empty());
     const Hypergraph::Node& v = in.nodes_[vert_index];
+    ScoreStatelessFeatures(v, is_goal);
     // cerr << " has " << v.in_edges_.size() << " in-coming edges\n";
     const vector<int>& in_edges = v.in_edges_;
     CandidateHeap cand;
@@ -345,11 +634,11 @@ public:
     for (int i = 0; i < in_edges.size(); ++i) {
       const Hypergraph::Edge& edge = in.edges_[in_edges[i]];
       const JVector j(edge.tail_nodes_.size(), 0);
-      cand.push_back(new Candidate(edge, j, out, D, node_states_, smeta, models, is_goal));
+      cand.push_back(pool_.New(edge, j, out, D, node_states_, smeta, models, stateless_, is_goal));
     }
     // cerr << " making heap of " << cand.size() << " candidates\n";
     make_heap(cand.begin(), cand.end(), HeapCandCompare());
-    State2Node state2node; // "buf" in Figure 2
+    State2Node state2node(models); // "buf" in Figure 2
     int pops = 0;
     while(!cand.empty() && pops < pop_limit_) {
       pop_heap(cand.begin(), cand.end(), HeapCandCompare());
@@ -358,14 +647,13 @@ public:
       // cerr << "POPPED: " << *item << endl;
 
       PushSuccFast(*item, is_goal, &cand);
-      IncorporateIntoPlusLMForest(v.node_hash, item, &state2node, &freelist);
+      IncorporateIntoPlusLMForest(v.node_hash, item, &state2node, &freelist, NULL);
       ++pops;
     }
     D_v.resize(state2node.size());
-    int c = 0;
-    for (auto& i : state2node) {
-      D_v[c++] = i.second;
-      // cerr << "MERGED: " << *i.second << endl;
+    for (int c = 0; c < D_v.size(); ++c) {
+      D_v[c] = state2node.value(c);
+      // cerr << "MERGED: " << *D_v[c] << endl;
     }
     //cerr <<"Node id: "<< vert_index<< endl;
     //#ifdef MEASURE_CA
@@ -376,12 +664,13 @@ public:
 
     // cerr << " expanded to " << D_v.size() << " nodes\n";
 
+    CountCandidates(pops, cand.size());
     for (int i = 0; i < cand.size(); ++i)
-      delete cand[i];
+      pool_.Delete(cand[i]);
     // freelist is necessary since even after an item merged, it still stays in
-    // the unique set so it can't be deleted til now
+    // the unique set so it can't be recycled til now
     for (int i = 0; i < freelist.size(); ++i)
-      delete freelist[i];
+      pool_.Delete(freelist[i]);
   }
 
   void KBestFast2(const int vert_index, const bool is_goal) {
@@ -389,6 +678,7 @@ public:
     CandidateList& D_v = D[vert_index];
     assert(D_v.empty());
     const Hypergraph::Node& v = in.nodes_[vert_index];
+    ScoreStatelessFeatures(v, is_goal);
     // cerr << " has " << v.in_edges_.size() << " in-coming edges\n";
     const vector<int>& in_edges = v.in_edges_;
     CandidateHeap cand;
@@ -399,11 +689,11 @@ public:
     for (int i = 0; i < in_edges.size(); ++i) {
       const Hypergraph::Edge& edge = in.edges_[in_edges[i]];
       const JVector j(edge.tail_nodes_.size(), 0);
-      cand.push_back(new Candidate(edge, j, out, D, node_states_, smeta, models, is_goal));
+      cand.push_back(pool_.New(edge, j, out, D, node_states_, smeta, models, stateless_, is_goal));
     }
     // cerr << " making heap of " << cand.size() << " candidates\n";
     make_heap(cand.begin(), cand.end(), HeapCandCompare());
-    State2Node state2node; // "buf" in Figure 2
+    State2Node state2node(models); // "buf" in Figure 2
     int pops = 0;
     while(!cand.empty() && pops < pop_limit_) {
       pop_heap(cand.begin(), cand.end(), HeapCandCompare());
@@ -414,14 +704,13 @@ public:
       // cerr << "POPPED: " << *item << endl;
 
       PushSuccFast2(*item, is_goal, &cand, &unique_accepted);
-      IncorporateIntoPlusLMForest(v.node_hash, item, &state2node, &freelist);
+      IncorporateIntoPlusLMForest(v.node_hash, item, &state2node, &freelist, NULL);
       ++pops;
     }
     D_v.resize(state2node.size());
-    int c = 0;
-    for (State2Node::iterator i = state2node.begin(); i != state2node.end(); ++i){
-      D_v[c++] = i->second;
-      // cerr << "MERGED: " << *i->second << endl;
+    for (int c = 0; c < D_v.size(); ++c) {
+      D_v[c] = state2node.value(c);
+      // cerr << "MERGED: " << *D_v[c] << endl;
     }
     //cerr <<"Node id: "<< vert_index<< endl;
     //#ifdef MEASURE_CA
@@ -432,23 +721,94 @@ public:
 
     // cerr << " expanded to " << D_v.size() << " nodes\n";
 
+    CountCandidates(pops, cand.size());
     for (int i = 0; i < cand.size(); ++i)
-      delete cand[i];
+      pool_.Delete(cand[i]);
     // freelist is necessary since even after an item merged, it still stays in
-    // the unique set so it can't be deleted til now
+    // the unique set so it can't be recycled til now
     for (int i = 0; i < freelist.size(); ++i)
-      delete freelist[i];
+      pool_.Delete(freelist[i]);
+  }
+
+  // the candidates of a -LM node that is expanded on demand by cube growing
+  struct LazyNode {
+    explicit LazyNode(const ModelSet& m) : state2node(m), pops() {}
+    CandidateHeap cand;
+    UniqueCandidateSet unique_cands;
+    State2Node state2node;
+    CandidateList freelist;
+    int pops;
+  };
+
+  // Cube growing (Huang and Chiang, Forest Rescoring, ACL 2007): instead of
+  // popping pop_limit candidates at every node bottom-up, nodes are expanded
+  // top-down when a parent needs them. The goal node pops up to pop_limit
+  // candidates; creating a candidate that uses the j-th +LM node of a tail
+  // first asks the tail for it (LazyKthBest), which pops candidates of its own
+  // until it has j+1 +LM nodes (or none are left, or it reaches the pop
+  // limit). Nodes the search never gets to are never scored. Unlike in KBest,
+  // the +LM nodes of a node stay in the order they were found, since parents
+  // refer to them by position while the node is still being expanded.
+  void KBestLazy(const int goal_id) {
+    lazy_.resize(in.nodes_.size());
+    LazyKthBest(goal_id, 0, true);
+    for (int i = 0; i < lazy_.size(); ++i)
+      if (lazy_[i]) CountCandidates(lazy_[i]->pops, lazy_[i]->cand.size());
+  }
+
+  // returns true if D[vert_index][k] exists (the goal node pops up to
+  // pop_limit candidates however large k is)
+  bool LazyKthBest(const int vert_index, const unsigned k, const bool is_goal) {
+    CandidateList& D_v = D[vert_index];
+    if (k < D_v.size()) return true;
+    const Hypergraph::Node& v = in.nodes_[vert_index];
+    boost::shared_ptr<LazyNode>& lazy = lazy_[vert_index];
+    if (!lazy) {
+      lazy.reset(new LazyNode(models));
+      ScoreStatelessFeatures(v, is_goal);
+      for (int i = 0; i < v.in_edges_.size(); ++i) {
+        const Hypergraph::Edge& edge = in.edges_[v.in_edges_[i]];
+        bool has_tails = true;
+        for (int t = 0; t < edge.tail_nodes_.size() && has_tails; ++t)
+          has_tails = LazyKthBest(edge.tail_nodes_[t], 0, false);
+        if (!has_tails) continue;
+        const JVector j(edge.tail_nodes_.size(), 0);
+        lazy->cand.push_back(pool_.New(edge, j, out, D, node_states_, smeta, models, stateless_, is_goal));
+        lazy->unique_cands.insert(lazy->cand.back());
+      }
+      make_heap(lazy->cand.begin(), lazy->cand.end(), HeapCandCompare());
+    }
+    LazyNode& n = *lazy;
+    while (!n.cand.empty() && n.pops < pop_limit_ && (is_goal || D_v.size() <= k)) {
+      pop_heap(n.cand.begin(), n.cand.end(), HeapCandCompare());
+      Candidate* item = n.cand.back();
+      n.cand.pop_back();
+      PushSucc(*item, is_goal, &n.cand, &n.unique_cands, &pool_, true);
+      const size_t num_states = n.state2node.size();
+      IncorporateIntoPlusLMForest(v.node_hash, item, &n.state2node, &n.freelist, NULL);
+      if (n.state2node.size() > num_states)
+        D_v.push_back(n.state2node.value(num_states));
+      ++n.pops;
+    }
+    return k < D_v.size();
+  }
+
+  void CountCandidates(int pops, size_t unpopped) {
+    pops_ += pops;
+    pushes_ += pops + unpopped;
   }
 
-  void PushSucc(const Candidate& item, const bool is_goal, CandidateHeap* pcand, UniqueCandidateSet* cs) {
+  // if lazy, the tail nodes are expanded as needed (see LazyKthBest)
+  void PushSucc(const Candidate& item, const bool is_goal, CandidateHeap* pcand, UniqueCandidateSet* cs, CandidatePool* pool, bool lazy = false) {
     CandidateHeap& cand = *pcand;
     for (int i = 0; i < item.j_.size(); ++i) {
       JVector j = item.j_;
       ++j[i];
+      if (lazy) LazyKthBest(item.in_edge_->tail_nodes_[i], j[i], false);
       if (j[i] < D[item.in_edge_->tail_nodes_[i]].size()) {
         Candidate query_unique(*item.in_edge_, j);
         if (cs->count(&query_unique) == 0) {
-          Candidate* new_cand = new Candidate(*item.in_edge_, j, out, D, node_states_, smeta, models, is_goal);
+          Candidate* new_cand = pool->New(*item.in_edge_, j, out, D, node_states_, smeta, models, stateless_, is_goal);
           cand.push_back(new_cand);
           push_heap(cand.begin(), cand.end(), HeapCandCompare());
           bool is_new = cs->insert(new_cand).second;
@@ -465,7 +825,7 @@ public:
       JVector j = item.j_;
       ++j[i];
       if (j[i] < D[item.in_edge_->tail_nodes_[i]].size()) {
-        Candidate* new_cand = new Candidate(*item.in_edge_, j, out, D, node_states_, smeta, models, is_goal);
+        Candidate* new_cand = pool_.New(*item.in_edge_, j, out, D, node_states_, smeta, models, stateless_, is_goal);
         cand.push_back(new_cand);
         push_heap(cand.begin(), cand.end(), HeapCandCompare());
       }
@@ -484,7 +844,7 @@ public:
       if (j[i] < D[item.in_edge_->tail_nodes_[i]].size()) {
         Candidate query_unique(*item.in_edge_, j);
         if (HasAllAncestors(&query_unique,ps)) {
-          Candidate* new_cand = new Candidate(*item.in_edge_, j, out, D, node_states_, smeta, models, is_goal);
+          Candidate* new_cand = pool_.New(*item.in_edge_, j, out, D, node_states_, smeta, models, stateless_, is_goal);
           cand.push_back(new_cand);
           push_heap(cand.begin(), cand.end(), HeapCandCompare());
         }
@@ -511,13 +871,22 @@ public:
   const Hypergraph& in;
   Hypergraph& out;
 
+  CandidatePool pool_;       // owns all candidates created for this forest
+  vector<boost::shared_ptr<CandidatePool> > parallel_pools_;  // ... or by
+                             // the threads of KBestParallel
   vector<CandidateList> D;   // maps nodes in in-HG to the
                              // equivalent nodes (many due to state
                              // splits) in the out-HG.
-  FFStates node_states_;  // for each node in the out-HG what is
+  vector<boost::shared_ptr<LazyNode> > lazy_;  // for each node in the in-HG
+                             // that has been expanded by cube growing
+  FFStateStore node_states_;  // for each node in the out-HG what is
                              // its q function value?
+  StatelessEdgeScores stateless_;  // for each edge in the in-HG
   const int pop_limit_;
-  const int strategy_;       //switch Cube Pruning strategy: 1 normal, 2 fast (alg 2), 3 fast_2 (alg 3). (see: Gesmundo A., Henderson J,. Faster Cube Pruning, IWSLT 2010)
+  const int strategy_;       //switch Cube Pruning strategy: 1 normal, 2 fast (alg 2), 3 fast_2 (alg 3). (see: Gesmundo A., Henderson J,. Faster Cube Pruning, IWSLT 2010), 4 cube growing
+  const int num_threads_;    // > 1 to process independent nodes in parallel (NORMAL_CP only)
+  std::atomic<uint64_t> pops_;    // reported to the DecodingStats of smeta
+  std::atomic<uint64_t> pushes_;
 };
 
 struct NoPruningRescorer {
@@ -526,12 +895,13 @@ struct NoPruningRescorer {
       smeta(sm),
       in(i),
       out(*o),
-      nodemap(i.nodes_.size()) {
+      nodemap(i.nodes_.size()),
+      node_states_(m) {
     if (!SILENT) cerr << "  Rescoring forest (full intersection)\n";
     node_states_.reserve(kRESERVE_NUM_NODES);
   }
 
-  typedef unordered_map<FFState, int, boost::hash<FFState> > State2NodeIndex;
+  typedef StateMap<int> State2NodeIndex;
 
   void ExpandEdge(const Hypergraph::Edge& in_edge, bool is_goal, size_t head_node_hash, State2NodeIndex* state2node) {
     const int arity = in_edge.Arity();
@@ -539,6 +909,13 @@ struct NoPruningRescorer {
     for (int i = 0; i < arity; ++i)
       ends[i] = nodemap[in_edge.tail_nodes_[i]].size();
 
+    // the stateless features are the same for every combination of tails
+    SparseVector<double> stateless_features(in_edge.feature_values_);
+    if (!is_goal) {
+      prob_t estimate;  // this is a full intersection, so we disregard this
+      models.AddStatelessFeatures(smeta, in_edge, &stateless_features, &estimate);
+    }
+
     Hypergraph::TailNodeVector tail_iter(arity, 0);
     bool done = false;
     while (!done) {
@@ -549,18 +926,21 @@ struct NoPruningRescorer {
       FFState head_state;
       if (is_goal) {
         assert(tail.size() == 1);
-        const FFState& ant_state = node_states_[tail.front()];
+        FFState ant_state;
+        node_states_.GetState(tail.front(), &ant_state);
         models.AddFinalFeatures(ant_state, new_edge,smeta);
       } else {
         prob_t edge_estimate; // this is a full intersection, so we disregard this
-        models.AddFeaturesToEdge(smeta, out, node_states_, new_edge, &head_state, &edge_estimate);
+        new_edge->feature_values_ = stateless_features;
+        models.AddStatefulFeaturesToEdge(smeta, out, node_states_, new_edge, &head_state, &edge_estimate);
       }
-      int& head_plus1 = (*state2node)[head_state];
+      const uint64_t state_hash = models.StateHash(head_state);
+      int& head_plus1 = state2node->Find(head_state, state_hash);
       if (!head_plus1) {
         HG::Node* new_node = out.AddNode(in_edge.rule_->GetLHS());
-        new_node->node_hash = cdec::HashNode(head_node_hash, head_state); // ID is combination of existing state + residual state
+        new_node->node_hash = cdec::HashNode(head_node_hash, state_hash); // ID is combination of existing state + residual state
         head_plus1 = new_node->id_ + 1;
-        node_states_.push_back(head_state);
+        node_states_.AddNode(head_state);
         nodemap[in_edge.head_node_].push_back(head_plus1 - 1);
       }
       const int head_index = head_plus1 - 1;
@@ -577,7 +957,7 @@ struct NoPruningRescorer {
   }
 
   void ProcessOneNode(const int node_num, const bool is_goal) {
-    State2NodeIndex state2node;
+    State2NodeIndex state2node(models);
     const Hypergraph::Node& node = in.nodes_[node_num];
     for (int i = 0; i < node.in_edges_.size(); ++i) {
       const Hypergraph::Edge& edge = in.edges_[node.in_edges_[i]];
@@ -609,7 +989,7 @@ struct NoPruningRescorer {
   Hypergraph& out;
 
   vector<vector<int> > nodemap;
-  FFStates node_states_;  // for each node in the out-HG what is
+  FFStateStore node_states_;  // for each node in the out-HG what is
                              // its q function value?
 };
 
@@ -626,7 +1006,10 @@ void ApplyModelSet(const Hypergraph& in,
   } else if (config.algorithm == IntersectionConfiguration::CUBE ||
              config.algorithm == IntersectionConfiguration::FAST_CUBE_PRUNING ||
              config.algorithm ==
-                 IntersectionConfiguration::FAST_CUBE_PRUNING_2) {
+                 IntersectionConfiguration::FAST_CUBE_PRUNING_2 ||
+             config.algorithm ==
+                 IntersectionConfiguration::PARALLEL_CUBE_PRUNING ||
+             config.algorithm == IntersectionConfiguration::CUBE_GROWING) {
     int pl = config.pop_limit;
     const int max_pl_for_large=50;
     if (pl > max_pl_for_large && in.nodes_.size() > 80000) {
@@ -645,6 +1028,19 @@ void ApplyModelSet(const Hypergraph& in,
       CubePruningRescorer ma(models, smeta, in, pl, out, FAST_CP_2);
       ma.Apply();
     }
+    else if (config.algorithm == IntersectionConfiguration::PARALLEL_CUBE_PRUNING){
+      int threads = config.num_threads;
+      if (threads > 1 && !models.IsThreadSafe()) {
+        cerr << "  Note: feature functions are not thread safe, using a single thread for cube pruning\n";
+        threads = 1;
+      }
+      CubePruningRescorer ma(models, smeta, in, pl, out, NORMAL_CP, threads);
+      ma.Apply();
+    }
+    else if (config.algorithm == IntersectionConfiguration::CUBE_GROWING){
+      CubePruningRescorer ma(models, smeta, in, pl, out, LAZY_CP);
+      ma.Apply();
+    }
 
   } else {
     cerr << "Don't understand intersection algorithm " << config.algorithm << endl;
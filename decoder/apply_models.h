@@ -15,13 +15,16 @@ enum {
   CUBE,
   FAST_CUBE_PRUNING,
   FAST_CUBE_PRUNING_2,
+  PARALLEL_CUBE_PRUNING,
+  CUBE_GROWING,
   N_ALGORITHMS
 };
 
   const int algorithm; // 0 = full intersection, 1 = cube pruning
   const int pop_limit; // max number of pops off the heap at each node
-  IntersectionConfiguration(int alg, int k) : algorithm(alg), pop_limit(k) {}
-  IntersectionConfiguration(exhaustive_t /* t */) : algorithm(0), pop_limit() {}
+  const int num_threads; // used by PARALLEL_CUBE_PRUNING
+  IntersectionConfiguration(int alg, int k, int threads = 1) : algorithm(alg), pop_limit(k), num_threads(threads) {}
+  IntersectionConfiguration(exhaustive_t /* t */) : algorithm(0), pop_limit(), num_threads(1) {}
 };
 
 inline std::ostream& operator<<(std::ostream& os, const IntersectionConfiguration& c) {
@@ -29,7 +32,9 @@ inline std::ostream& operator<<(std::ostream& os, const IntersectionConfiguratio
   else if (c.algorithm == 1) { os << "CUBE:k=" << c.pop_limit; }
   else if (c.algorithm == 2) { os << "FAST_CUBE_PRUNING"; }
   else if (c.algorithm == 3) { os << "FAST_CUBE_PRUNING_2"; }
-  else if (c.algorithm == 4) { os << "N_ALGORITHMS"; }
+  else if (c.algorithm == 4) { os << "PARALLEL_CUBE_PRUNING:k=" << c.pop_limit << ",threads=" << c.num_threads; }
+  else if (c.algorithm == 5) { os << "CUBE_GROWING:k=" << c.pop_limit; }
+  else if (c.algorithm == 6) { os << "N_ALGORITHMS"; }
   else os << "OTHER";
   return os;
 }
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <deque>
 
 #include "filelib.h"
 #include "decoder.h"
@@ -15,6 +16,7 @@ int main(int argc, char** argv) {
 
   const string input = decoder.GetConf()["input"].as<string>();
   const bool show_feature_dictionary = decoder.GetConf().count("show_feature_dictionary");
+  const int threads = decoder.GetConf()["threads"].as<int>();
   if (!SILENT) cerr << "Reading input from " << ((input == "-") ? "STDIN" : input.c_str()) << endl;
   ReadFile in_read(input);
   istream *in = in_read.stream();
@@ -24,10 +26,28 @@ int main(int argc, char** argv) {
 #ifdef CP_TIME
     clock_t time_cp(0);//, end_cp;
 #endif
-  while(*in) {
-    getline(*in, buf);
-    if (buf.empty()) continue;
-    decoder.Decode(buf);
+  if (decoder.GetConf().count("pipeline_passes")) {
+    if (threads > 1) {
+      cerr << "--pipeline_passes can't be used with --threads\n";
+      return 1;
+    }
+    decoder.DecodePipelined(in);
+  } else if (threads > 1) {
+    decoder.DecodeParallel(in, threads);
+  } else {
+    // the input is read prefetch lines ahead of the sentence being decoded
+    const unsigned prefetch = decoder.GetConf()["prefetch_grammars"].as<int>();
+    deque<string> ahead;
+    while(true) {
+      while (ahead.size() <= prefetch && getline(*in, buf)) {
+        if (buf.empty()) continue;
+        if (prefetch) decoder.Prefetch(buf);
+        ahead.push_back(buf);
+      }
+      if (ahead.empty()) break;
+      decoder.Decode(ahead.front());
+      ahead.pop_front();
+    }
   }
   Timer::Summarize();
 #ifdef CP_TIME
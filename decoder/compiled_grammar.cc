@@ -0,0 +1,516 @@
+#include "compiled_grammar.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+#ifndef HAVE_OLD_CPP
+# include <unordered_map>
+#else
+# include <tr1/unordered_map>
+namespace std { using std::tr1::unordered_map; }
+#endif
+
+#include <boost/static_assert.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "fdict.h"
+#include "rule_lexer.h"
+#include "tdict.h"
+
+using namespace std;
+
+// File layout (all sections are 8-byte aligned, integers are stored in the
+// native byte order):
+//   Header
+//   symbol table   words and nonterminal categories, ids start at 1
+//   feature table  feature names, ids start at 0
+//   Node[num_nodes]          the trie, node 0 is the root
+//   Child[num_nodes - 1]     the children of each node, sorted by symbol
+//   PackedRule[num_rules]    rules of each node, then the unary rules
+//   int32_t[num_words]       f_ and e_ of the rules, see PackedRule
+//   uint32_t[num_feature_values], double[num_feature_values]
+//   AlignmentPoint[num_alignment_points]
+// A string table is a uint64_t array of n + 1 offsets into the characters
+// that follow it. Source symbols are file symbol ids, negated for
+// nonterminals. Target symbols <= 0 are variables (as in TRule::e_).
+namespace {
+
+const char kMAGIC[8] = { 'c', 'd', 'e', 'c', 'S', 'C', 'F', 'G' };
+const uint32_t kVERSION = 1;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_symbols;
+  uint32_t num_features;
+  uint32_t num_nodes;
+  uint32_t num_rules;
+  uint32_t first_unary_rule;
+  uint64_t num_words;
+  uint64_t num_feature_values;
+  uint64_t num_alignment_points;
+  uint64_t symbols_offset;
+  uint64_t features_offset;
+  uint64_t nodes_offset;
+  uint64_t children_offset;
+  uint64_t rules_offset;
+  uint64_t words_offset;
+  uint64_t feature_ids_offset;
+  uint64_t feature_values_offset;
+  uint64_t alignments_offset;
+  uint64_t file_size;
+};
+
+struct Node {
+  uint32_t first_child;
+  uint32_t num_children;
+  uint32_t first_rule;
+  uint32_t num_rules;
+};
+
+struct Child {
+  int32_t symbol;
+  uint32_t node;
+};
+
+struct PackedRule {
+  uint64_t words;       // f_ followed by e_
+  uint64_t features;
+  uint64_t alignment;
+  int32_t lhs;
+  uint16_t f_size;
+  uint16_t e_size;
+  uint16_t num_features;
+  uint16_t num_alignment_points;
+  int32_t arity;
+};
+
+BOOST_STATIC_ASSERT(sizeof(AlignmentPoint) == 2 * sizeof(short));
+
+bool operator<(const Child& c, int32_t symbol) { return c.symbol < symbol; }
+
+struct CompilerNode {
+  map<int32_t, uint32_t> children;
+  vector<TRulePtr> rules;
+};
+
+struct GrammarCompiler {
+  GrammarCompiler() : nodes(1), symbols(1) {}
+
+  static void AddRuleHelper(const TRulePtr& rule, const unsigned int ctf_level, const TRulePtr& /* coarse_rule */, void* extra) {
+    if (ctf_level > 0) {
+      cerr << "Coarse-to-fine grammars can't be compiled\n";
+      exit(1);
+    }
+    static_cast<GrammarCompiler*>(extra)->AddRule(rule);
+  }
+
+  void AddRule(const TRulePtr& rule) {
+    // the format has no place for these, and decoding without them would
+    // silently differ from decoding with the text grammar
+    if (rule->tree_structure || !rule->ext_states_.empty()) {
+      cerr << "Rules with a tree structure or external states can't be compiled: " << rule->AsString() << endl;
+      exit(1);
+    }
+    if (rule->IsUnary()) {
+      unaries.push_back(rule);
+      return;
+    }
+    uint32_t cur = 0;
+    for (unsigned i = 0; i < rule->f_.size(); ++i) {
+      const int32_t s = SourceSymbol(rule->f_[i]);
+      map<int32_t, uint32_t>::iterator it = nodes[cur].children.find(s);
+      if (it == nodes[cur].children.end()) {
+        nodes[cur].children[s] = nodes.size();
+        cur = nodes.size();
+        nodes.push_back(CompilerNode());
+      } else {
+        cur = it->second;
+      }
+    }
+    nodes[cur].rules.push_back(rule);
+  }
+
+  int32_t Symbol(WordID w) {
+    if (w >= static_cast<int>(td2sym.size())) td2sym.resize(w + 1);
+    if (!td2sym[w]) {
+      td2sym[w] = symbols.size();
+      symbols.push_back(TD::Convert(w));
+    }
+    return td2sym[w];
+  }
+
+  int32_t SourceSymbol(WordID w) {
+    return w < 0 ? -Symbol(-w) : Symbol(w);
+  }
+
+  uint32_t Feature(int fid) {
+    if (fid >= static_cast<int>(fd2feat.size())) fd2feat.resize(fid + 1, -1);
+    if (fd2feat[fid] < 0) {
+      fd2feat[fid] = features.size();
+      features.push_back(FD::Convert(fid));
+    }
+    return fd2feat[fid];
+  }
+
+  void PackRule(const TRule& rule) {
+    PackedRule r;
+    memset(&r, 0, sizeof(r));
+    if (rule.f_.size() > 0xffff || rule.e_.size() > 0xffff ||
+        rule.scores_.size() > 0xffff || rule.a_.size() > 0xffff) {
+      cerr << "Rule is too large to compile: " << rule.AsString() << endl;
+      exit(1);
+    }
+    r.words = words.size();
+    r.features = feature_ids.size();
+    r.alignment = alignment.size();
+    r.lhs = SourceSymbol(rule.lhs_);
+    r.f_size = rule.f_.size();
+    r.e_size = rule.e_.size();
+    r.num_features = rule.scores_.size();
+    r.num_alignment_points = rule.a_.size();
+    r.arity = rule.arity_;
+    for (unsigned i = 0; i < rule.f_.size(); ++i)
+      words.push_back(SourceSymbol(rule.f_[i]));
+    for (unsigned i = 0; i < rule.e_.size(); ++i)
+      words.push_back(rule.e_[i] <= 0 ? rule.e_[i] : Symbol(rule.e_[i]));
+    for (SparseVector<double>::const_iterator it = rule.scores_.begin(); it != rule.scores_.end(); ++it) {
+      feature_ids.push_back(Feature(it->first));
+      feature_values.push_back(it->second);
+    }
+    alignment.insert(alignment.end(), rule.a_.begin(), rule.a_.end());
+    rules.push_back(r);
+  }
+
+  template <typename T>
+  static uint64_t WriteArray(const vector<T>& v, ofstream* out) {
+    const uint64_t offset = out->tellp();
+    if (!v.empty())
+      out->write(reinterpret_cast<const char*>(&v[0]), v.size() * sizeof(T));
+    static const char kZEROS[8] = {};
+    out->write(kZEROS, (8 - static_cast<uint64_t>(out->tellp()) % 8) % 8);
+    return offset;
+  }
+
+  static uint64_t WriteStrings(const vector<string>& strings, ofstream* out) {
+    vector<uint64_t> offsets(1, 0);
+    string chars;
+    for (unsigned i = 0; i < strings.size(); ++i) {
+      chars += strings[i];
+      offsets.push_back(chars.size());
+    }
+    const uint64_t offset = WriteArray(offsets, out);
+    WriteArray(vector<char>(chars.begin(), chars.end()), out);
+    return offset;
+  }
+
+  void Write(const string& file) {
+    // nodes are written in breadth first order, so the children of each node
+    // are contiguous
+    vector<uint32_t> order(1, 0);
+    for (unsigned i = 0; i < order.size(); ++i) {
+      const map<int32_t, uint32_t>& children = nodes[order[i]].children;
+      for (map<int32_t, uint32_t>::const_iterator it = children.begin(); it != children.end(); ++it)
+        order.push_back(it->second);
+    }
+    vector<uint32_t> position(nodes.size());
+    for (unsigned i = 0; i < order.size(); ++i)
+      position[order[i]] = i;
+    vector<Node> out_nodes(order.size());
+    vector<Child> out_children;
+    for (unsigned i = 0; i < order.size(); ++i) {
+      const CompilerNode& node = nodes[order[i]];
+      Node& out_node = out_nodes[i];
+      out_node.first_child = out_children.size();
+      out_node.num_children = node.children.size();
+      for (map<int32_t, uint32_t>::const_iterator it = node.children.begin(); it != node.children.end(); ++it) {
+        Child c;
+        c.symbol = it->first;
+        c.node = position[it->second];
+        out_children.push_back(c);
+      }
+      out_node.first_rule = rules.size();
+      out_node.num_rules = node.rules.size();
+      for (unsigned j = 0; j < node.rules.size(); ++j)
+        PackRule(*node.rules[j]);
+    }
+    const uint32_t first_unary_rule = rules.size();
+    for (unsigned i = 0; i < unaries.size(); ++i)
+      PackRule(*unaries[i]);
+
+    ofstream out(file.c_str(), ios::binary);
+    if (!out) {
+      cerr << "Can't write compiled grammar to " << file << endl;
+      exit(1);
+    }
+    Header h;
+    memset(&h, 0, sizeof(h));
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    memcpy(h.magic, kMAGIC, sizeof(kMAGIC));
+    h.version = kVERSION;
+    h.num_symbols = symbols.size() - 1;
+    h.num_features = features.size();
+    h.num_nodes = out_nodes.size();
+    h.num_rules = rules.size();
+    h.first_unary_rule = first_unary_rule;
+    h.num_words = words.size();
+    h.num_feature_values = feature_values.size();
+    h.num_alignment_points = alignment.size();
+    h.symbols_offset = WriteStrings(vector<string>(symbols.begin() + 1, symbols.end()), &out);
+    h.features_offset = WriteStrings(features, &out);
+    h.nodes_offset = WriteArray(out_nodes, &out);
+    h.children_offset = WriteArray(out_children, &out);
+    h.rules_offset = WriteArray(rules, &out);
+    h.words_offset = WriteArray(words, &out);
+    h.feature_ids_offset = WriteArray(feature_ids, &out);
+    h.feature_values_offset = WriteArray(feature_values, &out);
+    h.alignments_offset = WriteArray(alignment, &out);
+    h.file_size = out.tellp();
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    if (!out) {
+      cerr << "Error writing compiled grammar to " << file << endl;
+      exit(1);
+    }
+  }
+
+  vector<CompilerNode> nodes;
+  vector<TRulePtr> unaries;
+  vector<string> symbols;  // symbols[0] is unused
+  vector<int32_t> td2sym;
+  vector<string> features;
+  vector<int> fd2feat;
+
+  vector<PackedRule> rules;
+  vector<int32_t> words;
+  vector<uint32_t> feature_ids;
+  vector<double> feature_values;
+  vector<AlignmentPoint> alignment;
+};
+
+}  // namespace
+
+struct CompiledRuleBin : public RuleBin {
+  int GetNumRules() const { return rules_.size(); }
+  TRulePtr GetIthRule(int i) const { return rules_[i]; }
+  int Arity() const { return rules_.front()->Arity(); }
+  vector<TRulePtr> rules_;
+};
+
+struct CompiledGrammarNode : public GrammarIter {
+  CompiledGrammarNode(const CGImpl* g, uint32_t node) : g_(g), node_(node) {}
+  const GrammarIter* Extend(int symbol) const;
+  const RuleBin* GetRules() const {
+    return rb_.GetNumRules() ? &rb_ : NULL;
+  }
+
+  const CGImpl* g_;
+  const uint32_t node_;
+  CompiledRuleBin rb_;
+};
+
+// the trie nodes (and their rules) that the calling thread has reached since
+// it last called CompiledGrammar::ReleaseNodes, by grammar id and node. Each
+// thread creates its own nodes, so the parser needs no lock to extend them.
+typedef unordered_map<uint64_t, boost::shared_ptr<CompiledGrammarNode> > NodeCache;
+static boost::thread_specific_ptr<NodeCache> node_cache;
+static atomic<uint32_t> next_grammar_id(0);
+
+struct CGImpl {
+  explicit CGImpl(const string& file) : file_(file), id_(next_grammar_id++), data_(NULL), size_(0) {
+    const int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      cerr << "Can't open compiled grammar " << file << endl;
+      exit(1);
+    }
+    size_ = st.st_size;
+    if (size_ < sizeof(Header)) BadFile();
+    data_ = static_cast<const char*>(mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0));
+    close(fd);
+    if (data_ == MAP_FAILED) {
+      cerr << "Can't mmap compiled grammar " << file << endl;
+      exit(1);
+    }
+    h_ = reinterpret_cast<const Header*>(data_);
+    if (memcmp(h_->magic, kMAGIC, sizeof(kMAGIC)) != 0 || h_->file_size != size_) BadFile();
+    if (h_->version != kVERSION) {
+      cerr << "Compiled grammar " << file << " has version " << h_->version << ", expected " << kVERSION << ". Please recompile it.\n";
+      exit(1);
+    }
+    if (h_->num_nodes == 0 || h_->first_unary_rule > h_->num_rules) BadFile();
+    nodes_ = Section<Node>(h_->nodes_offset, h_->num_nodes);
+    children_ = Section<Child>(h_->children_offset, h_->num_nodes - 1);
+    rules_ = Section<PackedRule>(h_->rules_offset, h_->num_rules);
+    words_ = Section<int32_t>(h_->words_offset, h_->num_words);
+    feature_ids_ = Section<uint32_t>(h_->feature_ids_offset, h_->num_feature_values);
+    feature_values_ = Section<double>(h_->feature_values_offset, h_->num_feature_values);
+    alignments_ = Section<AlignmentPoint>(h_->alignments_offset, h_->num_alignment_points);
+
+    const char* chars;
+    const uint64_t* offsets = Strings(h_->symbols_offset, h_->num_symbols, &chars);
+    symbols_.resize(h_->num_symbols + 1);
+    for (unsigned i = 0; i < h_->num_symbols; ++i)
+      symbols_[i + 1] = TD::Convert(string(chars + offsets[i], chars + offsets[i + 1]));
+    sym_of_word_.resize(TD::NumWords() + 1);
+    for (unsigned i = 1; i < symbols_.size(); ++i) {
+      if (symbols_[i] >= static_cast<int>(sym_of_word_.size())) sym_of_word_.resize(symbols_[i] + 1);
+      sym_of_word_[symbols_[i]] = i;
+    }
+    offsets = Strings(h_->features_offset, h_->num_features, &chars);
+    features_.resize(h_->num_features);
+    for (unsigned i = 0; i < h_->num_features; ++i)
+      features_[i] = FD::Convert(string(chars + offsets[i], chars + offsets[i + 1]));
+    root_.reset(new CompiledGrammarNode(this, 0));
+    GetRules(0, &root_->rb_);
+  }
+
+  ~CGImpl() {
+    munmap(const_cast<char*>(data_), size_);
+  }
+
+  void BadFile() const {
+    cerr << file_ << " is not a compiled grammar\n";
+    exit(1);
+  }
+
+  // the array of n T's at offset, which must lie within the file
+  template <typename T>
+  const T* Section(uint64_t offset, uint64_t n) const {
+    if (offset > size_ || offset % 8 || n > (size_ - offset) / sizeof(T)) BadFile();
+    return reinterpret_cast<const T*>(data_ + offset);
+  }
+
+  // the offsets of the n strings of the string table at offset, which are
+  // relative to *chars
+  const uint64_t* Strings(uint64_t offset, uint64_t n, const char** chars) const {
+    const uint64_t* offsets = Section<uint64_t>(offset, n + 1);
+    for (uint64_t i = 0; i < n; ++i)
+      if (offsets[i] > offsets[i + 1]) BadFile();
+    const uint64_t chars_offset = offset + (n + 1) * sizeof(uint64_t);
+    *chars = Section<char>(chars_offset, offsets[n]);
+    return offsets;
+  }
+
+  // symbol of the grammar file for a symbol of a rule's source side, 0 if the
+  // symbol does not occur in the grammar
+  int32_t SourceSymbol(int symbol) const {
+    const int w = symbol < 0 ? -symbol : symbol;
+    if (w >= static_cast<int>(sym_of_word_.size())) return 0;
+    return symbol < 0 ? -sym_of_word_[w] : sym_of_word_[w];
+  }
+
+  TRulePtr MakeRule(uint32_t i) const {
+    const PackedRule& r = rules_[i];
+    const int32_t* w = words_ + r.words;
+    vector<WordID> f(r.f_size), e(r.e_size);
+    for (unsigned j = 0; j < r.f_size; ++j)
+      f[j] = w[j] < 0 ? -symbols_[-w[j]] : symbols_[w[j]];
+    w += r.f_size;
+    for (unsigned j = 0; j < r.e_size; ++j)
+      e[j] = w[j] <= 0 ? w[j] : symbols_[w[j]];
+    vector<int> fids(r.num_features);
+    for (unsigned j = 0; j < r.num_features; ++j)
+      fids[j] = features_[feature_ids_[r.features + j]];
+    return TRulePtr(new TRule(-symbols_[-r.lhs],
+                              f.empty() ? NULL : &f[0], f.size(),
+                              e.empty() ? NULL : &e[0], e.size(),
+                              fids.empty() ? NULL : &fids[0], feature_values_ + r.features, fids.size(),
+                              r.arity,
+                              alignments_ + r.alignment, r.num_alignment_points));
+  }
+
+  void GetRules(uint32_t node, CompiledRuleBin* rb) const {
+    const Node& n = nodes_[node];
+    rb->rules_.resize(n.num_rules);
+    for (unsigned i = 0; i < n.num_rules; ++i)
+      rb->rules_[i] = MakeRule(n.first_rule + i);
+  }
+
+  // the trie nodes (and their rules) are created when they are first used
+  const CompiledGrammarNode* GetNode(uint32_t node) const {
+    NodeCache* cache = node_cache.get();
+    if (!cache) {
+      cache = new NodeCache;
+      node_cache.reset(cache);
+    }
+    boost::shared_ptr<CompiledGrammarNode>& n = (*cache)[static_cast<uint64_t>(id_) << 32 | node];
+    if (!n) {
+      n.reset(new CompiledGrammarNode(this, node));
+      GetRules(node, &n->rb_);
+    }
+    return n.get();
+  }
+
+  const string file_;
+  const uint32_t id_;
+  const char* data_;
+  uint64_t size_;
+  const Header* h_;
+  const Node* nodes_;
+  const Child* children_;
+  const PackedRule* rules_;
+  const int32_t* words_;
+  const uint32_t* feature_ids_;
+  const double* feature_values_;
+  const AlignmentPoint* alignments_;
+
+  vector<WordID> symbols_;      // file symbol -> WordID
+  vector<int32_t> sym_of_word_; // WordID -> file symbol
+  vector<int> features_;        // file feature -> FD id
+
+  boost::shared_ptr<CompiledGrammarNode> root_;
+};
+
+const GrammarIter* CompiledGrammarNode::Extend(int symbol) const {
+  const int32_t s = g_->SourceSymbol(symbol);
+  if (!s) return NULL;
+  const Node& n = g_->nodes_[node_];
+  const Child* begin = g_->children_ + n.first_child;
+  const Child* end = begin + n.num_children;
+  const Child* c = lower_bound(begin, end, s);
+  if (c == end || c->symbol != s) return NULL;
+  return g_->GetNode(c->node);
+}
+
+CompiledGrammar::CompiledGrammar(const string& file) :
+    max_span_(10),
+    pimpl_(new CGImpl(file)) {
+  const Header& h = *pimpl_->h_;
+  for (uint32_t i = h.first_unary_rule; i < h.num_rules; ++i) {
+    TRulePtr rule = pimpl_->MakeRule(i);
+    rhs2unaries_[rule->f().front()].push_back(rule);
+    unaries_.push_back(rule);
+  }
+}
+
+const GrammarIter* CompiledGrammar::GetRoot() const {
+  return pimpl_->root_.get();
+}
+
+bool CompiledGrammar::HasRuleForSpan(int /* i */, int /* j */, int distance) const {
+  return (max_span_ >= distance);
+}
+
+void CompiledGrammar::ReleaseNodes() {
+  if (node_cache.get()) node_cache->clear();
+}
+
+bool CompiledGrammar::IsCompiledGrammar(const string& file) {
+  char magic[sizeof(kMAGIC)];
+  ifstream in(file.c_str(), ios::binary);
+  return in.read(magic, sizeof(magic)) && memcmp(magic, kMAGIC, sizeof(kMAGIC)) == 0;
+}
+
+void CompiledGrammar::Compile(istream* in, const string& file) {
+  GrammarCompiler c;
+  RuleLexer::ReadRules(in, &GrammarCompiler::AddRuleHelper, "UNKNOWN", &c);
+  c.Write(file);
+}
@@ -0,0 +1,44 @@
+#ifndef COMPILED_GRAMMAR_H_
+#define COMPILED_GRAMMAR_H_
+
+#include <iostream>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include "grammar.h"
+
+// A grammar in the binary format written by CompiledGrammar::Compile (see
+// training/utils/grammar_compile.cc). The file is memory mapped, so loading
+// only requires converting the vocabulary, and processes that use the same
+// grammar share its pages. The trie is stored as sorted arrays of children,
+// and rules are only turned into TRule objects when the parser first reaches
+// the trie node they belong to. Each thread keeps the nodes it has reached
+// until it calls ReleaseNodes.
+struct CGImpl;
+struct CompiledGrammar : public Grammar {
+  explicit CompiledGrammar(const std::string& file);
+  void SetMaxSpan(int m) { max_span_ = m; }
+
+  virtual const GrammarIter* GetRoot() const;
+  virtual bool HasRuleForSpan(int i, int j, int distance) const;
+
+  // frees the trie nodes (and their rules) that the calling thread has
+  // reached in all compiled grammars. Pointers returned by GetRoot()->Extend
+  // are invalid afterwards, so this is called once a sentence is parsed.
+  static void ReleaseNodes();
+
+  // true if file starts with the header of a compiled grammar
+  static bool IsCompiledGrammar(const std::string& file);
+
+  // reads rules in the text format (as read by TextGrammar) from in and
+  // writes them to file in the compiled format. Coarse-to-fine grammars and
+  // rules with a tree structure or external states can't be compiled.
+  static void Compile(std::istream* in, const std::string& file);
+
+ private:
+  int max_span_;
+  boost::shared_ptr<CGImpl> pimpl_;
+};
+
+#endif
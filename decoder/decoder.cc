@@ -1,5 +1,7 @@
 #include "decoder.h"
 
+#include <deque>
+
 #ifndef HAVE_OLD_CPP
 # include <unordered_map>
 #else
@@ -9,13 +11,17 @@ namespace std { using std::tr1::unordered_map; }
 #include <boost/program_options.hpp>
 #include <boost/program_options/variables_map.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
 #include "stringlib.h"
 #include "weights.h"
 #include "filelib.h"
 #include "fdict.h"
 #include "timing_stats.h"
+#include "decoding_stats.h"
 #include "verbose.h"
 #include "b64featvector.h"
 
@@ -73,6 +79,26 @@ void DecoderObserver::NotifyTranslationForest(const SentenceMetadata&, Hypergrap
 void DecoderObserver::NotifyAlignmentFailure(const SentenceMetadata&) {}
 void DecoderObserver::NotifyAlignmentForest(const SentenceMetadata&, Hypergraph*) {}
 void DecoderObserver::NotifyDecodingComplete(const SentenceMetadata&) {}
+void DecoderObserver::NotifyDecodingStats(int, const DecodingStats&) {}
+
+// writes the DecodingStats of every sentence as a line of JSON, followed by
+// the totals of all sentences. shared by the threads of DecodeParallel
+struct DecodingStatsWriter {
+  explicit DecodingStatsWriter(const string& fname) : file(fname) {}
+  ~DecodingStatsWriter() {
+    total.WriteJSON("\"total\"", file.stream());
+  }
+
+  void Write(int sent_id, const DecodingStats& stats) {
+    boost::mutex::scoped_lock lock(mutex);
+    stats.WriteJSON(boost::lexical_cast<string>(sent_id), file.stream());
+    total.Add(stats);
+  }
+
+  WriteFile file;
+  DecodingStats total;
+  boost::mutex mutex;
+};
 
 enum SummaryFeature {
   kNODE_RISK = 1,
@@ -143,6 +169,7 @@ struct RescoringPass {
   boost::shared_ptr<ModelSet> models;
   boost::shared_ptr<IntersectionConfiguration> inter_conf;
   vector<const FeatureFunction*> ffs;
+  vector<string> ff_specs;    // used to create per-thread copies of ffs
   boost::shared_ptr<vector<weight_t> > weight_vector;
   int fid_summary;            // 0 == no summary feature
   double density_prune;       // 0 == don't density prune
@@ -160,10 +187,50 @@ ostream& operator<<(ostream& os, const RescoringPass& rp) {
   return os;
 }
 
+// a sentence on its way through the stages of DecoderImpl::DecodeSentence:
+// translation, the rescoring passes, and output. With --pipeline_passes the
+// stages run on different threads, so everything a later stage needs is
+// kept here instead of in the DecoderImpl
+struct DecodingSentence {
+  DecodingSentence() : srclen(), has_ref(), sent_id(), o(), stats(), out(), start() {}
+  boost::scoped_ptr<SentenceMetadata> smeta;
+  Lattice ref;
+  Hypergraph forest;
+  unsigned srclen;
+  bool has_ref;
+  int sent_id;
+  boost::shared_ptr<WriteFile> extract_file;
+  DecoderObserver* o;
+  DecodingStats* stats;
+  ostream* out;
+  double start;  // wall clock time when decoding started
+};
+
 struct DecoderImpl {
   DecoderImpl(po::variables_map& conf, int argc, char** argv, istream* cfg);
   ~DecoderImpl();
   bool Decode(const string& input, DecoderObserver*);
+  bool DecodeSentence(const string& input, DecoderObserver*, DecodingStats* stats);
+  // the stages of DecodeSentence. TranslateSentence returns false (and sets
+  // *result to what DecodeSentence returns) if there is nothing left to do
+  bool TranslateSentence(const string& input, DecodingSentence* s, bool* result);
+  void RescoreSentence(int pass, DecodingSentence* s);
+  bool FinishSentence(DecodingSentence* s);
+  // makes the per-sentence members of this decoder those of s
+  void ResumeSentence(const DecodingSentence& s) {
+    sent_id = s.sent_id;
+    extract_file = s.extract_file;
+    out = s.out;
+  }
+  void Prefetch(const string& input) {
+    string buf = input;
+    map<string, string> sgml;
+    ProcessAndStripSGML(&buf, &sgml);
+    translator->Prefetch(sgml);
+  }
+  DecoderImpl* CreateWorker() const;
+  void DecodeParallel(istream* in, int num_threads);
+  void DecodePipelined(istream* in);
   vector<weight_t>& CurrentWeightVector() {
     return (rescoring_passes.empty() ? *init_weights : *rescoring_passes.back().weight_vector);
   }
@@ -182,7 +249,7 @@ struct DecoderImpl {
     return false;
   }
 
-  void maybe_prune(Hypergraph &forest,po::variables_map const& conf,string nbeam,string ndensity,string forestname,double srclen) {
+  void maybe_prune(Hypergraph &forest,po::variables_map const& conf,string nbeam,string ndensity,string forestname,double srclen,DecodingStats* stats=NULL) {
     double beam_prune=0,density_prune=0;
     bool use_beam_prune=beam_param(conf,nbeam,&beam_prune,conf.count("scale_prune_srclen"),srclen);
     bool use_density_prune=beam_param(conf,ndensity,&density_prune);
@@ -194,7 +261,14 @@ struct DecoderImpl {
         preserve_mask[CompoundSplit::GetFullWordEdgeIndex(forest)] = true;
         pm=&preserve_mask;
       }
-      forest.PruneInsideOutside(beam_prune,density_prune,pm,false,1);
+      {
+        StageTimer t(stats, "prune");
+        forest.PruneInsideOutside(beam_prune,density_prune,pm,false,1);
+      }
+      if (stats) {
+        stats->AddCount("pruned_nodes", forest.nodes_.size());
+        stats->AddCount("pruned_edges", forest.edges_.size());
+      }
       if (!forestname.empty()) forestname=" "+forestname;
       if (!SILENT) {
         forest_stats(forest,"  Pruned "+forestname+" forest",false,false);
@@ -249,9 +323,9 @@ struct DecoderImpl {
     sort(dist.begin(), dist.end(), SampleSort());
     if (k) {
       for (int i = 0; i < k; ++i)
-        cout << dist[i].first << " ||| " << dist[i].second << endl;
+        *out << dist[i].first << " ||| " << dist[i].second << endl;
     } else {
-      cout << dist[0].second << endl;
+      *out << dist[0].second << endl;
     }
   }
 
@@ -303,7 +377,10 @@ struct DecoderImpl {
   bool output_training_vector; // TODO Observer
   bool remove_intersected_rule_annotations;
   bool mr_mira_compat;  // Mr.MIRA compatibility mode.
-  boost::scoped_ptr<IncrementalBase> incremental;
+  boost::shared_ptr<IncrementalBase> incremental;
+  ostream* out;  // where translations, k-best lists, etc. are written
+  bool worker;   // true for the per-thread copies created by CreateWorker()
+  boost::shared_ptr<DecodingStatsWriter> stats_writer;  // --decoding_stats
 
 
   static void ConvertSV(const SparseVector<prob_t>& src, SparseVector<double>* trg) {
@@ -313,7 +390,8 @@ struct DecoderImpl {
 };
 
 DecoderImpl::~DecoderImpl() {
-  if (output_training_vector && !acc_vec.empty()) {
+  // workers hand what they accumulated to the decoder that created them
+  if (!worker && output_training_vector && !acc_vec.empty()) {
     if (encode_b64) {
       cout << "0\t";
       SparseVector<double> dav; ConvertSV(acc_vec, &dav);
@@ -325,7 +403,7 @@ DecoderImpl::~DecoderImpl() {
   }
 }
 
-DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream* cfg) : conf(conf) {
+DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream* cfg) : conf(conf), out(&cout), worker(false) {
   if (cfg) { if (argc || argv) { cerr << "DecoderImpl() can only take a file or command line options, not both\n"; exit(1); } }
   bool show_config;
   bool show_weights;
@@ -344,8 +422,9 @@ DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream
 
         ("weights,w",po::value<string>(),"Feature weights file (initial forest / pass 1)")
         ("feature_function,F",po::value<vector<string> >()->composing(), "Pass 1 additional feature function(s) (-L for list)")
-        ("intersection_strategy,I",po::value<string>()->default_value("cube_pruning"), "Pass 1 intersection strategy for incorporating finite-state features; values include Cube_pruning, Full, Fast_cube_pruning, Fast_cube_pruning_2")
+        ("intersection_strategy,I",po::value<string>()->default_value("cube_pruning"), "Pass 1 intersection strategy for incorporating finite-state features; values include Cube_pruning, Full, Fast_cube_pruning, Fast_cube_pruning_2, Parallel_cube_pruning, Cube_growing")
         ("cubepruning_pop_limit,K",po::value<unsigned>()->default_value(200), "Max number of pops from the candidate heap at each node")
+        ("cubepruning_threads",po::value<int>()->default_value(0), "Number of threads used by Parallel_cube_pruning (0 = number of cores)")
         ("summary_feature", po::value<string>(), "Compute a 'summary feature' at the end of the pass (before any pruning) with name=arg and value=inside-outside/Z")
         ("summary_feature_type", po::value<string>()->default_value("node_risk"), "Summary feature types: node_risk, edge_risk, edge_prob")
         ("density_prune", po::value<double>(), "Pass 1 pruning: keep no more than this many times the number of edges used in the best derivation tree (>=1.0)")
@@ -369,6 +448,11 @@ DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream
 
         ("add_pass_through_rules,P","Add rules to translate OOV words as themselves")
         ("add_extra_pass_through_features,Q", po::value<unsigned int>()->default_value(0), "Add PassThrough{1..N} features, capped at N.")
+        ("threads,j",po::value<int>()->default_value(1),"Number of decoding threads. Grammars, weights, and thread-safe feature functions are shared by all threads (SCFG only)")
+        ("decoding_stats",po::value<string>(),"Write the time spent in each stage of decoding (and in each feature function), forest sizes, and cube pruning pops/pushes of every sentence to this file, one JSON object per line; the last line has the totals")
+        ("prefetch_grammars",po::value<int>()->default_value(0),"Read the input N lines ahead and load their per-sentence grammars (<seg grammar=...>) in a background thread while earlier sentences are decoded (SCFG only)")
+        ("prefetch_grammars_max_mb",po::value<int>()->default_value(1024),"Maximum total size (of the files) of prefetched grammars that have not been used yet")
+        ("pipeline_passes","Run translation, each rescoring pass, and output in separate threads, so that consecutive sentences are decoded in different stages at the same time")
         ("k_best,k",po::value<int>(),"Extract the k best derivations")
         ("unique_k_best,r", "Unique k-best translation list")
         ("aligner,a", "Run as a word/phrase aligner (src & ref required)")
@@ -411,6 +495,8 @@ DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream
         ("max_translation_beam,x", po::value<int>(), "Beam approximation to get max translation from the chart")
         ("max_translation_sample,X", po::value<int>(), "Sample the max translation from the chart")
         ("pb_max_distortion,D", po::value<int>()->default_value(4), "Phrase-based decoder: maximum distortion")
+        ("pb_stack_size", po::value<int>()->default_value(100), "Phrase-based decoder: maximum number of coverages expanded per number of covered words (0 = no limit)")
+        ("pb_beam", po::value<double>()->default_value(0.0), "Phrase-based decoder: prune coverages whose score plus future cost estimate is more than this (log) below the best with the same number of covered words (0 = no limit)")
         ("cll_gradient,G","Compute conditional log-likelihood gradient and write to STDOUT (src & ref required)")
         ("get_oracle_forest,o", "Calculate rescored hypergraph using approximate BLEU scoring of rules")
         ("feature_expectations","Write feature expectations for all features in chart (**OBJ** will be the partition)")
@@ -567,6 +653,7 @@ DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream
           pffs.push_back(make_ff(add_ffs[i],verbose_feature_functions));
           FeatureFunction const* p=pffs.back().get();
           rp.ffs.push_back(p);
+          rp.ff_specs.push_back(add_ffs[i]);
           if (p->IsStateful()) { has_stateful = true; }
         }
       }
@@ -593,7 +680,16 @@ DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream
         palg = 3;
         cerr << "Using Fast Cube Pruning 2 intersection (see Algorithm 3 described in: Gesmundo A., Henderson J,. Faster Cube Pruning, IWSLT 2010).\n";
       }
-      rp.inter_conf.reset(new IntersectionConfiguration(palg, pop_limit));
+      int threads = 1;
+      if (LowercaseString(str(isn.c_str(),conf)) == "parallel_cube_pruning") {
+        palg = 4;
+        threads = conf["cubepruning_threads"].as<int>();
+        if (threads <= 0) threads = max(1u, boost::thread::hardware_concurrency());
+      }
+      if (LowercaseString(str(isn.c_str(),conf)) == "cube_growing") {
+        palg = 5;
+      }
+      rp.inter_conf.reset(new IntersectionConfiguration(palg, pop_limit, threads));
     } else {
       break;  // TODO alert user if there are any future configurations
     }
@@ -672,6 +768,8 @@ DecoderImpl::DecoderImpl(po::variables_map& conf, int argc, char** argv, istream
   oracle.show_derivation_mask=conf["show_derivations_mask"].as<int>();
   remove_intersected_rule_annotations = conf.count("remove_intersected_rule_annotations");
   mr_mira_compat = conf.count("mr_mira_compat");
+  if (conf.count("decoding_stats"))
+    stats_writer.reset(new DecodingStatsWriter(str("decoding_stats",conf)));
 
   combine_size = conf["combine_size"].as<int>();
   if (combine_size < 1) combine_size = 1;
@@ -695,6 +793,15 @@ bool Decoder::Decode(const string& input, DecoderObserver* o) {
   if (del) delete o;
   return res;
 }
+void Decoder::Prefetch(const string& input) {
+  pimpl_->Prefetch(input);
+}
+void Decoder::DecodeParallel(istream* in, int num_threads) {
+  pimpl_->DecodeParallel(in, num_threads);
+}
+void Decoder::DecodePipelined(istream* in) {
+  pimpl_->DecodePipelined(in);
+}
 vector<weight_t>& Decoder::CurrentWeightVector() { return pimpl_->CurrentWeightVector(); }
 const vector<weight_t>& Decoder::CurrentWeightVector() const { return pimpl_->CurrentWeightVector(); }
 void Decoder::AddSupplementalGrammar(GrammarPtr gp) {
@@ -705,6 +812,240 @@ void Decoder::AddSupplementalGrammarFromString(const std::string& grammar_string
   static_cast<SCFGTranslator&>(*pimpl_->translator).AddSupplementalGrammarFromString(grammar_string);
 }
 
+DecoderImpl* DecoderImpl::CreateWorker() const {
+  Translator* t = translator->CloneForThread();
+  if (!t) {
+    cerr << "Formalism '" << formalism << "' (with this configuration) does not support --threads\n";
+    exit(1);
+  }
+  DecoderImpl* w = new DecoderImpl(*this);
+  w->worker = true;
+  w->extract_file.reset();  // each sentence opens its own
+  w->acc_vec.clear();  // merged back into this decoder by DecodeParallel
+  w->acc_obj = 0;
+  w->g_count = 0;
+  w->translator.reset(t);
+  if (rng) w->rng.reset(new RandomNumberGenerator<boost::mt19937>);
+  // feature functions with per-sentence state get a private instance, the
+  // others (e.g., language models) are shared with this decoder
+  for (unsigned pass = 0; pass < w->rescoring_passes.size(); ++pass) {
+    RescoringPass& rp = w->rescoring_passes[pass];
+    for (unsigned i = 0; i < rp.ffs.size(); ++i) {
+      if (rp.ffs[i]->IsThreadSafe()) continue;
+      w->pffs.push_back(make_ff(rp.ff_specs[i], false));
+      rp.ffs[i] = w->pffs.back().get();
+    }
+    rp.models.reset(new ModelSet(*rp.weight_vector, rp.ffs));
+  }
+  return w;
+}
+
+// input lines and (in-order) output shared by the threads of DecodeParallel
+struct ParallelDecodeQueue {
+  ParallelDecodeQueue(istream* i, int first_id, DecoderImpl* d, int lookahead) :
+      in(i), next_in(first_id), next_out(first_id), decoder(d), prefetch(lookahead) {}
+
+  // reads the next non-empty input line, returns false at the end of input.
+  // with --prefetch_grammars N, the N lines after it have already been read
+  // and their grammars are being loaded
+  bool Next(string* line, int* id) {
+    boost::mutex::scoped_lock lock(in_mutex);
+    while (ahead.size() <= prefetch && getline(*in, *line)) {
+      if (line->empty()) continue;
+      if (prefetch) decoder->Prefetch(*line);
+      ahead.push_back(*line);
+    }
+    if (ahead.empty()) return false;
+    line->swap(ahead.front());
+    ahead.pop_front();
+    *id = next_in++;
+    return true;
+  }
+
+  // the output for sentence id is held back until all earlier sentences
+  // have been written
+  void Write(int id, const string& output) {
+    boost::mutex::scoped_lock lock(out_mutex);
+    pending[id] = output;
+    map<int, string>::iterator it;
+    while ((it = pending.find(next_out)) != pending.end()) {
+      cout << it->second << flush;
+      pending.erase(it);
+      ++next_out;
+    }
+  }
+
+  istream* in;
+  int next_in;
+  int next_out;
+  DecoderImpl* decoder;
+  const unsigned prefetch;
+  deque<string> ahead;
+  map<int, string> pending;
+  boost::mutex in_mutex;
+  boost::mutex out_mutex;
+};
+
+static void DecodeWorker(DecoderImpl* decoder, ParallelDecodeQueue* q) {
+  DecoderObserver o;
+  string line;
+  int id;
+  while (q->Next(&line, &id)) {
+    ostringstream os;
+    decoder->out = &os;
+    decoder->SetId(id);
+    decoder->Decode(line, &o);
+    q->Write(id, os.str());
+  }
+  decoder->out = &cout;
+}
+
+void DecoderImpl::DecodeParallel(istream* in, int num_threads) {
+  if (mr_mira_compat || incremental) {
+    cerr << "--threads can't be used with --mr_mira_compat or --incremental_search\n";
+    exit(1);
+  }
+  if (!SILENT) cerr << "Decoding with " << num_threads << " threads\n";
+  vector<boost::shared_ptr<DecoderImpl> > workers(num_threads);
+  for (int i = 0; i < num_threads; ++i)
+    workers[i].reset(CreateWorker());
+  ParallelDecodeQueue q(in, sent_id + 1, this, conf["prefetch_grammars"].as<int>());
+  boost::thread_group threads;
+  for (int i = 0; i < num_threads; ++i)
+    threads.create_thread(boost::bind(&DecodeWorker, workers[i].get(), &q));
+  threads.join_all();
+  sent_id = q.next_in - 1;
+  // gradient pieces that did not fill a batch of --combine_size sentences on
+  // their worker are written with the rest of this decoder's
+  for (int i = 0; i < num_threads; ++i) {
+    acc_vec += workers[i]->acc_vec;
+    acc_obj += workers[i]->acc_obj;
+    g_count += workers[i]->g_count;
+  }
+}
+
+// a sentence in DecodePipelined
+struct PipelinedSentence {
+  PipelinedSentence() : id(), done(), result() {}
+  DecodingSentence s;
+  ostringstream os;     // its output
+  DecodingStats stats;  // used if --decoding_stats is set
+  int id;
+  bool done;            // no stages are left but writing the output
+  bool result;
+};
+
+// a bounded queue of sentences between two stages of DecodePipelined. NULL
+// is pushed after the last sentence
+class SentencePipe {
+ public:
+  explicit SentencePipe(unsigned capacity) : capacity_(capacity) {}
+  void Push(PipelinedSentence* p) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.size() >= capacity_) not_full_.wait(lock);
+    queue_.push_back(p);
+    not_empty_.notify_one();
+  }
+  PipelinedSentence* Pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) not_empty_.wait(lock);
+    PipelinedSentence* p = queue_.front();
+    queue_.pop_front();
+    not_full_.notify_one();
+    return p;
+  }
+ private:
+  const unsigned capacity_;
+  deque<PipelinedSentence*> queue_;
+  boost::mutex mutex_;
+  boost::condition_variable not_empty_;
+  boost::condition_variable not_full_;
+};
+
+static void TranslateStage(DecoderImpl* decoder, ParallelDecodeQueue* q, DecoderObserver* o, SentencePipe* next) {
+  string line;
+  int id;
+  while (q->Next(&line, &id)) {
+    PipelinedSentence* p = new PipelinedSentence;
+    p->id = id;
+    p->s.o = o;
+    p->s.out = &p->os;
+    if (decoder->stats_writer) {
+      p->stats.SetSentences(1);
+      p->s.stats = &p->stats;
+    }
+    p->s.start = DecodingStats::WallTime();
+    decoder->out = &p->os;
+    decoder->SetId(id);
+    p->done = !decoder->TranslateSentence(line, &p->s, &p->result);
+    next->Push(p);
+  }
+  next->Push(NULL);
+}
+
+static void RescoreStage(DecoderImpl* decoder, int pass, SentencePipe* in, SentencePipe* next) {
+  while (PipelinedSentence* p = in->Pop()) {
+    if (!p->done) {
+      decoder->ResumeSentence(p->s);
+      decoder->RescoreSentence(pass, &p->s);
+    }
+    next->Push(p);
+  }
+  next->Push(NULL);
+}
+
+static void FinishStage(DecoderImpl* decoder, SentencePipe* in, ParallelDecodeQueue* q) {
+  while (PipelinedSentence* p = in->Pop()) {
+    if (!p->done) {
+      decoder->ResumeSentence(p->s);
+      p->result = decoder->FinishSentence(&p->s);
+    }
+    if (p->s.stats) {
+      // the stages ran on different threads, so only the wall clock time is
+      // meaningful
+      p->stats.AddTime("total", DecodingStats::WallTime() - p->s.start, -1);
+      p->s.o->NotifyDecodingStats(p->s.sent_id, p->stats);
+      decoder->stats_writer->Write(p->s.sent_id, p->stats);
+    }
+    q->Write(p->id, p->os.str());
+    delete p;
+  }
+}
+
+// the translation and rescoring stages run on copies of this decoder that
+// share its translator and feature functions: the translator is only used
+// by the translation stage and the feature functions of a pass only by the
+// stage of that pass. the output stage runs on this decoder, so anything it
+// accumulates (e.g., gradients) ends up here
+void DecoderImpl::DecodePipelined(istream* in) {
+  if (mr_mira_compat || incremental) {
+    cerr << "--pipeline_passes can't be used with --mr_mira_compat or --incremental_search\n";
+    exit(1);
+  }
+  const int num_passes = rescoring_passes.size();
+  if (!SILENT) cerr << "Decoding with " << (num_passes + 2) << " pipelined stages\n";
+  vector<boost::shared_ptr<DecoderImpl> > stages(num_passes + 1);
+  for (int i = 0; i <= num_passes; ++i) {
+    stages[i].reset(new DecoderImpl(*this));
+    stages[i]->worker = true;
+    stages[i]->extract_file.reset();
+  }
+  vector<boost::shared_ptr<SentencePipe> > pipes(num_passes + 1);
+  for (int i = 0; i <= num_passes; ++i)
+    pipes[i].reset(new SentencePipe(2));
+  ostream* const orig_out = out;
+  DecoderObserver o;
+  ParallelDecodeQueue q(in, sent_id + 1, this, conf["prefetch_grammars"].as<int>());
+  boost::thread_group threads;
+  threads.create_thread(boost::bind(&TranslateStage, stages[0].get(), &q, &o, pipes[0].get()));
+  for (int pass = 0; pass < num_passes; ++pass)
+    threads.create_thread(boost::bind(&RescoreStage, stages[pass + 1].get(), pass, pipes[pass].get(), pipes[pass + 1].get()));
+  FinishStage(this, pipes[num_passes].get(), &q);
+  threads.join_all();
+  out = orig_out;
+  sent_id = q.next_in - 1;
+}
+
 static inline void ApplyWeightDelta(const string &delta_b64, vector<weight_t> *weights) {
   SparseVector<weight_t> delta;
   DecodeFeatureVector(delta_b64, &delta);
@@ -724,9 +1065,39 @@ static inline void ApplyWeightDelta(const string &delta_b64, vector<weight_t> *w
 }
 
 bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
+  if (!stats_writer) return DecodeSentence(input, o, NULL);
+  DecodingStats stats;
+  stats.SetSentences(1);
+  bool res;
+  {
+    StageTimer t(&stats, "total");
+    res = DecodeSentence(input, o, &stats);
+  }
+  o->NotifyDecodingStats(sent_id, stats);
+  stats_writer->Write(sent_id, stats);
+  return res;
+}
+
+bool DecoderImpl::DecodeSentence(const string& input, DecoderObserver* o, DecodingStats* stats) {
+  DecodingSentence s;
+  s.o = o;
+  s.stats = stats;
+  s.out = out;
+  bool result;
+  if (!TranslateSentence(input, &s, &result)) return result;
+  for (int pass = 0; pass < rescoring_passes.size(); ++pass)
+    RescoreSentence(pass, &s);
+  return FinishSentence(&s);
+}
+
+bool DecoderImpl::TranslateSentence(const string& input, DecodingSentence* s, bool* result) {
+  DecoderObserver* o = s->o;
+  DecodingStats* stats = s->stats;
   string buf = input;
-  NgramCache::Clear();   // clear ngram cache for remote LM (if used)
-  Timer::Summarize();
+  if (!worker) {
+    NgramCache::Clear();   // clear ngram cache for remote LM (if used)
+    Timer::Summarize();
+  }
   ++sent_id;
   map<string, string> sgml;
   ProcessAndStripSGML(&buf, &sgml);
@@ -754,30 +1125,45 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
     extract_file.reset(new WriteFile(str("extract_rules",conf)+"/"+ss.str()));
   }
   string to_translate;
-  Lattice ref;
+  Lattice& ref = s->ref;
   ParseTranslatorInputLattice(buf, &to_translate, &ref);
   const unsigned srclen=NTokens(to_translate,' ');
+  s->srclen = srclen;
 //FIXME: should get the avg. or max source length of the input lattice (like Lattice::dist_(start,end)); but this is only used to scale beam parameters (optionally) anyway so fidelity isn't important.
-  const bool has_ref = ref.size() > 0;
-  SentenceMetadata smeta(sent_id, ref);
+  s->has_ref = ref.size() > 0;
+  s->sent_id = sent_id;
+  s->extract_file = extract_file;
+  s->smeta.reset(new SentenceMetadata(sent_id, ref));
+  SentenceMetadata& smeta = *s->smeta;
   smeta.sgml_.swap(sgml);
+  smeta.stats_ = stats;
   o->NotifyDecodingStart(smeta);
-  Hypergraph forest;          // -LM forest
-  translator->ProcessMarkupHints(smeta.sgml_);
-  Timer t("Translation");
-  const bool translation_successful =
-    translator->Translate(to_translate, &smeta, *init_weights, &forest);
-  translator->SentenceComplete();
+  Hypergraph& forest = s->forest;          // -LM forest
+  bool translation_successful;
+  {
+    StageTimer st(stats, "translate");
+    translator->ProcessMarkupHints(smeta.sgml_);
+    Timer t("Translation");
+    translation_successful =
+      translator->Translate(to_translate, &smeta, *init_weights, &forest);
+    translator->SentenceComplete();
+  }
+  if (stats) {
+    stats->AddCount("source_length", srclen);
+    stats->AddCount("translate.nodes", forest.nodes_.size());
+    stats->AddCount("translate.edges", forest.edges_.size());
+  }
 
   if (!translation_successful) {
     if (!SILENT) { cerr << "  NO PARSE FOUND.\n"; }
     o->NotifySourceParseFailure(smeta);
     o->NotifyDecodingComplete(smeta);
     if (conf.count("show_conditional_prob")) {
-      cout << "-Inf" << endl << flush;
+      *out << "-Inf" << endl << flush;
     } else if (!SILENT) {
-      cout << endl;
+      *out << endl;
     }
+    *result = false;
     return false;
   }
 
@@ -805,6 +1191,26 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
     cerr << "  Partition         log(Z): " << log(z) << endl;
   }
 
+  if (conf.count("show_target_graph")) {
+    HypergraphIO::WriteTarget(conf["show_target_graph"].as<string>(), sent_id, forest);
+  }
+  if (conf.count("incremental_search")) {
+    incremental->Search(conf["cubepruning_pop_limit"].as<unsigned>(), forest);
+  }
+  if (conf.count("show_target_graph") || conf.count("incremental_search")) {
+    o->NotifyDecodingComplete(smeta);
+    *result = true;
+    return false;
+  }
+  return true;
+}
+
+void DecoderImpl::RescoreSentence(int pass, DecodingSentence* s) {
+  const SentenceMetadata& smeta = *s->smeta;
+  Hypergraph& forest = s->forest;
+  DecodingStats* stats = s->stats;
+  const unsigned srclen = s->srclen;
+  const bool show_tree_structure=conf.count("show_tree_structure");
   SummaryFeature summary_feature_type = kNODE_RISK;
   if (conf["summary_feature_type"].as<string>() == "edge_risk")
     summary_feature_type = kEDGE_RISK;
@@ -817,29 +1223,20 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
     abort();
   }
 
-  if (conf.count("show_target_graph")) {
-    HypergraphIO::WriteTarget(conf["show_target_graph"].as<string>(), sent_id, forest);
-  }
-  if (conf.count("incremental_search")) {
-    incremental->Search(conf["cubepruning_pop_limit"].as<unsigned>(), forest);
-  }
-  if (conf.count("show_target_graph") || conf.count("incremental_search")) {
-    o->NotifyDecodingComplete(smeta);
-    return true;
-  }
-
-  for (int pass = 0; pass < rescoring_passes.size(); ++pass) {
-    const RescoringPass& rp = rescoring_passes[pass];
-    const vector<weight_t>& cur_weights = *rp.weight_vector;
-    if (!SILENT) cerr << endl << "  RESCORING PASS #" << (pass+1) << " " << rp << endl;
-
-    string passtr = "Pass1"; passtr[4] += pass;
-    forest.Reweight(cur_weights);
-    const bool has_rescoring_models = !rp.models->empty();
-    if (has_rescoring_models) {
-      Timer t("Forest rescoring:");
+  const RescoringPass& rp = rescoring_passes[pass];
+  const vector<weight_t>& cur_weights = *rp.weight_vector;
+  if (!SILENT) cerr << endl << "  RESCORING PASS #" << (pass+1) << " " << rp << endl;
+
+  string passtr = "Pass1"; passtr[4] += pass;
+  if (stats) stats->SetPrefix("pass" + boost::lexical_cast<string>(pass + 1));
+  forest.Reweight(cur_weights);
+  const bool has_rescoring_models = !rp.models->empty();
+  if (has_rescoring_models) {
+    Timer t("Forest rescoring:");
+    Hypergraph rescored_forest;
+    {
+      StageTimer st(stats, "rescore");
       rp.models->PrepareForInput(smeta);
-      Hypergraph rescored_forest;
 #ifdef CP_TIME
       CpTime::Sub(clock());
 #endif
@@ -851,88 +1248,104 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
 #ifdef CP_TIME
       CpTime::Add(clock());
 #endif
-      forest.swap(rescored_forest);
-      forest.Reweight(cur_weights);
-      if (!SILENT) forest_stats(forest,"  " + passtr +" forest",show_tree_structure,oracle.show_derivation, conf.count("extract_rules"), extract_file);
-      // this is mainly used for debugging, eventually this will be an assertion
-      if (!forest.AreNodesUniquelyIdentified()) {
-        if (!SILENT) cerr << "  *** NODES NOT UNIQUELY IDENTIFIED ***\n";
-      }
     }
-
-    if (conf.count("show_partition")) {
-      const prob_t z = Inside<prob_t, EdgeProb>(forest);
-      cerr << "  " << passtr << " partition     log(Z): " << log(z) << endl;
+    if (stats) {
+      rp.models->ReportTimes(stats);
+      stats->AddCount("nodes", rescored_forest.nodes_.size());
+      stats->AddCount("edges", rescored_forest.edges_.size());
     }
+    forest.swap(rescored_forest);
+    forest.Reweight(cur_weights);
+    if (!SILENT) forest_stats(forest,"  " + passtr +" forest",show_tree_structure,oracle.show_derivation, conf.count("extract_rules"), extract_file);
+    // this is mainly used for debugging, eventually this will be an assertion
+    if (!forest.AreNodesUniquelyIdentified()) {
+      if (!SILENT) cerr << "  *** NODES NOT UNIQUELY IDENTIFIED ***\n";
+    }
+  }
 
-    if (rp.fid_summary) {
-      if (summary_feature_type == kEDGE_PROB) {
-        const prob_t z = forest.PushWeightsToGoal(1.0);
-        if (!std::isfinite(log(z)) || std::isnan(log(z))) {
-          cerr << "  " << passtr << " !!! Invalid partition detected, abandoning.\n";
-        } else {
-          for (int i = 0; i < forest.edges_.size(); ++i) {
-            const double log_prob_transition = log(forest.edges_[i].edge_prob_); // locally normalized by the edge
-                                                                              // head node by forest.PushWeightsToGoal
-            if (!std::isfinite(log_prob_transition) || std::isnan(log_prob_transition)) {
-              cerr << "Edge: i=" << i << " got bad inside prob: " << *forest.edges_[i].rule_ << endl;
-              abort();
-            }
-
-            forest.edges_[i].feature_values_.set_value(rp.fid_summary, log_prob_transition);
+  if (conf.count("show_partition")) {
+    const prob_t z = Inside<prob_t, EdgeProb>(forest);
+    cerr << "  " << passtr << " partition     log(Z): " << log(z) << endl;
+  }
+
+  if (rp.fid_summary) {
+    if (summary_feature_type == kEDGE_PROB) {
+      const prob_t z = forest.PushWeightsToGoal(1.0);
+      if (!std::isfinite(log(z)) || std::isnan(log(z))) {
+        cerr << "  " << passtr << " !!! Invalid partition detected, abandoning.\n";
+      } else {
+        for (int i = 0; i < forest.edges_.size(); ++i) {
+          const double log_prob_transition = log(forest.edges_[i].edge_prob_); // locally normalized by the edge
+                                                                            // head node by forest.PushWeightsToGoal
+          if (!std::isfinite(log_prob_transition) || std::isnan(log_prob_transition)) {
+            cerr << "Edge: i=" << i << " got bad inside prob: " << *forest.edges_[i].rule_ << endl;
+            abort();
           }
-          forest.Reweight(cur_weights);  // reset weights
+
+          forest.edges_[i].feature_values_.set_value(rp.fid_summary, log_prob_transition);
         }
-      } else if (summary_feature_type == kNODE_RISK) {
-        Hypergraph::EdgeProbs posts;
-        const prob_t z = forest.ComputeEdgePosteriors(1.0, &posts);
-        if (!std::isfinite(log(z)) || std::isnan(log(z))) {
-          cerr << "  " << passtr << " !!! Invalid partition detected, abandoning.\n";
-        } else {
-          for (int i = 0; i < forest.nodes_.size(); ++i) {
-            const Hypergraph::EdgesVector& in_edges = forest.nodes_[i].in_edges_;
-            prob_t node_post = prob_t(0);
-            for (int j = 0; j < in_edges.size(); ++j)
-              node_post += (posts[in_edges[j]] / z);
-            const double log_np = log(node_post);
-            if (!std::isfinite(log_np) || std::isnan(log_np)) {
-              cerr << "got bad posterior prob for node " << i << endl;
-              abort();
-            }
-            for (int j = 0; j < in_edges.size(); ++j)
-              forest.edges_[in_edges[j]].feature_values_.set_value(rp.fid_summary, exp(log_np));
+        forest.Reweight(cur_weights);  // reset weights
+      }
+    } else if (summary_feature_type == kNODE_RISK) {
+      Hypergraph::EdgeProbs posts;
+      const prob_t z = forest.ComputeEdgePosteriors(1.0, &posts);
+      if (!std::isfinite(log(z)) || std::isnan(log(z))) {
+        cerr << "  " << passtr << " !!! Invalid partition detected, abandoning.\n";
+      } else {
+        for (int i = 0; i < forest.nodes_.size(); ++i) {
+          const Hypergraph::EdgesVector& in_edges = forest.nodes_[i].in_edges_;
+          prob_t node_post = prob_t(0);
+          for (int j = 0; j < in_edges.size(); ++j)
+            node_post += (posts[in_edges[j]] / z);
+          const double log_np = log(node_post);
+          if (!std::isfinite(log_np) || std::isnan(log_np)) {
+            cerr << "got bad posterior prob for node " << i << endl;
+            abort();
+          }
+          for (int j = 0; j < in_edges.size(); ++j)
+            forest.edges_[in_edges[j]].feature_values_.set_value(rp.fid_summary, exp(log_np));
 //            Hypergraph::Edge& example_edge = forest.edges_[in_edges[0]];
 //            string n = "NONE";
 //            if (forest.nodes_[i].cat_) n = TD::Convert(-forest.nodes_[i].cat_);
 //            cerr << "[" << n << "," << example_edge.i_ << "," << example_edge.j_ << "] = " << exp(log_np) << endl;
-          }
         }
-      } else if (summary_feature_type == kEDGE_RISK) {
-        Hypergraph::EdgeProbs posts;
-        const prob_t z = forest.ComputeEdgePosteriors(1.0, &posts);
-        if (!std::isfinite(log(z)) || std::isnan(log(z))) {
-          cerr << "  " << passtr << " !!! Invalid partition detected, abandoning.\n";
-        } else {
-          assert(posts.size() == forest.edges_.size());
-          for (int i = 0; i < posts.size(); ++i) {
-            const double log_np = log(posts[i] / z);
-            if (!std::isfinite(log_np) || std::isnan(log_np)) {
-              cerr << "got bad posterior prob for node " << i << endl;
-              abort();
-            }
-            forest.edges_[i].feature_values_.set_value(rp.fid_summary, exp(log_np));
+      }
+    } else if (summary_feature_type == kEDGE_RISK) {
+      Hypergraph::EdgeProbs posts;
+      const prob_t z = forest.ComputeEdgePosteriors(1.0, &posts);
+      if (!std::isfinite(log(z)) || std::isnan(log(z))) {
+        cerr << "  " << passtr << " !!! Invalid partition detected, abandoning.\n";
+      } else {
+        assert(posts.size() == forest.edges_.size());
+        for (int i = 0; i < posts.size(); ++i) {
+          const double log_np = log(posts[i] / z);
+          if (!std::isfinite(log_np) || std::isnan(log_np)) {
+            cerr << "got bad posterior prob for node " << i << endl;
+            abort();
           }
+          forest.edges_[i].feature_values_.set_value(rp.fid_summary, exp(log_np));
         }
-      } else {
-        assert(!"shouldn't happen");
       }
+    } else {
+      assert(!"shouldn't happen");
     }
-
-    string fullbp = "beam_prune" + StringSuffixForRescoringPass(pass);
-    string fulldp = "density_prune" + StringSuffixForRescoringPass(pass);
-    maybe_prune(forest,conf,fullbp.c_str(),fulldp.c_str(),passtr,srclen);
   }
 
+  string fullbp = "beam_prune" + StringSuffixForRescoringPass(pass);
+  string fulldp = "density_prune" + StringSuffixForRescoringPass(pass);
+  maybe_prune(forest,conf,fullbp.c_str(),fulldp.c_str(),passtr,srclen,stats);
+  if (stats) stats->SetPrefix("");
+}
+
+bool DecoderImpl::FinishSentence(DecodingSentence* s) {
+  const SentenceMetadata& smeta = *s->smeta;
+  const Lattice& ref = s->ref;
+  Hypergraph& forest = s->forest;
+  DecoderObserver* o = s->o;
+  DecodingStats* stats = s->stats;
+  const bool has_ref = s->has_ref;
+  const bool show_tree_structure=conf.count("show_tree_structure");
+
   const vector<double>& last_weights = (rescoring_passes.empty() ? *init_weights : *rescoring_passes.back().weight_vector);
 
   // Oracle Rescoring
@@ -950,6 +1363,7 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
 
   // TODO I think this should probably be handled by an Observer
   if (conf.count("forest_output") && !has_ref) {
+    StageTimer st(stats, "write_forest");
     ForestWriter writer(str("forest_output",conf), sent_id);
     if (FileExists(writer.fname_)) {
       if (!SILENT) cerr << "  Unioning...\n";
@@ -970,22 +1384,24 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
 
   // TODO I think this should probably be handled by an Observer
   if (sample_max_trans) {
+    StageTimer st(stats, "output");
     MaxTranslationSample(&forest, sample_max_trans, conf.count("k_best") ? conf["k_best"].as<int>() : 0);
   } else {
+    StageTimer st(stats, (kbest && !has_ref) ? "kbest" : "output");
     if (kbest && !has_ref) {
       //TODO: does this work properly?
       const string deriv_fname = conf.count("show_derivations") ? str("show_derivations",conf) : "-";
-      oracle.DumpKBest(sent_id, forest, conf["k_best"].as<int>(), unique_kbest,mr_mira_compat, smeta.GetSourceLength(), "-", deriv_fname);
+      oracle.DumpKBest(sent_id, forest, conf["k_best"].as<int>(), unique_kbest,mr_mira_compat, smeta.GetSourceLength(), "-", deriv_fname, out);
     } else if (csplit_output_plf) {
-      cout << HypergraphIO::AsPLF(forest, false) << endl;
+      *out << HypergraphIO::AsPLF(forest, false) << endl;
     } else {
       if (!graphviz && !has_ref && !joshua_viz && !SILENT) {
         vector<WordID> trans;
         ViterbiESentence(forest, &trans);
-        cout << TD::GetString(trans) << endl << flush;
+        *out << TD::GetString(trans) << endl << flush;
       }
       if (joshua_viz) {
-        cout << sent_id << " ||| " << JoshuaVisualizationString(forest) << " ||| 1.0 ||| " << -1.0 << endl << flush;
+        *out << sent_id << " ||| " << JoshuaVisualizationString(forest) << " ||| 1.0 ||| " << -1.0 << endl << flush;
       }
     }
   }
@@ -1010,7 +1426,7 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
   SparseVector<prob_t> full_exp, ref_exp, gradient;
   double log_z = 0, log_ref_z = 0;
   if (write_gradient) {
-    const prob_t z = InsideOutside<prob_t, EdgeProb, SparseVector<prob_t>, EdgeFeaturesAndProbWeightFunction>(forest, &full_exp);
+    const prob_t z = forest.ComputeFeatureExpectations(&full_exp);
     log_z = log(z);
     full_exp /= z;
   }
@@ -1061,9 +1477,9 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
         }
       }
       if (aligner_mode && !output_training_vector)
-        AlignerTools::WriteAlignment(smeta.GetSourceLattice(), smeta.GetReference(), forest, &cout, 0 == conf.count("aligner_use_viterbi"), kbest ? conf["k_best"].as<int>() : 0);
+        AlignerTools::WriteAlignment(smeta.GetSourceLattice(), smeta.GetReference(), forest, out, 0 == conf.count("aligner_use_viterbi"), kbest ? conf["k_best"].as<int>() : 0);
       if (write_gradient) {
-        const prob_t ref_z = InsideOutside<prob_t, EdgeProb, SparseVector<prob_t>, EdgeFeaturesAndProbWeightFunction>(forest, &ref_exp);
+        const prob_t ref_z = forest.ComputeFeatureExpectations(&ref_exp);
         ref_exp /= ref_z;
 //        if (crf_uniform_empirical)
 //          log_ref_z = ref_exp.dot(last_weights);
@@ -1081,7 +1497,7 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
       }
       if (feature_expectations) {
         const prob_t z =
-          InsideOutside<prob_t, EdgeProb, SparseVector<prob_t>, EdgeFeaturesAndProbWeightFunction>(forest, &ref_exp);
+          forest.ComputeFeatureExpectations(&ref_exp);
         ref_exp /= z;
         acc_obj += log(z);
         acc_vec += ref_exp;
@@ -1092,12 +1508,12 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
         ++g_count;
         if (g_count % combine_size == 0) {
           if (encode_b64) {
-            cout << "0\t";
+            *out << "0\t";
             SparseVector<double> dav; ConvertSV(acc_vec, &dav);
-            B64::Encode(acc_obj, dav, &cout);
-            cout << endl << flush;
+            B64::Encode(acc_obj, dav, out);
+            *out << endl << flush;
           } else {
-            cout << "0\t**OBJ**=" << acc_obj << ';' <<  acc_vec << endl << flush;
+            *out << "0\t**OBJ**=" << acc_obj << ';' <<  acc_vec << endl << flush;
           }
           acc_vec.clear();
           acc_obj = 0;
@@ -1106,20 +1522,20 @@ bool DecoderImpl::Decode(const string& input, DecoderObserver* o) {
       if (conf.count("graphviz")) forest.PrintGraphviz();
       if (kbest) {
         const string deriv_fname = conf.count("show_derivations") ? str("show_derivations",conf) : "-";
-        oracle.DumpKBest(sent_id, forest, conf["k_best"].as<int>(), unique_kbest, mr_mira_compat, smeta.GetSourceLength(), "-", deriv_fname);
+        oracle.DumpKBest(sent_id, forest, conf["k_best"].as<int>(), unique_kbest, mr_mira_compat, smeta.GetSourceLength(), "-", deriv_fname, out);
       }
       if (conf.count("show_conditional_prob")) {
         const prob_t ref_z = Inside<prob_t, EdgeProb>(forest);
-        cout << (log(ref_z) - log(first_z)) << endl << flush;
+        *out << (log(ref_z) - log(first_z)) << endl << flush;
       }
     } else {
       o->NotifyAlignmentFailure(smeta);
       if (!SILENT) cerr << "  REFERENCE UNREACHABLE.\n";
       if (write_gradient) {
-        cout << endl << flush;
+        *out << endl << flush;
       }
       if (conf.count("show_conditional_prob")) {
-        cout << "-Inf" << endl << flush;
+        *out << "-Inf" << endl << flush;
       }
     }
   }
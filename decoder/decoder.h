@@ -25,6 +25,7 @@ private:
 
 class SentenceMetadata;
 class Hypergraph;
+class DecodingStats;
 struct DecoderImpl;
 
 class DecoderObserver {
@@ -36,6 +37,9 @@ class DecoderObserver {
   virtual void NotifyAlignmentFailure(const SentenceMetadata& semta);
   virtual void NotifyAlignmentForest(const SentenceMetadata& smeta, Hypergraph* hg);
   virtual void NotifyDecodingComplete(const SentenceMetadata& smeta);
+  // called after NotifyDecodingComplete with the measurements of the
+  // decoder's stages (see decoding_stats.h), only with --decoding_stats
+  virtual void NotifyDecodingStats(int sent_id, const DecodingStats& stats);
 };
 
 struct Grammar;  // TODO once the decoder interface is cleaned up,
@@ -46,6 +50,25 @@ class Decoder {
   Decoder(std::istream* config_file);
   bool Decode(const std::string& input, DecoderObserver* observer = NULL);
 
+  // decode every (non-empty) line of in using num_threads threads and write
+  // the results to STDOUT in input order. the grammars, weights, and
+  // thread-safe feature functions are loaded once and shared by all threads;
+  // everything that depends on the sentence being decoded is private to a
+  // thread (see THREADS.txt)
+  void DecodeParallel(std::istream* in, int num_threads);
+
+  // decode every (non-empty) line of in and write the results to STDOUT in
+  // input order, with translation, each rescoring pass, and output running
+  // on their own threads (--pipeline_passes). while one sentence is in pass
+  // 2, the next one can be in pass 1. the feature functions of a pass are
+  // only used by the thread of that pass (see THREADS.txt)
+  void DecodePipelined(std::istream* in);
+
+  // tells the translator that input will be decoded later, so that it can
+  // load the resources it needs (e.g., per-sentence grammars) in the
+  // background. this has no effect unless --prefetch_grammars is used
+  void Prefetch(const std::string& input);
+
   // access this to either *read* or *write* to the decoder's last
   // weight vector (i.e., the weights of the finest past)
   std::vector<weight_t>& CurrentWeightVector();
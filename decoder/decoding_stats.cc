@@ -0,0 +1,97 @@
+#include "decoding_stats.h"
+
+#include <time.h>
+
+using namespace std;
+
+static double Seconds(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double DecodingStats::WallTime() {
+  return Seconds(CLOCK_MONOTONIC);
+}
+
+double DecodingStats::CPUTime() {
+  return Seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void DecodingStats::SetPrefix(const string& prefix) {
+  boost::mutex::scoped_lock lock(mutex_);
+  prefix_ = prefix;
+}
+
+static void AddTo(DecodingStats::Time* t, double wall, double cpu, uint64_t calls) {
+  t->calls += calls;
+  t->wall += wall;
+  if (cpu < 0)
+    t->cpu = -1;
+  else if (t->cpu >= 0)
+    t->cpu += cpu;
+}
+
+void DecodingStats::AddTime(const string& stage, double wall, double cpu, uint64_t calls) {
+  boost::mutex::scoped_lock lock(mutex_);
+  AddTo(&times_[Name(stage)], wall, cpu, calls);
+}
+
+void DecodingStats::AddCount(const string& counter, uint64_t n) {
+  boost::mutex::scoped_lock lock(mutex_);
+  counts_[Name(counter)] += n;
+}
+
+void DecodingStats::Add(const DecodingStats& other) {
+  if (&other == this) return;
+  boost::mutex::scoped_lock lock(mutex_);
+  boost::mutex::scoped_lock other_lock(other.mutex_);
+  for (map<string, Time>::const_iterator it = other.times_.begin(); it != other.times_.end(); ++it)
+    AddTo(&times_[it->first], it->second.wall, it->second.cpu, it->second.calls);
+  for (map<string, uint64_t>::const_iterator it = other.counts_.begin(); it != other.counts_.end(); ++it)
+    counts_[it->first] += it->second;
+  sentences_ += other.sentences_;
+}
+
+void DecodingStats::clear() {
+  boost::mutex::scoped_lock lock(mutex_);
+  prefix_.clear();
+  sentences_ = 0;
+  times_.clear();
+  counts_.clear();
+}
+
+// stage names are made up by the decoder and feature function names, but
+// quote them properly anyway
+static void WriteJSONString(const string& s, ostream* out) {
+  *out << '"';
+  for (unsigned i = 0; i < s.size(); ++i) {
+    const char c = s[i];
+    if (c == '"' || c == '\\')
+      *out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      *out << ' ';
+    else
+      *out << c;
+  }
+  *out << '"';
+}
+
+void DecodingStats::WriteJSON(const string& id, ostream* out) const {
+  boost::mutex::scoped_lock lock(mutex_);
+  *out << "{\"id\":" << id << ",\"sentences\":" << sentences_ << ",\"times\":{";
+  for (map<string, Time>::const_iterator it = times_.begin(); it != times_.end(); ++it) {
+    if (it != times_.begin()) *out << ',';
+    WriteJSONString(it->first, out);
+    *out << ":{\"calls\":" << it->second.calls << ",\"wall\":" << it->second.wall;
+    if (it->second.cpu >= 0) *out << ",\"cpu\":" << it->second.cpu;
+    *out << '}';
+  }
+  *out << "},\"counts\":{";
+  for (map<string, uint64_t>::const_iterator it = counts_.begin(); it != counts_.end(); ++it) {
+    if (it != counts_.begin()) *out << ',';
+    WriteJSONString(it->first, out);
+    *out << ':' << it->second;
+  }
+  *out << "}}\n";
+}
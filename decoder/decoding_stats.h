@@ -0,0 +1,94 @@
+#ifndef DECODING_STATS_H_
+#define DECODING_STATS_H_
+
+#include <stdint.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <boost/thread/mutex.hpp>
+
+// Measurements of the stages of decoding one sentence (or, when added up, of
+// many). A stage (e.g., "translate", "pass1.rescore", "pass1.ff.WordPenalty")
+// records how often it ran and how much wall clock and CPU time it took; a
+// counter (e.g., "pass1.edges", "pass1.cube_pops") records sizes and events.
+// Stages and counters added while a prefix is set (see SetPrefix) are named
+// prefix + "." + name. Updates are synchronized, so the threads of parallel
+// cube pruning may share a DecodingStats.
+//
+// The decoder collects these when --decoding_stats is used. They are
+// attached to the SentenceMetadata of the sentence being decoded (see
+// SentenceMetadata::GetStats()) and passed to
+// DecoderObserver::NotifyDecodingStats().
+class DecodingStats {
+ public:
+  struct Time {
+    Time() : calls(), wall(), cpu() {}
+    uint64_t calls;
+    double wall;   // seconds
+    double cpu;    // seconds, < 0 if only wall clock time was measured
+  };
+
+  DecodingStats() : sentences_() {}
+
+  void SetPrefix(const std::string& prefix);
+  void AddTime(const std::string& stage, double wall, double cpu, uint64_t calls = 1);
+  void AddCount(const std::string& counter, uint64_t n);
+
+  // adds other's stages and counters (which are not prefixed) to these
+  void Add(const DecodingStats& other);
+  void clear();
+
+  // number of sentences that have been added together
+  unsigned sentences() const { return sentences_; }
+  void SetSentences(unsigned n) { sentences_ = n; }
+  const std::map<std::string, Time>& times() const { return times_; }
+  const std::map<std::string, uint64_t>& counts() const { return counts_; }
+
+  // writes a JSON object on a single line, e.g.
+  //   {"id":3,"times":{"translate":{"calls":1,"wall":0.12,"cpu":0.11}},"counts":{"parse.edges":7120}}
+  // id is written as it is, so strings must be quoted
+  void WriteJSON(const std::string& id, std::ostream* out) const;
+
+  // wall clock and CPU time (of the calling thread), in seconds
+  static double WallTime();
+  static double CPUTime();
+
+ private:
+  DecodingStats(const DecodingStats&);
+  const DecodingStats& operator=(const DecodingStats&);
+  std::string Name(const std::string& name) const {
+    return prefix_.empty() ? name : prefix_ + '.' + name;
+  }
+
+  mutable boost::mutex mutex_;
+  std::string prefix_;
+  unsigned sentences_;
+  std::map<std::string, Time> times_;
+  std::map<std::string, uint64_t> counts_;
+};
+
+// adds the wall clock and CPU time between its construction and destruction
+// to a stage; does nothing if stats is NULL
+class StageTimer {
+ public:
+  StageTimer(DecodingStats* stats, const std::string& stage) : stats_(stats) {
+    if (stats_) {
+      stage_ = stage;
+      wall_ = DecodingStats::WallTime();
+      cpu_ = DecodingStats::CPUTime();
+    }
+  }
+  ~StageTimer() {
+    if (stats_)
+      stats_->AddTime(stage_, DecodingStats::WallTime() - wall_, DecodingStats::CPUTime() - cpu_);
+  }
+ private:
+  StageTimer(const StageTimer&);
+  const StageTimer& operator=(const StageTimer&);
+  DecodingStats* stats_;
+  std::string stage_;
+  double wall_;
+  double cpu_;
+};
+
+#endif
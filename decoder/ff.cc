@@ -2,6 +2,7 @@
 
 #include "tdict.h"
 #include "hg.h"
+#include "murmur_hash3.h"
 
 using namespace std;
 
@@ -9,6 +10,10 @@ FeatureFunction::~FeatureFunction() {}
 
 void FeatureFunction::PrepareForInput(const SentenceMetadata&) {}
 
+uint64_t FeatureFunction::StateHash(const void* state) const {
+  return cdec::MurmurHash3_64(state, state_size_ - ignored_state_size_, 2654435769U);
+}
+
 void FeatureFunction::FinalTraversalFeatures(const void* /* ant_state */,
                                              SparseVector<double>* /* features */) const {}
 
@@ -1,6 +1,7 @@
 #ifndef FF_H_
 #define FF_H_
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include "sparse_vector.h"
@@ -17,9 +18,10 @@ class FeatureFunction {
   friend class ExternalFeature;
  public:
   std::string name_; // set by FF factory using usage()
-  FeatureFunction() : state_size_(), ignored_state_size_() {}
+  FeatureFunction() : state_size_(), ignored_state_size_(), thread_safe_() {}
   explicit FeatureFunction(int state_size, int ignored_state_size = 0)
-      : state_size_(state_size), ignored_state_size_(ignored_state_size) {}
+      : state_size_(state_size), ignored_state_size_(ignored_state_size),
+        thread_safe_() {}
   virtual ~FeatureFunction();
   bool IsStateful() const { return state_size_ > 0; }
   int StateSize() const { return state_size_; }
@@ -35,6 +37,22 @@ class FeatureFunction {
   // understand how this affects ApplyModelSet() before using it.
   int IgnoredStateSize() const { return ignored_state_size_; }
 
+  // Returns true if a single instance of this feature may be shared by
+  // several decoding threads, i.e., PrepareForInput does nothing and
+  // TraversalFeaturesImpl only reads data set up in the constructor. When
+  // decoding with --threads, features that are not thread safe are
+  // instantiated once per thread.
+  bool IsThreadSafe() const { return thread_safe_; }
+
+  // Returns a hash of a state written by this feature function. Hypotheses
+  // are recombined by their state, and the hash of the state of all features
+  // (see ModelSet::StateHash()) is computed from these. States that are
+  // equal must have the same hash, so the ignored bytes at the end of the
+  // state must not change it. The default hashes the state's bytes; feature
+  // functions whose state already has a (cheaper) hash of its own, such as
+  // the ChartState of a KenLM language model, should return that instead.
+  virtual uint64_t StateHash(const void* state) const;
+
   // override this.  not virtual because we want to expose this to factory template for help before creating a FF
   static std::string usage(bool show_params,bool show_details) {
     return usage_helper("FIXME_feature_needs_name","[no parameters]","[no documentation yet]",show_params,show_details);
@@ -93,8 +111,14 @@ class FeatureFunction {
     ignored_state_size_ = ignored_state_size;
   }
 
+  // See document of IsThreadSafe() above.
+  void SetThreadSafe(bool thread_safe) {
+    thread_safe_ = thread_safe;
+  }
+
  private:
   int state_size_, ignored_state_size_;
+  bool thread_safe_;
 };
 
 #endif
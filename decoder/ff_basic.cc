@@ -12,6 +12,7 @@ WordPenalty::WordPenalty(const string& param) :
   if (!param.empty()) {
     cerr << "Warning WordPenalty ignoring parameter: " << param << endl;
   }
+  SetThreadSafe(true);
 }
 
 void WordPenalty::TraversalFeaturesImpl(const SentenceMetadata& smeta,
@@ -34,6 +35,7 @@ SourceWordPenalty::SourceWordPenalty(const string& param) :
   if (!param.empty()) {
     cerr << "Warning SourceWordPenalty ignoring parameter: " << param << endl;
   }
+  SetThreadSafe(true);
 }
 
 void SourceWordPenalty::TraversalFeaturesImpl(const SentenceMetadata& smeta,
@@ -61,6 +63,7 @@ ArityPenalty::ArityPenalty(const std::string& param) {
   }
   // pretty up features vector in case FD was frozen.  doesn't change anything
   while (!fids_.empty() && fids_.back()==0) fids_.pop_back();
+  SetThreadSafe(true);
 }
 
 void ArityPenalty::TraversalFeaturesImpl(const SentenceMetadata& smeta,
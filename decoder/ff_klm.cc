@@ -333,6 +333,8 @@ KLanguageModel<Model>::KLanguageModel(const string& param) {
   emit_fid_ = FD::Convert(featname+"_Emit");
   // cerr << "FID: " << oov_fid_ << endl;
   SetStateSize(pimpl_->ReserveStateSize());
+  // the model and vocabulary map are read-only after loading
+  SetThreadSafe(true);
 }
 
 template <class Model>
@@ -356,6 +358,14 @@ void KLanguageModel<Model>::TraversalFeaturesImpl(const SentenceMetadata& /* sme
     features->set_value(emit_fid_, emit);
 }
 
+// the ChartState is zeroed past its used length (see LookupWords), so its
+// hash agrees with the byte comparison used for recombination
+template <class Model>
+uint64_t KLanguageModel<Model>::StateHash(const void* state) const {
+  const BoundaryAnnotatedState& annotated = *static_cast<const BoundaryAnnotatedState*>(state);
+  return hash_value(annotated.state) ^ (annotated.seen_bos ? 0x5bd1e995u : 0) ^ (annotated.seen_eos ? 0x1b873593u : 0);
+}
+
 template <class Model>
 void KLanguageModel<Model>::FinalTraversalFeatures(const void* ant_state,
                                            SparseVector<double>* features) const {
@@ -19,6 +19,7 @@ class KLanguageModel : public FeatureFunction {
   ~KLanguageModel();
   virtual void FinalTraversalFeatures(const void* context,
                                       SparseVector<double>* features) const;
+  virtual uint64_t StateHash(const void* state) const;
   static std::string usage(bool param,bool verbose);
  protected:
   virtual void TraversalFeaturesImpl(const SentenceMetadata& smeta,
@@ -1,19 +1,29 @@
 #include "ffset.h"
 
+#include <boost/lexical_cast.hpp>
+
 #include "ff.h"
 #include "tdict.h"
 #include "hg.h"
+#include "decoding_stats.h"
+#include "sentence_metadata.h"
 
 using namespace std;
 
 ModelSet::ModelSet(const vector<double>& w, const vector<const FeatureFunction*>& models) :
     models_(models),
+    times_(models.size()),
     weights_(w),
     state_size_(0),
     model_state_pos_(models.size()) {
   for (int i = 0; i < models_.size(); ++i) {
     model_state_pos_[i] = state_size_;
     state_size_ += models_[i]->StateSize();
+    all_models_.push_back(i);
+    if (models_[i]->IsStateful())
+      stateful_models_.push_back(i);
+    else
+      stateless_models_.push_back(i);
     int num_ignored_bytes = models_[i]->IgnoredStateSize();
     if (num_ignored_bytes > 0) {
       ranges_to_erase_.push_back(
@@ -29,7 +39,34 @@ void ModelSet::PrepareForInput(const SentenceMetadata& smeta) {
 
 void ModelSet::AddFeaturesToEdge(const SentenceMetadata& smeta,
                                  const Hypergraph& /* hg */,
-                                 const FFStates& node_states,
+                                 const FFStateStore& node_states,
+                                 HG::Edge* edge,
+                                 FFState* context,
+                                 prob_t* combination_cost_estimate) const {
+  AddFeaturesToEdge(all_models_, smeta, node_states, edge, context, combination_cost_estimate);
+}
+
+void ModelSet::AddStatelessFeatures(const SentenceMetadata& smeta,
+                                    const HG::Edge& edge,
+                                    SparseVector<double>* features,
+                                    prob_t* combination_cost_estimate) const {
+  SparseVector<double> est_vals;
+  TraversalFeatures(stateless_models_, smeta, NULL, edge, features, &est_vals, NULL);
+  combination_cost_estimate->logeq(est_vals.dot(weights_));
+}
+
+void ModelSet::AddStatefulFeaturesToEdge(const SentenceMetadata& smeta,
+                                         const Hypergraph& /* hg */,
+                                         const FFStateStore& node_states,
+                                         HG::Edge* edge,
+                                         FFState* context,
+                                         prob_t* combination_cost_estimate) const {
+  AddFeaturesToEdge(stateful_models_, smeta, node_states, edge, context, combination_cost_estimate);
+}
+
+void ModelSet::AddFeaturesToEdge(const vector<int>& which,
+                                 const SentenceMetadata& smeta,
+                                 const FFStateStore& node_states,
                                  HG::Edge* edge,
                                  FFState* context,
                                  prob_t* combination_cost_estimate) const {
@@ -40,23 +77,55 @@ void ModelSet::AddFeaturesToEdge(const SentenceMetadata& smeta,
   }
   SparseVector<double> est_vals;  // only computed if combination_cost_estimate is non-NULL
   if (combination_cost_estimate) *combination_cost_estimate = prob_t::One();
-  for (int i = 0; i < models_.size(); ++i) {
-    const FeatureFunction& ff = *models_[i];
+  TraversalFeatures(which, smeta, &node_states, *edge, &edge->feature_values_, &est_vals, context);
+  if (combination_cost_estimate)
+    combination_cost_estimate->logeq(est_vals.dot(weights_));
+  edge->edge_prob_.logeq(edge->feature_values_.dot(weights_));
+}
+
+void ModelSet::TraversalFeatures(const vector<int>& which,
+                                 const SentenceMetadata& smeta,
+                                 const FFStateStore* node_states,
+                                 const HG::Edge& edge,
+                                 SparseVector<double>* features,
+                                 SparseVector<double>* est_vals,
+                                 FFState* context) const {
+  // the antecedent states are only set for stateful features
+  vector<const void*> ants(edge.tail_nodes_.size());
+  // the ignored bytes of the antecedents are stored separately, so their
+  // complete states have to be put back together
+  FFStates full_ant_states;
+  if (node_states && node_states->HasIgnoredBytes() && !stateful_models_.empty()) {
+    full_ant_states.resize(ants.size());
+    for (int i = 0; i < ants.size(); ++i)
+      node_states->GetState(edge.tail_nodes_[i], &full_ant_states[i]);
+  }
+  for (int k = 0; k < which.size(); ++k) {
+    const int m = which[k];
+    const FeatureFunction& ff = *models_[m];
     void* cur_ff_context = NULL;
-    vector<const void*> ants(edge->tail_nodes_.size());
     bool has_context = ff.StateSize() > 0;
     if (has_context) {
-      int spos = model_state_pos_[i];
+      int spos = model_state_pos_[m];
       cur_ff_context = &(*context)[spos];
       for (int i = 0; i < ants.size(); ++i) {
-        ants[i] = &node_states[edge->tail_nodes_[i]][spos];
+        if (full_ant_states.empty())
+          ants[i] = node_states->SharedState(edge.tail_nodes_[i]) + spos;
+        else
+          ants[i] = &full_ant_states[i][spos];
       }
+    } else {
+      fill(ants.begin(), ants.end(), static_cast<const void*>(NULL));
+    }
+    if (smeta.GetStats()) {
+      const double start = DecodingStats::WallTime();
+      ff.TraversalFeatures(smeta, edge, ants, features, est_vals, cur_ff_context);
+      times_[m].nanos += static_cast<uint64_t>((DecodingStats::WallTime() - start) * 1e9);
+      ++times_[m].calls;
+    } else {
+      ff.TraversalFeatures(smeta, edge, ants, features, est_vals, cur_ff_context);
     }
-    ff.TraversalFeatures(smeta, *edge, ants, &edge->feature_values_, &est_vals, cur_ff_context);
   }
-  if (combination_cost_estimate)
-    combination_cost_estimate->logeq(est_vals.dot(weights_));
-  edge->edge_prob_.logeq(edge->feature_values_.dot(weights_));
 }
 
 void ModelSet::AddFinalFeatures(const FFState& state, HG::Edge* edge,SentenceMetadata const& smeta) const {
@@ -75,8 +144,49 @@ void ModelSet::AddFinalFeatures(const FFState& state, HG::Edge* edge,SentenceMet
   edge->edge_prob_.logeq(edge->feature_values_.dot(weights_));
 }
 
+void ModelSet::ReportTimes(DecodingStats* stats) const {
+  for (int i = 0; i < models_.size(); ++i) {
+    const uint64_t calls = times_[i].calls.exchange(0);
+    const uint64_t nanos = times_[i].nanos.exchange(0);
+    if (!stats || !calls) continue;
+    const string& name = models_[i]->name_;
+    stats->AddTime("ff." + (name.empty() ? "Feature" + boost::lexical_cast<string>(i) : name), nanos * 1e-9, -1, calls);
+  }
+}
+
 bool ModelSet::NeedsStateErasure() const { return !ranges_to_erase_.empty(); }
 
+uint64_t ModelSet::StateHash(const FFState& state) const {
+  return state.size() ? StateHash(&state[0]) : 0;
+}
+
+uint64_t ModelSet::StateHash(const uint8_t* state) const {
+  if (!state_size_) return 0;
+  uint64_t h = 0;
+  for (int i = 0; i < stateful_models_.size(); ++i) {
+    const int m = stateful_models_[i];
+    h ^= models_[m]->StateHash(state + model_state_pos_[m]) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  }
+  return h ? h : 1;
+}
+
+bool ModelSet::StatesEqual(const FFState& a, const FFState& b) const {
+  if (a.size() != b.size()) return false;
+  if (a.size() == 0) return true;
+  int pos = 0;
+  for (const auto& range : ranges_to_erase_) {
+    if (memcmp(&a[pos], &b[pos], range.first - pos) != 0) return false;
+    pos = range.second;
+  }
+  return memcmp(&a[0] + pos, &b[0] + pos, a.size() - pos) == 0;
+}
+
+bool ModelSet::IsThreadSafe() const {
+  for (int i = 0; i < models_.size(); ++i)
+    if (!models_[i]->IsThreadSafe()) return false;
+  return true;
+}
+
 void ModelSet::EraseIgnoredBytes(FFState* state) const {
   // TODO: can we memset?
   for (const auto& range : ranges_to_erase_) {
@@ -85,3 +195,66 @@ void ModelSet::EraseIgnoredBytes(FFState* state) const {
     }
   }
 }
+
+FFStateStore::FFStateStore(const ModelSet& models) :
+    models_(models),
+    ranges_(models.ranges_to_erase_),
+    state_size_(models.state_size_),
+    ignored_size_(0),
+    index_(100, HandleHash{this}, HandleEquals{this}) {
+  for (const auto& range : ranges_)
+    ignored_size_ += range.second - range.first;
+}
+
+// the ignored bytes of stored states are 0, which doesn't change their hash
+size_t FFStateStore::HandleHash::operator()(uint32_t h) const {
+  return store->models_.StateHash(&store->states_[h * store->state_size_]);
+}
+
+bool FFStateStore::HandleEquals::operator()(uint32_t a, uint32_t b) const {
+  const int n = store->state_size_;
+  return memcmp(&store->states_[a * n], &store->states_[b * n], n) == 0;
+}
+
+void FFStateStore::reserve(size_t num_nodes) {
+  handles_.reserve(num_nodes);
+  ignored_.reserve(num_nodes * ignored_size_);
+}
+
+void FFStateStore::AddNode(const FFState& state) {
+  assert(state.size() == state_size_);
+  if (state_size_ == 0) {
+    handles_.push_back(0);
+    return;
+  }
+  // tentatively add the state, and remove it again if it's already there
+  const uint32_t h = states_.size() / state_size_;
+  states_.insert(states_.end(), state.begin(), state.end());
+  for (const auto& range : ranges_) {
+    ignored_.insert(ignored_.end(), &states_[h * state_size_ + range.first], &states_[h * state_size_ + range.second]);
+    memset(&states_[h * state_size_ + range.first], 0, range.second - range.first);
+  }
+  const pair<unordered_set<uint32_t, HandleHash, HandleEquals>::iterator, bool> r = index_.insert(h);
+  if (!r.second) states_.resize(h * state_size_);
+  handles_.push_back(*r.first);
+}
+
+void FFStateStore::SetState(int node, const FFState& state) {
+  assert(state.size() == state_size_);
+  uint8_t* ignored = ignored_.data() + node * ignored_size_;
+  for (const auto& range : ranges_) {
+    memcpy(ignored, &state[range.first], range.second - range.first);
+    ignored += range.second - range.first;
+  }
+}
+
+void FFStateStore::GetState(int node, FFState* state) const {
+  state->resize(state_size_);
+  if (state_size_ == 0) return;
+  memcpy(&(*state)[0], SharedState(node), state_size_);
+  const uint8_t* ignored = ignored_.data() + node * ignored_size_;
+  for (const auto& range : ranges_) {
+    memcpy(&(*state)[range.first], ignored, range.second - range.first);
+    ignored += range.second - range.first;
+  }
+}
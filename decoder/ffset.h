@@ -1,18 +1,28 @@
 #ifndef FFSET_H_
 #define FFSET_H_
 
+#include <stdint.h>
+#include <atomic>
 #include <utility>
 #include <vector>
+#ifndef HAVE_OLD_CPP
+# include <unordered_set>
+#else
+# include <tr1/unordered_set>
+namespace std { using std::tr1::unordered_set; }
+#endif
 #include "value_array.h"
 #include "prob.h"
+#include "sparse_vector.h"
 
 namespace HG { struct Edge; struct Node; }
 class Hypergraph;
 class FeatureFunction;
 class SentenceMetadata;
 class FeatureFunction;  // see definition below
+class FFStateStore;
+class DecodingStats;
 
-// TODO let states be dynamically sized
 typedef ValueArray<uint8_t> FFState; // this is a fixed array, but about 10% faster than string
 
 //FIXME: only context.data() is required to be contiguous, and it becomes invalid after next string operation.  use ValueArray instead? (higher performance perhaps, save a word due to fixed size)
@@ -30,11 +40,30 @@ class ModelSet {
   // must be.  edge features are supposed to be overwritten, not added to (possibly because rule features aren't in ModelSet so need to be left alone
   void AddFeaturesToEdge(const SentenceMetadata& smeta,
                          const Hypergraph& hg,
-                         const FFStates& node_states,
+                         const FFStateStore& node_states,
                          HG::Edge* edge,
                          FFState* residual_context,
                          prob_t* combination_cost_estimate = NULL) const;
 
+  // The stateless feature functions only look at the rule, span, and
+  // sentence of an edge, so when many edges are built from the same edge of
+  // the input forest (as in cube pruning), their values can be computed once
+  // for the input edge with AddStatelessFeatures and the rest with
+  // AddStatefulFeaturesToEdge, which only calls the stateful feature
+  // functions. The feature values of the new edges must be initialized to
+  // *features, and their combination cost estimates are the product of the
+  // two estimates.
+  void AddStatelessFeatures(const SentenceMetadata& smeta,
+                            const HG::Edge& edge,
+                            SparseVector<double>* features,
+                            prob_t* combination_cost_estimate) const;
+  void AddStatefulFeaturesToEdge(const SentenceMetadata& smeta,
+                                 const Hypergraph& hg,
+                                 const FFStateStore& node_states,
+                                 HG::Edge* edge,
+                                 FFState* residual_context,
+                                 prob_t* combination_cost_estimate = NULL) const;
+
   //this is called INSTEAD of above when result of edge is goal (must be a unary rule - i.e. one variable, but typically it's assumed that there are no target terminals either (e.g. for LM))
   void AddFinalFeatures(const FFState& residual_context,
                         HG::Edge* edge,
@@ -54,12 +83,100 @@ class ModelSet {
   bool NeedsStateErasure() const;
   void EraseIgnoredBytes(FFState* state) const;
 
+  // Hypotheses are recombined if their states are equal up to the ignored
+  // bytes. StateHash combines the FeatureFunction::StateHash() of each
+  // stateful feature function, so the state is not rehashed as one byte
+  // string; it is 0 only for empty states.
+  uint64_t StateHash(const FFState& state) const;
+  // the same for the state_size bytes of a state (see FFStateStore)
+  uint64_t StateHash(const uint8_t* state) const;
+  bool StatesEqual(const FFState& a, const FFState& b) const;
+
+  // true if every feature function may be used by several threads at once
+  // (see FeatureFunction::IsThreadSafe())
+  bool IsThreadSafe() const;
+
+  // feature functions are timed while scoring edges of sentences that
+  // collect DecodingStats. This adds the (wall clock) time spent in each of
+  // them since the last call to stats, as the stage "ff.<name>".
+  void ReportTimes(DecodingStats* stats) const;
+
  private:
+  friend class FFStateStore;
+
+  // calls models_[which[i]] for every i and sets edge->edge_prob_
+  void AddFeaturesToEdge(const std::vector<int>& which,
+                         const SentenceMetadata& smeta,
+                         const FFStateStore& node_states,
+                         HG::Edge* edge,
+                         FFState* residual_context,
+                         prob_t* combination_cost_estimate) const;
+  void TraversalFeatures(const std::vector<int>& which,
+                         const SentenceMetadata& smeta,
+                         const FFStateStore* node_states,
+                         const HG::Edge& edge,
+                         SparseVector<double>* features,
+                         SparseVector<double>* estimated_features,
+                         FFState* residual_context) const;
+
+  struct FFTime {
+    std::atomic<uint64_t> nanos;
+    std::atomic<uint64_t> calls;
+  };
+
   std::vector<const FeatureFunction*> models_;
+  std::vector<int> all_models_, stateless_models_, stateful_models_;
+  mutable std::vector<FFTime> times_;  // updated by several threads during
+                                       // parallel cube pruning
   const std::vector<double>& weights_;
   int state_size_;
   std::vector<int> model_state_pos_;
   std::vector<std::pair<int, int> > ranges_to_erase_;
 };
 
+// The states of the nodes of a forest that is being rescored with a ModelSet.
+// Many nodes have the same state (e.g., the same language model context in
+// different spans), so every distinct state is stored once in a contiguous
+// array and nodes refer to it by a 32-bit handle. The ignored bytes of a
+// state (see FeatureFunction::IgnoredStateSize()) are not part of the shared
+// state; they are stored per node in a separate array.
+class FFStateStore {
+ public:
+  explicit FFStateStore(const ModelSet& models);
+
+  // adds the next node (nodes are numbered from 0)
+  void AddNode(const FFState& state);
+  // only the ignored bytes of the new state may differ from the old one
+  void SetState(int node, const FFState& state);
+  void GetState(int node, FFState* state) const;
+
+  // the state of node with its ignored bytes set to 0. The pointer is
+  // invalidated by AddNode.
+  const uint8_t* SharedState(int node) const {
+    return state_size_ ? &states_[handles_[node] * state_size_] : NULL;
+  }
+  bool HasIgnoredBytes() const { return ignored_size_ > 0; }
+  int size() const { return handles_.size(); }
+  void reserve(size_t num_nodes);
+
+ private:
+  struct HandleHash {
+    const FFStateStore* store;
+    size_t operator()(uint32_t h) const;
+  };
+  struct HandleEquals {
+    const FFStateStore* store;
+    bool operator()(uint32_t a, uint32_t b) const;
+  };
+
+  const ModelSet& models_;
+  const std::vector<std::pair<int, int> >& ranges_;  // ignored bytes
+  const int state_size_;
+  int ignored_size_;
+  std::vector<uint8_t> states_;     // the distinct states
+  std::unordered_set<uint32_t, HandleHash, HandleEquals> index_;
+  std::vector<uint32_t> handles_;   // for each node
+  std::vector<uint8_t> ignored_;    // ignored_size_ bytes for each node
+};
+
 #endif
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <utility>
 #include <map>
+#include <atomic>
 #ifndef HAVE_OLD_CPP
 # include <unordered_map>
 # include <unordered_set>
@@ -12,7 +13,12 @@
 namespace std { using std::tr1::unordered_map; using std::tr1::unordered_set; }
 #endif
 
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
 #include "rule_lexer.h"
+#include "rule_store.h"
 #include "filelib.h"
 #include "tdict.h"
 
@@ -31,53 +37,232 @@ bool Grammar::HasRuleForSpan(int i, int j, int distance) const {
   return true;  // always true by default
 }
 
-struct TextRuleBin : public RuleBin {
+// Rules are added to a trie of maps. Before the grammar is first used, the
+// trie is flattened: the nodes are stored breadth first in one array, the
+// children of each node are a sorted, contiguous range of child_syms_, and the
+// rules of each node are a contiguous range of rules_. Since children are laid
+// out breadth first, the child at position c of child_syms_ is node c + 1, so
+// Extend is a binary search over a few adjacent symbols and no pointers need
+// to be followed.
+//
+// Once a grammar has kMIN_STORED_RULES rules, its rules are moved into a
+// RuleStore as they are read, and only their 32-bit ids are kept (rules that
+// carry decoder state, see RuleStore::CanStore, are kept as they are). Small
+// and per-sentence grammars (see TextGrammar::SetUseRuleStore) keep their
+// TRules, since the store would save little memory on them. The TRules of a
+// node of a large grammar are recreated when the parser first asks for them,
+// so only the part of the grammar that is used is expanded. Each thread keeps
+// the rules it has expanded until it calls TextGrammar::ReleaseRules (once a
+// sentence is done), so the parser needs no lock and the expanded rules don't
+// accumulate over the life of the grammar; edges keep the TRules they use.
+struct TextGrammarNode {
+  map<WordID, TextGrammarNode> tree_;
+  vector<uint32_t> rules_;  // as in TGImpl::rules_
+};
+
+struct TGImpl;
+struct FlatGrammarNode : public GrammarIter, public RuleBin {
+  const GrammarIter* Extend(int symbol) const;
+  const RuleBin* GetRules() const {
+    return first_rule_ == end_rule_ ? NULL : this;
+  }
   int GetNumRules() const {
-    return rules_.size();
+    return end_rule_ - first_rule_;
   }
-  TRulePtr GetIthRule(int i) const {
-    return rules_[i];
+  TRulePtr GetIthRule(int i) const;
+  int Arity() const {
+    return GetIthRule(0)->Arity();
   }
-  void AddRule(TRulePtr t) {
-    rules_.push_back(t);
+  const TRulePtr* Rules() const;
+
+  const TGImpl* g_;
+  unsigned first_child_, end_child_;
+  unsigned first_rule_, end_rule_;
+};
+
+// the TRules of the trie nodes of large grammars that the calling thread has
+// reached since it last called TextGrammar::ReleaseRules, by grammar id and
+// node
+typedef unordered_map<uint64_t, vector<TRulePtr> > ExpandedRules;
+static boost::thread_specific_ptr<ExpandedRules> expanded_rules;
+static atomic<uint32_t> next_grammar_id(0);
+
+struct TGImpl {
+  TGImpl() : id_(0), num_rules_(0), use_store_(true), storing_(false), pending_node_(NULL), flat_(false) {}
+
+  // the last rule is only added to the trie when the next one is read: the
+  // fine rules of a coarse-to-fine grammar are attached to it until then
+  void AddRule(const TRulePtr& rule) {
+    if (flat_) Unflatten();
+    AddPending();
+    TextGrammarNode* cur = &root_;
+    for (int i = 0; i < rule->f_.size(); ++i)
+      cur = &cur->tree_[rule->f_[i]];
+    pending_ = rule;
+    pending_node_ = cur;
   }
-  int Arity() const {
-    return rules_.front()->Arity();
+
+  void AddPending() {
+    if (!pending_) return;
+    if (use_store_ && !storing_ && num_rules_ >= kMIN_STORED_RULES) {
+      vector<TRulePtr> pinned;
+      storing_ = true;
+      StoreRules(&root_, &pinned);
+      pinned_.swap(pinned);
+    }
+    pending_node_->rules_.push_back(Add(pending_, &pinned_));
+    ++num_rules_;
+    pending_.reset();
+    pending_node_ = NULL;
   }
-  void Dump() const {
-    for (int i = 0; i < rules_.size(); ++i)
-      cerr << rules_[i]->AsString() << endl;
+
+  // the id of rule in rules_. Unless rules are being stored, or rule can't be
+  // stored, rule is kept in pinned
+  uint32_t Add(const TRulePtr& rule, vector<TRulePtr>* pinned) {
+    if (storing_ && RuleStore::CanStore(*rule) && store_.size() < kPINNED)
+      return store_.Add(*rule);
+    pinned->push_back(rule);
+    return kPINNED | (pinned->size() - 1);
   }
- private:
-  vector<TRulePtr> rules_;
-};
 
-struct TextGrammarNode : public GrammarIter {
-  TextGrammarNode() : rb_(NULL) {}
-  ~TextGrammarNode() {
-    delete rb_;
+  // moves the rules of node and its descendants from pinned_ into store_
+  void StoreRules(TextGrammarNode* node, vector<TRulePtr>* pinned) {
+    for (unsigned i = 0; i < node->rules_.size(); ++i)
+      node->rules_[i] = Add(pinned_[node->rules_[i] & ~kPINNED], pinned);
+    for (map<WordID, TextGrammarNode>::iterator it = node->tree_.begin(); it != node->tree_.end(); ++it)
+      StoreRules(&it->second, pinned);
   }
-  const GrammarIter* Extend(int symbol) const {
-    map<WordID, TextGrammarNode>::const_iterator i = tree_.find(symbol);
-    if (i == tree_.end()) return NULL;
-    return &i->second;
+
+  void SetUseRuleStore(bool use) {
+    use_store_ = use;
   }
 
-  const RuleBin* GetRules() const {
-    if (rb_) {
-      //rb_->Dump();
+  // rules may not be added while the grammar is being used, but several
+  // threads may share a grammar, so the first of them flattens it
+  const GrammarIter* GetRoot() {
+    if (!flat_) {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (!flat_) {
+        AddPending();
+        Flatten();
+        flat_ = true;
+      }
     }
-    return rb_;
+    return &nodes_[0];
   }
 
-  map<WordID, TextGrammarNode> tree_;
-  TextRuleBin* rb_;
-};
+  void Flatten() {
+    nodes_.clear();
+    child_syms_.clear();
+    rules_.clear();
+    vector<TextGrammarNode*> queue(1, &root_);
+    for (unsigned i = 0; i < queue.size(); ++i) {
+      TextGrammarNode& node = *queue[i];
+      FlatGrammarNode fn;
+      fn.g_ = this;
+      fn.first_child_ = child_syms_.size();
+      for (map<WordID, TextGrammarNode>::iterator it = node.tree_.begin(); it != node.tree_.end(); ++it) {
+        child_syms_.push_back(it->first);
+        queue.push_back(&it->second);
+      }
+      fn.end_child_ = child_syms_.size();
+      fn.first_rule_ = rules_.size();
+      rules_.insert(rules_.end(), node.rules_.begin(), node.rules_.end());
+      fn.end_rule_ = rules_.size();
+      nodes_.push_back(fn);
+    }
+    root_ = TextGrammarNode();
+    store_.DoneAdding();
+    // a new id, so rules expanded before the grammar was unflattened aren't
+    // used
+    id_ = next_grammar_id++;
+    flat_rules_.clear();
+    if (!storing_) {
+      flat_rules_.resize(rules_.size());
+      for (unsigned i = 0; i < rules_.size(); ++i)
+        flat_rules_[i] = MakeRule(rules_[i]);
+    }
+  }
 
-struct TGImpl {
+  TRulePtr MakeRule(uint32_t r) const {
+    return (r & kPINNED) ? pinned_[r & ~kPINNED] : store_.Get(r);
+  }
+
+  // the TRules of node n. Unless all rules are kept as TRules, they are
+  // created when the calling thread first needs them
+  const TRulePtr* Rules(unsigned n) const {
+    const FlatGrammarNode& fn = nodes_[n];
+    if (!storing_) return &flat_rules_[fn.first_rule_];
+    ExpandedRules* cache = expanded_rules.get();
+    if (!cache) {
+      cache = new ExpandedRules;
+      expanded_rules.reset(cache);
+    }
+    vector<TRulePtr>& rules = (*cache)[(static_cast<uint64_t>(id_) << 32) | n];
+    if (rules.empty()) {
+      rules.resize(fn.end_rule_ - fn.first_rule_);
+      for (unsigned i = fn.first_rule_; i < fn.end_rule_; ++i)
+        rules[i - fn.first_rule_] = MakeRule(rules_[i]);
+    }
+    return &rules[0];
+  }
+
+  // rebuilds the map based trie when rules are added after the grammar has
+  // been flattened
+  void Unflatten() {
+    root_ = TextGrammarNode();
+    Unflatten(0, &root_);
+    nodes_.clear();
+    child_syms_.clear();
+    rules_.clear();
+    flat_rules_.clear();
+    flat_ = false;
+  }
+
+  void Unflatten(unsigned n, TextGrammarNode* out) const {
+    const FlatGrammarNode& fn = nodes_[n];
+    out->rules_.assign(rules_.begin() + fn.first_rule_, rules_.begin() + fn.end_rule_);
+    for (unsigned c = fn.first_child_; c < fn.end_child_; ++c)
+      Unflatten(c + 1, &out->tree_[child_syms_[c]]);
+  }
+
+  static const uint32_t kPINNED = 0x80000000u;  // rules_[i] is kPINNED | index into pinned_
+  static const uint32_t kMIN_STORED_RULES = 20000;
+
+  uint32_t id_;  // changes every time the grammar is flattened
   TextGrammarNode root_;
+  vector<FlatGrammarNode> nodes_;
+  vector<WordID> child_syms_;
+  vector<uint32_t> rules_;  // ids in store_ (or pinned_)
+  RuleStore store_;
+  vector<TRulePtr> pinned_;  // rules that are not in store_
+  uint32_t num_rules_;
+  bool use_store_;
+  bool storing_;             // new rules are added to store_
+  TRulePtr pending_;         // the last rule, to be added to pending_node_
+  TextGrammarNode* pending_node_;
+  atomic<bool> flat_;
+  boost::mutex mutex_;
+  vector<TRulePtr> flat_rules_;  // the rules of rules_, unless storing_
 };
 
+const GrammarIter* FlatGrammarNode::Extend(int symbol) const {
+  if (first_child_ == end_child_) return NULL;
+  const WordID* b = &g_->child_syms_[first_child_];
+  const WordID* e = b + (end_child_ - first_child_);
+  const WordID* i = lower_bound(b, e, symbol);
+  if (i == e || *i != symbol) return NULL;
+  return &g_->nodes_[first_child_ + (i - b) + 1];
+}
+
+const TRulePtr* FlatGrammarNode::Rules() const {
+  return g_->Rules(this - &g_->nodes_[0]);
+}
+
+TRulePtr FlatGrammarNode::GetIthRule(int i) const {
+  return Rules()[i];
+}
+
 TextGrammar::TextGrammar() : max_span_(10), pimpl_(new TGImpl) {}
 TextGrammar::TextGrammar(const string& file) :
     max_span_(10),
@@ -91,8 +276,16 @@ TextGrammar::TextGrammar(istream* in) :
   ReadFromStream(in);
 }
 
+void TextGrammar::SetUseRuleStore(bool use) {
+  pimpl_->SetUseRuleStore(use);
+}
+
+void TextGrammar::ReleaseRules() {
+  if (expanded_rules.get()) expanded_rules->clear();
+}
+
 const GrammarIter* TextGrammar::GetRoot() const {
-  return &pimpl_->root_;
+  return pimpl_->GetRoot();
 }
 
 void TextGrammar::AddRule(const TRulePtr& rule, const unsigned int ctf_level, const TRulePtr& coarse_rule) {
@@ -106,12 +299,7 @@ void TextGrammar::AddRule(const TRulePtr& rule, const unsigned int ctf_level, co
     rhs2unaries_[rule->f().front()].push_back(rule);
     unaries_.push_back(rule);
   } else {
-    TextGrammarNode* cur = &pimpl_->root_;
-    for (int i = 0; i < rule->f_.size(); ++i)
-      cur = &cur->tree_[rule->f_[i]];
-    if (cur->rb_ == NULL)
-      cur->rb_ = new TextRuleBin;
-    cur->rb_->AddRule(rule);
+    pimpl_->AddRule(rule);
   }
 }
 
@@ -67,6 +67,15 @@ struct TextGrammar : public Grammar {
   explicit TextGrammar(const std::string& file);
   explicit TextGrammar(std::istream* in);
   void SetMaxSpan(int m) { max_span_ = m; }
+  // if false, the rules are kept as TRules instead of being moved into a
+  // compact RuleStore once the grammar is large. Must be called before any
+  // rules are added; per-sentence grammars don't use the store.
+  void SetUseRuleStore(bool use);
+
+  // frees the rules that the calling thread has expanded from the rule
+  // stores of all text grammars. Rules returned by their RuleBins are
+  // invalid afterwards, so this is called once a sentence is parsed.
+  static void ReleaseRules();
 
   virtual const GrammarIter* GetRoot() const;
   void AddRule(const TRulePtr& rule, const unsigned int ctf_level=0, const TRulePtr& coarse_parent=TRulePtr());
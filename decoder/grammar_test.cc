@@ -5,10 +5,17 @@
 #include <cassert>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "filelib.h"
 #include "trule.h"
 #include "tdict.h"
 #include "grammar.h"
+#include "compiled_grammar.h"
+#include "rule_store.h"
 #include "bottom_up_parser.h"
 #include "hg.h"
 #include "ff.h"
@@ -40,6 +47,85 @@ BOOST_AUTO_TEST_CASE(TestTextGrammar) {
   g.AddRule(r1);
   g.AddRule(r2);
   g.AddRule(r3);
+
+  const GrammarIter* abc = g.GetRoot()->Extend(TD::Convert("a"))->Extend(TD::Convert("b"))->Extend(TD::Convert("c"));
+  BOOST_REQUIRE(abc);
+  BOOST_CHECK_EQUAL(abc->GetRules()->GetNumRules(), 2);
+  BOOST_CHECK_EQUAL(abc->GetRules()->GetIthRule(1)->AsString(), r2->AsString());
+  BOOST_CHECK(abc->GetRules()->GetIthRule(1) == abc->GetRules()->GetIthRule(1));
+  BOOST_CHECK(!g.GetRoot()->Extend(TD::Convert("b")));
+  BOOST_CHECK(!abc->Extend(TD::Convert("e")));
+
+  // rules may still be added once the grammar has been used
+  TRulePtr r4(new TRule("[X] ||| a b ||| A B ||| 0.1 0.2 0.3"));
+  g.AddRule(r4);
+  const GrammarIter* ab = g.GetRoot()->Extend(TD::Convert("a"))->Extend(TD::Convert("b"));
+  BOOST_REQUIRE(ab);
+  BOOST_CHECK_EQUAL(ab->GetRules()->GetNumRules(), 1);
+  BOOST_CHECK_EQUAL(ab->Extend(TD::Convert("c"))->GetRules()->GetNumRules(), 2);
+  BOOST_CHECK_EQUAL(ab->Extend(TD::Convert("c"))->Extend(TD::Convert("d"))->GetRules()->GetNumRules(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestLargeTextGrammar) {
+  // large grammars move their rules into a RuleStore as they are read
+  TextGrammar stored, kept;
+  kept.SetUseRuleStore(false);
+  const int kNUM_RULES = 30000;
+  for (int i = 0; i < kNUM_RULES; ++i) {
+    ostringstream os;
+    os << "[X] ||| w" << i % 100 << " [X,1] v" << i / 100 << " ||| [X,1] u" << i << " ||| 0.5 " << i;
+    TRulePtr r(new TRule(os.str()));
+    stored.AddRule(r);
+    kept.AddRule(r);
+  }
+  TRulePtr last(new TRule("[X] ||| w1 [X,1] v1 ||| [X,1] last ||| 1"));
+  stored.AddRule(last);
+  kept.AddRule(last);
+
+  const WordID x = -TD::Convert("X");
+  for (int i = 0; i < kNUM_RULES; i += 997) {
+    ostringstream w, v;
+    w << "w" << i % 100;
+    v << "v" << i / 100;
+    const GrammarIter* s = stored.GetRoot()->Extend(TD::Convert(w.str()))->Extend(x)->Extend(TD::Convert(v.str()));
+    const GrammarIter* k = kept.GetRoot()->Extend(TD::Convert(w.str()))->Extend(x)->Extend(TD::Convert(v.str()));
+    BOOST_REQUIRE(s && k);
+    BOOST_REQUIRE_EQUAL(s->GetRules()->GetNumRules(), k->GetRules()->GetNumRules());
+    for (int j = 0; j < s->GetRules()->GetNumRules(); ++j)
+      BOOST_CHECK_EQUAL(s->GetRules()->GetIthRule(j)->AsString(), k->GetRules()->GetIthRule(j)->AsString());
+  }
+  const RuleBin* rb = stored.GetRoot()->Extend(TD::Convert("w1"))->Extend(x)->Extend(TD::Convert("v1"))->GetRules();
+  BOOST_CHECK_EQUAL(rb->GetIthRule(rb->GetNumRules() - 1)->AsString(), last->AsString());
+  // a rule that was read last is copied into the store, the kept one is not
+  BOOST_CHECK(rb->GetIthRule(rb->GetNumRules() - 1) != last);
+  const RuleBin* kb = kept.GetRoot()->Extend(TD::Convert("w1"))->Extend(x)->Extend(TD::Convert("v1"))->GetRules();
+  BOOST_CHECK(kb->GetIthRule(kb->GetNumRules() - 1) == last);
+
+  // expanded rules are shared until the thread releases them
+  const TRulePtr first = rb->GetIthRule(0);
+  BOOST_CHECK(rb->GetIthRule(0) == first);
+  TextGrammar::ReleaseRules();
+  rb = stored.GetRoot()->Extend(TD::Convert("w1"))->Extend(x)->Extend(TD::Convert("v1"))->GetRules();
+  BOOST_CHECK(rb->GetIthRule(0) != first);
+  BOOST_CHECK_EQUAL(rb->GetIthRule(0)->AsString(), first->AsString());
+}
+
+BOOST_AUTO_TEST_CASE(TestRuleStore) {
+  RuleStore store;
+  TRulePtr r1(new TRule("[X] ||| a [X,1] c ||| A [X,1] C ||| 0.1 0.2 0.3 ||| 0-0 2-2"));
+  TRulePtr r2(new TRule("[X] ||| a [X,1] c ||| [X,1] B ||| x=0.5"));
+  const uint32_t i1 = store.Add(*r1);
+  const uint32_t i2 = store.Add(*r2);
+  BOOST_CHECK_EQUAL(store.size(), 2);
+  BOOST_CHECK_EQUAL(store.Get(i1)->AsString(), r1->AsString());
+  BOOST_CHECK_EQUAL(store.Get(i2)->AsString(), r2->AsString());
+  BOOST_CHECK(store.Get(i1)->GetFeatureValues() == r1->GetFeatureValues());
+  BOOST_CHECK_EQUAL(store.Get(i1)->Arity(), 1);
+  BOOST_CHECK_EQUAL(store.Get(i1)->als().size(), 2);
+  // the source sides are stored once
+  BOOST_CHECK_EQUAL(store.BytesUsed(), 2 * 32 + (3 + 3 + 2) * sizeof(WordID) + 4 * (sizeof(int) + sizeof(double)) + 2 * sizeof(AlignmentPoint));
+  r2->parent_rule_ = r1;
+  BOOST_CHECK(!RuleStore::CanStore(*r2));
 }
 
 BOOST_AUTO_TEST_CASE(TestTextGrammarFile) {
@@ -57,5 +143,46 @@ BOOST_AUTO_TEST_CASE(TestTextGrammarFile) {
   parser.Parse(lattice, &forest);
   forest.PrintGraphviz();
 }
+BOOST_AUTO_TEST_CASE(TestCompiledGrammar) {
+  std::string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
+  const char* tmpdir = getenv("TMPDIR");
+  std::string compiled = std::string(tmpdir ? tmpdir : "/tmp") + "/grammar_test.XXXXXX";
+  {
+    const int fd = mkstemp(&compiled[0]);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+
+    ReadFile rf(path + "/grammar.prune");
+    CompiledGrammar::Compile(rf.stream(), compiled);
+  }
+  BOOST_CHECK(CompiledGrammar::IsCompiledGrammar(compiled));
+  BOOST_CHECK(!CompiledGrammar::IsCompiledGrammar(path + "/grammar.prune"));
+
+  LatticeArc a(TD::Convert("ein"), SparseVector<double>(), 1);
+  LatticeArc b(TD::Convert("haus"), SparseVector<double>(), 1);
+  Lattice lattice(2);
+  lattice[0].push_back(a);
+  lattice[1].push_back(b);
+  Hypergraph text_forest, compiled_forest;
+  {
+    vector<GrammarPtr> grammars(1, GrammarPtr(new TextGrammar(path + "/grammar.prune")));
+    ExhaustiveBottomUpParser parser("PHRASE", grammars);
+    parser.Parse(lattice, &text_forest);
+  }
+  {
+    vector<GrammarPtr> grammars(1, GrammarPtr(new CompiledGrammar(compiled)));
+    ExhaustiveBottomUpParser parser("PHRASE", grammars);
+    parser.Parse(lattice, &compiled_forest);
+    CompiledGrammar::ReleaseNodes();
+  }
+  remove(compiled.c_str());
+  BOOST_CHECK_EQUAL(text_forest.nodes_.size(), compiled_forest.nodes_.size());
+  BOOST_REQUIRE_EQUAL(text_forest.edges_.size(), compiled_forest.edges_.size());
+  for (unsigned i = 0; i < text_forest.edges_.size(); ++i) {
+    const TRule& r1 = *text_forest.edges_[i].rule_;
+    const TRule& r2 = *compiled_forest.edges_[i].rule_;
+    BOOST_CHECK_EQUAL(r1.AsString(), r2.AsString());
+  }
+}
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -15,6 +15,7 @@ namespace std { using std::tr1::unordered_set; }
 
 #include "viterbi.h"
 #include "inside_outside.h"
+#include "log_inside_outside.h"
 #include "tdict.h"
 #include "verbose.h"
 
@@ -105,17 +106,6 @@ double Hypergraph::NumberOfPaths() const {
   return Inside<double, TransitionCountWeightFunction>(*this);
 }
 
-struct ScaledTransitionEventWeightFunction {
-  typedef SparseVector<prob_t> Result;
-  ScaledTransitionEventWeightFunction(double alpha) : scale_(alpha) {}
-  inline SparseVector<prob_t> operator()(const Hypergraph::Edge& e) const {
-    SparseVector<prob_t> result;
-    result.set_value(e.id_, e.edge_prob_.pow(scale_));
-    return result;
-  }
-  const double scale_;
-};
-
 // safe to reinterpret a vector of these as a vector of prob_t (plain old data)
 struct TropicalValue {
   TropicalValue() : v_() {}
@@ -146,42 +136,59 @@ struct ViterbiWeightFunction {
   }
 };
 
-struct ViterbiTransitionEventWeightFunction {
-  typedef SparseVector<TropicalValue> Result;
-  inline SparseVector<TropicalValue> operator()(const Hypergraph::Edge& e) const {
-    SparseVector<TropicalValue> result;
-    result.set_value(e.id_, TropicalValue(e.edge_prob_));
-    return result;
-  }
-};
-
+// log(edge_prob_^scale) of every edge
+static void LogEdgeWeights(const Hypergraph& hg, double scale, vector<double>* w) {
+  w->resize(hg.edges_.size());
+  for (unsigned i = 0; i < hg.edges_.size(); ++i)
+    (*w)[i] = log(hg.edges_[i].edge_prob_) * scale;
+}
 
-//TODO: both Compute* methods build sparse vectors with size = whole subhypergraph, for every node.  there's no need for that.
+// these used to be computed with InsideOutside() and a sparse vector
+// (indexed by edge) per node as the X semiring; the marginals can be read
+// off the inside and outside scores directly
 prob_t Hypergraph::ComputeEdgePosteriors(double scale, vector<prob_t>* posts) const {
-  const ScaledEdgeProb weight(scale);
-  const ScaledTransitionEventWeightFunction w2(scale);
-  SparseVector<prob_t> pv;
-  const prob_t inside = InsideOutside<prob_t,
-                  ScaledEdgeProb,
-                  SparseVector<prob_t>,
-                  ScaledTransitionEventWeightFunction>(*this, &pv, weight, w2);
+  vector<double> w, m;
+  LogEdgeWeights(*this, scale, &w);
+  const LogInsideOutside io(*this, w);
+  io.EdgeMarginals(&m);
   posts->resize(edges_.size());
   for (unsigned i = 0; i < edges_.size(); ++i)
-    (*posts)[i] = prob_t(pv.value(i));
-  return inside;
+    (*posts)[i] = prob_t::exp(m[i]);
+  return prob_t::exp(io.LogZ());
 }
 
 prob_t Hypergraph::ComputeBestPathThroughEdges(vector<prob_t>* post) const {
-  // I don't like this - explicitly passing around counts of each edge.  It's clever but slow.
-  SparseVector<TropicalValue> pv;
-  const TropicalValue viterbi_weight = InsideOutside<TropicalValue,
-                  ViterbiWeightFunction,
-                  SparseVector<TropicalValue>,
-                  ViterbiTransitionEventWeightFunction>(*this, &pv);
+  vector<double> w, m;
+  LogEdgeWeights(*this, 1.0, &w);
+  const LogInsideOutside io(*this, w, true);
+  io.EdgeMarginals(&m);
   post->resize(edges_.size());
   for (unsigned i = 0; i < edges_.size(); ++i)
-    (*post)[i] = pv.value(i).v_;
-  return viterbi_weight.v_;
+    (*post)[i] = prob_t::exp(m[i]);
+  return prob_t::exp(io.LogZ());
+}
+
+prob_t Hypergraph::ComputeFeatureExpectations(SparseVector<prob_t>* result) const {
+  vector<double> w, m;
+  LogEdgeWeights(*this, 1.0, &w);
+  const LogInsideOutside io(*this, w);
+  result->clear();
+  const double log_z = io.LogZ();
+  if (std::isinf(log_z)) return prob_t::exp(log_z);
+  io.EdgeMarginals(&m);
+  // the posteriors are summed up as doubles and scaled back by Z at the end
+  SparseVector<double> acc;
+  for (unsigned i = 0; i < edges_.size(); ++i) {
+    const double post = exp(m[i] - log_z);
+    if (!post) continue;
+    const SparseVector<double>& fv = edges_[i].feature_values_;
+    for (SparseVector<double>::const_iterator it = fv.begin(); it != fv.end(); ++it)
+      acc.add_value(it->first, it->second * post);
+  }
+  const prob_t z = prob_t::exp(log_z);
+  for (SparseVector<double>::iterator it = acc.begin(); it != acc.end(); ++it)
+    result->set_value(it->first, prob_t(it->second) * z);
+  return z;
 }
 
 void Hypergraph::PushWeightsToSource(double scale) {
@@ -343,14 +350,18 @@ bool Hypergraph::PruneInsideOutside(double alpha,double density,const EdgeMask*
     }
   }
   assert(use_density||use_beam);
-  InsideOutsides<prob_t> io;
-  OutsideNormalize<prob_t> norm;
-  if (use_sum_prod_semiring)
-    io.compute(*this,norm,ScaledEdgeProb(scale));
-  else
-    io.compute(*this,norm,ViterbiWeightFunction());  // the storage gets cast to Tropical from prob_t, scary - e.g. w/ specialized static allocator differences it could break.
-  vector<prob_t> mm;
-  io.compute_edge_marginals(*this,mm,EdgeProb()); // should be normalized to 1 for best edges in viterbi.  in sum, best is less than 1.
+  vector<double> w, lm;
+  LogEdgeWeights(*this, use_sum_prod_semiring ? scale : 1.0, &w);
+  const LogInsideOutside io(*this, w, !use_sum_prod_semiring);
+  if (use_sum_prod_semiring && scale != 1.0)
+    LogEdgeWeights(*this, 1.0, &w);
+  io.EdgeMarginals(w, &lm);
+  // outside scores are normalized by the inside score of the goal, so this
+  // is 1 for the best edges with the viterbi semiring. in sum, best is less
+  // than 1.
+  vector<prob_t> mm(lm.size());
+  for (unsigned i = 0; i < lm.size(); ++i)
+    mm[i] = prob_t::exp(lm[i] - io.LogZ());
 
   prob_t cutoff=prob_t::One(); // we'll destroy everything smaller than this (note: nothing is bigger than 1).  so bigger cutoff = more pruning.
   bool density_won=false;
@@ -401,6 +401,12 @@ public:
   // find the score of the very best path passing through each edge
   prob_t ComputeBestPathThroughEdges(EdgeProbs* posts) const;
 
+  // sets (*feature_expectations)[f] to the sum over edges of the value of f
+  // times the (unnormalized) posterior of the edge, i.e., the same as
+  // InsideOutside<prob_t, EdgeProb, SparseVector<prob_t>,
+  // EdgeFeaturesAndProbWeightFunction>. returns inside prob of goal node
+  prob_t ComputeFeatureExpectations(SparseVector<prob_t>* feature_expectations) const;
+
 
   /* for all of the below subsets, the hg Nodes must be topo sorted already*/
 
@@ -549,11 +555,15 @@ private:
 };
 
 
+class CSRHypergraph;
+
 // common WeightFunctions, map an edge -> WeightType
 // for generic Viterbi/Inside algorithms
+// (the CSRHypergraph versions are defined in hg_csr.h)
 struct EdgeProb {
   typedef prob_t Weight;
   inline const prob_t& operator()(const HG::Edge& e) const { return e.edge_prob_; }
+  inline const prob_t& operator()(const CSRHypergraph& hg, unsigned e) const;
 };
 
 struct EdgeSelectEdgeWeightFunction {
@@ -571,6 +581,7 @@ private:
 struct ScaledEdgeProb {
   ScaledEdgeProb(const double& alpha) : alpha_(alpha) {}
   inline prob_t operator()(const HG::Edge& e) const { return e.edge_prob_.pow(alpha_); }
+  inline prob_t operator()(const CSRHypergraph& hg, unsigned e) const;
   const double alpha_;
   typedef prob_t Weight;
 };
@@ -586,6 +597,7 @@ struct EdgeFeaturesAndProbWeightFunction {
       res.set_value(it->first, prob_t(it->second) * e.edge_prob_);
     return res;
   }
+  inline const Weight operator()(const CSRHypergraph& hg, unsigned e) const;
 };
 
 struct TransitionCountWeightFunction {
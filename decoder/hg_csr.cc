@@ -0,0 +1,97 @@
+#include "hg_csr.h"
+
+#include <boost/unordered_map.hpp>
+
+using namespace std;
+
+void CSRHypergraph::Freeze(const Hypergraph& hg) {
+  const unsigned num_nodes = hg.nodes_.size();
+  unsigned num_edges = 0, num_tails = 0, num_feats = 0;
+  for (unsigned i = 0; i < num_nodes; ++i) {
+    const Hypergraph::EdgesVector& in = hg.nodes_[i].in_edges_;
+    num_edges += in.size();
+    for (unsigned j = 0; j < in.size(); ++j) {
+      num_tails += hg.edges_[in[j]].tail_nodes_.size();
+      num_feats += hg.edges_[in[j]].feature_values_.size();
+    }
+  }
+
+  in_begin_.resize(num_nodes + 1);
+  head_.resize(num_edges);
+  tail_begin_.resize(num_edges + 1);
+  tails_.resize(num_tails);
+  rule_.resize(num_edges);
+  rules_.clear();
+  edge_prob_.resize(num_edges);
+  feat_begin_.resize(num_edges + 1);
+  feat_ids_.resize(num_feats);
+  feat_vals_.resize(num_feats);
+  orig_id_.resize(num_edges);
+
+  boost::unordered_map<const TRule*, uint32_t> rule_index;
+  unsigned e = 0, t = 0, f = 0;
+  for (unsigned i = 0; i < num_nodes; ++i) {
+    in_begin_[i] = e;
+    const Hypergraph::EdgesVector& in = hg.nodes_[i].in_edges_;
+    for (unsigned j = 0; j < in.size(); ++j, ++e) {
+      const HG::Edge& edge = hg.edges_[in[j]];
+      head_[e] = i;
+      tail_begin_[e] = t;
+      for (unsigned k = 0; k < edge.tail_nodes_.size(); ++k)
+        tails_[t++] = edge.tail_nodes_[k];
+      const pair<boost::unordered_map<const TRule*, uint32_t>::iterator, bool> r =
+          rule_index.insert(make_pair(edge.rule_.get(), rules_.size()));
+      if (r.second) rules_.push_back(edge.rule_);
+      rule_[e] = r.first->second;
+      edge_prob_[e] = edge.edge_prob_;
+      feat_begin_[e] = f;
+      for (SparseVector<weight_t>::const_iterator it = edge.feature_values_.begin();
+           it != edge.feature_values_.end(); ++it, ++f) {
+        feat_ids_[f] = it->first;
+        feat_vals_[f] = it->second;
+      }
+      orig_id_[e] = edge.id_;
+    }
+  }
+  in_begin_[num_nodes] = e;
+  tail_begin_[num_edges] = t;
+  feat_begin_[num_edges] = f;
+}
+
+void CSRHypergraph::Reweight(const vector<weight_t>& weights) {
+  for (unsigned e = 0; e < head_.size(); ++e) {
+    weight_t dot = 0;
+    for (unsigned f = feat_begin_[e]; f < feat_begin_[e + 1]; ++f)
+      if (static_cast<unsigned>(feat_ids_[f]) < weights.size())
+        dot += feat_vals_[f] * weights[feat_ids_[f]];
+    edge_prob_[e].logeq(dot);
+  }
+}
+
+void CSRHypergraph::Reweight(const SparseVector<weight_t>& weights) {
+  for (unsigned e = 0; e < head_.size(); ++e) {
+    weight_t dot = 0;
+    for (unsigned f = feat_begin_[e]; f < feat_begin_[e + 1]; ++f)
+      dot += feat_vals_[f] * weights.value(feat_ids_[f]);
+    edge_prob_[e].logeq(dot);
+  }
+}
+
+void CSRHypergraph::AddFeatures(unsigned e, SparseVector<weight_t>* fv) const {
+  for (unsigned f = feat_begin_[e]; f < feat_begin_[e + 1]; ++f)
+    fv->add_value(feat_ids_[f], feat_vals_[f]);
+}
+
+size_t CSRHypergraph::BytesUsed() const {
+  return in_begin_.size() * sizeof(unsigned) +
+         head_.size() * sizeof(int) +
+         tail_begin_.size() * sizeof(unsigned) +
+         tails_.size() * sizeof(int) +
+         rule_.size() * sizeof(uint32_t) +
+         rules_.size() * sizeof(TRulePtr) +
+         edge_prob_.size() * sizeof(prob_t) +
+         feat_begin_.size() * sizeof(unsigned) +
+         feat_ids_.size() * sizeof(int) +
+         feat_vals_.size() * sizeof(weight_t) +
+         orig_id_.size() * sizeof(int);
+}
@@ -0,0 +1,108 @@
+#ifndef HG_CSR_H_
+#define HG_CSR_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include "hg.h"
+
+// A frozen, read-only copy of a Hypergraph in compressed sparse row (CSR)
+// form. Instead of a vector of Edges (each with a shared_ptr to its rule, a
+// SparseVector of features and a vector of tails) and Nodes (each with
+// vectors of in and out edges), the forest is a handful of flat arrays:
+//
+//   * edges are renumbered so that the in-edges of node v are the edges
+//     InBegin(v) .. InEnd(v)-1 (in the order of Node::in_edges_), i.e., edges
+//     are sorted by head node and node v only needs an offset;
+//   * the tail nodes of edge e are Tails(e)[0 .. Arity(e)-1], one contiguous
+//     array for all edges;
+//   * each distinct rule is stored once, edges refer to it by a 32-bit index;
+//   * edge probabilities are one array;
+//   * the features of edge e are FeatureIds(e)[0 .. NumFeatures(e)-1] and
+//     FeatureValues(e)[...], again one array for all edges.
+//
+// Nodes keep their positions (so the goal is still the last node), and
+// edges that are not the in-edge of any node are dropped. OriginalEdge(e)
+// is the id_ of edge e in the Hypergraph it was frozen from.
+//
+// Inside and Outside (inside_outside.h), Viterbi (viterbi.h) and
+// KBest::KBestDerivations (kbest.h, with Graph = CSRHypergraph) run on
+// CSRHypergraphs. Their weight functions and traversals are called with
+// (hg, edge) instead of an HG::Edge; EdgeProb, ScaledEdgeProb,
+// EdgeFeaturesAndProbWeightFunction and the traversals in viterbi.h support
+// both.
+class CSRHypergraph {
+ public:
+  CSRHypergraph() {}
+  explicit CSRHypergraph(const Hypergraph& hg) { Freeze(hg); }
+
+  // (re)builds this from hg
+  void Freeze(const Hypergraph& hg);
+
+  // recomputes the edge probabilities, like Hypergraph::Reweight
+  void Reweight(const std::vector<weight_t>& weights);
+  void Reweight(const SparseVector<weight_t>& weights);
+
+  unsigned NumNodes() const { return in_begin_.empty() ? 0 : in_begin_.size() - 1; }
+  unsigned NumEdges() const { return head_.size(); }
+  unsigned NumRules() const { return rules_.size(); }
+
+  unsigned InBegin(unsigned node) const { return in_begin_[node]; }
+  unsigned InEnd(unsigned node) const { return in_begin_[node + 1]; }
+  unsigned NumInEdges(unsigned node) const { return in_begin_[node + 1] - in_begin_[node]; }
+
+  int Head(unsigned e) const { return head_[e]; }
+  unsigned Arity(unsigned e) const { return tail_begin_[e + 1] - tail_begin_[e]; }
+  const int* Tails(unsigned e) const { return tails_.data() + tail_begin_[e]; }
+  int Tail(unsigned e, unsigned i) const { return tails_[tail_begin_[e] + i]; }
+
+  uint32_t RuleIndex(unsigned e) const { return rule_[e]; }
+  const TRulePtr& Rule(unsigned e) const { return rules_[rule_[e]]; }
+  const TRulePtr& RuleAt(uint32_t rule_index) const { return rules_[rule_index]; }
+
+  const prob_t& EdgeProb(unsigned e) const { return edge_prob_[e]; }
+
+  unsigned NumFeatures(unsigned e) const { return feat_begin_[e + 1] - feat_begin_[e]; }
+  const int* FeatureIds(unsigned e) const { return feat_ids_.data() + feat_begin_[e]; }
+  const weight_t* FeatureValues(unsigned e) const { return feat_vals_.data() + feat_begin_[e]; }
+  // adds the features of edge e to *fv
+  void AddFeatures(unsigned e, SparseVector<weight_t>* fv) const;
+
+  int OriginalEdge(unsigned e) const { return orig_id_[e]; }
+
+  // bytes used by the arrays (not counting the rules themselves)
+  size_t BytesUsed() const;
+
+ private:
+  std::vector<unsigned> in_begin_;    // NumNodes()+1 offsets into the edges
+  std::vector<int> head_;
+  std::vector<unsigned> tail_begin_;  // NumEdges()+1 offsets into tails_
+  std::vector<int> tails_;
+  std::vector<uint32_t> rule_;        // index into rules_
+  std::vector<TRulePtr> rules_;
+  std::vector<prob_t> edge_prob_;
+  std::vector<unsigned> feat_begin_;  // NumEdges()+1 offsets into feat_*
+  std::vector<int> feat_ids_;
+  std::vector<weight_t> feat_vals_;
+  std::vector<int> orig_id_;
+};
+
+inline const prob_t& EdgeProb::operator()(const CSRHypergraph& hg, unsigned e) const {
+  return hg.EdgeProb(e);
+}
+
+inline prob_t ScaledEdgeProb::operator()(const CSRHypergraph& hg, unsigned e) const {
+  return hg.EdgeProb(e).pow(alpha_);
+}
+
+inline const EdgeFeaturesAndProbWeightFunction::Weight
+EdgeFeaturesAndProbWeightFunction::operator()(const CSRHypergraph& hg, unsigned e) const {
+  SparseVector<prob_t> res;
+  const int* ids = hg.FeatureIds(e);
+  const weight_t* vals = hg.FeatureValues(e);
+  for (unsigned i = 0; i < hg.NumFeatures(e); ++i)
+    res.set_value(ids[i], prob_t(vals[i]) * hg.EdgeProb(e));
+  return res;
+}
+
+#endif
@@ -1,7 +1,14 @@
 #include "hg_io.h"
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -9,25 +16,356 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 
 #include "fast_lexical_cast.hpp"
 
+#include "fdict.h"
+#include "filelib.h"
 #include "tdict.h"
 #include "hg.h"
 
 using namespace std;
 
-bool HypergraphIO::ReadFromBinary(istream* in, Hypergraph* hg) {
-  boost::archive::binary_iarchive oa(*in);
+// Binary forest format (written by WriteToBinary). A fixed size header is
+// followed by a body of varints (LEB128; signed values are zigzag coded)
+// and doubles (8 bytes, native byte order):
+//   symbols    num_symbols strings (varint length + bytes): the words and
+//              categories used by the forest, referred to by index + 1
+//   features   num_features strings: feature names, referred to by index
+//   rules      num_rules rules, each stored once however many edges use it:
+//              lhs, arity, |f|, f (+symbol, or -symbol for nonterminals),
+//              |e|, e (+symbol, or the variable index <= 0), scores
+//   nodes      node_hash (8 bytes), id, category (0 = none), in-edges,
+//              out-edges
+//   edges      head, tails (zigzag of head - tail, small in topologically
+//              sorted forests), rule (0 = none), features, i, j, prev_i,
+//              prev_j, id
+// Feature blocks are a count followed by (feature index, double) pairs.
+// Symbols and features are converted to TD/FD ids once per file, not once
+// per use. Forests in the format of earlier versions (boost::serialization
+// archives) are still read.
+namespace {
+
+const char kFOREST_MAGIC[8] = { 'c', 'd', 'e', 'c', 'F', 'R', 'S', 'T' };
+const uint32_t kFOREST_VERSION = 1;
+
+struct ForestHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t num_symbols;
+  uint32_t num_features;
+  uint32_t num_rules;
+  uint32_t num_nodes;
+  uint32_t num_edges;
+  uint32_t reserved;
+  uint64_t body_size;
+};
+
+enum { kEDGES_TOPO = 1, kLINEAR_CHAIN = 2 };
+
+struct ForestEncoder {
+  void Varint(uint64_t x) {
+    while (x >= 0x80) {
+      body.push_back(static_cast<char>(x | 0x80));
+      x >>= 7;
+    }
+    body.push_back(static_cast<char>(x));
+  }
+  void Signed(int64_t x) { Varint((static_cast<uint64_t>(x) << 1) ^ static_cast<uint64_t>(x >> 63)); }
+  void Raw(const void* p, size_t n) { body.append(static_cast<const char*>(p), n); }
+  void String(const string& str) {
+    Varint(str.size());
+    body.append(str);
+  }
+
+  // index + 1 of w in symbols
+  uint32_t Symbol(WordID w) {
+    pair<boost::unordered_map<WordID, uint32_t>::iterator, bool> r =
+        symbol_index.insert(make_pair(w, symbols.size() + 1));
+    if (r.second) symbols.push_back(w);
+    return r.first->second;
+  }
+  uint32_t Feature(int fid) {
+    pair<boost::unordered_map<int, uint32_t>::iterator, bool> r =
+        feature_index.insert(make_pair(fid, features.size()));
+    if (r.second) features.push_back(fid);
+    return r.first->second;
+  }
+  // features are numbered by tables, which holds the shared feature table
+  void Features(const SparseVector<double>& fv, ForestEncoder* tables) {
+    unsigned n = 0;
+    for (SparseVector<double>::const_iterator it = fv.begin(); it != fv.end(); ++it)
+      if (it->first) ++n;  // 0 is not a feature
+    Varint(n);
+    for (SparseVector<double>::const_iterator it = fv.begin(); it != fv.end(); ++it) {
+      if (!it->first) continue;
+      Varint(tables->Feature(it->first));
+      Raw(&it->second, sizeof(double));
+    }
+  }
+
+  string body;
+  vector<WordID> symbols;
+  vector<int> features;
+  boost::unordered_map<WordID, uint32_t> symbol_index;
+  boost::unordered_map<int, uint32_t> feature_index;
+};
+
+struct ForestDecoder {
+  ForestDecoder(const char* b, const char* e) : p(b), end(e), ok(true) {}
+  uint64_t Varint() {
+    uint64_t x = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (p == end) { ok = false; return 0; }
+      const unsigned char c = *p++;
+      x |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if (!(c & 0x80)) return x;
+    }
+    ok = false;
+    return 0;
+  }
+  int64_t Signed() {
+    const uint64_t x = Varint();
+    return static_cast<int64_t>(x >> 1) ^ -static_cast<int64_t>(x & 1);
+  }
+  double Double() {
+    double d = 0;
+    if (end - p < static_cast<ptrdiff_t>(sizeof(double))) { ok = false; return d; }
+    memcpy(&d, p, sizeof(double));
+    p += sizeof(double);
+    return d;
+  }
+  void String(string* str) {
+    const uint64_t n = Varint();
+    if (static_cast<uint64_t>(end - p) < n) { ok = false; return; }
+    str->assign(p, n);
+    p += n;
+  }
+  WordID Symbol(uint64_t i) {
+    if (i == 0 || i > symbols.size()) { ok = false; return 0; }
+    return symbols[i - 1];
+  }
+  void Features(SparseVector<double>* fv) {
+    fv->clear();
+    const uint64_t n = Varint();
+    for (uint64_t i = 0; i < n && ok; ++i) {
+      const uint64_t f = Varint();
+      const double v = Double();
+      if (f >= features.size()) { ok = false; return; }
+      fv->set_value(features[f], v);
+    }
+  }
+
+  const char* p;
+  const char* end;
+  bool ok;
+  vector<WordID> symbols;
+  vector<int> features;
+};
+
+bool ReadForest(const char* data, size_t size, Hypergraph* hg) {
+  ForestHeader h;
+  if (size < sizeof(h)) return false;
+  memcpy(&h, data, sizeof(h));
+  if (h.version != kFOREST_VERSION) {
+    cerr << "Forest has version " << h.version << ", expected " << kFOREST_VERSION << endl;
+    return false;
+  }
+  if (size - sizeof(h) < h.body_size) return false;
+  ForestDecoder d(data + sizeof(h), data + sizeof(h) + h.body_size);
+  string str;
+  d.symbols.resize(h.num_symbols);
+  for (unsigned i = 0; i < h.num_symbols && d.ok; ++i) {
+    d.String(&str);
+    d.symbols[i] = TD::Convert(str);
+  }
+  d.features.resize(h.num_features);
+  for (unsigned i = 0; i < h.num_features && d.ok; ++i) {
+    d.String(&str);
+    d.features[i] = FD::Convert(str);
+  }
+  vector<TRulePtr> rules(h.num_rules);
+  for (unsigned i = 0; i < h.num_rules && d.ok; ++i) {
+    TRule* rule = new TRule;
+    rules[i].reset(rule);
+    rule->lhs_ = -d.Symbol(d.Varint());
+    rule->arity_ = d.Varint();
+    rule->f_.resize(d.Varint());
+    for (unsigned j = 0; j < rule->f_.size() && d.ok; ++j) {
+      const int64_t x = d.Signed();
+      rule->f_[j] = x < 0 ? -d.Symbol(-x) : d.Symbol(x);
+    }
+    rule->e_.resize(d.Varint());
+    for (unsigned j = 0; j < rule->e_.size() && d.ok; ++j) {
+      const int64_t x = d.Signed();
+      rule->e_[j] = x <= 0 ? x : d.Symbol(x);
+    }
+    d.Features(&rule->scores_);
+  }
   hg->clear();
-  oa >> *hg;
+  hg->nodes_.resize(h.num_nodes);
+  for (unsigned i = 0; i < h.num_nodes && d.ok; ++i) {
+    HG::Node& node = hg->nodes_[i];
+    uint64_t node_hash = 0;
+    if (d.end - d.p < static_cast<ptrdiff_t>(sizeof(node_hash))) return false;
+    memcpy(&node_hash, d.p, sizeof(node_hash));
+    d.p += sizeof(node_hash);
+    node.node_hash = node_hash;
+    node.id_ = d.Varint();
+    const uint64_t cat = d.Varint();
+    node.cat_ = cat ? -d.Symbol(cat) : 0;
+    node.in_edges_.resize(d.Varint());
+    for (unsigned j = 0; j < node.in_edges_.size() && d.ok; ++j)
+      node.in_edges_[j] = d.Varint();
+    node.out_edges_.resize(d.Varint());
+    for (unsigned j = 0; j < node.out_edges_.size() && d.ok; ++j)
+      node.out_edges_[j] = d.Varint();
+  }
+  hg->edges_.resize(h.num_edges);
+  for (unsigned i = 0; i < h.num_edges && d.ok; ++i) {
+    HG::Edge& edge = hg->edges_[i];
+    edge.head_node_ = d.Varint();
+    edge.tail_nodes_.resize(d.Varint());
+    for (unsigned j = 0; j < edge.tail_nodes_.size() && d.ok; ++j)
+      edge.tail_nodes_[j] = edge.head_node_ - d.Signed();
+    const uint64_t r = d.Varint();
+    if (r > rules.size()) return false;
+    if (r) edge.rule_ = rules[r - 1];
+    d.Features(&edge.feature_values_);
+    edge.i_ = d.Signed();
+    edge.j_ = d.Signed();
+    edge.prev_i_ = d.Signed();
+    edge.prev_j_ = d.Signed();
+    edge.id_ = d.Varint();
+  }
+  if (!d.ok) return false;
+  hg->edges_topo_ = h.flags & kEDGES_TOPO;
+  hg->is_linear_chain_ = h.flags & kLINEAR_CHAIN;
   return true;
 }
 
+}
+
+bool HypergraphIO::ReadFromBinary(istream* in, Hypergraph* hg) {
+  if (in->peek() != kFOREST_MAGIC[0]) {
+    // boost::serialization archive (which start with the length of a string)
+    boost::archive::binary_iarchive oa(*in);
+    hg->clear();
+    oa >> *hg;
+    return true;
+  }
+  ForestHeader h;
+  if (!in->read(reinterpret_cast<char*>(&h), sizeof(h)) ||
+      memcmp(h.magic, kFOREST_MAGIC, sizeof(kFOREST_MAGIC)) != 0)
+    return false;
+  vector<char> buf(sizeof(h) + h.body_size);
+  memcpy(&buf[0], &h, sizeof(h));
+  if (h.body_size && !in->read(&buf[sizeof(h)], h.body_size))
+    return false;
+  return ReadForest(&buf[0], buf.size(), hg);
+}
+
+bool HypergraphIO::ReadFromFile(const string& fname, Hypergraph* hg) {
+  const bool gzipped = fname.size() > 3 && fname.compare(fname.size() - 3, 3, ".gz") == 0;
+  if (fname != "-" && !gzipped) {
+    const int fd = open(fname.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(ForestHeader)) {
+      void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (data != MAP_FAILED) {
+        bool res = false;
+        const bool is_forest = memcmp(data, kFOREST_MAGIC, sizeof(kFOREST_MAGIC)) == 0;
+        if (is_forest)
+          res = ReadForest(static_cast<const char*>(data), st.st_size, hg);
+        munmap(data, st.st_size);
+        if (is_forest) return res;
+      }
+    } else if (fd >= 0) {
+      close(fd);
+    }
+  }
+  ReadFile rf(fname);
+  return ReadFromBinary(rf.stream(), hg);
+}
+
 bool HypergraphIO::WriteToBinary(const Hypergraph& hg, ostream* out) {
-  boost::archive::binary_oarchive oa(*out);
-  oa << hg;
-  return true;
+  ForestEncoder enc;  // symbol and feature tables
+  boost::unordered_map<const TRule*, uint32_t> rule_index;
+  vector<const TRule*> rules;
+  // rules and symbols are numbered in the order they are first used, but
+  // written before the nodes and edges, so those are encoded first
+  ForestEncoder graph;
+  for (unsigned i = 0; i < hg.nodes_.size(); ++i) {
+    const HG::Node& node = hg.nodes_[i];
+    const uint64_t node_hash = node.node_hash;
+    graph.Raw(&node_hash, sizeof(node_hash));
+    graph.Varint(node.id_);
+    graph.Varint(node.cat_ ? enc.Symbol(-node.cat_) : 0);
+    graph.Varint(node.in_edges_.size());
+    for (unsigned j = 0; j < node.in_edges_.size(); ++j)
+      graph.Varint(node.in_edges_[j]);
+    graph.Varint(node.out_edges_.size());
+    for (unsigned j = 0; j < node.out_edges_.size(); ++j)
+      graph.Varint(node.out_edges_[j]);
+  }
+  for (unsigned i = 0; i < hg.edges_.size(); ++i) {
+    const HG::Edge& edge = hg.edges_[i];
+    graph.Varint(edge.head_node_);
+    graph.Varint(edge.tail_nodes_.size());
+    for (unsigned j = 0; j < edge.tail_nodes_.size(); ++j)
+      graph.Signed(static_cast<int64_t>(edge.head_node_) - edge.tail_nodes_[j]);
+    uint32_t r = 0;
+    if (edge.rule_) {
+      pair<boost::unordered_map<const TRule*, uint32_t>::iterator, bool> ins =
+          rule_index.insert(make_pair(edge.rule_.get(), rules.size() + 1));
+      if (ins.second) rules.push_back(edge.rule_.get());
+      r = ins.first->second;
+    }
+    graph.Varint(r);
+    graph.Features(edge.feature_values_, &enc);
+    graph.Signed(edge.i_);
+    graph.Signed(edge.j_);
+    graph.Signed(edge.prev_i_);
+    graph.Signed(edge.prev_j_);
+    graph.Varint(edge.id_);
+  }
+  ForestEncoder rule_enc;
+  for (unsigned i = 0; i < rules.size(); ++i) {
+    const TRule& rule = *rules[i];
+    rule_enc.Varint(enc.Symbol(-rule.lhs_));
+    rule_enc.Varint(rule.arity_);
+    rule_enc.Varint(rule.f_.size());
+    for (unsigned j = 0; j < rule.f_.size(); ++j)
+      rule_enc.Signed(rule.f_[j] <= 0 ? -static_cast<int64_t>(enc.Symbol(-rule.f_[j])) : enc.Symbol(rule.f_[j]));
+    rule_enc.Varint(rule.e_.size());
+    for (unsigned j = 0; j < rule.e_.size(); ++j)
+      rule_enc.Signed(rule.e_[j] <= 0 ? static_cast<int64_t>(rule.e_[j]) : enc.Symbol(rule.e_[j]));
+    rule_enc.Features(rule.scores_, &enc);
+  }
+  for (unsigned i = 0; i < enc.symbols.size(); ++i)
+    enc.String(TD::Convert(enc.symbols[i]));
+  for (unsigned i = 0; i < enc.features.size(); ++i)
+    enc.String(FD::Convert(enc.features[i]));
+
+  ForestHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kFOREST_MAGIC, sizeof(kFOREST_MAGIC));
+  h.version = kFOREST_VERSION;
+  h.flags = (hg.edges_topo_ ? kEDGES_TOPO : 0) | (hg.is_linear_chain_ ? kLINEAR_CHAIN : 0);
+  h.num_symbols = enc.symbols.size();
+  h.num_features = enc.features.size();
+  h.num_rules = rules.size();
+  h.num_nodes = hg.nodes_.size();
+  h.num_edges = hg.edges_.size();
+  h.body_size = enc.body.size() + rule_enc.body.size() + graph.body.size();
+  out->write(reinterpret_cast<const char*>(&h), sizeof(h));
+  out->write(enc.body.data(), enc.body.size());
+  out->write(rule_enc.body.data(), rule_enc.body.size());
+  out->write(graph.body.data(), graph.body.size());
+  return static_cast<bool>(*out);
 }
 
 bool needs_escape[128];
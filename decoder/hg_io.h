@@ -9,8 +9,13 @@ class Hypergraph;
 
 struct HypergraphIO {
 
+  // binary forests (see hg_io.cc for the format); ReadFromBinary also reads
+  // forests written with boost::serialization by earlier versions
   static bool ReadFromBinary(std::istream* in, Hypergraph* out);
   static bool WriteToBinary(const Hypergraph& hg, std::ostream* out);
+  // reads a binary forest from fname; uncompressed files are mmapped and
+  // decoded in place instead of being copied through a stream
+  static bool ReadFromFile(const std::string& fname, Hypergraph* out);
 
   // if remove_rules is used, the hypergraph is serialized without rule information
   // (so it only contains structure and feature information)
@@ -9,11 +9,13 @@
 #include <iostream>
 #include "tdict.h"
 
+#include "hg_csr.h"
 #include "hg_intersect.h"
 #include "hg_union.h"
 #include "viterbi.h"
 #include "kbest.h"
 #include "inside_outside.h"
+#include "log_inside_outside.h"
 
 #include "hg_test.h"
 
@@ -131,6 +133,45 @@ BOOST_AUTO_TEST_CASE(ControlledKBest) {
 }
 
 
+BOOST_AUTO_TEST_CASE(EYieldKBest) {
+  std::string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
+  Hypergraph hg;
+  CreateSmallHG(&hg, path);
+  SparseVector<double> wts;
+  wts.set_value(FD::Convert("Model_0"), -2.0);
+  wts.set_value(FD::Convert("Model_1"), -0.5);
+  wts.set_value(FD::Convert("Model_2"), -1.1);
+  wts.set_value(FD::Convert("Model_3"), -1.0);
+  wts.set_value(FD::Convert("Model_4"), -1.0);
+  wts.set_value(FD::Convert("Model_5"), 0.5);
+  wts.set_value(FD::Convert("Model_6"), 0.2);
+  wts.set_value(FD::Convert("Model_7"), -3.0);
+  hg.Reweight(wts);
+
+  typedef KBest::KBestDerivations<vector<WordID>, ESentenceTraversal, KBest::FilterUnique> K;
+  typedef KBest::KBestDerivations<KBest::EYield, KBest::EYieldTraversal, KBest::FilterUniqueEYield> EK;
+  K kbest(hg, 50);
+  EK ekbest(hg, 50, KBest::EYieldTraversal(), EdgeProb(), false);
+  vector<WordID> words;
+  SparseVector<double> fv;
+  int n = 0;
+  for (int i = 0; i < 50; ++i) {
+    const K::Derivation* d = kbest.LazyKthBest(hg.nodes_.size() - 1, i);
+    const EK::Derivation* ed = ekbest.LazyKthBest(hg.nodes_.size() - 1, i);
+    BOOST_CHECK_EQUAL(d == NULL, ed == NULL);
+    if (!d || !ed) break;
+    ++n;
+    ed->yield.Words(&words);
+    BOOST_CHECK_EQUAL(TD::GetString(d->yield), TD::GetString(words));
+    BOOST_CHECK_EQUAL(d->yield.size(), ed->yield.size());
+    BOOST_CHECK_CLOSE(log(d->score), log(ed->score), 1e-4);
+    BOOST_CHECK(ed->feature_values.empty());
+    ekbest.FeatureValues(*ed, &fv);
+    BOOST_CHECK_CLOSE(d->feature_values.dot(wts), fv.dot(wts), 1e-4);
+  }
+  BOOST_CHECK(n > 1);
+}
+
 BOOST_AUTO_TEST_CASE(InsideScore) {
   std::string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
   SparseVector<double> wts;
@@ -375,6 +416,111 @@ BOOST_AUTO_TEST_CASE(TestAddExpectations) {
   cerr << "Z=" << z << endl;
 }
 
+BOOST_AUTO_TEST_CASE(TestLogInsideOutside) {
+  std::string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
+  Hypergraph hg;
+  CreateHG(path, &hg);
+  SparseVector<double> wts;
+  wts.set_value(FD::Convert("f1"), 0.4);
+  wts.set_value(FD::Convert("f2"), 0.8);
+  hg.Reweight(wts);
+  vector<prob_t> inside, outside;
+  const prob_t ins = Inside<prob_t, EdgeProb>(hg, &inside);
+  Outside<prob_t, EdgeProb>(hg, inside, &outside);
+  vector<double> lw(hg.edges_.size());
+  for (unsigned i = 0; i < lw.size(); ++i)
+    lw[i] = log(hg.edges_[i].edge_prob_);
+  LogInsideOutside io(hg, lw);
+  BOOST_CHECK_CLOSE(log(ins), io.LogZ(), 1e-4);
+  for (unsigned i = 0; i < hg.nodes_.size(); ++i) {
+    BOOST_CHECK_CLOSE(log(inside[i]), io.Inside()[i], 1e-4);
+    BOOST_CHECK_CLOSE(log(outside[i]), io.Outside()[i], 1e-4);
+  }
+
+  // edge posteriors sum to Z over the in-edges of the goal
+  vector<prob_t> posts;
+  const prob_t z = hg.ComputeEdgePosteriors(1.0, &posts);
+  BOOST_CHECK_CLOSE(log(ins), log(z), 1e-4);
+  prob_t goal_sum = prob_t::Zero();
+  for (unsigned i = 0; i < hg.nodes_.back().in_edges_.size(); ++i)
+    goal_sum += posts[hg.nodes_.back().in_edges_[i]];
+  BOOST_CHECK_CLOSE(log(z), log(goal_sum), 1e-4);
+
+  // the best path through every edge is at most as good as the viterbi path
+  vector<prob_t> best;
+  const prob_t vit = hg.ComputeBestPathThroughEdges(&best);
+  vector<WordID> trans;
+  BOOST_CHECK_CLOSE(log(ViterbiESentence(hg, &trans)), log(vit), 1e-4);
+  for (unsigned i = 0; i < best.size(); ++i)
+    BOOST_CHECK(best[i] <= vit * prob_t(1.0 + 1e-9));
+
+  SparseVector<prob_t> feat_exps, feat_exps2;
+  const prob_t z2 = InsideOutside<prob_t, EdgeProb,
+                  SparseVector<prob_t>, EdgeFeaturesAndProbWeightFunction>(hg, &feat_exps);
+  const prob_t z3 = hg.ComputeFeatureExpectations(&feat_exps2);
+  BOOST_CHECK_CLOSE(log(z2), log(z3), 1e-4);
+  BOOST_CHECK_CLOSE(feat_exps.value(FD::Convert("f1")).as_float(), feat_exps2.value(FD::Convert("f1")).as_float(), 1e-4);
+  BOOST_CHECK_CLOSE(feat_exps.value(FD::Convert("f2")).as_float(), feat_exps2.value(FD::Convert("f2")).as_float(), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TestCSRHypergraph) {
+  std::string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
+  Hypergraph hg;
+  CreateHG(path, &hg);
+  SparseVector<double> wts;
+  wts.set_value(FD::Convert("f1"), 0.4);
+  wts.set_value(FD::Convert("f2"), 0.8);
+  hg.Reweight(wts);
+  CSRHypergraph csr(hg);
+  BOOST_CHECK_EQUAL(hg.nodes_.size(), csr.NumNodes());
+  BOOST_CHECK_EQUAL(hg.edges_.size(), csr.NumEdges());
+  for (unsigned e = 0; e < csr.NumEdges(); ++e) {
+    const HG::Edge& edge = hg.edges_[csr.OriginalEdge(e)];
+    BOOST_CHECK_EQUAL(edge.head_node_, csr.Head(e));
+    BOOST_CHECK_EQUAL(edge.Arity(), csr.Arity(e));
+    BOOST_CHECK(edge.rule_ == csr.Rule(e));
+    SparseVector<double> fv;
+    csr.AddFeatures(e, &fv);
+    BOOST_CHECK(edge.feature_values_ == fv);
+  }
+
+  vector<prob_t> inside, csr_inside, outside, csr_outside;
+  const prob_t z = Inside<prob_t, EdgeProb>(hg, &inside);
+  BOOST_CHECK_CLOSE(log(z), log(Inside<prob_t, EdgeProb>(csr, &csr_inside)), 1e-4);
+  Outside<prob_t, EdgeProb>(hg, inside, &outside);
+  Outside<prob_t, EdgeProb>(csr, csr_inside, &csr_outside);
+  for (unsigned i = 0; i < hg.nodes_.size(); ++i) {
+    BOOST_CHECK_CLOSE(log(inside[i]), log(csr_inside[i]), 1e-4);
+    BOOST_CHECK_CLOSE(log(outside[i]), log(csr_outside[i]), 1e-4);
+  }
+
+  SparseVector<prob_t> feat_exps, csr_feat_exps;
+  InsideOutside<prob_t, EdgeProb, SparseVector<prob_t>, EdgeFeaturesAndProbWeightFunction>(hg, &feat_exps);
+  InsideOutside<prob_t, EdgeProb, SparseVector<prob_t>, EdgeFeaturesAndProbWeightFunction>(csr, &csr_feat_exps);
+  BOOST_CHECK_CLOSE(feat_exps.value(FD::Convert("f1")).as_float(), csr_feat_exps.value(FD::Convert("f1")).as_float(), 1e-4);
+  BOOST_CHECK_CLOSE(feat_exps.value(FD::Convert("f2")).as_float(), csr_feat_exps.value(FD::Convert("f2")).as_float(), 1e-4);
+
+  vector<WordID> trans, csr_trans;
+  const prob_t vit = ViterbiESentence(hg, &trans);
+  BOOST_CHECK_CLOSE(log(vit), log(Viterbi<ESentenceTraversal>(csr, &csr_trans)), 1e-4);
+  BOOST_CHECK_EQUAL(TD::GetString(trans), TD::GetString(csr_trans));
+
+  typedef KBest::KBestDerivations<vector<WordID>, ESentenceTraversal> K;
+  typedef KBest::KBestDerivations<vector<WordID>, ESentenceTraversal, KBest::NoFilter<vector<WordID> >,
+                                  prob_t, EdgeProb, CSRHypergraph> CSRK;
+  K kbest(hg, 10);
+  CSRK csr_kbest(csr, 10);
+  for (int i = 0; i < 10; ++i) {
+    const K::Derivation* d = kbest.LazyKthBest(hg.nodes_.size() - 1, i);
+    const CSRK::Derivation* csr_d = csr_kbest.LazyKthBest(csr.NumNodes() - 1, i);
+    BOOST_CHECK_EQUAL(d == NULL, csr_d == NULL);
+    if (!d || !csr_d) break;
+    BOOST_CHECK_CLOSE(log(d->score), log(csr_d->score), 1e-4);
+    BOOST_CHECK_EQUAL(TD::GetString(d->yield), TD::GetString(csr_d->yield));
+    BOOST_CHECK_EQUAL(d->feature_values, csr_d->feature_values);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(Small) {
   std::string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
   Hypergraph hg;
@@ -446,4 +592,44 @@ BOOST_AUTO_TEST_CASE(TestReadWriteHG_Boost) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestReadWriteHG_Binary) {
+  std::string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
+  Hypergraph hg;
+  Hypergraph hg2;
+  CreateHG(path, &hg);
+  hg.edges_.front().j_ = 23;
+  hg.edges_.back().prev_i_ = 99;
+  SparseVector<double> wts;
+  wts.set_value(FD::Convert("f1"), 0.4);
+  wts.set_value(FD::Convert("f2"), 0.8);
+  hg.Reweight(wts);
+  ostringstream os;
+  BOOST_CHECK(HypergraphIO::WriteToBinary(hg, &os));
+  istringstream is(os.str());
+  BOOST_CHECK(HypergraphIO::ReadFromBinary(&is, &hg2));
+  BOOST_CHECK_EQUAL(hg2.nodes_.size(), hg.nodes_.size());
+  BOOST_CHECK_EQUAL(hg2.edges_.size(), hg.edges_.size());
+  for (unsigned i = 0; i < hg.nodes_.size(); ++i) {
+    BOOST_CHECK_EQUAL(hg2.nodes_[i].cat_, hg.nodes_[i].cat_);
+    BOOST_CHECK(hg2.nodes_[i].in_edges_ == hg.nodes_[i].in_edges_);
+    BOOST_CHECK(hg2.nodes_[i].out_edges_ == hg.nodes_[i].out_edges_);
+  }
+  for (unsigned i = 0; i < hg.edges_.size(); ++i) {
+    const HG::Edge& a = hg.edges_[i];
+    const HG::Edge& b = hg2.edges_[i];
+    BOOST_CHECK_EQUAL(b.head_node_, a.head_node_);
+    BOOST_CHECK(b.tail_nodes_ == a.tail_nodes_);
+    BOOST_CHECK(b.feature_values_ == a.feature_values_);
+    BOOST_CHECK_EQUAL(b.rule_->AsString(), a.rule_->AsString());
+  }
+  BOOST_CHECK_EQUAL(hg2.edges_.front().j_, 23);
+  BOOST_CHECK_EQUAL(hg2.edges_.back().prev_i_, 99);
+  hg2.Reweight(wts);
+  vector<WordID> trans, trans2;
+  const prob_t p = ViterbiESentence(hg, &trans);
+  const prob_t p2 = ViterbiESentence(hg2, &trans2);
+  BOOST_CHECK_CLOSE(log(p), log(p2), 1e-9);
+  BOOST_CHECK_EQUAL(TD::GetString(trans), TD::GetString(trans2));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 #include <vector>
 #include <algorithm>
 #include "hg.h"
+#include "hg_csr.h"
 
 // semiring for Inside/Outside
 struct Boolean {
@@ -94,6 +95,62 @@ void Outside(const Hypergraph& hg,
   }
 }
 
+// the same for the frozen form; the weight function is called with (hg, edge)
+template<class WeightType, class WeightFunction>
+WeightType Inside(const CSRHypergraph& hg,
+                  std::vector<WeightType>* result = NULL,
+                  const WeightFunction& weight = WeightFunction()) {
+  const unsigned num_nodes = hg.NumNodes();
+  std::vector<WeightType> dummy;
+  std::vector<WeightType>& inside_score = result ? *result : dummy;
+  inside_score.clear();
+  inside_score.resize(num_nodes);
+  for (unsigned i = 0; i < num_nodes; ++i) {
+    WeightType* const cur_node_inside_score = &inside_score[i];
+    for (unsigned e = hg.InBegin(i); e < hg.InEnd(i); ++e) {
+      WeightType score = weight(hg, e);
+      const int* tails = hg.Tails(e);
+      for (unsigned k = 0; k < hg.Arity(e); ++k)
+        score *= inside_score[tails[k]];
+      *cur_node_inside_score += score;
+    }
+  }
+  return inside_score.empty() ? WeightType(0) : inside_score.back();
+}
+
+template<class WeightType, class WeightFunction>
+void Outside(const CSRHypergraph& hg,
+             std::vector<WeightType>& inside_score,
+             std::vector<WeightType>* result,
+             const WeightFunction& weight = WeightFunction(),
+             WeightType scale_outside = WeightType(1)
+  ) {
+  assert(result);
+  const int num_nodes = hg.NumNodes();
+  assert(static_cast<int>(inside_score.size()) == num_nodes);
+  std::vector<WeightType>& outside_score = *result;
+  outside_score.clear();
+  outside_score.resize(num_nodes);
+  outside_score.back() = scale_outside;
+  for (int i = num_nodes - 1; i >= 0; --i) {
+    const WeightType& head_node_outside_score = outside_score[i];
+    for (unsigned e = hg.InBegin(i); e < hg.InEnd(i); ++e) {
+      WeightType head_and_edge_weight = weight(hg, e);
+      head_and_edge_weight *= head_node_outside_score;
+      const int* tails = hg.Tails(e);
+      const int num_tail_nodes = hg.Arity(e);
+      for (int k = 0; k < num_tail_nodes; ++k) {
+        WeightType inside_contribution = WeightType(1);
+        for (int l = 0; l < num_tail_nodes; ++l)
+          if (tails[k] != tails[l])
+            inside_contribution *= inside_score[tails[l]];
+        inside_contribution *= head_and_edge_weight;
+        outside_score[tails[k]] += inside_contribution;
+      }
+    }
+  }
+}
+
 template <class K> // obviously not all semirings have a multiplicative inverse
 struct OutsideNormalize {
   bool enable;
@@ -186,4 +243,27 @@ KType InsideOutside(const Hypergraph& hg,
   return io.root_inside();
 }
 
+// the same for the frozen form
+template<class KType, class KWeightFunction, class XType, class XWeightFunction>
+KType InsideOutside(const CSRHypergraph& hg,
+                    XType* result_x,
+                    const KWeightFunction& kwf = KWeightFunction(),
+                    const XWeightFunction& xwf = XWeightFunction()) {
+  std::vector<KType> inside, outside;
+  const KType z = Inside<KType, KWeightFunction>(hg, &inside, kwf);
+  Outside<KType, KWeightFunction>(hg, inside, &outside, kwf);
+  XType x;
+  for (unsigned i = 0; i < hg.NumNodes(); ++i) {
+    for (unsigned e = hg.InBegin(i); e < hg.InEnd(i); ++e) {
+      KType kbar_e = outside[i];
+      const int* tails = hg.Tails(e);
+      for (unsigned k = 0; k < hg.Arity(e); ++k)
+        kbar_e *= inside[tails[k]];
+      x += xwf(hg, e) * kbar_e;
+    }
+  }
+  *result_x = x;
+  return z;
+}
+
 #endif
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <utility>
+#include <stdint.h>
 #ifndef HAVE_OLD_CPP
 # include <unordered_set>
 #else
@@ -15,6 +16,7 @@ namespace std { using std::tr1::unordered_set; }
 
 #include "wordid.h"
 #include "hg.h"
+#include "hg_csr.h"
 
 namespace KBest {
   // default, don't filter any derivations from the k-best list
@@ -34,19 +36,176 @@ namespace KBest {
     }
   };
 
+  // the target string of a derivation, kept as a persistent tree: the rule of
+  // the derivation's edge plus the yields of its antecedents, which are
+  // shared with the derivations they came from instead of being copied into
+  // a vector<WordID> at every node. The length and a hash of the string are
+  // computed from those of the antecedents (a polynomial hash, so equal
+  // strings hash equally however they were derived), so yields can be
+  // compared and filtered without building the strings; Words() builds it.
+  class EYield {
+   public:
+    EYield() {}
+    EYield(const TRule& rule, const std::vector<const EYield*>& ants) {
+      boost::shared_ptr<Node> node(new Node);
+      Node& n = *node;
+      n.rule = &rule;
+      n.ants.resize(ants.size());
+      n.size = 0;
+      n.hash = 0;
+      n.mult = 1;
+      for (unsigned i = 0; i < rule.e_.size(); ++i) {
+        const WordID c = rule.e_[i];
+        if (c < 1) {
+          const EYield& ant = *ants[-c];
+          n.ants[-c] = ant.node_;
+          if (!ant.node_) continue;
+          n.size += ant.node_->size;
+          n.hash = n.hash * ant.node_->mult + ant.node_->hash;
+          n.mult *= ant.node_->mult;
+        } else {
+          ++n.size;
+          n.hash = n.hash * kBASE + c;
+          n.mult *= kBASE;
+        }
+      }
+      node_ = node;
+    }
+
+    unsigned size() const { return node_ ? node_->size : 0; }
+    uint64_t hash() const { return node_ ? node_->hash : 0; }
+
+    // sets *words to the string
+    void Words(std::vector<WordID>* words) const {
+      words->clear();
+      words->reserve(size());
+      if (node_) AppendWords(*node_, words);
+    }
+
+    bool operator==(const EYield& other) const {
+      if (node_ == other.node_) return true;
+      if (size() != other.size() || hash() != other.hash()) return false;
+      std::vector<WordID> a, b;
+      Words(&a);
+      other.Words(&b);
+      return a == b;
+    }
+
+   private:
+    static const uint64_t kBASE = 0x100000001b3ull;
+    struct Node {
+      const TRule* rule;
+      std::vector<boost::shared_ptr<const Node> > ants;
+      unsigned size;
+      uint64_t hash;
+      uint64_t mult;  // kBASE^size
+    };
+    static void AppendWords(const Node& n, std::vector<WordID>* words) {
+      const std::vector<WordID>& e = n.rule->e_;
+      for (unsigned i = 0; i < e.size(); ++i) {
+        if (e[i] < 1) {
+          if (n.ants[-e[i]]) AppendWords(*n.ants[-e[i]], words);
+        } else {
+          words->push_back(e[i]);
+        }
+      }
+    }
+    boost::shared_ptr<const Node> node_;
+  };
+
+  // like ESentenceTraversal, but the result is an EYield
+  struct EYieldTraversal {
+    typedef EYield Result;
+    void operator()(const HG::Edge& edge,
+                    const std::vector<const Result*>& ants,
+                    Result* result) const {
+      *result = EYield(*edge.rule_, ants);
+    }
+    void operator()(const CSRHypergraph& hg, unsigned e,
+                    const std::vector<const Result*>& ants,
+                    Result* result) const {
+      *result = EYield(*hg.Rule(e), ants);
+    }
+  };
+
+  // filter unique yield strings, with EYield yields. Only the hashes of the
+  // yields are compared unless they collide.
+  struct FilterUniqueEYield {
+    struct Hash {
+      size_t operator()(const EYield& y) const { return y.hash(); }
+    };
+    std::unordered_set<EYield, Hash> unique;
+
+    bool operator()(const EYield& yield) {
+      return !unique.insert(yield).second;
+    }
+  };
+
+  // how KBestDerivations walks a forest of type Graph. Edge is what a
+  // derivation refers to its edge by; the traversal and weight function are
+  // called with an HG::Edge for a Hypergraph and with (hg, edge) for a
+  // CSRHypergraph (see viterbi.h)
+  template<typename Graph> struct KBestGraph;
+
+  template<> struct KBestGraph<Hypergraph> {
+    typedef const HG::Edge* Edge;
+    static unsigned NumNodes(const Hypergraph& g) { return g.nodes_.size(); }
+    static unsigned NumInEdges(const Hypergraph& g, unsigned v) { return g.nodes_[v].in_edges_.size(); }
+    static Edge InEdge(const Hypergraph& g, unsigned v, unsigned i) { return &g.edges_[g.nodes_[v].in_edges_[i]]; }
+    static unsigned Arity(const Hypergraph&, Edge e) { return e->tail_nodes_.size(); }
+    static int Tail(const Hypergraph&, Edge e, unsigned i) { return e->tail_nodes_[i]; }
+    static size_t Id(Edge e) { return e->id_; }
+    static void AddFeatures(const Hypergraph&, Edge e, SparseVector<double>* fv) { *fv += e->feature_values_; }
+    template<typename WeightType, typename WeightFunction>
+    static WeightType Weight(const WeightFunction& w, const Hypergraph&, Edge e) { return w(*e); }
+    template<typename Traversal, typename T>
+    static void Traverse(const Traversal& tf, const Hypergraph&, Edge e,
+                         const std::vector<const T*>& ants, T* result) {
+      tf(*e, ants, result);
+    }
+  };
+
+  template<> struct KBestGraph<CSRHypergraph> {
+    typedef unsigned Edge;
+    static unsigned NumNodes(const CSRHypergraph& g) { return g.NumNodes(); }
+    static unsigned NumInEdges(const CSRHypergraph& g, unsigned v) { return g.NumInEdges(v); }
+    static Edge InEdge(const CSRHypergraph& g, unsigned v, unsigned i) { return g.InBegin(v) + i; }
+    static unsigned Arity(const CSRHypergraph& g, Edge e) { return g.Arity(e); }
+    static int Tail(const CSRHypergraph& g, Edge e, unsigned i) { return g.Tail(e, i); }
+    static size_t Id(Edge e) { return e; }
+    static void AddFeatures(const CSRHypergraph& g, Edge e, SparseVector<double>* fv) { g.AddFeatures(e, fv); }
+    template<typename WeightType, typename WeightFunction>
+    static WeightType Weight(const WeightFunction& w, const CSRHypergraph& g, Edge e) { return w(g, e); }
+    template<typename Traversal, typename T>
+    static void Traverse(const Traversal& tf, const CSRHypergraph& g, Edge e,
+                         const std::vector<const T*>& ants, T* result) {
+      tf(g, e, ants, result);
+    }
+  };
+
   // utility class to lazily create the k-best derivations from a forest, uses
   // the lazy k-best algorithm (Algorithm 3) from Huang and Chiang (IWPT 2005)
+  // if feature_values is false, the feature vectors of derivations are not
+  // summed up as they are created (Derivation::feature_values is empty);
+  // FeatureValues() computes them for the derivations that are needed.
+  // Graph is a Hypergraph or a CSRHypergraph (see KBestGraph).
   template<typename T,  // yield type (returned by Traversal)
            typename Traversal,
            typename DerivationFilter = NoFilter<T>,
            typename WeightType = prob_t,
-           typename WeightFunction = EdgeProb>
+           typename WeightFunction = EdgeProb,
+           typename Graph = Hypergraph>
   struct KBestDerivations {
-    KBestDerivations(const Hypergraph& hg,
+    typedef KBestGraph<Graph> GraphAccess;
+    typedef typename GraphAccess::Edge Edge;
+
+    KBestDerivations(const Graph& hg,
                      const size_t k,
                      const Traversal& tf = Traversal(),
-                     const WeightFunction& wf = WeightFunction()) :
-      traverse(tf), w(wf), g(hg), nds(g.nodes_.size()), k_prime(k) {}
+                     const WeightFunction& wf = WeightFunction(),
+                     const bool feature_values = true) :
+      traverse(tf), w(wf), g(hg), nds(GraphAccess::NumNodes(g)), k_prime(k),
+      sum_features(feature_values) {}
 
     ~KBestDerivations() {
       for (unsigned i = 0; i < freelist.size(); ++i)
@@ -54,21 +213,21 @@ namespace KBest {
     }
 
     struct Derivation {
-      Derivation(const HG::Edge& e,
+      Derivation(Edge e,
                  const SmallVectorInt& jv,
                  const WeightType& w,
                  const SparseVector<double>& f) :
-        edge(&e),
+        edge(e),
         j(jv),
         score(w),
         feature_values(f) {}
 
       // dummy constructor, just for query
-      Derivation(const HG::Edge& e,
-                 const SmallVectorInt& jv) : edge(&e), j(jv) {}
+      Derivation(Edge e,
+                 const SmallVectorInt& jv) : edge(e), j(jv) {}
 
       T yield;
-      const HG::Edge* const edge;
+      const Edge edge;
       const SmallVectorInt j;
       const WeightType score;
       const SparseVector<double> feature_values;
@@ -100,10 +259,21 @@ namespace KBest {
       return d.edge->derivation_tree(*this,EdgeHandle(&d),indent,show_mask,maxdepth,depth);
     }
 
+    // sets *fv to the feature vector of d (a derivation returned by
+    // LazyKthBest)
+    void FeatureValues(const Derivation& d, SparseVector<double>* fv) const {
+      if (sum_features) {
+        *fv = d.feature_values;
+        return;
+      }
+      fv->clear();
+      AddFeatureValues(d, fv);
+    }
+
     struct DerivationUniquenessHash {
       size_t operator()(const Derivation* d) const {
         size_t x = 5381;
-        x = ((x << 5) + x) ^ d->edge->id_;
+        x = ((x << 5) + x) ^ GraphAccess::Id(d->edge);
         for (unsigned i = 0; i < d->j.size(); ++i)
           x = ((x << 5) + x) ^ d->j[i];
         return x;
@@ -144,10 +314,10 @@ namespace KBest {
           std::pop_heap(cand.begin(), cand.end(), HeapCompare());
           Derivation* d = cand.back();
           cand.pop_back();
-          std::vector<const T*> ants(d->edge->Arity());
+          std::vector<const T*> ants(GraphAccess::Arity(g, d->edge));
           for (unsigned j = 0; j < ants.size(); ++j)
-            ants[j] = &LazyKthBest(d->edge->tail_nodes_[j], d->j[j])->yield;
-          traverse(*d->edge, ants, &d->yield);
+            ants[j] = &LazyKthBest(GraphAccess::Tail(g, d->edge, j), d->j[j])->yield;
+          GraphAccess::Traverse(traverse, g, d->edge, ants, &d->yield);
           if (!filter(d->yield)) {
             D.push_back(d);
             add_next = true;
@@ -169,27 +339,36 @@ namespace KBest {
     // the yield is computed in LazyKthBest before the derivation is added to D
     // returns NULL if j refers to derivation numbers larger than the
     // antecedent structure define
-    Derivation* CreateDerivation(const HG::Edge& e, const SmallVectorInt& j) {
-      WeightType score = w(e);
-      SparseVector<double> feats = e.feature_values_;
-      for (int i = 0; i < e.Arity(); ++i) {
-        const Derivation* ant = LazyKthBest(e.tail_nodes_[i], j[i]);
+    Derivation* CreateDerivation(Edge e, const SmallVectorInt& j) {
+      WeightType score = GraphAccess::template Weight<WeightType>(w, g, e);
+      SparseVector<double> feats;
+      if (sum_features) GraphAccess::AddFeatures(g, e, &feats);
+      const unsigned arity = GraphAccess::Arity(g, e);
+      for (unsigned i = 0; i < arity; ++i) {
+        const Derivation* ant = LazyKthBest(GraphAccess::Tail(g, e, i), j[i]);
         if (!ant) { return NULL; }
         score *= ant->score;
-        feats += ant->feature_values;
+        if (sum_features) feats += ant->feature_values;
       }
       freelist.push_back(new Derivation(e, j, score, feats));
       return freelist.back();
     }
 
+    // the antecedents of a derivation returned by LazyKthBest are in D
+    void AddFeatureValues(const Derivation& d, SparseVector<double>* fv) const {
+      GraphAccess::AddFeatures(g, d.edge, fv);
+      for (unsigned i = 0; i < d.j.size(); ++i)
+        AddFeatureValues(*nds[GraphAccess::Tail(g, d.edge, i)].D[d.j[i]], fv);
+    }
+
     NodeDerivationState& GetCandidates(unsigned v) {
       NodeDerivationState& s = nds[v];
       if (!s.D.empty() || !s.cand.empty()) return s;
 
-      const Hypergraph::Node& node = g.nodes_[v];
-      for (unsigned i = 0; i < node.in_edges_.size(); ++i) {
-        const HG::Edge& edge = g.edges_[node.in_edges_[i]];
-        SmallVectorInt jv(edge.Arity(), 0);
+      const unsigned num_in_edges = GraphAccess::NumInEdges(g, v);
+      for (unsigned i = 0; i < num_in_edges; ++i) {
+        const Edge edge = GraphAccess::InEdge(g, v, i);
+        SmallVectorInt jv(GraphAccess::Arity(g, edge), 0);
         Derivation* d = CreateDerivation(edge, jv);
         assert(d);
         s.cand.push_back(d);
@@ -212,11 +391,11 @@ namespace KBest {
       for (unsigned i = 0; i < d->j.size(); ++i) {
         SmallVectorInt j = d->j;
         ++j[i];
-        const Derivation* ant = LazyKthBest(d->edge->tail_nodes_[i], j[i]);
+        const Derivation* ant = LazyKthBest(GraphAccess::Tail(g, d->edge, i), j[i]);
         if (ant) {
-          Derivation query_unique(*d->edge, j);
+          Derivation query_unique(d->edge, j);
           if (ds->count(&query_unique) == 0) {
-            Derivation* new_d = CreateDerivation(*d->edge, j);
+            Derivation* new_d = CreateDerivation(d->edge, j);
             if (new_d) {
               cand->push_back(new_d);
               std::push_heap(cand->begin(), cand->end(), HeapCompare());
@@ -234,10 +413,11 @@ namespace KBest {
 
     const Traversal traverse;
     const WeightFunction w;
-    const Hypergraph& g;
+    const Graph& g;
     std::vector<NodeDerivationState> nds;
     std::vector<Derivation*> freelist;
     const size_t k_prime;
+    const bool sum_features;
   };
 }
 
@@ -0,0 +1,147 @@
+#include "log_inside_outside.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "hg.h"
+#include "hg_csr.h"
+
+using namespace std;
+
+static const double kLOG_ZERO = -numeric_limits<double>::infinity();
+
+// log(exp(a) + exp(b))
+static inline double LogAdd(double a, double b) {
+  if (a < b) swap(a, b);
+  if (b == kLOG_ZERO) return a;
+  return a + log1p(exp(b - a));
+}
+
+double LogInsideOutside::LogSumExp(const double* x, unsigned n) {
+  if (n == 1) return x[0];
+  double m = kLOG_ZERO;
+  for (unsigned i = 0; i < n; ++i)
+    m = max(m, x[i]);
+  if (std::isinf(m)) return m;
+  double sum = 0;
+  for (unsigned i = 0; i < n; ++i)
+    sum += exp(x[i] - m);
+  return m + log(sum);
+}
+
+LogInsideOutside::LogInsideOutside(const Hypergraph& hg,
+                                   const vector<double>& log_weights,
+                                   bool max_product) {
+  const unsigned num_nodes = hg.nodes_.size();
+  num_edges_ = hg.edges_.size();
+  node_begin_.resize(num_nodes + 1);
+  edge_id_.reserve(num_edges_);
+  tail_begin_.reserve(num_edges_ + 1);
+  weight_.reserve(num_edges_);
+  for (unsigned i = 0; i < num_nodes; ++i) {
+    node_begin_[i] = edge_id_.size();
+    const Hypergraph::EdgesVector& in = hg.nodes_[i].in_edges_;
+    for (unsigned j = 0; j < in.size(); ++j) {
+      const HG::Edge& edge = hg.edges_[in[j]];
+      edge_id_.push_back(in[j]);
+      weight_.push_back(log_weights[in[j]]);
+      tail_begin_.push_back(tails_.size());
+      tails_.insert(tails_.end(), edge.tail_nodes_.begin(), edge.tail_nodes_.end());
+    }
+  }
+  node_begin_[num_nodes] = edge_id_.size();
+  tail_begin_.push_back(tails_.size());
+  ComputeInside(max_product);
+  ComputeOutside(max_product);
+}
+
+LogInsideOutside::LogInsideOutside(const CSRHypergraph& hg,
+                                   const vector<double>& log_weights,
+                                   bool max_product) {
+  const unsigned num_nodes = hg.NumNodes();
+  num_edges_ = hg.NumEdges();
+  node_begin_.resize(num_nodes + 1);
+  for (unsigned i = 0; i <= num_nodes; ++i)
+    node_begin_[i] = i < num_nodes ? hg.InBegin(i) : num_edges_;
+  edge_id_.resize(num_edges_);
+  tail_begin_.resize(num_edges_ + 1);
+  for (unsigned e = 0; e < num_edges_; ++e) {
+    edge_id_[e] = e;
+    tail_begin_[e] = tails_.size();
+    tails_.insert(tails_.end(), hg.Tails(e), hg.Tails(e) + hg.Arity(e));
+  }
+  tail_begin_[num_edges_] = tails_.size();
+  weight_.assign(log_weights.begin(), log_weights.begin() + num_edges_);
+  ComputeInside(max_product);
+  ComputeOutside(max_product);
+}
+
+void LogInsideOutside::ComputeInside(bool max_product) {
+  const unsigned num_nodes = node_begin_.size() - 1;
+  inside_.resize(num_nodes);
+  edge_inside_.resize(edge_id_.size());
+  for (unsigned i = 0; i < num_nodes; ++i) {
+    const unsigned b = node_begin_[i];
+    const unsigned e = node_begin_[i + 1];
+    if (b == e) {
+      inside_[i] = kLOG_ZERO;
+      continue;
+    }
+    for (unsigned p = b; p < e; ++p) {
+      double s = weight_[p];
+      for (unsigned t = tail_begin_[p]; t < tail_begin_[p + 1]; ++t)
+        s += inside_[tails_[t]];
+      edge_inside_[p] = s;
+    }
+    if (max_product)
+      inside_[i] = *max_element(&edge_inside_[b], &edge_inside_[b] + (e - b));
+    else
+      inside_[i] = LogSumExp(&edge_inside_[b], e - b);
+  }
+}
+
+void LogInsideOutside::ComputeOutside(bool max_product) {
+  const int num_nodes = node_begin_.size() - 1;
+  outside_.assign(num_nodes, kLOG_ZERO);
+  if (!num_nodes) return;
+  outside_.back() = 0;
+  for (int i = num_nodes - 1; i >= 0; --i) {
+    const double head_outside = outside_[i];
+    if (head_outside == kLOG_ZERO) continue;
+    for (unsigned p = node_begin_[i]; p < node_begin_[i + 1]; ++p) {
+      const double with_edge = head_outside + edge_inside_[p];
+      if (with_edge == kLOG_ZERO) continue;  // then some tail has inside -inf
+      for (unsigned t = tail_begin_[p]; t < tail_begin_[p + 1]; ++t) {
+        // the inside scores of the other tails are what is left when the
+        // inside score of this one is taken out
+        const int tail = tails_[t];
+        const double x = with_edge - inside_[tail];
+        double& o = outside_[tail];
+        o = max_product ? max(o, x) : LogAdd(o, x);
+      }
+    }
+  }
+}
+
+void LogInsideOutside::EdgeMarginals(const vector<double>& log_weights, vector<double>* marginals) const {
+  // edges that are not an in-edge of any node are not part of the forest
+  marginals->assign(num_edges_, kLOG_ZERO);
+  const unsigned num_nodes = node_begin_.size() - 1;
+  for (unsigned i = 0; i < num_nodes; ++i) {
+    for (unsigned p = node_begin_[i]; p < node_begin_[i + 1]; ++p) {
+      double s = outside_[i] + log_weights[edge_id_[p]];
+      for (unsigned t = tail_begin_[p]; t < tail_begin_[p + 1]; ++t)
+        s += inside_[tails_[t]];
+      (*marginals)[edge_id_[p]] = s;
+    }
+  }
+}
+
+void LogInsideOutside::EdgeMarginals(vector<double>* marginals) const {
+  marginals->assign(num_edges_, kLOG_ZERO);
+  const unsigned num_nodes = node_begin_.size() - 1;
+  for (unsigned i = 0; i < num_nodes; ++i)
+    for (unsigned p = node_begin_[i]; p < node_begin_[i + 1]; ++p)
+      (*marginals)[edge_id_[p]] = outside_[i] + edge_inside_[p];
+}
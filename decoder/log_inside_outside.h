@@ -0,0 +1,66 @@
+#ifndef LOG_INSIDE_OUTSIDE_H_
+#define LOG_INSIDE_OUTSIDE_H_
+
+#include <vector>
+
+class Hypergraph;
+class CSRHypergraph;
+
+// Inside and outside scores of a forest computed directly on log weights
+// (doubles), either in the log semiring (logadd, +) or, if max_product is
+// true, in the Viterbi semiring (max, +). This computes the same quantities
+// as InsideOutsides<prob_t> (see inside_outside.h) with EdgeProb-like weight
+// functions, but the structure of the forest is first copied into flat
+// arrays: the in-edges of each node are stored together (in the order of
+// Node::in_edges_) and the tail nodes of all edges are one contiguous array.
+// The scores of the in-edges of a node are computed into a buffer and
+// combined with a single log-sum-exp, instead of one log1p(exp(.)) per
+// LogVal addition, and the loops only touch contiguous arrays of doubles.
+//
+// Scores are natural logs; -infinity is the semiring zero. As with Outside()
+// the outside score of the goal node is 0 (i.e., not normalized).
+class LogInsideOutside {
+ public:
+  // log_weights[e] is the log weight of edge e of hg
+  LogInsideOutside(const Hypergraph& hg,
+                   const std::vector<double>& log_weights,
+                   bool max_product = false);
+  // the same for the frozen form (which already has this layout); edges are
+  // numbered as in hg, both in log_weights and in the marginals
+  LogInsideOutside(const CSRHypergraph& hg,
+                   const std::vector<double>& log_weights,
+                   bool max_product = false);
+
+  // inside score of the goal node
+  double LogZ() const { return inside_.empty() ? 0.0 : inside_.back(); }
+  const std::vector<double>& Inside() const { return inside_; }
+  const std::vector<double>& Outside() const { return outside_; }
+
+  // (*marginals)[e] = outside(head) + log_weights[e] + sum of inside(tail)
+  // for every edge e. log_weights may differ from the weights the inside and
+  // outside scores were computed with.
+  void EdgeMarginals(const std::vector<double>& log_weights, std::vector<double>* marginals) const;
+  // the same, with the weights the inside and outside scores were computed with
+  void EdgeMarginals(std::vector<double>* marginals) const;
+
+  // log(sum(exp(x[i]))) over n values
+  static double LogSumExp(const double* x, unsigned n);
+
+ private:
+  void ComputeInside(bool max_product);
+  void ComputeOutside(bool max_product);
+
+  unsigned num_edges_;
+  std::vector<unsigned> node_begin_;  // in-edges of node i are positions
+                                      // node_begin_[i] .. node_begin_[i+1]-1
+  std::vector<int> edge_id_;          // edge at each position
+  std::vector<unsigned> tail_begin_;  // tails of the edge at position p are
+                                      // tails_[tail_begin_[p] .. tail_begin_[p+1]-1]
+  std::vector<int> tails_;
+  std::vector<double> weight_;        // log weight of the edge at each position
+  std::vector<double> edge_inside_;   // weight_ + inside scores of the tails
+  std::vector<double> inside_;
+  std::vector<double> outside_;
+};
+
+#endif
@@ -27,13 +27,11 @@ namespace cdec {
     return MurmurHash3_64(&fpn, sizeof(FirstPassNode), 2654435769U);
   }
 
-  inline uint64_t HashNode(uint64_t old_hash, const FFState& state) {
-    if (state.size() == 0) return old_hash;
-    uint8_t buf[1024];
-    std::memcpy(buf, &old_hash, sizeof(uint64_t));
-    assert(state.size() < (1024u - sizeof(uint64_t)));
-    std::memcpy(&buf[sizeof(uint64_t)], state.begin(), state.size());
-    return MurmurHash3_64(buf, sizeof(uint64_t) + state.size(), 2654435769U);
+  // state_hash is ModelSet::StateHash() of the state, 0 if it is empty
+  inline uint64_t HashNode(uint64_t old_hash, uint64_t state_hash) {
+    if (state_hash == 0) return old_hash;
+    const uint64_t buf[2] = { old_hash, state_hash };
+    return MurmurHash3_64(buf, sizeof(buf), 2654435769U);
   }
 
 }
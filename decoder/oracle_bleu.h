@@ -255,31 +255,40 @@ struct OracleBleu {
   bool show_derivation;
   int show_derivation_mask;
 
+  // each derivation is written as soon as it is found. Yields are EYields
+  // (shared between derivations, and compared by hash for unique k-best
+  // lists) and feature vectors are only summed up for the derivations that
+  // are written, so large k-best lists do not keep a string and a feature
+  // vector for every derivation of every node.
   template <class Filter>
   void kbest(int sent_id, Hypergraph const& forest, int k, bool mr_mira_compat,
              int src_len, std::ostream& kbest_out = std::cout,
              std::ostream& deriv_out = std::cerr) {
     using namespace std;
     using namespace boost;
-    typedef KBest::KBestDerivations<Sentence, ESentenceTraversal,Filter> K;
-    K kbest(forest,k);
+    typedef KBest::KBestDerivations<KBest::EYield, KBest::EYieldTraversal, Filter> K;
+    K kbest(forest, k, KBest::EYieldTraversal(), EdgeProb(), false);
     //add length (f side) src length of this sentence to the psuedo-doc src length count
     float curr_src_length = doc_src_length + tmp_src_length;
     if (mr_mira_compat) kbest_out << k << "\n";
+    Sentence yield;
+    SparseVector<double> feature_values;
     int i = 0;
     for (; i < k; ++i) {
       typename K::Derivation *d = kbest.LazyKthBest(forest.nodes_.size() - 1, i);
       if (!d) break;
+      d->yield.Words(&yield);
+      kbest.FeatureValues(*d, &feature_values);
       kbest_out << sent_id << " ||| ";
       if (mr_mira_compat) kbest_out << src_len << " ||| ";
-      kbest_out << TD::GetString(d->yield) << " ||| ";
+      kbest_out << TD::GetString(yield) << " ||| ";
       if (mr_mira_compat)
-        kbest_out << EncodeFeatureVector(d->feature_values);
+        kbest_out << EncodeFeatureVector(feature_values);
       else
-        kbest_out << d->feature_values;
+        kbest_out << feature_values;
       kbest_out << " ||| " << log(d->score);
       if (!refs.empty()) {
-        ScoreP sentscore = GetScore(d->yield,sent_id);
+        ScoreP sentscore = GetScore(yield,sent_id);
         sentscore->PlusEquals(*doc_score,float(1));
         float bleu = curr_src_length * sentscore->ComputeScore();
         kbest_out << " ||| " << bleu;
@@ -299,13 +308,20 @@ struct OracleBleu {
   }
 
 // TODO decoder output should probably be moved to another file - how about oracle_bleu.h
+  // if kbest_out is not NULL, the k-best list is written to it instead of
+  // to kbest_out_filename_
   void DumpKBest(const int sent_id, const Hypergraph& forest, const int k,
                  const bool unique, const bool mr_mira_compat,
                  const int src_len, std::string const& kbest_out_filename_,
-                 std::string const& deriv_out_filename_) {
+                 std::string const& deriv_out_filename_,
+                 std::ostream* kbest_out = NULL) {
 
-    WriteFile ko(kbest_out_filename_);
-    std::cerr << "Output kbest to " << kbest_out_filename_ <<std::endl;
+    WriteFile ko;
+    if (!kbest_out) {
+      ko.Init(kbest_out_filename_);
+      kbest_out = &ko.get();
+      std::cerr << "Output kbest to " << kbest_out_filename_ <<std::endl;
+    }
     std::ostringstream sderiv;
     sderiv << deriv_out_filename_;
     if (show_derivation) {
@@ -315,11 +331,11 @@ struct OracleBleu {
     WriteFile oderiv(sderiv.str());
 
     if (!unique)
-      kbest<KBest::NoFilter<std::vector<WordID> > >(
-          sent_id, forest, k, mr_mira_compat, src_len, ko.get(), oderiv.get());
+      kbest<KBest::NoFilter<KBest::EYield> >(
+          sent_id, forest, k, mr_mira_compat, src_len, *kbest_out, oderiv.get());
     else {
-      kbest<KBest::FilterUnique>(sent_id, forest, k, mr_mira_compat, src_len,
-                                 ko.get(), oderiv.get());
+      kbest<KBest::FilterUniqueEYield>(sent_id, forest, k, mr_mira_compat, src_len,
+                                       *kbest_out, oderiv.get());
     }
   }
 
@@ -2,6 +2,8 @@
 
 #include <queue>
 #include <iostream>
+#include <limits>
+#include <algorithm>
 #ifndef HAVE_OLD_CPP
 # include <unordered_map>
 # include <unordered_set>
@@ -21,46 +23,96 @@ namespace std { using std::tr1::unordered_map; using std::tr1::unordered_set; }
 #include "lattice.h"
 #include "phrasetable_fst.h"
 #include "array2d.h"
+#include "murmur_hash3.h"
 
 using namespace std;
 using namespace boost::tuples;
 
-struct Coverage : public vector<bool> {
-  explicit Coverage(int n, bool v = false) : vector<bool>(n, v), first_gap() {}
+#if defined(__GNUC__)
+static inline int PopCount(uint64_t x) { return __builtin_popcountll(x); }
+static inline int LowestSetBit(uint64_t x) { return __builtin_ctzll(x); }
+#else
+static inline int PopCount(uint64_t x) {
+  int c = 0;
+  for (; x; x &= x - 1) ++c;
+  return c;
+}
+static inline int LowestSetBit(uint64_t x) {
+  int i = 0;
+  for (; !(x & 1); x >>= 1) ++i;
+  return i;
+}
+#endif
+
+// the source positions covered by a hypothesis, a bitset of kCOVERAGE_WORDS
+// 64-bit words (so inputs of up to kMAX_COVERAGE words can be translated)
+static const int kCOVERAGE_WORDS = 4;
+static const int kMAX_COVERAGE = 64 * kCOVERAGE_WORDS;
+
+class Coverage {
+ public:
+  explicit Coverage(int n, bool v = false) : size_(n), first_gap_(0) {
+    fill(bits_, bits_ + kCOVERAGE_WORDS, 0);
+    if (v) Cover(0, n);
+  }
+  // covers positions i .. j-1
   void Cover(int i, int j) {
-    vector<bool>::iterator it = this->begin() + i;
-    vector<bool>::iterator end = this->begin() + j;
-    while (it != end)
-      *it++ = true;
-    if (first_gap == i) {
-      first_gap = j;
-      it = end;
-      while (*it && it != this->end()) {
-        ++it;
-        ++first_gap;
-      }
-    }
+    for (int w = i >> 6; i < j && w <= (j - 1) >> 6; ++w)
+      bits_[w] |= RangeMask(w, i, j);
+    if (first_gap_ == i) first_gap_ = FirstUncovered(j);
   }
+  // true if any of positions i .. j-1 is covered
   bool Collides(int i, int j) const {
-    vector<bool>::const_iterator it = this->begin() + i;
-    vector<bool>::const_iterator end = this->begin() + j;
-    while (it != end)
-      if (*it++) return true;
+    for (int w = i >> 6; i < j && w <= (j - 1) >> 6; ++w)
+      if (bits_[w] & RangeMask(w, i, j)) return true;
     return false;
   }
-  int GetFirstGap() const { return first_gap; }
+  bool operator[](int i) const { return (bits_[i >> 6] >> (i & 63)) & 1; }
+  int size() const { return size_; }
+  int GetFirstGap() const { return first_gap_; }
+  // number of covered positions
+  int Count() const {
+    int c = 0;
+    for (int w = 0; w < kCOVERAGE_WORDS; ++w) c += PopCount(bits_[w]);
+    return c;
+  }
+  // the first position >= i that is not covered, or size()
+  int FirstUncovered(int i) const {
+    for (int w = i >> 6; i < size_ && w < kCOVERAGE_WORDS; ++w) {
+      const uint64_t free = ~bits_[w] & RangeMask(w, i, size_);
+      if (free) return 64 * w + LowestSetBit(free);
+    }
+    return size_;
+  }
+  // the first position >= i that is covered, or size()
+  int FirstCovered(int i) const {
+    for (int w = i >> 6; i < size_ && w < kCOVERAGE_WORDS; ++w) {
+      const uint64_t used = bits_[w] & RangeMask(w, i, size_);
+      if (used) return 64 * w + LowestSetBit(used);
+    }
+    return size_;
+  }
+  bool operator==(const Coverage& other) const {
+    return equal(bits_, bits_ + kCOVERAGE_WORDS, other.bits_);
+  }
+  size_t hash() const {
+    return cdec::MurmurHash3_64(bits_, sizeof(bits_), 2654435769U);
+  }
  private:
-  int first_gap;
+  // the bits of word w that are positions i .. j-1
+  static uint64_t RangeMask(int w, int i, int j) {
+    const int lo = max(i - 64 * w, 0);
+    const int hi = min(j - 64 * w, 64);
+    if (lo >= hi) return 0;
+    const uint64_t upper = hi == 64 ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << hi) - 1;
+    return upper & ~((static_cast<uint64_t>(1) << lo) - 1);
+  }
+  uint64_t bits_[kCOVERAGE_WORDS];
+  int size_;
+  int first_gap_;
 };
 struct CoverageHash {
-  size_t operator()(const Coverage& cov) const {
-    int seed = 131;
-    size_t res = 0;
-    for (vector<bool>::const_iterator it = cov.begin(); it != cov.end(); ++it) {
-      res = (res * seed) + (*it + 1);
-    }
-    return res;
-  }
+  size_t operator()(const Coverage& cov) const { return cov.hash(); }
 };
 ostream& operator<<(ostream& os, const Coverage& cov) {
   os << '[';
@@ -69,16 +121,18 @@ ostream& operator<<(ostream& os, const Coverage& cov) {
   return os << " gap=" << cov.GetFirstGap() << ']';
 }
 
-typedef unordered_map<Coverage, int, CoverageHash> CoverageNodeMap;
-typedef unordered_set<Coverage, CoverageHash> UniqueCoverageSet;
+static const double kLOG_ZERO = -numeric_limits<double>::infinity();
 
 struct PhraseBasedTranslatorImpl {
   PhraseBasedTranslatorImpl(const boost::program_options::variables_map& conf) :
       add_pass_through_rules(conf.count("add_pass_through_rules")),
       max_distortion(conf["pb_max_distortion"].as<int>()),
+      stack_size(conf["pb_stack_size"].as<int>()),
+      beam(conf["pb_beam"].as<double>()),
       kCONCAT_RULE(new TRule("[X] ||| [X,1] [X,2] ||| [X,1] [X,2]", true)),
       kNT_TYPE(TD::Convert("X") * -1) {
     assert(max_distortion >= 0);
+    assert(conf["pb_stack_size"].as<int>() >= 0);
     vector<string> gfiles = conf["grammar"].as<vector<string> >();
     assert(gfiles.size() == 1);
     cerr << "Reading phrasetable from " << gfiles.front() << endl;
@@ -87,23 +141,174 @@ struct PhraseBasedTranslatorImpl {
   }
 
   struct State {
-    State(const Coverage& c, int _i, int _j, const FSTNode* q) :
-      coverage(c), i(_i), j(_j), fst(q) {}
-    Coverage coverage;
+    State(int _i, int _j, const FSTNode* q) : i(_i), j(_j), fst(q) {}
     int i;
     int j;
     const FSTNode* fst;
   };
 
-  // we keep track of unique coverages that have been extended since it's
-  // possible to "extend" the same coverage twice, e.g. translate "a b c"
-  // with phrases "a" "b" "a b" and "c".  There are two ways to cover "a b"
-  void EnqueuePossibleContinuations(const Coverage& coverage, queue<State>* q, UniqueCoverageSet* ucs) {
-    if (ucs->insert(coverage).second) {
-      const int gap = coverage.GetFirstGap();
-      const int end = min(static_cast<int>(coverage.size()), gap + max_distortion + 1);
-      for (int i = gap; i < end; ++i)
-        if (!coverage[i]) q->push(State(coverage, i, i, fst.get()));
+  // the translations of source positions i .. j-1 along one path of the
+  // lattice. The node they are attached to is shared by all coverages the
+  // phrase extends and only added to the forest when first used.
+  struct Phrase {
+    Phrase(int _i, int _j, const FSTNode* q) : i(_i), j(_j), fst(q), node(-1), score(kLOG_ZERO) {}
+    int i;
+    int j;
+    const FSTNode* fst;
+    int node;
+    double score;  // of the best translation
+  };
+
+  // the hypotheses that cover the same positions: the node whose in-edges
+  // are their derivations (-1 for the empty coverage) and the score of the
+  // best one
+  struct CoverageInfo {
+    CoverageInfo() : node(-1), score(kLOG_ZERO) {}
+    int node;
+    double score;
+  };
+  typedef unordered_map<Coverage, CoverageInfo, CoverageHash> CoverageStack;
+
+  // (*phrases)[i] are the phrases of the table that start at position i
+  void CollectPhrases(const Lattice& lattice, const vector<double>& weights,
+                      vector<vector<Phrase> >* phrases) const {
+    const int n = lattice.size();
+    phrases->resize(n);
+    for (int start = 0; start < n; ++start) {
+      queue<State> q;
+      q.push(State(start, start, fst.get()));
+      while (!q.empty()) {
+        const State s = q.front();
+        q.pop();
+        if (s.fst->HasData()) {
+          Phrase p(s.i, s.j, s.fst);
+          const vector<TRulePtr>& rules = s.fst->GetTranslations()->GetRules();
+          for (unsigned k = 0; k < rules.size(); ++k)
+            p.score = max(p.score, rules[k]->scores_.dot(weights));
+          (*phrases)[start].push_back(p);
+        }
+        if (s.j == n) continue;
+        const vector<LatticeArc>& arcs = lattice[s.j];
+        for (unsigned l = 0; l < arcs.size(); ++l) {
+          const FSTNode* next_fst_state = s.fst->Extend(arcs[l].label);
+          if (next_fst_state)
+            q.push(State(s.i, s.j + arcs[l].dist2next, next_fst_state));
+        }
+      }
+    }
+  }
+
+  // (*future)(i, j) is the score of the best way to translate positions
+  // i .. j-1 with phrases in monotone order, ignoring everything but the
+  // phrase scores; kLOG_ZERO if they can't be
+  static void ComputeFutureCosts(int n, const vector<vector<Phrase> >& phrases,
+                                 Array2D<double>* future) {
+    future->resize(n + 1, n + 1, kLOG_ZERO);
+    for (int i = 0; i < n; ++i)
+      for (unsigned k = 0; k < phrases[i].size(); ++k) {
+        double& f = (*future)(i, phrases[i][k].j);
+        f = max(f, phrases[i][k].score);
+      }
+    for (int len = 2; len <= n; ++len)
+      for (int i = 0; i + len <= n; ++i) {
+        const int j = i + len;
+        double& f = (*future)(i, j);
+        for (int k = i + 1; k < j; ++k)
+          f = max(f, (*future)(i, k) + (*future)(k, j));
+      }
+  }
+
+  // the sum of the future costs of the uncovered spans of cov
+  static double FutureCost(const Coverage& cov, const Array2D<double>& future) {
+    double res = 0;
+    for (int i = cov.FirstUncovered(0); i < cov.size(); ) {
+      const int j = cov.FirstCovered(i);
+      res += future(i, j);
+      i = cov.FirstUncovered(j);
+    }
+    return res;
+  }
+
+  // histogram (stack_size) and threshold (beam) pruning of the hypotheses
+  // with the same number of covered positions, by their score plus the
+  // future cost of the rest of the input. Coverages that can't be completed
+  // are always dropped.
+  void Prune(const CoverageStack& stack, const Array2D<double>& future,
+             vector<CoverageStack::const_iterator>* survivors) const {
+    vector<pair<double, CoverageStack::const_iterator> > scored;
+    scored.reserve(stack.size());
+    double best = kLOG_ZERO;
+    for (CoverageStack::const_iterator it = stack.begin(); it != stack.end(); ++it) {
+      const double s = it->second.score + FutureCost(it->first, future);
+      if (s == kLOG_ZERO) continue;
+      scored.push_back(make_pair(s, it));
+      best = max(best, s);
+    }
+    if (beam > 0) {
+      unsigned k = 0;
+      for (unsigned i = 0; i < scored.size(); ++i)
+        if (scored[i].first >= best - beam) scored[k++] = scored[i];
+      scored.resize(k);
+    }
+    if (stack_size > 0 && scored.size() > stack_size) {
+      nth_element(scored.begin(), scored.begin() + stack_size, scored.end(), ScoreGreater());
+      scored.resize(stack_size);
+    }
+    survivors->resize(scored.size());
+    for (unsigned i = 0; i < scored.size(); ++i)
+      (*survivors)[i] = scored[i].second;
+  }
+  struct ScoreGreater {
+    bool operator()(const pair<double, CoverageStack::const_iterator>& a,
+                    const pair<double, CoverageStack::const_iterator>& b) const {
+      return a.first > b.first;
+    }
+  };
+
+  void AddPhraseEdges(const Phrase& p, int head, Hypergraph* hg) const {
+    const vector<TRulePtr>& rules = p.fst->GetTranslations()->GetRules();
+    for (unsigned k = 0; k < rules.size(); ++k) {
+      Hypergraph::Edge* edge = hg->AddEdge(rules[k], Hypergraph::TailNodeVector());
+      edge->feature_values_ = edge->rule_->scores_;
+      edge->i_ = p.i;
+      edge->j_ = p.j;
+      hg->ConnectEdgeToHeadNode(edge->id_, head);
+    }
+  }
+
+  // extends the hypotheses covering cov with every phrase that doesn't
+  // collide with it and starts within max_distortion of its first gap
+  void Extend(const Coverage& cov, const CoverageInfo& info,
+              vector<vector<Phrase> >* phrases,
+              vector<CoverageStack>* stacks,
+              Hypergraph* hg) const {
+    const int gap = cov.GetFirstGap();
+    const int end = min(cov.size(), gap + max_distortion + 1);
+    for (int i = gap; i < end; ++i) {
+      if (cov[i]) continue;
+      vector<Phrase>& starting = (*phrases)[i];
+      for (unsigned k = 0; k < starting.size(); ++k) {
+        Phrase& p = starting[k];
+        if (cov.Collides(p.i, p.j)) continue;
+        Coverage new_cov = cov;
+        new_cov.Cover(p.i, p.j);
+        CoverageInfo& next = (*stacks)[new_cov.Count()][new_cov];
+        if (next.node < 0)
+          next.node = hg->AddNode(kNT_TYPE)->id_;
+        next.score = max(next.score, info.score + p.score);
+        if (info.node < 0) {  // left edge, the phrase is the whole derivation
+          AddPhraseEdges(p, next.node, hg);
+        } else {
+          if (p.node < 0) {
+            p.node = hg->AddNode(kNT_TYPE)->id_;
+            AddPhraseEdges(p, p.node, hg);
+          }
+          Hypergraph::TailNodeVector tail(2, info.node);
+          tail[1] = p.node;
+          const int concat_edge = hg->AddEdge(kCONCAT_RULE, tail)->id_;
+          hg->ConnectEdgeToHeadNode(concat_edge, next.node);
+        }
+      }
     }
   }
 
@@ -115,78 +320,51 @@ struct PhraseBasedTranslatorImpl {
     LatticeTools::ConvertTextOrPLF(input, &lattice);
     smeta->SetSourceLength(lattice.size());
     smeta->ComputeInputLatticeType();
-    size_t est_nodes = lattice.size() * lattice.size() * (1 << max_distortion);
-    minus_lm_forest->ReserveNodes(est_nodes, est_nodes * 100);
+    if (lattice.size() > kMAX_COVERAGE) {
+      cerr << "Phrase-based decoder: input has " << lattice.size()
+           << " positions, at most " << kMAX_COVERAGE << " are supported\n";
+      return false;
+    }
+    const size_t per_stack = stack_size ? stack_size : lattice.size() << min(max_distortion, 8);
+    const size_t est_nodes = lattice.size() * per_stack;
+    minus_lm_forest->ReserveNodes(est_nodes, est_nodes * 10);
     if (add_pass_through_rules) {
       SparseVector<double> feats;
       feats.set_value(FD::Convert("PassThrough"), 1);
-      for (int i = 0; i < lattice.size(); ++i) {
+      for (unsigned i = 0; i < lattice.size(); ++i) {
         const vector<LatticeArc>& arcs = lattice[i];
-        for (int j = 0; j < arcs.size(); ++j) {
+        for (unsigned j = 0; j < arcs.size(); ++j) {
           fst->AddPassThroughTranslation(arcs[j].label, feats);
           // TODO handle lattice edge features
         }
       }
     }
-    CoverageNodeMap c;
-    queue<State> q;
-    UniqueCoverageSet ucs;
+    vector<vector<Phrase> > phrases;
+    CollectPhrases(lattice, weights, &phrases);
+    Array2D<double> future;
+    ComputeFutureCosts(lattice.size(), phrases, &future);
+
+    // stacks[k] are the hypotheses covering k positions. Every phrase covers
+    // at least one position, so hypotheses only extend into later stacks
+    // and each stack is pruned and expanded once.
+    vector<CoverageStack> stacks(lattice.size() + 1);
     const Coverage empty_cov(lattice.size(), false);
-    const Coverage goal_cov(lattice.size(), true);
-    EnqueuePossibleContinuations(empty_cov, &q, &ucs);
-    c[empty_cov] = 0;   // have to handle the left edge specially
-    while(!q.empty()) {
-      const State s = q.front();
-      q.pop();
-      // cerr << "(" << s.i << "," << s.j << " ptr=" << s.fst << ") cov=" << s.coverage << endl;
-      const vector<LatticeArc>& arcs = lattice[s.j];
-      if (s.fst->HasData()) {
-        Coverage new_cov = s.coverage;
-        new_cov.Cover(s.i, s.j);
-        EnqueuePossibleContinuations(new_cov, &q, &ucs);
-        const vector<TRulePtr>& phrases = s.fst->GetTranslations()->GetRules();
-        const int phrase_head_index = minus_lm_forest->AddNode(kNT_TYPE)->id_;
-        for (int i = 0; i < phrases.size(); ++i) {
-          Hypergraph::Edge* edge = minus_lm_forest->AddEdge(phrases[i], Hypergraph::TailNodeVector());
-          edge->feature_values_ = edge->rule_->scores_;
-          edge->i_ = s.i;
-          edge->j_ = s.j;
-          minus_lm_forest->ConnectEdgeToHeadNode(edge->id_, phrase_head_index);
-        }
-        CoverageNodeMap::iterator cit = c.find(s.coverage);
-        assert(cit != c.end());
-        const int tail_node_plus1 = cit->second;
-        if (tail_node_plus1 == 0) {  // left edge
-          c[new_cov] = phrase_head_index + 1;
-        } else { // not left edge
-          int& head_node_plus1 = c[new_cov];
-          if (!head_node_plus1)
-            head_node_plus1 = minus_lm_forest->AddNode(kNT_TYPE)->id_ + 1;
-          Hypergraph::TailNodeVector tail(2, tail_node_plus1 - 1);
-          tail[1] = phrase_head_index;
-          const int concat_edge = minus_lm_forest->AddEdge(kCONCAT_RULE, tail)->id_;
-          minus_lm_forest->ConnectEdgeToHeadNode(concat_edge, head_node_plus1 - 1);
-        }
-      }
-      if (s.j == lattice.size()) continue;
-      for (int l = 0; l < arcs.size(); ++l) {
-        const LatticeArc& arc = arcs[l];
-
-        const FSTNode* next_fst_state = s.fst->Extend(arc.label);
-        const int next_j = s.j + arc.dist2next;
-        if (next_fst_state &&
-            !s.coverage.Collides(s.i, next_j)) {
-          q.push(State(s.coverage, s.i, next_j, next_fst_state));
-        }
-      }
+    stacks[0][empty_cov].score = 0;
+    vector<CoverageStack::const_iterator> survivors;
+    for (unsigned k = 0; k < lattice.size(); ++k) {
+      Prune(stacks[k], future, &survivors);
+      for (unsigned i = 0; i < survivors.size(); ++i)
+        Extend(survivors[i]->first, survivors[i]->second, &phrases, &stacks, minus_lm_forest);
+      CoverageStack().swap(stacks[k]);
     }
     if (add_pass_through_rules)
       fst->ClearPassThroughTranslations();
-    int pregoal_plus1 = c[goal_cov];
-    if (pregoal_plus1 > 0) {
+    const Coverage goal_cov(lattice.size(), true);
+    CoverageStack::const_iterator pregoal = stacks.back().find(goal_cov);
+    if (pregoal != stacks.back().end()) {
       TRulePtr kGOAL_RULE(new TRule("[Goal] ||| [X,1] ||| [X,1]"));
       int goal = minus_lm_forest->AddNode(TD::Convert("Goal") * -1)->id_;
-      int gedge = minus_lm_forest->AddEdge(kGOAL_RULE, Hypergraph::TailNodeVector(1, pregoal_plus1 - 1))->id_;
+      int gedge = minus_lm_forest->AddEdge(kGOAL_RULE, Hypergraph::TailNodeVector(1, pregoal->second.node))->id_;
       minus_lm_forest->ConnectEdgeToHeadNode(gedge, goal);
       // they are almost topo, but not quite always
       minus_lm_forest->TopologicallySortNodesAndEdges(goal);
@@ -199,6 +377,8 @@ struct PhraseBasedTranslatorImpl {
 
   const bool add_pass_through_rules;
   const int max_distortion;
+  const unsigned stack_size;
+  const double beam;
   const TRulePtr kCONCAT_RULE;
   const WordID kNT_TYPE;
   boost::shared_ptr<FSTNode> fst;
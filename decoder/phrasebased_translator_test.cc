@@ -0,0 +1,84 @@
+#define BOOST_TEST_MODULE PhraseBasedTranslatorTest
+#include <boost/test/unit_test.hpp>
+#include <boost/test/floating_point_comparison.hpp>
+#include <boost/program_options/variables_map.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+#include "phrasebased_translator.h"
+#include "sentence_metadata.h"
+#include "lattice.h"
+#include "viterbi.h"
+#include "hg.h"
+#include "fdict.h"
+#include "tdict.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+// decodes input with the phrase table in test_data, sets *trans to the best
+// translation and returns its score (-infinity if there is none)
+static double Decode(const string& input, int max_distortion, int stack_size, double beam,
+                     vector<WordID>* trans, int* num_nodes) {
+  const string path(boost::unit_test::framework::master_test_suite().argc == 2 ? boost::unit_test::framework::master_test_suite().argv[1] : TEST_DATA);
+  po::variables_map conf;
+  conf.insert(make_pair("grammar", po::variable_value(vector<string>(1, path + "/phrasebased.phrases"), false)));
+  conf.insert(make_pair("pb_max_distortion", po::variable_value(max_distortion, false)));
+  conf.insert(make_pair("pb_stack_size", po::variable_value(stack_size, false)));
+  conf.insert(make_pair("pb_beam", po::variable_value(beam, false)));
+  PhraseBasedTranslator translator(conf);
+  translator.ProcessMarkupHints(map<string, string>());
+  vector<double> weights(FD::Convert("PhraseModel_0") + 1);
+  weights[FD::Convert("PhraseModel_0")] = 1;
+  SentenceMetadata smeta(0, Lattice());
+  Hypergraph forest;
+  trans->clear();
+  *num_nodes = 0;
+  if (!translator.Translate(input, &smeta, weights, &forest)) return -numeric_limits<double>::infinity();
+  *num_nodes = forest.nodes_.size();
+  return log(ViterbiESentence(forest, trans));
+}
+
+static vector<string> SortedWords(const vector<WordID>& words) {
+  vector<string> res;
+  for (unsigned i = 0; i < words.size(); ++i)
+    res.push_back(TD::Convert(words[i]));
+  sort(res.begin(), res.end());
+  return res;
+}
+
+BOOST_AUTO_TEST_CASE(TestMonotone) {
+  vector<WordID> trans;
+  int nodes, pruned_nodes;
+  BOOST_CHECK_CLOSE(Decode("a b c d", 0, 0, 0, &trans, &nodes), -2.0, 1e-4);
+  BOOST_CHECK_EQUAL(TD::GetString(trans), "A BC D2");
+  BOOST_CHECK_CLOSE(Decode("a b c d", 0, 1, 0, &trans, &pruned_nodes), -2.0, 1e-4);
+  BOOST_CHECK_EQUAL(TD::GetString(trans), "A BC D2");
+  // there is only one coverage per number of covered words
+  BOOST_CHECK_EQUAL(nodes, pruned_nodes);
+}
+
+// without a language model, the future cost of a coverage is exact, so
+// pruning keeps the best translation (up to the order of its phrases, which
+// all have the same score) while expanding fewer coverages
+BOOST_AUTO_TEST_CASE(TestPruning) {
+  vector<WordID> trans;
+  int nodes;
+  BOOST_CHECK_CLOSE(Decode("a b c d", 4, 0, 0, &trans, &nodes), -2.0, 1e-4);
+  vector<string> best = SortedWords(trans);
+  BOOST_CHECK_EQUAL(best.size(), 3);
+
+  int stack_nodes;
+  BOOST_CHECK_CLOSE(Decode("a b c d", 4, 1, 0, &trans, &stack_nodes), -2.0, 1e-4);
+  BOOST_CHECK(SortedWords(trans) == best);
+  BOOST_CHECK_LT(stack_nodes, nodes);
+
+  int beam_nodes;
+  BOOST_CHECK_CLOSE(Decode("a b c d", 4, 0, 0.1, &trans, &beam_nodes), -2.0, 1e-4);
+  BOOST_CHECK(SortedWords(trans) == best);
+  BOOST_CHECK_LT(beam_nodes, nodes);
+}
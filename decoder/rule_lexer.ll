@@ -8,6 +8,7 @@
 #include <cstring>
 #include <cassert>
 #include <stack>
+#include <boost/thread/mutex.hpp>
 #include "tdict.h"
 #include "fdict.h"
 #include "trule.h"
@@ -17,8 +18,10 @@
 bool lex_mono_rules = false;
 int lex_line = 0;
 std::istream* scfglex_stream = NULL;
-RuleLexer::RuleCallback rule_callback = NULL;
-void* rule_callback_extra = NULL;
+// the rule that was just read, which yylex returns to scan_rules
+TRulePtr scfglex_rule;
+TRulePtr scfglex_coarse_rule;
+unsigned int scfglex_rule_ctf_level = 0;
 std::vector<int> scfglex_phrase_fnames;
 std::string scfglex_fname;
 
@@ -255,8 +258,9 @@ NT ([^\t \n\r\[\],]+|Goal)
 		  rp->tree_structure.swap(scfglex_tree);
 		}
 		check_and_update_ctf_stack(rp);
-		TRulePtr coarse_rp = ((ctf_level == 0) ? TRulePtr() : ctf_rule_stack.top());
-		rule_callback(rp, ctf_level, coarse_rp, rule_callback_extra);
+		scfglex_coarse_rule = ((ctf_level == 0) ? TRulePtr() : ctf_rule_stack.top());
+		scfglex_rule = rp;
+		scfglex_rule_ctf_level = ctf_level;
 		ctf_rule_stack.push(rp);
 		//std::cerr << "RULE: " << rp->AsString() << std::endl;
 		num_rules++;
@@ -267,6 +271,7 @@ NT ([^\t \n\r\[\],]+|Goal)
 		}
 		ctf_level = 0;
 		BEGIN(INITIAL);
+		return 1;
 		}
 
 <FEATS>[ \t;]	{ ; }
@@ -332,6 +337,13 @@ NT ([^\t \n\r\[\],]+|Goal)
 
 #include "filelib.h"
 
+// the flex scanner is not reentrant, so the calls to ReadRules and ReadRule
+// take turns: each one holds lexer_mutex only while it scans one rule, and
+// keeps its own buffer and state in between. The rule callback is called
+// after the lock is released, so callbacks of different grammars run
+// concurrently and may read rules themselves
+static boost::mutex lexer_mutex;
+
 static void init_default_feature_names() {
   if (scfglex_phrase_fnames.empty()) {
     scfglex_phrase_fnames.resize(100);
@@ -343,26 +355,46 @@ static void init_default_feature_names() {
   }
 }
 
+// reads the rules from in, or from srule if in is NULL
+static void scan_rules(std::istream* in, const std::string& srule, RuleLexer::RuleCallback func, const std::string& fname, bool mono, void* extra) {
+  YY_BUFFER_STATE buffer = NULL;
+  std::stack<TRulePtr> ctf_stack;
+  int line = 1;
+  while (true) {
+    TRulePtr rule, coarse_rule;
+    unsigned int level;
+    {
+      boost::mutex::scoped_lock lock(lexer_mutex);
+      init_default_feature_names();
+      lex_mono_rules = mono;
+      lex_line = line;
+      scfglex_fname = fname;
+      scfglex_stream = in;
+      ctf_rule_stack.swap(ctf_stack);
+      if (!buffer)
+        buffer = in ? yy_create_buffer(NULL, YY_BUF_SIZE) : yy_scan_string(srule.c_str());
+      yy_switch_to_buffer(buffer);
+      BEGIN(INITIAL);
+      const bool more = yylex();
+      ctf_rule_stack.swap(ctf_stack);
+      line = lex_line;
+      if (!more) {
+        yy_delete_buffer(buffer);
+        return;
+      }
+      rule.swap(scfglex_rule);
+      coarse_rule.swap(scfglex_coarse_rule);
+      level = scfglex_rule_ctf_level;
+    }
+    func(rule, level, coarse_rule, extra);
+  }
+}
+
 void RuleLexer::ReadRules(std::istream* in, RuleLexer::RuleCallback func, const std::string& fname, void* extra) {
-  init_default_feature_names();
-  lex_mono_rules = false;
-  lex_line = 1;
-  scfglex_fname = fname;
-  scfglex_stream = in;
-  rule_callback_extra = extra,
-  rule_callback = func;
-  yylex();
+  scan_rules(in, "", func, fname, false, extra);
 }
 
 void RuleLexer::ReadRule(const std::string& srule, RuleCallback func, bool mono, void* extra) {
-  init_default_feature_names();
-  scfglex_fname = srule;
-  lex_mono_rules = mono;
-  lex_line = 1;
-  rule_callback_extra = extra;
-  rule_callback = func;
-  yy_scan_string(srule.c_str());
-  yylex();
-  yylex_destroy();
+  scan_rules(NULL, srule, func, srule, mono, extra);
 }
 
@@ -0,0 +1,104 @@
+#include "rule_store.h"
+
+#include <cstdlib>
+#include <limits>
+
+#include <boost/static_assert.hpp>
+
+#include "murmur_hash3.h"
+
+using namespace std;
+
+BOOST_STATIC_ASSERT(sizeof(AlignmentPoint) == 2 * sizeof(short));
+
+static void TooLarge(const char* what) {
+  cerr << "RuleStore: too many " << what << endl;
+  abort();
+}
+
+bool RuleStore::CanStore(const TRule& rule) {
+  return !rule.parent_rule_ && !rule.fine_rules_ && !rule.tree_structure &&
+         rule.ext_states_.empty() && rule.prev_i == -1 && rule.prev_j == -1 &&
+         rule.f_.size() <= numeric_limits<uint16_t>::max() &&
+         rule.e_.size() <= numeric_limits<uint16_t>::max() &&
+         rule.scores_.size() <= numeric_limits<uint16_t>::max() &&
+         rule.a_.size() <= numeric_limits<uint16_t>::max();
+}
+
+uint32_t RuleStore::AddSymbols(const vector<WordID>& syms) {
+  if (syms.empty()) return 0;
+  const uint64_t h = cdec::MurmurHash3_64(&syms[0], syms.size() * sizeof(WordID), syms.size());
+  boost::unordered_map<uint64_t, uint32_t>::iterator it = sequences_.find(h);
+  if (it != sequences_.end() && it->second + syms.size() <= symbols_.size() &&
+      equal(syms.begin(), syms.end(), symbols_.begin() + it->second))
+    return it->second;
+  if (symbols_.size() + syms.size() > numeric_limits<uint32_t>::max()) TooLarge("symbols");
+  const uint32_t offset = symbols_.size();
+  symbols_.insert(symbols_.end(), syms.begin(), syms.end());
+  sequences_[h] = offset;  // on a hash collision the newer sequence wins
+  return offset;
+}
+
+uint32_t RuleStore::Add(const TRule& rule) {
+  assert(CanStore(rule));
+  if (rules_.size() == numeric_limits<uint32_t>::max()) TooLarge("rules");
+  if (feature_ids_.size() + rule.scores_.size() > numeric_limits<uint32_t>::max()) TooLarge("feature values");
+  if (alignment_.size() + rule.a_.size() > numeric_limits<uint32_t>::max()) TooLarge("alignment points");
+  PackedRule r;
+  r.f = AddSymbols(rule.f_);
+  r.e = AddSymbols(rule.e_);
+  r.features = feature_ids_.size();
+  for (SparseVector<double>::const_iterator it = rule.scores_.begin(); it != rule.scores_.end(); ++it) {
+    feature_ids_.push_back(it->first);
+    feature_values_.push_back(it->second);
+  }
+  r.alignment = alignment_.size();
+  alignment_.insert(alignment_.end(), rule.a_.begin(), rule.a_.end());
+  r.lhs = rule.lhs_;
+  r.f_size = rule.f_.size();
+  r.e_size = rule.e_.size();
+  r.num_features = feature_ids_.size() - r.features;
+  r.num_alignment_points = rule.a_.size();
+  r.arity = rule.arity_;
+  rules_.push_back(r);
+  return rules_.size() - 1;
+}
+
+TRulePtr RuleStore::Get(uint32_t id) const {
+  const PackedRule& r = rules_[id];
+  return TRulePtr(new TRule(r.lhs,
+                            r.f_size ? &symbols_[r.f] : NULL, r.f_size,
+                            r.e_size ? &symbols_[r.e] : NULL, r.e_size,
+                            r.num_features ? &feature_ids_[r.features] : NULL,
+                            r.num_features ? &feature_values_[r.features] : NULL,
+                            r.num_features,
+                            r.arity,
+                            r.num_alignment_points ? &alignment_[r.alignment] : NULL,
+                            r.num_alignment_points));
+}
+
+void RuleStore::clear() {
+  rules_.clear();
+  symbols_.clear();
+  feature_ids_.clear();
+  feature_values_.clear();
+  alignment_.clear();
+  sequences_.clear();
+}
+
+void RuleStore::DoneAdding() {
+  boost::unordered_map<uint64_t, uint32_t>().swap(sequences_);
+  vector<PackedRule>(rules_).swap(rules_);
+  vector<WordID>(symbols_).swap(symbols_);
+  vector<int>(feature_ids_).swap(feature_ids_);
+  vector<double>(feature_values_).swap(feature_values_);
+  vector<AlignmentPoint>(alignment_).swap(alignment_);
+}
+
+size_t RuleStore::BytesUsed() const {
+  return rules_.size() * sizeof(PackedRule) +
+         symbols_.size() * sizeof(WordID) +
+         feature_ids_.size() * sizeof(int) +
+         feature_values_.size() * sizeof(double) +
+         alignment_.size() * sizeof(AlignmentPoint);
+}
@@ -0,0 +1,71 @@
+#ifndef RULE_STORE_H_
+#define RULE_STORE_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+#include "trule.h"
+
+// A compact, append-only table of rules. A TRule is a few hundred bytes
+// (three vectors, a SparseVector, several shared_ptrs) plus the memory they
+// point to; here a rule is a 32-byte record with offsets into shared pools:
+// the source and target sides are ranges of one pool of symbols, in which
+// equal sequences (e.g., the source sides of all rules of a trie node) are
+// stored once, and the features are ranges of parallel arrays of feature
+// ids and values. Rules are referred to by 32-bit ids and turned back into
+// TRules by Get().
+//
+// Only the parts of a rule that a grammar provides are stored, see
+// CanStore().
+class RuleStore {
+ public:
+  RuleStore() {}
+
+  // true if Get(Add(rule)) is equal to rule, i.e., rule has no attributes
+  // set by the decoder (parent_rule_, fine_rules_, tree_structure,
+  // ext_states_ or a span)
+  static bool CanStore(const TRule& rule);
+
+  // returns the id of the new rule (ids are 0, 1, 2, ...)
+  uint32_t Add(const TRule& rule);
+  // a new TRule with the contents of rule id
+  TRulePtr Get(uint32_t id) const;
+
+  uint32_t size() const { return rules_.size(); }
+  bool empty() const { return rules_.empty(); }
+  void clear();
+
+  // frees the index used to share symbol sequences between rules. Rules
+  // may still be added but won't share sequences with earlier ones.
+  void DoneAdding();
+
+  // bytes used by the pools and rule records
+  size_t BytesUsed() const;
+
+ private:
+  struct PackedRule {
+    uint32_t f;             // f_ is symbols_[f .. f+f_size-1]
+    uint32_t e;             // e_ is symbols_[e .. e+e_size-1]
+    uint32_t features;      // into feature_ids_ and feature_values_
+    uint32_t alignment;     // into alignment_
+    WordID lhs;
+    uint16_t f_size;
+    uint16_t e_size;
+    uint16_t num_features;
+    uint16_t num_alignment_points;
+    int32_t arity;
+  };
+
+  uint32_t AddSymbols(const std::vector<WordID>& syms);
+
+  std::vector<PackedRule> rules_;
+  std::vector<WordID> symbols_;
+  std::vector<int> feature_ids_;
+  std::vector<double> feature_values_;
+  std::vector<AlignmentPoint> alignment_;
+  boost::unordered_map<uint64_t, uint32_t> sequences_;  // hash -> offset
+};
+
+#endif
@@ -1,13 +1,20 @@
 #include <algorithm>
+#include <list>
 #include <vector>
 #include <unordered_set>
+#include <sys/stat.h>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/function.hpp>
 #include <boost/functional/hash.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
 #include "fast_lexical_cast.hpp"
 #include "hash.h"
 #include "translator.h"
 #include "hg.h"
 #include "grammar.h"
+#include "compiled_grammar.h"
 #include "bottom_up_parser.h"
 #include "sentence_metadata.h"
 #include "stringlib.h"
@@ -90,6 +97,171 @@ bool PassThroughGrammar::HasRuleForSpan(int, int, int distance) const {
   return (distance < 4);  // TODO this isn't great, but helps with EPS lattices
 }
 
+// reads a grammar file in the text or the compiled format. A per-sentence
+// text grammar keeps its TRules (see TextGrammar::SetUseRuleStore)
+static GrammarPtr LoadGrammar(const string& file, int max_span_limit, bool per_sentence) {
+  if (CompiledGrammar::IsCompiledGrammar(file)) {
+    CompiledGrammar* g = new CompiledGrammar(file);
+    g->SetMaxSpan(max_span_limit);
+    g->SetGrammarName(file);
+    return GrammarPtr(g);
+  }
+  TextGrammar* g = new TextGrammar;
+  g->SetUseRuleStore(!per_sentence);
+  g->ReadFromFile(file);
+  g->SetMaxSpan(max_span_limit);
+  g->SetGrammarName(file);
+  return GrammarPtr(g);
+}
+
+// Loads the per-sentence grammars of sentences that will be translated later
+// in a background thread, so that reading and parsing them overlaps with
+// decoding. Grammars that have been loaded but not yet used may take up at
+// most max_bytes (measured by the size of their files); the thread waits
+// until a grammar has been used before it loads the next one. Grammars that
+// were not requested in advance are loaded by the caller of Get. This is
+// shared by the translators of all decoding threads.
+//
+// Sentences are translated in the order they are requested, except that
+// num_threads of them may be translated at the same time. Once the grammars
+// of a sentence have been passed over by num_threads later sentences, the
+// sentence has been skipped, and they are freed (if the guess is wrong, Get
+// loads them again).
+class GrammarPrefetcher {
+ public:
+  typedef boost::function<GrammarPtr (const string&)> Loader;
+  GrammarPrefetcher(const Loader& load, uint64_t max_bytes, int num_threads) :
+      load_(load), max_bytes_(max_bytes), max_skips_(max(num_threads, 1)),
+      loaded_bytes_(0), stop_(false) {
+    thread_.reset(new boost::thread(boost::bind(&GrammarPrefetcher::Run, this)));
+  }
+
+  ~GrammarPrefetcher() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    thread_->join();
+    // grammars of sentences that were never translated
+    entries_.clear();
+    loaded_bytes_ = 0;
+  }
+
+  // requests the grammars of the next sentence
+  void Request(const vector<string>& files) {
+    boost::mutex::scoped_lock lock(mutex_);
+    entries_.push_back(Entry(files));
+    cond_.notify_all();
+  }
+
+  // the grammars of a sentence, in the order of files
+  void Get(const vector<string>& files, vector<GrammarPtr>* grammars) {
+    boost::mutex::scoped_lock lock(mutex_);
+    list<Entry>::iterator it = entries_.begin();
+    while (it != entries_.end() && (it->claimed || it->files != files)) ++it;
+    // the earlier sentences that are still waiting for their grammars
+    for (list<Entry>::iterator prev = entries_.begin(); it != entries_.end() && prev != it;) {
+      list<Entry>::iterator skipped = prev++;
+      if (!skipped->claimed && skipped->state != kLoading && ++skipped->skips >= max_skips_)
+        Erase(skipped);
+    }
+    if (it == entries_.end() || it->state == kPending) {
+      if (it != entries_.end()) Erase(it);
+      lock.unlock();
+      grammars->clear();
+      for (unsigned i = 0; i < files.size(); ++i)
+        grammars->push_back(load_(files[i]));
+      return;
+    }
+    it->claimed = true;
+    while (it->state == kLoading) cond_.wait(lock);
+    *grammars = it->grammars;
+    Erase(it);
+  }
+
+ private:
+  enum State { kPending, kLoading, kDone };
+  struct Entry {
+    explicit Entry(const vector<string>& f) : files(f), state(kPending), claimed(false), skips(0), bytes(0) {}
+    vector<string> files;
+    State state;
+    bool claimed;   // a translator is waiting for these grammars
+    int skips;      // number of later sentences whose grammars were used first
+    uint64_t bytes;
+    vector<GrammarPtr> grammars;
+  };
+
+  // frees the grammars of an entry that is not being loaded (requires mutex_)
+  void Erase(list<Entry>::iterator it) {
+    loaded_bytes_ -= it->bytes;
+    entries_.erase(it);
+    cond_.notify_all();
+  }
+
+  void Run() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (!stop_) {
+      list<Entry>::iterator it = entries_.begin();
+      while (it != entries_.end() && it->state != kPending) ++it;
+      if (it == entries_.end() || (loaded_bytes_ > 0 && loaded_bytes_ >= max_bytes_)) {
+        cond_.wait(lock);
+        continue;
+      }
+      it->state = kLoading;
+      for (unsigned i = 0; i < it->files.size(); ++i) {
+        struct stat st;
+        if (stat(it->files[i].c_str(), &st) == 0) it->bytes += st.st_size;
+      }
+      loaded_bytes_ += it->bytes;
+      const vector<string> files = it->files;
+      lock.unlock();
+      vector<GrammarPtr> grammars;
+      for (unsigned i = 0; i < files.size(); ++i)
+        grammars.push_back(load_(files[i]));
+      lock.lock();
+      // entries that are being loaded are never erased
+      it->grammars.swap(grammars);
+      it->state = kDone;
+      cond_.notify_all();
+    }
+  }
+
+  const Loader load_;
+  const uint64_t max_bytes_;
+  const int max_skips_;
+  uint64_t loaded_bytes_;
+  bool stop_;
+  list<Entry> entries_;
+  boost::mutex mutex_;
+  boost::condition_variable cond_;
+  boost::scoped_ptr<boost::thread> thread_;
+};
+
+// the files named by the grammar, grammar1, grammar2, ... sentence markup
+static void SentenceGrammarFiles(const map<string, string>& kv, vector<string>* files) {
+  if (kv.find("grammar0") != kv.end()) {
+    cerr << "SGML tag grammar0 is not expected (order is: grammar, grammar1, grammar2, ...)\n";
+    abort();
+  }
+  unsigned gc = 0;
+  set<string> loaded;
+  while(true) {
+    string gkey = "grammar";
+    if (gc > 0) gkey += boost::lexical_cast<string>(gc);
+    ++gc;
+    map<string,string>::const_iterator it = kv.find(gkey);
+    if (it == kv.end()) break;
+    const string& gfile = it->second;
+    if (loaded.count(gfile) == 1) {
+      cerr << "Attempting to load " << gfile << " twice!\n";
+      abort();
+    }
+    loaded.insert(gfile);
+    files->push_back(gfile);
+  }
+}
+
 struct SCFGTranslatorImpl {
   SCFGTranslatorImpl(const boost::program_options::variables_map& conf) :
       max_span_limit(conf["scfg_max_span_limit"].as<int>()),
@@ -99,14 +271,15 @@ struct SCFGTranslatorImpl {
       default_nt(conf["scfg_default_nt"].as<string>()),
       use_ctf_(conf.count("coarse_to_fine_beam_prune"))
   {
+    if (conf["prefetch_grammars"].as<int>() > 0) {
+      const uint64_t max_mb = conf["prefetch_grammars_max_mb"].as<int>();
+      prefetcher_.reset(new GrammarPrefetcher(boost::bind(&::LoadGrammar, _1, max_span_limit, true), max_mb << 20, conf["threads"].as<int>()));
+    }
     if(conf.count("grammar")){
       vector<string> gfiles = conf["grammar"].as<vector<string> >();
       for (unsigned i = 0; i < gfiles.size(); ++i) {
         if (!SILENT) cerr << "Reading SCFG grammar from " << gfiles[i] << endl;
-        TextGrammar* g = new TextGrammar(gfiles[i]);
-        g->SetMaxSpan(max_span_limit);
-        g->SetGrammarName(gfiles[i]);
-        grammars.push_back(GrammarPtr(g));
+        grammars.push_back(LoadGrammar(gfiles[i]));
       }
       if (!SILENT) cerr << endl;
     }
@@ -147,6 +320,20 @@ struct SCFGTranslatorImpl {
     }
  }
 
+  GrammarPtr LoadGrammar(const string& file) const {
+    return ::LoadGrammar(file, max_span_limit, false);
+  }
+
+  void LoadSentenceGrammars(const vector<string>& files, vector<GrammarPtr>* grammars) const {
+    if (prefetcher_) {
+      prefetcher_->Get(files, grammars);
+      return;
+    }
+    grammars->clear();
+    for (unsigned i = 0; i < files.size(); ++i)
+      grammars->push_back(::LoadGrammar(files[i], max_span_limit, true));
+  }
+
   const int max_span_limit;
   const bool add_pass_through_rules;
   const unsigned int num_pt_features;
@@ -161,6 +348,7 @@ struct SCFGTranslatorImpl {
   unsigned int ctf_iterations_;
   vector<GrammarPtr> grammars;
   set<GrammarPtr> sup_grammars_;
+  boost::shared_ptr<GrammarPrefetcher> prefetcher_;
 
   struct ContainedIn {
     ContainedIn(const set<GrammarPtr>& gs) : gs_(gs) {}
@@ -171,7 +359,9 @@ struct SCFGTranslatorImpl {
   void AddSupplementalGrammarFromString(const std::string& grammar_string) {
     grammars.erase(remove_if(grammars.begin(), grammars.end(), ContainedIn(sup_grammars_)), grammars.end());
     istringstream in(grammar_string);
-    TextGrammar* sent_grammar = new TextGrammar(&in);
+    TextGrammar* sent_grammar = new TextGrammar;
+    sent_grammar->SetUseRuleStore(false);
+    sent_grammar->ReadFromStream(&in);
     sent_grammar->SetMaxSpan(max_span_limit);
     sent_grammar->SetGrammarName("SupFromString");
     AddSupplementalGrammar(GrammarPtr(sent_grammar));
@@ -369,29 +559,20 @@ bool SCFGTranslator::TranslateImpl(const string& input,
 // Check for extra grammars in the sentence markup, for use with sentence specific grammars
 //
 void SCFGTranslator::ProcessMarkupHintsImpl(const map<string, string>& kv) {
-  if (kv.find("grammar0") != kv.end()) {
-    cerr << "SGML tag grammar0 is not expected (order is: grammar, grammar1, grammar2, ...)\n";
-    abort();
-  }
-  unsigned gc = 0;
-  set<string> loaded;
-  while(true) {
-    string gkey = "grammar";
-    if (gc > 0) gkey += boost::lexical_cast<string>(gc);
-    ++gc;
-    map<string,string>::const_iterator it = kv.find(gkey);
-    if (it == kv.end()) break;
-    const string& gfile = it->second;
-    if (loaded.count(gfile) == 1) {
-      cerr << "Attempting to load " << gfile << " twice!\n";
-      abort();
-    }
-    loaded.insert(gfile);
-    TextGrammar* sentGrammar = new TextGrammar(gfile);
-    sentGrammar->SetMaxSpan(pimpl_->max_span_limit);
-    sentGrammar->SetGrammarName(gfile);
-    pimpl_->AddSupplementalGrammar(GrammarPtr(sentGrammar));
-  }
+  vector<string> files;
+  SentenceGrammarFiles(kv, &files);
+  if (files.empty()) return;
+  vector<GrammarPtr> grammars;
+  pimpl_->LoadSentenceGrammars(files, &grammars);
+  for (unsigned i = 0; i < grammars.size(); ++i)
+    pimpl_->AddSupplementalGrammar(grammars[i]);
+}
+
+void SCFGTranslator::Prefetch(const map<string, string>& kv) {
+  if (!pimpl_->prefetcher_) return;
+  vector<string> files;
+  SentenceGrammarFiles(kv, &files);
+  if (!files.empty()) pimpl_->prefetcher_->Request(files);
 }
 
 void SCFGTranslator::AddSupplementalGrammarFromString(const std::string& grammar) {
@@ -404,9 +585,19 @@ void SCFGTranslator::AddSupplementalGrammar(GrammarPtr grammar) {
 
 void SCFGTranslator::SentenceCompleteImpl() {
   pimpl_->RemoveSupplementalGrammars();
+  CompiledGrammar::ReleaseNodes();
+  TextGrammar::ReleaseRules();
 }
 
 std::string SCFGTranslator::GetDecoderType() const {
   return "SCFG";
 }
 
+Translator* SCFGTranslator::CloneForThread() const {
+  // coarse-to-fine parsing refines the (shared) rules in place
+  if (pimpl_->use_ctf_) return NULL;
+  SCFGTranslator* res = new SCFGTranslator(*this);
+  res->pimpl_.reset(new SCFGTranslatorImpl(*pimpl_));  // grammars are shared
+  return res;
+}
+
@@ -7,6 +7,7 @@
 #include "lattice.h"
 #include "tree_fragment.h"
 
+class DecodingStats;
 class DocScorer;  // deprecated, will be removed
 class Score;     // deprecated, will be removed
 
@@ -24,6 +25,7 @@ class SentenceMetadata {
     has_reference_(ref.size() > 0),
     trg_len_(ref.size()),
     ref_(has_reference_ ? &ref : NULL),
+    stats_(NULL),
     input_type_(cdec::kUNKNOWN) {}
 
   // helper function for lattice inputs
@@ -66,6 +68,10 @@ class SentenceMetadata {
   const DocScorer& GetDocScorer() const { return *ds; }
   double GetDocLen() const {return doc_len;}
 
+  // measurements of the decoder's stages for this sentence, NULL unless
+  // the decoder was asked to collect them (--decoding_stats)
+  DecodingStats* GetStats() const { return stats_; }
+
   std::string GetSGMLValue(const std::string& key) const {
     std::map<std::string, std::string>::const_iterator it = sgml_.find(key);
     if (it == sgml_.end()) return "";
@@ -89,6 +95,7 @@ class SentenceMetadata {
   const bool has_reference_;
   int trg_len_;
   const Lattice* const ref_;
+  DecodingStats* stats_;
  public:
   cdec::InputType input_type_;
 };
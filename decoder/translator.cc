@@ -13,6 +13,12 @@ std::string Translator::GetDecoderType() const {
   return "UNKNOWN";
 }
 
+Translator* Translator::CloneForThread() const {
+  return NULL;
+}
+
+void Translator::Prefetch(const map<string, string>&) {}
+
 void Translator::ProcessMarkupHints(const map<string, string>& kv) {
   if (state_ != kUninitialized) {
     cerr << "Translator::ProcessMarkupHints in wrong state: " << state_ << endl;
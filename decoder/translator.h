@@ -41,7 +41,17 @@ class Translator {
 
   // Free any sentence-specific resources
   void SentenceComplete();
+
+  // This may be called with the markup of a sentence that will be
+  // translated later (in any state) so that sentence-specific resources,
+  // e.g., grammars, can be loaded in the background.
+  virtual void Prefetch(const std::map<std::string, std::string>& kv);
   virtual std::string GetDecoderType() const;
+
+  // Returns a new translator for use by another decoding thread. It shares
+  // this translator's read-only models (e.g., grammars) but has its own
+  // per-sentence state. Returns NULL if the translator does not support this.
+  virtual Translator* CloneForThread() const;
  protected:
   virtual bool TranslateImpl(const std::string& src,
                              SentenceMetadata* smeta,
@@ -61,6 +71,8 @@ class SCFGTranslator : public Translator {
   void AddSupplementalGrammar(GrammarPtr gp);
   void AddSupplementalGrammarFromString(const std::string& grammar);
   virtual std::string GetDecoderType() const;
+  virtual Translator* CloneForThread() const;
+  virtual void Prefetch(const std::map<std::string, std::string>& kv);
  protected:
   bool TranslateImpl(const std::string& src,
                  SentenceMetadata* smeta,
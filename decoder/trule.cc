@@ -41,19 +41,25 @@ TRule* TRule::CreateRuleMonolingual(const string& rule) {
 
 namespace {
 // callback for single rule lexer
-int n_assigned=0;
+struct AssignTarget {
+  AssignTarget(TRule* r) : rule(r), n_assigned() {}
+  TRule* rule;
+  int n_assigned;
+};
   void assign_trule(const TRulePtr& new_rule, const unsigned int ctf_level, const TRulePtr& coarse_rule, void* extra) {
     (void) ctf_level;
     (void) coarse_rule;
-    *static_cast<TRule*>(extra) = *new_rule;
-    ++n_assigned;
+    AssignTarget* target = static_cast<AssignTarget*>(extra);
+    *target->rule = *new_rule;
+    ++target->n_assigned;
   }
 }
 
 bool TRule::ReadFromString(const string& line, bool mono) {
-  n_assigned = 0;
+  AssignTarget target(this);
   //cerr << "LINE: " << line << "  -- mono=" << mono << endl;
-  RuleLexer::ReadRule(line + '\n', assign_trule, mono, this);
+  RuleLexer::ReadRule(line + '\n', assign_trule, mono, &target);
+  const int n_assigned = target.n_assigned;
   if (n_assigned > 1)
     cerr<<"\nWARNING: more than one rule parsed from multi-line string; kept last: "<<line<<".\n";
   if (mono) {
@@ -5,7 +5,9 @@
 #include "fast_lexical_cast.hpp"
 #include <sstream>
 #include <vector>
+#include <boost/thread/mutex.hpp>
 #include "hg.h"
+#include "kbest.h"
 
 
 //#define DEBUG_VITERBI_SORT
@@ -26,6 +28,9 @@ std::string viterbi_stats(Hypergraph const& hg, std::string const& name, bool es
     o<<name<<"          tree: "<<ViterbiETree(hg)<<endl;
   }
   if (extract_rules) {
+    // the decoding threads write their rules one at a time
+    static boost::mutex extract_mutex;
+    boost::mutex::scoped_lock lock(extract_mutex);
     ViterbiRules(hg, extract_file->stream());
   }
   if (show_derivation) {
@@ -62,7 +67,12 @@ string ViterbiFTree(const Hypergraph& hg) {
 }
 
 prob_t ViterbiESentence(const Hypergraph& hg, vector<WordID>* result) {
-  return Viterbi<ESentenceTraversal>(hg, result);
+  // the yields of the nodes share their antecedents' yields; the string is
+  // only built for the goal
+  KBest::EYield yield;
+  const prob_t p = Viterbi<KBest::EYieldTraversal>(hg, &yield);
+  yield.Words(result);
+  return p;
 }
 
 prob_t ViterbiFSentence(const Hypergraph& hg, vector<WordID>* result) {
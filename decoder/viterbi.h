@@ -4,6 +4,7 @@
 #include <vector>
 #include "prob.h"
 #include "hg.h"
+#include "hg_csr.h"
 #include "tdict.h"
 #include "filelib.h"
 #include <boost/make_shared.hpp>
@@ -96,6 +97,60 @@ prob_t Viterbi(const Hypergraph& hg,
   return Viterbi(hg,result,traverse,weight);
 }
 
+// the same for the frozen form; the traversal and weight function are
+// called with (hg, edge) instead of an HG::Edge:
+//  void operator()(const CSRHypergraph& hg, unsigned e, const vector<const Result*>& ants, Result* result) const;
+//  Weight operator()(const CSRHypergraph& hg, unsigned e) const;
+template<class Traversal,class WeightFunction>
+typename WeightFunction::Weight Viterbi(const CSRHypergraph& hg,
+                   typename Traversal::Result* result,
+                   const Traversal& traverse,
+                   const WeightFunction& weight) {
+  typedef typename Traversal::Result T;
+  typedef typename WeightFunction::Weight WeightType;
+  const int num_nodes = hg.NumNodes();
+  std::vector<T> vit_result(num_nodes);
+  std::vector<WeightType> vit_weight(num_nodes, WeightType());
+  std::vector<const T*> antsb;
+
+  for (int i = 0; i < num_nodes; ++i) {
+    WeightType* const cur_node_best_weight = &vit_weight[i];
+    if (hg.NumInEdges(i) == 0) {
+      *cur_node_best_weight = WeightType(1);
+      continue;
+    }
+    int edge_best = -1;
+    for (unsigned e = hg.InBegin(i); e < hg.InEnd(i); ++e) {
+      WeightType score = weight(hg, e);
+      const int* tails = hg.Tails(e);
+      for (unsigned k = 0; k < hg.Arity(e); ++k)
+        score *= vit_weight[tails[k]];
+      if (edge_best < 0 || *cur_node_best_weight < score) {
+        *cur_node_best_weight = score;
+        edge_best = e;
+      }
+    }
+    antsb.resize(hg.Arity(edge_best));
+    for (unsigned k = 0; k < antsb.size(); ++k)
+      antsb[k] = &vit_result[hg.Tail(edge_best, k)];
+    traverse(hg, edge_best, antsb, &vit_result[i]);
+  }
+  if (vit_result.empty())
+    return WeightType(0);
+  std::swap(*result, vit_result.back());
+  return vit_weight.back();
+}
+
+template<class Traversal>
+prob_t Viterbi(const CSRHypergraph& hg,
+                   typename Traversal::Result* result,
+                   Traversal const& traverse=Traversal()
+  )
+{
+  EdgeProb weight;
+  return Viterbi(hg,result,traverse,weight);
+}
+
 struct PathLengthTraversal {
   typedef int Result;
   void operator()(const HG::Edge& edge,
@@ -105,6 +160,12 @@ struct PathLengthTraversal {
     *result = 1;
     for (unsigned i = 0; i < ants.size(); ++i) *result += *ants[i];
   }
+  void operator()(const CSRHypergraph&, unsigned,
+                  const std::vector<const int*>& ants,
+                  int* result) const {
+    *result = 1;
+    for (unsigned i = 0; i < ants.size(); ++i) *result += *ants[i];
+  }
 };
 
 struct ESentenceTraversal {
@@ -114,6 +175,11 @@ struct ESentenceTraversal {
                   Result* result) const {
     edge.rule_->ESubstitute(ants, result);
   }
+  void operator()(const CSRHypergraph& hg, unsigned e,
+                  const std::vector<const Result*>& ants,
+                  Result* result) const {
+    hg.Rule(e)->ESubstitute(ants, result);
+  }
 };
 
 struct ELengthTraversal {
@@ -124,6 +190,12 @@ struct ELengthTraversal {
     *result = edge.rule_->ELength() - edge.rule_->Arity();
     for (unsigned i = 0; i < ants.size(); ++i) *result += *ants[i];
   }
+  void operator()(const CSRHypergraph& hg, unsigned e,
+                  const std::vector<const int*>& ants,
+                  int* result) const {
+    *result = hg.Rule(e)->ELength() - hg.Rule(e)->Arity();
+    for (unsigned i = 0; i < ants.size(); ++i) *result += *ants[i];
+  }
 };
 
 struct FSentenceTraversal {
@@ -133,6 +205,11 @@ struct FSentenceTraversal {
                   Result* result) const {
     edge.rule_->FSubstitute(ants, result);
   }
+  void operator()(const CSRHypergraph& hg, unsigned e,
+                  const std::vector<const Result*>& ants,
+                  Result* result) const {
+    hg.Rule(e)->FSubstitute(ants, result);
+  }
 };
 
 // create a strings of the form (S (X the man) (X said (X he (X would (X go)))))
@@ -197,6 +274,13 @@ struct FeatureVectorTraversal {
       *result+=*ants[i];
     *result+=edge.feature_values_;
   }
+  void operator()(const CSRHypergraph& hg, unsigned e,
+                  std::vector<Result const*> const& ants,
+                  Result* result) const {
+    for (unsigned i = 0; i < ants.size(); ++i)
+      *result+=*ants[i];
+    hg.AddFeatures(e, result);
+  }
 };
 
 
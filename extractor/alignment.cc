@@ -16,6 +16,7 @@ using namespace std;
 namespace extractor {
 
 Alignment::Alignment(const string& filename) {
+  vector<vector<pair<int, int>>> alignments;
   ReadFile rf(filename);
   istream& infile = *rf.stream();
   string line;
@@ -29,19 +30,53 @@ Alignment::Alignment(const string& filename) {
     }
     alignments.push_back(alignment);
   }
-  alignments.shrink_to_fit();
+  SetAlignments(alignments);
 }
 
-Alignment::Alignment() {}
+Alignment::Alignment() {
+  link_start.push_back(0);
+}
 
 Alignment::~Alignment() {}
 
+void Alignment::SetAlignments(
+    const vector<vector<pair<int, int>>>& alignments) {
+  vector<int> values;
+  vector<uint64_t> starts;
+  for (const vector<pair<int, int>>& alignment: alignments) {
+    starts.push_back(values.size() / 2);
+    for (const pair<int, int>& link: alignment) {
+      values.push_back(link.first);
+      values.push_back(link.second);
+    }
+  }
+  starts.push_back(values.size() / 2);
+  links = move(values);
+  link_start = move(starts);
+}
+
 vector<pair<int, int>> Alignment::GetLinks(int sentence_index) const {
-  return alignments[sentence_index];
+  vector<pair<int, int>> result;
+  result.reserve(link_start[sentence_index + 1] - link_start[sentence_index]);
+  for (uint64_t i = link_start[sentence_index];
+       i < link_start[sentence_index + 1]; ++i) {
+    result.push_back(make_pair(links[2 * i], links[2 * i + 1]));
+  }
+  return result;
 }
 
 bool Alignment::operator==(const Alignment& other) const {
-  return alignments == other.alignments;
+  return links == other.links && link_start == other.link_start;
+}
+
+void Alignment::WriteFlat(FlatWriter& writer) const {
+  writer.Write(links);
+  writer.Write(link_start);
+}
+
+void Alignment::ReadFlat(FlatReader& reader) {
+  reader.Read(links);
+  reader.Read(link_start);
 }
 
 } // namespace extractor
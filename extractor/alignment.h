@@ -9,6 +9,9 @@
 #include <boost/serialization/utility.hpp>
 #include <boost/serialization/vector.hpp>
 
+#include "flat_array.h"
+#include "flat_file.h"
+
 using namespace std;
 
 namespace extractor {
@@ -31,14 +34,40 @@ class Alignment {
 
   bool operator==(const Alignment& alignment) const;
 
+  // Writes the alignment in the flat format (see flat_file.h).
+  void WriteFlat(FlatWriter& writer) const;
+
+  // Maps an alignment written by WriteFlat.
+  void ReadFlat(FlatReader& reader);
+
  private:
+  // Stores the links of all the sentences.
+  void SetAlignments(const vector<vector<pair<int, int>>>& alignments);
+
   friend class boost::serialization::access;
 
-  template<class Archive> void serialize(Archive& ar, unsigned int) {
-    ar & alignments;
+  template<class Archive> void save(Archive& ar, unsigned int) const {
+    vector<vector<pair<int, int>>> alignments(link_start.size() - 1);
+    for (size_t i = 0; i < alignments.size(); ++i) {
+      for (uint64_t j = link_start[i]; j < link_start[i + 1]; ++j) {
+        alignments[i].push_back(make_pair(links[2 * j], links[2 * j + 1]));
+      }
+    }
+    ar << alignments;
   }
 
-  vector<vector<pair<int, int>>> alignments;
+  template<class Archive> void load(Archive& ar, unsigned int) {
+    vector<vector<pair<int, int>>> alignments;
+    ar >> alignments;
+    SetAlignments(alignments);
+  }
+
+  BOOST_SERIALIZATION_SPLIT_MEMBER();
+
+  // The links of sentence i are (links[2 * j], links[2 * j + 1]) for
+  // link_start[i] <= j < link_start[i + 1].
+  FlatArray<int> links;
+  FlatArray<uint64_t> link_start;
 };
 
 } // namespace extractor
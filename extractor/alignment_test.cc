@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <memory>
 #include <sstream>
 #include <string>
 
@@ -7,6 +8,7 @@
 #include <boost/archive/binary_oarchive.hpp>
 
 #include "alignment.h"
+#include "flat_file.h"
 
 using namespace std;
 using namespace ::testing;
@@ -45,5 +47,18 @@ TEST_F(AlignmentTest, TestSerialization) {
   EXPECT_EQ(alignment, alignment_copy);
 }
 
+TEST_F(AlignmentTest, TestFlatSerialization) {
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "Alignment");
+  alignment.WriteFlat(writer);
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "Alignment");
+  Alignment alignment_copy;
+  alignment_copy.ReadFlat(reader);
+
+  EXPECT_EQ(alignment, alignment_copy);
+}
+
 } // namespace
 } // namespace extractor
@@ -1,5 +1,6 @@
 #include "data_array.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -17,11 +18,10 @@ string DataArray::NULL_WORD_STR = "__NULL__";
 string DataArray::END_OF_LINE_STR = "__END_OF_LINE__";
 
 DataArray::DataArray() {
-  InitializeDataArray();
+  SetWords({NULL_WORD_STR, END_OF_LINE_STR});
 }
 
 DataArray::DataArray(const string& filename) {
-  InitializeDataArray();
   ReadFile rf(filename);
   istream& infile = *rf.stream();
   vector<string> lines;
@@ -33,7 +33,6 @@ DataArray::DataArray(const string& filename) {
 }
 
 DataArray::DataArray(const string& filename, const Side& side) {
-  InitializeDataArray();
   ReadFile rf(filename);
   istream& infile = *rf.stream();
   vector<string> lines;
@@ -49,14 +48,14 @@ DataArray::DataArray(const string& filename, const Side& side) {
   CreateDataArray(lines);
 }
 
-void DataArray::InitializeDataArray() {
+void DataArray::CreateDataArray(const vector<string>& lines) {
+  unordered_map<string, int> word2id;
+  vector<string> id2word;
   word2id[NULL_WORD_STR] = NULL_WORD;
   id2word.push_back(NULL_WORD_STR);
   word2id[END_OF_LINE_STR] = END_OF_LINE;
   id2word.push_back(END_OF_LINE_STR);
-}
 
-void DataArray::CreateDataArray(const vector<string>& lines) {
   for (size_t i = 0; i < lines.size(); ++i) {
     sentence_start.push_back(data.size());
 
@@ -78,12 +77,29 @@ void DataArray::CreateDataArray(const vector<string>& lines) {
   data.shrink_to_fit();
   sentence_id.shrink_to_fit();
   sentence_start.shrink_to_fit();
+  SetWords(id2word);
+}
+
+void DataArray::SetWords(const vector<string>& words) {
+  vector<char> chars;
+  vector<uint64_t> starts;
+  vector<uint64_t> hashes;
+  for (const string& word: words) {
+    starts.push_back(chars.size());
+    chars.insert(chars.end(), word.begin(), word.end());
+    hashes.push_back(FlatHash(word.data(), word.size()));
+  }
+  starts.push_back(chars.size());
+
+  word_chars = move(chars);
+  word_start = move(starts);
+  word_index = FlatHashIndex(hashes);
 }
 
 DataArray::~DataArray() {}
 
 vector<int> DataArray::GetData() const {
-  return data;
+  return data.ToVector();
 }
 
 int DataArray::AtIndex(int index) const {
@@ -91,7 +107,7 @@ int DataArray::AtIndex(int index) const {
 }
 
 string DataArray::GetWordAtIndex(int index) const {
-  return id2word[data[index]];
+  return GetWord(data[index]);
 }
 
 vector<int> DataArray::GetWordIds(int index, int size) const {
@@ -101,7 +117,7 @@ vector<int> DataArray::GetWordIds(int index, int size) const {
 vector<string> DataArray::GetWords(int start_index, int size) const {
   vector<string> words;
   for (int word_id: GetWordIds(start_index, size)) {
-    words.push_back(id2word[word_id]);
+    words.push_back(GetWord(word_id));
   }
   return words;
 }
@@ -111,7 +127,7 @@ int DataArray::GetSize() const {
 }
 
 int DataArray::GetVocabularySize() const {
-  return id2word.size();
+  return word_start.size() - 1;
 }
 
 int DataArray::GetNumSentences() const {
@@ -132,18 +148,41 @@ int DataArray::GetSentenceId(int position) const {
 }
 
 int DataArray::GetWordId(const string& word) const {
-  auto result = word2id.find(word);
-  return result == word2id.end() ? -1 : result->second;
+  return word_index.Find(FlatHash(word.data(), word.size()),
+      [this, &word](uint32_t word_id) {
+        return word.size() == word_start[word_id + 1] - word_start[word_id] &&
+               equal(word.begin(), word.end(),
+                     word_chars.begin() + word_start[word_id]);
+      });
 }
 
 string DataArray::GetWord(int word_id) const {
-  return id2word[word_id];
+  return string(word_chars.begin() + word_start[word_id],
+                word_chars.begin() + word_start[word_id + 1]);
 }
 
 bool DataArray::operator==(const DataArray& other) const {
-  return word2id == other.word2id && id2word == other.id2word &&
+  return word_chars == other.word_chars && word_start == other.word_start &&
          data == other.data && sentence_start == other.sentence_start &&
          sentence_id == other.sentence_id;
 }
 
+void DataArray::WriteFlat(FlatWriter& writer) const {
+  writer.Write(word_chars);
+  writer.Write(word_start);
+  word_index.WriteFlat(writer);
+  writer.Write(data);
+  writer.Write(sentence_id);
+  writer.Write(sentence_start);
+}
+
+void DataArray::ReadFlat(FlatReader& reader) {
+  reader.Read(word_chars);
+  reader.Read(word_start);
+  word_index.ReadFlat(reader);
+  reader.Read(data);
+  reader.Read(sentence_id);
+  reader.Read(sentence_start);
+}
+
 } // namespace extractor
@@ -10,6 +10,9 @@
 #include <boost/serialization/string.hpp>
 #include <boost/serialization/vector.hpp>
 
+#include "flat_array.h"
+#include "flat_file.h"
+
 using namespace std;
 
 namespace extractor {
@@ -94,40 +97,60 @@ class DataArray {
 
   bool operator==(const DataArray& other) const;
 
- private:
-  // Sets up specific constants.
-  void InitializeDataArray();
+  // Writes the data array in the flat format (see flat_file.h).
+  void WriteFlat(FlatWriter& writer) const;
 
+  // Maps a data array written by WriteFlat.
+  void ReadFlat(FlatReader& reader);
+
+ private:
   // Constructs the data array.
   void CreateDataArray(const vector<string>& lines);
 
+  // Stores the words with ids 0, 1, ... and indexes them.
+  void SetWords(const vector<string>& words);
+
   friend class boost::serialization::access;
 
   template<class Archive> void save(Archive& ar, unsigned int) const {
+    vector<string> id2word;
+    for (size_t i = 0; i + 1 < word_start.size(); ++i) {
+      id2word.push_back(string(word_chars.begin() + word_start[i],
+                               word_chars.begin() + word_start[i + 1]));
+    }
     ar << id2word;
-    ar << data;
-    ar << sentence_id;
-    ar << sentence_start;
+    vector<int> values = data.ToVector();
+    ar << values;
+    values = sentence_id.ToVector();
+    ar << values;
+    values = sentence_start.ToVector();
+    ar << values;
   }
 
   template<class Archive> void load(Archive& ar, unsigned int) {
+    vector<string> id2word;
     ar >> id2word;
-    for (size_t i = 0; i < id2word.size(); ++i) {
-      word2id[id2word[i]] = i;
-    }
-
-    ar >> data;
-    ar >> sentence_id;
-    ar >> sentence_start;
+    SetWords(id2word);
+
+    vector<int> values;
+    ar >> values;
+    data = move(values);
+    ar >> values;
+    sentence_id = move(values);
+    ar >> values;
+    sentence_start = move(values);
   }
 
   BOOST_SERIALIZATION_SPLIT_MEMBER();
 
-  unordered_map<string, int> word2id;
-  vector<string> id2word;
-  vector<int> data;
-  vector<int> sentence_id;
-  vector<int> sentence_start;
+  // The words, one after another: word i is word_chars[word_start[i]] up to
+  // word_chars[word_start[i + 1]].
+  FlatArray<char> word_chars;
+  FlatArray<uint64_t> word_start;
+  FlatHashIndex word_index;
+  FlatArray<int> data;
+  FlatArray<int> sentence_id;
+  FlatArray<int> sentence_start;
 };
 
 } // namespace extractor
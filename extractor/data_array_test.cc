@@ -9,6 +9,7 @@
 #include <boost/filesystem.hpp>
 
 #include "data_array.h"
+#include "flat_file.h"
 
 using namespace std;
 using namespace ::testing;
@@ -119,5 +120,23 @@ TEST_F(DataArrayTest, TestSerialization) {
   EXPECT_EQ(target_data, target_copy);
 }
 
+TEST_F(DataArrayTest, TestFlatSerialization) {
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "DataArray");
+  source_data.WriteFlat(writer);
+  target_data.WriteFlat(writer);
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "DataArray");
+  DataArray source_copy, target_copy;
+  source_copy.ReadFlat(reader);
+  target_copy.ReadFlat(reader);
+
+  EXPECT_EQ(source_data, source_copy);
+  EXPECT_EQ(target_data, target_copy);
+  EXPECT_EQ(source_data.GetWordId("mere"), source_copy.GetWordId("mere"));
+  EXPECT_EQ(-1, source_copy.GetWordId("banane"));
+}
+
 } // namespace
 } // namespace extractor
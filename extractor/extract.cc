@@ -25,8 +25,10 @@
 #include "features/max_lex_target_given_source.h"
 #include "features/sample_source_count.h"
 #include "features/target_given_source_coherent.h"
+#include "flat_file.h"
 #include "grammar.h"
 #include "grammar_extractor.h"
+#include "grammar_server.h"
 #include "precomputation.h"
 #include "rule.h"
 #include "scorer.h"
@@ -48,6 +50,20 @@ fs::path GetGrammarFilePath(const fs::path& grammar_path, int file_number, bool
   return grammar_path / file_name;
 }
 
+// Reads a data structure written by sacompile. Flat files are memory mapped,
+// older directories compiled into boost archives are deserialized.
+template<typename T>
+void ReadIndex(const string& filename, const string& kind, T& index) {
+  if (FlatReader::IsFlatFile(filename)) {
+    FlatReader reader(filename, kind);
+    index.ReadFlat(reader);
+  } else {
+    ifstream input(filename);
+    ar::binary_iarchive stream(input);
+    stream >> index;
+  }
+}
+
 int main(int argc, char** argv) {
   po::options_description general_options("General options");
   int max_threads = 1;
@@ -58,7 +74,12 @@ int main(int argc, char** argv) {
   general_options.add_options()
     ("threads,t", po::value<int>()->required()->default_value(1),
      threads_option.c_str())
-    ("grammars,g", po::value<string>()->required(), "Grammars output path")
+    ("grammars,g", po::value<string>(), "Grammars output path")
+    ("server", "Keep the data structures in memory and answer grammar "
+        "requests from stdin on stdout, see grammar_server.h")
+    ("socket", po::value<string>(),
+        "Keep the data structures in memory and answer grammar requests on "
+        "a unix domain socket created at this path")
     ("gzip,z", "Gzip grammars")
     ("max_rule_span", po::value<int>()->default_value(15),
         "Maximum rule span")
@@ -71,6 +92,11 @@ int main(int argc, char** argv) {
         "Maximum number of samples")
     ("tight_phrases", po::value<bool>()->default_value(true),
         "False if phrases may be loose (better, but slower)")
+    ("phrase_cache_size", po::value<int>()->default_value(10000),
+        "Number of source phrases whose occurrences and rules are cached "
+        "across sentences (0 disables the cache)")
+    ("phrase_cache_memory", po::value<int>()->default_value(512),
+        "Maximum memory (in MB) used by the phrase cache")
     ("leave_one_out", po::value<bool>()->zero_tokens(),
         "do leave-one-out estimation of grammars "
         "(e.g. for extracting grammars for the training set");
@@ -112,47 +138,47 @@ int main(int argc, char** argv) {
   po::store(po::parse_config_file(config_stream, config_options), vm);
   po::notify(vm);
 
+  const bool server_mode = vm.count("server") || vm.count("socket");
+  if (!server_mode && !vm.count("grammars")) {
+    cerr << "A grammars output path (-g) is required unless grammars are "
+         << "served with --server or --socket." << endl;
+    return 1;
+  }
+
   int num_threads = vm["threads"].as<int>();
   cerr << "Grammar extraction will use " << num_threads << " threads." << endl;
 
   Clock::time_point read_start_time = Clock::now();
 
   Clock::time_point start_time = Clock::now();
-  cerr << "Reading target data in binary format..." << endl;
+  cerr << "Reading target data..." << endl;
   shared_ptr<DataArray> target_data_array = make_shared<DataArray>();
-  ifstream target_fstream(vm["target"].as<string>());
-  ar::binary_iarchive target_stream(target_fstream);
-  target_stream >> *target_data_array;
+  ReadIndex(vm["target"].as<string>(), "DataArray", *target_data_array);
   Clock::time_point end_time = Clock::now();
   cerr << "Reading target data took " << GetDuration(start_time, end_time)
        << " seconds" << endl;
 
   start_time = Clock::now();
-  cerr << "Reading source suffix array in binary format..." << endl;
+  cerr << "Reading source suffix array..." << endl;
   shared_ptr<SuffixArray> source_suffix_array = make_shared<SuffixArray>();
-  ifstream source_fstream(vm["source"].as<string>());
-  ar::binary_iarchive source_stream(source_fstream);
-  source_stream >> *source_suffix_array;
+  ReadIndex(vm["source"].as<string>(), "SuffixArray", *source_suffix_array);
   end_time = Clock::now();
   cerr << "Reading source suffix array took "
        << GetDuration(start_time, end_time) << " seconds" << endl;
 
   start_time = Clock::now();
-  cerr << "Reading alignment in binary format..." << endl;
+  cerr << "Reading alignment..." << endl;
   shared_ptr<Alignment> alignment = make_shared<Alignment>();
-  ifstream alignment_fstream(vm["alignment"].as<string>());
-  ar::binary_iarchive alignment_stream(alignment_fstream);
-  alignment_stream >> *alignment;
+  ReadIndex(vm["alignment"].as<string>(), "Alignment", *alignment);
   end_time = Clock::now();
   cerr << "Reading alignment took " << GetDuration(start_time, end_time)
        << " seconds" << endl;
 
   start_time = Clock::now();
-  cerr << "Reading precomputation in binary format..." << endl;
+  cerr << "Reading precomputation..." << endl;
   shared_ptr<Precomputation> precomputation = make_shared<Precomputation>();
-  ifstream precomputation_fstream(vm["precomputation"].as<string>());
-  ar::binary_iarchive precomputation_stream(precomputation_fstream);
-  precomputation_stream >> *precomputation;
+  ReadIndex(vm["precomputation"].as<string>(), "Precomputation",
+            *precomputation);
   end_time = Clock::now();
   cerr << "Reading precomputation took " << GetDuration(start_time, end_time)
        << " seconds" << endl;
@@ -168,11 +194,9 @@ int main(int argc, char** argv) {
        << " seconds" << endl;
 
   start_time = Clock::now();
-  cerr << "Reading translation table in binary format..." << endl;
+  cerr << "Reading translation table..." << endl;
   shared_ptr<TranslationTable> table = make_shared<TranslationTable>();
-  ifstream ttable_fstream(vm["ttable"].as<string>());
-  ar::binary_iarchive ttable_stream(ttable_fstream);
-  ttable_stream >> *table;
+  ReadIndex(vm["ttable"].as<string>(), "TranslationTable", *table);
   end_time = Clock::now();
   cerr << "Reading translation table took " << GetDuration(start_time, end_time)
        << " seconds" << endl;
@@ -194,7 +218,7 @@ int main(int argc, char** argv) {
   };
   shared_ptr<Scorer> scorer = make_shared<Scorer>(features);
 
-  GrammarExtractor extractor(
+  shared_ptr<GrammarExtractor> extractor = make_shared<GrammarExtractor>(
       source_suffix_array,
       target_data_array,
       alignment,
@@ -206,9 +230,23 @@ int main(int argc, char** argv) {
       vm["max_nonterminals"].as<int>(),
       vm["max_rule_symbols"].as<int>(),
       vm["max_samples"].as<int>(),
-      vm["tight_phrases"].as<bool>());
+      vm["tight_phrases"].as<bool>(),
+      vm["phrase_cache_size"].as<int>(),
+      vm["phrase_cache_memory"].as<int>());
   const bool use_zip = vm.count("gzip");
 
+  bool leave_one_out = vm.count("leave_one_out");
+  if (server_mode) {
+    // Answers requests until stdin is closed or, with --socket, until the
+    // process is stopped.
+    GrammarServer server(extractor, leave_one_out);
+    if (vm.count("socket")) {
+      return server.ServeSocket(vm["socket"].as<string>(), num_threads) ? 0 : 1;
+    }
+    server.Serve(cin, cout);
+    return 0;
+  }
+
   // Creates the grammars directory if it doesn't exist.
   fs::path grammar_path = vm["grammars"].as<string>();
   if (!fs::is_directory(grammar_path)) {
@@ -226,7 +264,6 @@ int main(int argc, char** argv) {
 
   // Extracts the grammar for each sentence and saves it to a file.
   vector<string> suffixes(sentences.size());
-  bool leave_one_out = vm.count("leave_one_out");
   #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
   for (size_t i = 0; i < sentences.size(); ++i) {
     string suffix;
@@ -241,7 +278,7 @@ int main(int argc, char** argv) {
     if (leave_one_out) {
       blacklisted_sentence_ids.insert(i);
     }
-    Grammar grammar = extractor.GetGrammar(
+    Grammar grammar = extractor->GetGrammar(
         sentences[i], blacklisted_sentence_ids);
     WriteFile wf(GetGrammarFilePath(grammar_path, i, use_zip).c_str());
     *wf.stream() << grammar;
@@ -0,0 +1,178 @@
+#ifndef _FLAT_ARRAY_H_
+#define _FLAT_ARRAY_H_
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+
+namespace extractor {
+
+/**
+ * Array of plain values that either owns its elements (like a vector) or is a
+ * read-only view of elements stored elsewhere, typically in a memory mapped
+ * index file (see flat_file.h). A view keeps the memory it points to alive
+ * through a shared pointer to its owner.
+ *
+ * The data structures of the extractor are built in owned arrays and are only
+ * read after that, so the element accessors are the same for both. Views are
+ * shared by all the threads (and processes) using the mapped file, so they
+ * cannot be modified: the mutators throw a logic_error on a view.
+ */
+template<typename T>
+class FlatArray {
+ public:
+  FlatArray() : ptr(NULL), length(0) {}
+
+  FlatArray(const vector<T>& values) : owned(values) {
+    Sync();
+  }
+
+  FlatArray(vector<T>&& values) : owned(move(values)) {
+    Sync();
+  }
+
+  FlatArray(const FlatArray& other) {
+    *this = other;
+  }
+
+  FlatArray(FlatArray&& other) {
+    *this = move(other);
+  }
+
+  FlatArray& operator=(const FlatArray& other) {
+    if (this != &other) {
+      owned = other.owned;
+      owner = other.owner;
+      if (owner) {
+        ptr = other.ptr;
+        length = other.length;
+      } else {
+        Sync();
+      }
+    }
+    return *this;
+  }
+
+  FlatArray& operator=(FlatArray&& other) {
+    if (this != &other) {
+      owned = move(other.owned);
+      owner = move(other.owner);
+      if (owner) {
+        ptr = other.ptr;
+        length = other.length;
+      } else {
+        Sync();
+      }
+      other.clear();
+    }
+    return *this;
+  }
+
+  // Makes this a view of the n elements starting at values, which stay valid
+  // as long as owner is alive.
+  void Map(const T* values, size_t n, shared_ptr<const void> owner) {
+    vector<T>().swap(owned);
+    this->owner = owner;
+    ptr = values;
+    length = n;
+  }
+
+  bool IsMapped() const {
+    return owner != NULL;
+  }
+
+  size_t size() const {
+    return length;
+  }
+
+  bool empty() const {
+    return length == 0;
+  }
+
+  const T* data() const {
+    return ptr;
+  }
+
+  const T* begin() const {
+    return ptr;
+  }
+
+  const T* end() const {
+    return ptr + length;
+  }
+
+  const T& operator[](size_t index) const {
+    return ptr[index];
+  }
+
+  T& operator[](size_t index) {
+    CheckOwned();
+    return owned[index];
+  }
+
+  void push_back(const T& value) {
+    CheckOwned();
+    owned.push_back(value);
+    Sync();
+  }
+
+  void resize(size_t n, const T& value = T()) {
+    CheckOwned();
+    owned.resize(n, value);
+    Sync();
+  }
+
+  void reserve(size_t n) {
+    CheckOwned();
+    owned.reserve(n);
+    Sync();
+  }
+
+  void shrink_to_fit() {
+    CheckOwned();
+    owned.shrink_to_fit();
+    Sync();
+  }
+
+  void clear() {
+    owner.reset();
+    owned.clear();
+    Sync();
+  }
+
+  vector<T> ToVector() const {
+    return vector<T>(begin(), end());
+  }
+
+  bool operator==(const FlatArray& other) const {
+    return length == other.length && equal(begin(), end(), other.begin());
+  }
+
+  bool operator!=(const FlatArray& other) const {
+    return !(*this == other);
+  }
+
+ private:
+  void CheckOwned() const {
+    if (owner) {
+      throw logic_error("Modifying a memory mapped array");
+    }
+  }
+
+  void Sync() {
+    ptr = owned.data();
+    length = owned.size();
+  }
+
+  vector<T> owned;
+  shared_ptr<const void> owner;
+  const T* ptr;
+  size_t length;
+};
+
+} // namespace extractor
+
+#endif
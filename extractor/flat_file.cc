@@ -0,0 +1,205 @@
+#include "flat_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace extractor {
+
+namespace {
+
+const char MAGIC[] = "cdecSAX1";
+const size_t MAGIC_SIZE = 8;
+
+void Die(const string& filename, const string& message) {
+  cerr << "Error reading " << filename << ": " << message << endl;
+  exit(1);
+}
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile(const string& filename) : data(NULL), size(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      Die(filename, strerror(errno));
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+      Die(filename, strerror(errno));
+    }
+    size = file_stat.st_size;
+    if (size > 0) {
+      // Shared, so all the processes mapping the file use the same pages.
+      void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapped == MAP_FAILED) {
+        Die(filename, strerror(errno));
+      }
+      data = static_cast<const char*>(mapped);
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data != NULL) {
+      munmap(const_cast<char*>(data), size);
+    }
+  }
+
+  const char* data;
+  size_t size;
+};
+
+} // namespace
+
+FlatWriter::FlatWriter(ostream& output, const string& kind) : output(output) {
+  output.write(MAGIC, MAGIC_SIZE);
+  Write(kind.data(), kind.size());
+}
+
+void FlatWriter::Write(uint64_t value) {
+  output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void FlatWriter::WriteRaw(uint64_t n, const void* data, size_t bytes) {
+  Write(n);
+  output.write(static_cast<const char*>(data), bytes);
+  const char padding[8] = {0};
+  output.write(padding, (8 - bytes % 8) % 8);
+}
+
+FlatReader::FlatReader(const string& filename, const string& kind) :
+    filename(filename), position(0) {
+  shared_ptr<MappedFile> file = make_shared<MappedFile>(filename);
+  owner = file;
+  data = file->data;
+  size = file->size;
+  ReadHeader(kind);
+}
+
+FlatReader::FlatReader(const char* data, size_t size,
+                       shared_ptr<const void> owner, const string& kind) :
+    filename("<memory>"), owner(owner), data(data), size(size), position(0) {
+  ReadHeader(kind);
+}
+
+void FlatReader::ReadHeader(const string& kind) {
+  if (size < MAGIC_SIZE || memcmp(data, MAGIC, MAGIC_SIZE) != 0) {
+    Die(filename, "not a flat index file");
+  }
+  position = MAGIC_SIZE;
+  FlatArray<char> file_kind;
+  Read(file_kind);
+  if (string(file_kind.begin(), file_kind.end()) != kind) {
+    Die(filename, "expected " + kind + ", found " +
+        string(file_kind.begin(), file_kind.end()));
+  }
+}
+
+uint64_t FlatReader::ReadInt() {
+  if (size - position < sizeof(uint64_t)) {
+    Die(filename, "unexpected end of file");
+  }
+  uint64_t value;
+  memcpy(&value, data + position, sizeof(value));
+  position += sizeof(value);
+  return value;
+}
+
+const void* FlatReader::ReadRaw(size_t element_size, size_t* n) {
+  *n = ReadInt();
+  if (*n > (size - position) / element_size) {
+    Die(filename, "unexpected end of file");
+  }
+  const void* values = data + position;
+  size_t bytes = *n * element_size;
+  position += bytes + (8 - bytes % 8) % 8;
+  position = min(position, size);
+  return values;
+}
+
+bool FlatReader::IsFlatFile(const string& filename) {
+  ifstream input(filename, ios_base::binary);
+  char magic[MAGIC_SIZE];
+  return input.read(magic, MAGIC_SIZE) &&
+         memcmp(magic, MAGIC, MAGIC_SIZE) == 0;
+}
+
+uint64_t FlatHash(const void* data, size_t bytes) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < bytes; ++i) {
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  }
+  // FNV-1a mixes the last bytes poorly into the top bits, which select the
+  // bucket.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+FlatHashIndex::FlatHashIndex() : shift(63) {}
+
+FlatHashIndex::FlatHashIndex(const vector<uint64_t>& key_hashes) {
+  int bits = 1;
+  while (bits < 32 && (1ULL << bits) < key_hashes.size()) {
+    ++bits;
+  }
+  shift = 64 - bits;
+
+  vector<uint32_t> order(key_hashes.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [&key_hashes](uint32_t a, uint32_t b) {
+    return key_hashes[a] < key_hashes[b] ||
+           (key_hashes[a] == key_hashes[b] && a < b);
+  });
+
+  vector<uint64_t> sorted_hashes(order.size());
+  vector<uint32_t> starts((1ULL << bits) + 1);
+  for (size_t i = 0; i < order.size(); ++i) {
+    sorted_hashes[i] = key_hashes[order[i]];
+    ++starts[(sorted_hashes[i] >> shift) + 1];
+  }
+  for (size_t i = 1; i < starts.size(); ++i) {
+    starts[i] += starts[i - 1];
+  }
+
+  hashes = move(sorted_hashes);
+  positions = move(order);
+  bucket_start = move(starts);
+}
+
+void FlatHashIndex::WriteFlat(FlatWriter& writer) const {
+  writer.Write(shift);
+  writer.Write(hashes);
+  writer.Write(positions);
+  writer.Write(bucket_start);
+}
+
+void FlatHashIndex::ReadFlat(FlatReader& reader) {
+  shift = reader.ReadInt();
+  reader.Read(hashes);
+  reader.Read(positions);
+  reader.Read(bucket_start);
+}
+
+bool FlatHashIndex::operator==(const FlatHashIndex& other) const {
+  return shift == other.shift && hashes == other.hashes &&
+         positions == other.positions && bucket_start == other.bucket_start;
+}
+
+} // namespace extractor
@@ -0,0 +1,142 @@
+#ifndef _FLAT_FILE_H_
+#define _FLAT_FILE_H_
+
+#include <stdint.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flat_array.h"
+
+using namespace std;
+
+namespace extractor {
+
+/**
+ * Writes the data structures of the extractor in a flat format that can be
+ * memory mapped and used without deserialization.
+ *
+ * A flat file starts with a magic string and the kind of data structure it
+ * holds, followed by a sequence of arrays. Each array is stored as its number
+ * of elements (64 bits) and its raw elements, padded to a multiple of 8 bytes,
+ * so every array starts at an aligned offset of the mapped file. Integers are
+ * written in the byte order of the machine writing them.
+ */
+class FlatWriter {
+ public:
+  // Writes the header of a file holding a data structure of the given kind.
+  FlatWriter(ostream& output, const string& kind);
+
+  template<typename T>
+  void Write(const T* values, size_t n) {
+    WriteRaw(n, values, n * sizeof(T));
+  }
+
+  template<typename T>
+  void Write(const FlatArray<T>& values) {
+    Write(values.data(), values.size());
+  }
+
+  template<typename T>
+  void Write(const vector<T>& values) {
+    Write(values.data(), values.size());
+  }
+
+  void Write(uint64_t value);
+
+ private:
+  void WriteRaw(uint64_t n, const void* data, size_t bytes);
+
+  ostream& output;
+};
+
+/**
+ * Reads a flat file, see FlatWriter. The arrays are views of the mapped file,
+ * which stays mapped as long as any of them is alive.
+ */
+class FlatReader {
+ public:
+  // Maps the file and checks that it holds a data structure of the given kind.
+  FlatReader(const string& filename, const string& kind);
+
+  // Reads from memory, which must stay valid as long as owner is alive (used
+  // for testing).
+  FlatReader(const char* data, size_t size, shared_ptr<const void> owner,
+             const string& kind);
+
+  template<typename T>
+  void Read(FlatArray<T>& values) {
+    size_t n;
+    const void* data = ReadRaw(sizeof(T), &n);
+    values.Map(static_cast<const T*>(data), n, owner);
+  }
+
+  uint64_t ReadInt();
+
+  // Returns true if the file starts with the magic string of a flat file.
+  static bool IsFlatFile(const string& filename);
+
+ private:
+  void ReadHeader(const string& kind);
+
+  const void* ReadRaw(size_t element_size, size_t* n);
+
+  string filename;
+  shared_ptr<const void> owner;
+  const char* data;
+  size_t size;
+  size_t position;
+};
+
+// Hash function of the flat hash index: a 64 bit FNV-1a hash with a final
+// mixing step (the stored hashes must not depend on the standard library).
+uint64_t FlatHash(const void* data, size_t bytes);
+
+/**
+ * Read-only hash index mapping 64 bit hashes to the positions of the keys
+ * with that hash, in a layout that can be written to and mapped from a flat
+ * file: the (hash, position) pairs sorted by hash, and the start of each
+ * bucket (a range of hashes sharing their top bits) in that order. A lookup
+ * scans the pairs of one bucket, of about one pair on average.
+ */
+class FlatHashIndex {
+ public:
+  FlatHashIndex();
+
+  // Builds the index where key i has hash hashes[i].
+  FlatHashIndex(const vector<uint64_t>& hashes);
+
+  // Returns the first position p of a key with the given hash for which
+  // matches(p) is true, or -1.
+  template<typename Matcher>
+  int64_t Find(uint64_t hash, Matcher matches) const {
+    if (bucket_start.empty()) {
+      return -1;
+    }
+    uint64_t bucket = hash >> shift;
+    for (uint32_t i = bucket_start[bucket]; i < bucket_start[bucket + 1]; ++i) {
+      if (hashes[i] == hash && matches(positions[i])) {
+        return positions[i];
+      }
+    }
+    return -1;
+  }
+
+  void WriteFlat(FlatWriter& writer) const;
+
+  void ReadFlat(FlatReader& reader);
+
+  bool operator==(const FlatHashIndex& other) const;
+
+ private:
+  int shift;
+  FlatArray<uint64_t> hashes;
+  FlatArray<uint32_t> positions;
+  FlatArray<uint32_t> bucket_start;
+};
+
+} // namespace extractor
+
+#endif
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "flat_array.h"
+#include "flat_file.h"
+
+using namespace std;
+using namespace ::testing;
+
+namespace extractor {
+namespace {
+
+TEST(FlatArrayTest, TestOwnedArray) {
+  FlatArray<int> values(vector<int>{3, 1, 2});
+  EXPECT_FALSE(values.IsMapped());
+  EXPECT_EQ(3, values.size());
+  values.push_back(5);
+  values[0] = 4;
+  EXPECT_EQ(vector<int>({4, 1, 2, 5}), values.ToVector());
+
+  FlatArray<int> copy = values;
+  copy[1] = 0;
+  EXPECT_EQ(1, values[1]);
+  EXPECT_NE(values, copy);
+}
+
+TEST(FlatArrayTest, TestMappedArray) {
+  shared_ptr<vector<int>> storage = make_shared<vector<int>>(
+      vector<int>{1, 2, 3});
+  FlatArray<int> values;
+  values.Map(storage->data(), storage->size(), storage);
+  EXPECT_TRUE(values.IsMapped());
+  EXPECT_EQ(storage->data(), values.data());
+  EXPECT_EQ(FlatArray<int>(vector<int>{1, 2, 3}), values);
+
+  // Views cannot be modified.
+  EXPECT_THROW(values[2] = 7, logic_error);
+  EXPECT_THROW(values.push_back(4), logic_error);
+  EXPECT_THROW(values.resize(1), logic_error);
+  EXPECT_TRUE(values.IsMapped());
+  EXPECT_EQ(vector<int>({1, 2, 3}), values.ToVector());
+}
+
+TEST(FlatFileTest, TestWriteRead) {
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "Test");
+  writer.Write(vector<char>{'a', 'b', 'c'});
+  writer.Write(42);
+  writer.Write(FlatArray<double>(vector<double>{0.5, 0.25}));
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  EXPECT_EQ(0, buffer->size() % 8);
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "Test");
+  FlatArray<char> chars;
+  reader.Read(chars);
+  EXPECT_EQ(vector<char>({'a', 'b', 'c'}), chars.ToVector());
+  EXPECT_EQ(42, reader.ReadInt());
+  FlatArray<double> doubles;
+  reader.Read(doubles);
+  EXPECT_TRUE(doubles.IsMapped());
+  EXPECT_EQ(0, ((const char*) doubles.data() - buffer->data()) % 8);
+  EXPECT_EQ(vector<double>({0.5, 0.25}), doubles.ToVector());
+}
+
+TEST(FlatFileTest, TestWrongKind) {
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "Test");
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  EXPECT_EXIT(FlatReader(buffer->data(), buffer->size(), buffer, "Other"),
+              ExitedWithCode(1), "expected Other, found Test");
+}
+
+TEST(FlatHashIndexTest, TestFind) {
+  vector<string> keys = {"ana", "are", "mere", "", "."};
+  vector<uint64_t> hashes;
+  for (const string& key: keys) {
+    hashes.push_back(FlatHash(key.data(), key.size()));
+  }
+  FlatHashIndex index(hashes);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(i, index.Find(hashes[i], [&](uint64_t j) {
+      return keys[j] == keys[i];
+    }));
+  }
+  string missing = "pere";
+  EXPECT_EQ(-1, index.Find(FlatHash(missing.data(), missing.size()),
+                           [&](uint64_t j) { return keys[j] == missing; }));
+  EXPECT_EQ(-1, FlatHashIndex().Find(hashes[0], [](uint64_t) {
+    return true;
+  }));
+}
+
+TEST(FlatHashIndexTest, TestSerialization) {
+  FlatHashIndex index({1, 1ULL << 63, 5, 1});
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "FlatHashIndex");
+  index.WriteFlat(writer);
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "FlatHashIndex");
+  FlatHashIndex index_copy;
+  index_copy.ReadFlat(reader);
+
+  EXPECT_EQ(index, index_copy);
+  EXPECT_EQ(3, index_copy.Find(1, [](uint64_t j) { return j == 3; }));
+  EXPECT_EQ(1, index_copy.Find(1ULL << 63, [](uint64_t) { return true; }));
+}
+
+} // namespace
+} // namespace extractor
@@ -37,7 +37,9 @@ class GrammarExtractor {
       int max_nonterminals,
       int max_rule_symbols,
       int max_samples,
-      bool require_tight_phrases);
+      bool require_tight_phrases,
+      int phrase_cache_size,
+      int phrase_cache_memory);
 
   // For testing only.
   GrammarExtractor(shared_ptr<Vocabulary> vocabulary,
@@ -0,0 +1,169 @@
+#include "grammar_server.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <streambuf>
+#include <unordered_set>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "grammar.h"
+#include "grammar_extractor.h"
+#include "rule.h"
+
+using namespace std;
+
+namespace extractor {
+
+namespace {
+
+// Buffered reads and writes on a socket, so a connection can be served as an
+// istream and an ostream.
+class SocketBuffer : public streambuf {
+ public:
+  SocketBuffer(int fd) : fd(fd) {
+    setg(input, input, input);
+    setp(output, output + sizeof(output));
+  }
+
+  ~SocketBuffer() {
+    sync();
+  }
+
+ protected:
+  int_type underflow() {
+    ssize_t bytes_read;
+    do {
+      bytes_read = read(fd, input, sizeof(input));
+    } while (bytes_read < 0 && errno == EINTR);
+    if (bytes_read <= 0) {
+      return traits_type::eof();
+    }
+    setg(input, input, input + bytes_read);
+    return traits_type::to_int_type(*gptr());
+  }
+
+  int_type overflow(int_type c) {
+    if (sync() != 0) {
+      return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() {
+    for (char* p = pbase(); p < pptr(); ) {
+      ssize_t bytes_written = write(fd, p, pptr() - p);
+      if (bytes_written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return -1;
+      }
+      p += bytes_written;
+    }
+    setp(output, output + sizeof(output));
+    return 0;
+  }
+
+ private:
+  int fd;
+  char input[1 << 16];
+  char output[1 << 16];
+};
+
+} // namespace
+
+GrammarServer::GrammarServer(shared_ptr<GrammarExtractor> extractor,
+                             bool leave_one_out) :
+    extractor(extractor), leave_one_out(leave_one_out) {}
+
+GrammarServer::~GrammarServer() {}
+
+void GrammarServer::Serve(istream& input, ostream& output) {
+  string sentence;
+  for (int sentence_id = 0; getline(input, sentence); ++sentence_id) {
+    size_t position = sentence.find("|||");
+    if (position != sentence.npos) {
+      sentence = sentence.substr(0, position);
+    }
+
+    unordered_set<int> blacklisted_sentence_ids;
+    if (leave_one_out) {
+      blacklisted_sentence_ids.insert(sentence_id);
+    }
+    Grammar grammar = extractor->GetGrammar(
+        sentence, blacklisted_sentence_ids);
+    // The empty line ends the reply; flushing sends it to the client before
+    // the next request is read.
+    output << grammar << endl;
+    if (!output) {
+      break;
+    }
+  }
+}
+
+bool GrammarServer::ServeSocket(const string& socket_path, int num_threads) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    cerr << "Socket path is too long: " << socket_path << endl;
+    return false;
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    cerr << "Unable to create socket: " << strerror(errno) << endl;
+    return false;
+  }
+  unlink(socket_path.c_str());
+  if (bind(listen_fd, (sockaddr*) &address, sizeof(address)) < 0 ||
+      listen(listen_fd, SOMAXCONN) < 0) {
+    cerr << "Unable to listen on " << socket_path << ": "
+         << strerror(errno) << endl;
+    close(listen_fd);
+    return false;
+  }
+  // Clients that disconnect before reading their grammars make writes fail
+  // instead of killing the server.
+  signal(SIGPIPE, SIG_IGN);
+  cerr << "Serving grammars on " << socket_path << " with " << num_threads
+       << " threads." << endl;
+
+  bool accept_failed = false;
+  #pragma omp parallel num_threads(num_threads)
+  while (true) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      #pragma omp critical
+      cerr << "Unable to accept connections: " << strerror(errno) << endl;
+      accept_failed = true;
+      break;
+    }
+
+    {
+      SocketBuffer buffer(fd);
+      istream input(&buffer);
+      ostream output(&buffer);
+      Serve(input, output);
+    }
+    close(fd);
+  }
+
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  return !accept_failed;
+}
+
+} // namespace extractor
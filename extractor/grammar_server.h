@@ -0,0 +1,48 @@
+#ifndef _GRAMMAR_SERVER_H_
+#define _GRAMMAR_SERVER_H_
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+namespace extractor {
+
+class GrammarExtractor;
+
+/**
+ * Serves grammars from an extractor that is kept in memory.
+ *
+ * A request is a line with a sentence, optionally followed by "|||" and
+ * anything else (which is ignored, as in batch mode). The reply is the
+ * grammar of the sentence in the format of the grammar files written in batch
+ * mode (one rule per line) followed by an empty line. The requests of one
+ * stream are answered in order. With leave-one-out estimation, the i-th
+ * request of a stream (counting from 0) is extracted without the i-th
+ * sentence of the training data.
+ */
+class GrammarServer {
+ public:
+  GrammarServer(shared_ptr<GrammarExtractor> extractor, bool leave_one_out);
+
+  virtual ~GrammarServer();
+
+  // Answers the requests read from input until it ends.
+  void Serve(istream& input, ostream& output);
+
+  // Listens on a unix domain socket created at socket_path (replacing any
+  // file there) and serves every connection as a stream of requests. Each of
+  // the num_threads OpenMP threads accepts connections and serves them one at
+  // a time, so up to num_threads clients are served concurrently. Returns
+  // false if the socket can't be set up or accepting connections fails.
+  bool ServeSocket(const string& socket_path, int num_threads);
+
+ private:
+  shared_ptr<GrammarExtractor> extractor;
+  bool leave_one_out;
+};
+
+} // namespace extractor
+
+#endif
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "grammar.h"
+#include "grammar_extractor.h"
+#include "grammar_server.h"
+#include "mocks/mock_rule_factory.h"
+#include "mocks/mock_vocabulary.h"
+#include "phrase_builder.h"
+#include "rule.h"
+
+using namespace std;
+using namespace ::testing;
+
+namespace extractor {
+namespace {
+
+class GrammarServerTest : public Test {
+ protected:
+  virtual void SetUp() {
+    vocabulary = make_shared<MockVocabulary>();
+    EXPECT_CALL(*vocabulary, GetTerminalIndex("<s>"))
+        .WillRepeatedly(Return(0));
+    EXPECT_CALL(*vocabulary, GetTerminalIndex("Anna"))
+        .WillRepeatedly(Return(1));
+    EXPECT_CALL(*vocabulary, GetTerminalIndex("apples"))
+        .WillRepeatedly(Return(2));
+    EXPECT_CALL(*vocabulary, GetTerminalIndex("</s>"))
+        .WillRepeatedly(Return(3));
+    EXPECT_CALL(*vocabulary, GetTerminalValue(1))
+        .WillRepeatedly(Return("Anna"));
+    EXPECT_CALL(*vocabulary, GetTerminalValue(2))
+        .WillRepeatedly(Return("apples"));
+
+    PhraseBuilder phrase_builder(vocabulary);
+    vector<Rule> rules = {
+        Rule(phrase_builder.Build({1}), phrase_builder.Build({1}),
+             {0.5}, {make_pair(0, 0)})
+    };
+    vector<string> feature_names = {"f"};
+    anna_grammar = make_shared<Grammar>(rules, feature_names);
+    empty_grammar = make_shared<Grammar>(vector<Rule>(), feature_names);
+
+    factory = make_shared<MockHieroCachingRuleFactory>();
+    extractor = make_shared<GrammarExtractor>(vocabulary, factory);
+  }
+
+  shared_ptr<MockVocabulary> vocabulary;
+  shared_ptr<MockHieroCachingRuleFactory> factory;
+  shared_ptr<GrammarExtractor> extractor;
+  shared_ptr<Grammar> anna_grammar;
+  shared_ptr<Grammar> empty_grammar;
+};
+
+TEST_F(GrammarServerTest, TestServe) {
+  unordered_set<int> blacklisted_sentence_ids;
+  vector<int> anna_ids = {0, 1, 3};
+  vector<int> apples_ids = {0, 2, 3};
+  EXPECT_CALL(*factory, GetGrammar(anna_ids, blacklisted_sentence_ids))
+      .WillOnce(Return(*anna_grammar));
+  EXPECT_CALL(*factory, GetGrammar(apples_ids, blacklisted_sentence_ids))
+      .WillOnce(Return(*empty_grammar));
+
+  GrammarServer server(extractor, false);
+  istringstream input("Anna ||| ignored\napples\n");
+  ostringstream output;
+  server.Serve(input, output);
+  EXPECT_EQ("[X] ||| Anna ||| Anna ||| f=0.5 ||| 0-0\n\n\n", output.str());
+}
+
+TEST_F(GrammarServerTest, TestServeLeaveOneOut) {
+  vector<int> anna_ids = {0, 1, 3};
+  unordered_set<int> first = {0}, second = {1};
+  EXPECT_CALL(*factory, GetGrammar(anna_ids, first))
+      .WillOnce(Return(*anna_grammar));
+  EXPECT_CALL(*factory, GetGrammar(anna_ids, second))
+      .WillOnce(Return(*anna_grammar));
+
+  GrammarServer server(extractor, true);
+  istringstream input("Anna\nAnna\n");
+  ostringstream output;
+  server.Serve(input, output);
+}
+
+} // namespace
+} // namespace extractor
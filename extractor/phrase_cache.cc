@@ -0,0 +1,125 @@
+#include "phrase_cache.h"
+
+#include <string>
+
+namespace extractor {
+
+namespace {
+
+size_t GetNumBytes(const PhraseLocation& matchings) {
+  size_t num_bytes = sizeof(PhraseLocation);
+  if (matchings.matchings != NULL) {
+    num_bytes += matchings.matchings->size() * sizeof(int);
+  }
+  return num_bytes;
+}
+
+size_t GetNumBytes(const Rule& rule) {
+  int num_symbols = rule.source_phrase.GetNumSymbols() +
+                    rule.target_phrase.GetNumSymbols();
+  return sizeof(Rule) + num_symbols * (sizeof(int) + sizeof(string)) +
+         rule.scores.size() * sizeof(double) +
+         rule.alignment.size() * sizeof(pair<int, int>);
+}
+
+} // namespace
+
+CachedPhrase::CachedPhrase(const PhraseLocation& matchings) :
+    matchings(matchings), has_rules(false) {
+  num_bytes = sizeof(CachedPhrase) + GetNumBytes(matchings);
+}
+
+CachedPhrase::CachedPhrase(const PhraseLocation& matchings,
+                           const vector<Rule>& rules) :
+    matchings(matchings), has_rules(true), rules(rules) {
+  num_bytes = sizeof(CachedPhrase) + GetNumBytes(matchings);
+  for (const Rule& rule: rules) {
+    num_bytes += GetNumBytes(rule);
+  }
+}
+
+PhraseCache::PhraseCache(int capacity, size_t max_bytes) :
+    capacity(capacity), max_bytes(max_bytes), num_bytes(0), num_lookups(0),
+    num_hits(0) {}
+
+PhraseCache::~PhraseCache() {}
+
+shared_ptr<const CachedPhrase> PhraseCache::Get(const vector<int>& phrase) {
+  shared_ptr<const CachedPhrase> data;
+  #pragma omp critical (phrase_cache)
+  {
+    ++num_lookups;
+    auto it = index.find(phrase);
+    if (it != index.end()) {
+      ++num_hits;
+      entries.splice(entries.begin(), entries, it->second);
+      data = it->second->second;
+    }
+  }
+  return data;
+}
+
+void PhraseCache::Put(const vector<int>& phrase,
+                      shared_ptr<const CachedPhrase> data) {
+  size_t data_bytes = data->num_bytes + phrase.size() * sizeof(int);
+  if (capacity == 0 || data_bytes > max_bytes) {
+    return;
+  }
+
+  #pragma omp critical (phrase_cache)
+  {
+    auto it = index.find(phrase);
+    if (it != index.end()) {
+      num_bytes -= it->second->second->num_bytes + phrase.size() * sizeof(int);
+      entries.erase(it->second);
+      index.erase(it);
+    }
+    while (!entries.empty() &&
+           (entries.size() >= capacity || num_bytes + data_bytes > max_bytes)) {
+      Evict();
+    }
+    entries.push_front(make_pair(phrase, data));
+    index[phrase] = entries.begin();
+    num_bytes += data_bytes;
+  }
+}
+
+void PhraseCache::Evict() {
+  const vector<int>& phrase = entries.back().first;
+  num_bytes -= entries.back().second->num_bytes + phrase.size() * sizeof(int);
+  index.erase(phrase);
+  entries.pop_back();
+}
+
+long long PhraseCache::GetNumLookups() const {
+  long long result;
+  #pragma omp critical (phrase_cache)
+  result = num_lookups;
+  return result;
+}
+
+long long PhraseCache::GetNumHits() const {
+  long long result;
+  #pragma omp critical (phrase_cache)
+  result = num_hits;
+  return result;
+}
+
+double PhraseCache::GetHitRate() const {
+  long long lookups, hits;
+  #pragma omp critical (phrase_cache)
+  {
+    lookups = num_lookups;
+    hits = num_hits;
+  }
+  return lookups == 0 ? 0 : 1.0 * hits / lookups;
+}
+
+size_t PhraseCache::GetNumBytes() const {
+  size_t result;
+  #pragma omp critical (phrase_cache)
+  result = num_bytes;
+  return result;
+}
+
+} // namespace extractor
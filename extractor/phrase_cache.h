@@ -0,0 +1,89 @@
+#ifndef _PHRASE_CACHE_H_
+#define _PHRASE_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/functional/hash.hpp>
+
+#include "phrase_location.h"
+#include "rule.h"
+
+using namespace std;
+
+namespace extractor {
+
+typedef boost::hash<vector<int>> VectorHash;
+
+/**
+ * Data cached for a source phrase: its occurrences in the source data and, if
+ * they have been extracted without blacklisting any sentences, its rules.
+ */
+struct CachedPhrase {
+  CachedPhrase(const PhraseLocation& matchings);
+
+  CachedPhrase(const PhraseLocation& matchings, const vector<Rule>& rules);
+
+  PhraseLocation matchings;
+  bool has_rules;
+  vector<Rule> rules;
+  // Approximate number of bytes used by the matchings and the rules.
+  size_t num_bytes;
+};
+
+/**
+ * Bounded cache of the source phrases analyzed by the rule factory, shared by
+ * all the sentences and threads. When the cache holds too many phrases or too
+ * many bytes (the matchings of frequent phrases with gaps can be very large),
+ * the least recently used phrases are evicted.
+ *
+ * The phrases are keyed by their symbols (word ids and nonterminals). All the
+ * operations are thread safe.
+ */
+class PhraseCache {
+ public:
+  // Caches at most capacity phrases using at most max_bytes bytes.
+  PhraseCache(int capacity, size_t max_bytes);
+
+  virtual ~PhraseCache();
+
+  // Returns the cached data for a phrase (marking it as the most recently
+  // used phrase) or NULL if the phrase is not cached.
+  shared_ptr<const CachedPhrase> Get(const vector<int>& phrase);
+
+  // Caches the data for a phrase, replacing any previous data.
+  void Put(const vector<int>& phrase, shared_ptr<const CachedPhrase> data);
+
+  // Returns the number of calls to Get.
+  long long GetNumLookups() const;
+
+  // Returns the number of calls to Get which found the phrase.
+  long long GetNumHits() const;
+
+  // Returns the fraction of lookups which found the phrase.
+  double GetHitRate() const;
+
+  // Returns the approximate number of bytes used by the cached phrases.
+  size_t GetNumBytes() const;
+
+ private:
+  typedef list<pair<vector<int>, shared_ptr<const CachedPhrase>>> Entries;
+
+  // Removes the least recently used phrase.
+  void Evict();
+
+  size_t capacity;
+  size_t max_bytes;
+  size_t num_bytes;
+  // Most recently used phrases first.
+  Entries entries;
+  unordered_map<vector<int>, Entries::iterator, VectorHash> index;
+  long long num_lookups;
+  long long num_hits;
+};
+
+} // namespace extractor
+
+#endif
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include "phrase.h"
+#include "phrase_cache.h"
+#include "phrase_location.h"
+#include "rule.h"
+
+using namespace std;
+using namespace ::testing;
+
+namespace extractor {
+namespace {
+
+TEST(PhraseCacheTest, TestGetPut) {
+  PhraseCache cache(2, 1 << 20);
+  vector<int> phrase = {2, -1, 3};
+  EXPECT_TRUE(cache.Get(phrase) == NULL);
+
+  cache.Put(phrase, make_shared<CachedPhrase>(PhraseLocation(1, 5)));
+  shared_ptr<const CachedPhrase> cached_phrase = cache.Get(phrase);
+  ASSERT_TRUE(cached_phrase != NULL);
+  EXPECT_EQ(PhraseLocation(1, 5), cached_phrase->matchings);
+  EXPECT_FALSE(cached_phrase->has_rules);
+
+  vector<Rule> rules = {Rule(Phrase(), Phrase(), {0.5}, {make_pair(0, 0)})};
+  cache.Put(phrase, make_shared<CachedPhrase>(PhraseLocation(1, 5), rules));
+  cached_phrase = cache.Get(phrase);
+  ASSERT_TRUE(cached_phrase != NULL);
+  EXPECT_TRUE(cached_phrase->has_rules);
+  EXPECT_EQ(1, cached_phrase->rules.size());
+}
+
+TEST(PhraseCacheTest, TestEvictsLeastRecentlyUsed) {
+  PhraseCache cache(2, 1 << 20);
+  vector<int> phrase1 = {2}, phrase2 = {3}, phrase3 = {4};
+  cache.Put(phrase1, make_shared<CachedPhrase>(PhraseLocation(0, 1)));
+  cache.Put(phrase2, make_shared<CachedPhrase>(PhraseLocation(1, 2)));
+  // Using phrase1 makes phrase2 the least recently used phrase.
+  EXPECT_TRUE(cache.Get(phrase1) != NULL);
+  cache.Put(phrase3, make_shared<CachedPhrase>(PhraseLocation(2, 3)));
+
+  EXPECT_TRUE(cache.Get(phrase1) != NULL);
+  EXPECT_TRUE(cache.Get(phrase2) == NULL);
+  EXPECT_TRUE(cache.Get(phrase3) != NULL);
+}
+
+TEST(PhraseCacheTest, TestEvictsWhenTooLarge) {
+  vector<Rule> rules = {Rule(Phrase(), Phrase(), {0.5}, {make_pair(0, 0)})};
+  shared_ptr<CachedPhrase> data =
+      make_shared<CachedPhrase>(PhraseLocation(0, 1), rules);
+  size_t num_bytes = data->num_bytes + sizeof(int);
+  PhraseCache cache(10, 2 * num_bytes);
+  vector<int> phrase1 = {2}, phrase2 = {3}, phrase3 = {4};
+  cache.Put(phrase1, data);
+  cache.Put(phrase2, data);
+  EXPECT_EQ(2 * num_bytes, cache.GetNumBytes());
+  cache.Put(phrase3, data);
+  EXPECT_EQ(2 * num_bytes, cache.GetNumBytes());
+
+  EXPECT_TRUE(cache.Get(phrase1) == NULL);
+  EXPECT_TRUE(cache.Get(phrase2) != NULL);
+  EXPECT_TRUE(cache.Get(phrase3) != NULL);
+
+  // Phrases larger than the cache are never stored.
+  PhraseCache small_cache(10, num_bytes - 1);
+  small_cache.Put(phrase1, data);
+  EXPECT_TRUE(small_cache.Get(phrase1) == NULL);
+  EXPECT_EQ(0, small_cache.GetNumBytes());
+}
+
+TEST(PhraseCacheTest, TestHitRate) {
+  PhraseCache cache(10, 1 << 20);
+  EXPECT_EQ(0, cache.GetHitRate());
+  vector<int> phrase = {2};
+  cache.Get(phrase);
+  cache.Put(phrase, make_shared<CachedPhrase>(PhraseLocation(0, 1)));
+  cache.Get(phrase);
+  cache.Get(phrase);
+  cache.Get({3});
+  EXPECT_EQ(4, cache.GetNumLookups());
+  EXPECT_EQ(2, cache.GetNumHits());
+  EXPECT_EQ(0.5, cache.GetHitRate());
+}
+
+TEST(PhraseCacheTest, TestZeroCapacity) {
+  PhraseCache cache(0, 1 << 20);
+  vector<int> phrase = {2};
+  cache.Put(phrase, make_shared<CachedPhrase>(PhraseLocation(0, 1)));
+  EXPECT_TRUE(cache.Get(phrase) == NULL);
+}
+
+TEST(PhraseCacheTest, TestConcurrentAccess) {
+  PhraseCache cache(100, 1 << 20);
+  #pragma omp parallel for num_threads(8)
+  for (int i = 0; i < 10000; ++i) {
+    vector<int> phrase = {i % 200};
+    shared_ptr<const CachedPhrase> cached_phrase = cache.Get(phrase);
+    if (cached_phrase == NULL) {
+      cache.Put(phrase, make_shared<CachedPhrase>(
+          PhraseLocation(i % 200, i % 200 + 1)));
+    } else {
+      EXPECT_EQ(PhraseLocation(i % 200, i % 200 + 1),
+                cached_phrase->matchings);
+    }
+  }
+  EXPECT_EQ(10000, cache.GetNumLookups());
+}
+
+} // namespace
+} // namespace extractor
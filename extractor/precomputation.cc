@@ -1,7 +1,9 @@
 #include "precomputation.h"
 
+#include <algorithm>
 #include <iostream>
 #include <queue>
+#include <stdexcept>
 
 #include "data_array.h"
 #include "suffix_array.h"
@@ -36,13 +38,14 @@ Precomputation::Precomputation(
   }
 
   start_time = Clock::now();
+  Index index;
   vector<tuple<int, int, int>> matchings;
   vector<vector<int>> annotations;
   for (size_t i = 0; i < data.size(); ++i) {
     // If the sentence is over, add all the discontiguous frequent patterns to
     // the index.
     if (data[i] == DataArray::END_OF_LINE) {
-      UpdateIndex(matchings, annotations, max_rule_span, min_gap_size,
+      UpdateIndex(index, matchings, annotations, max_rule_span, min_gap_size,
                   max_rule_symbols);
       matchings.clear();
       annotations.clear();
@@ -63,12 +66,15 @@ Precomputation::Precomputation(
       annotations.push_back(pattern_annotations[it->second]);
     }
   }
+  SetIndex(index);
   end_time = Clock::now();
   cerr << "Constructing collocations index took "
        << GetDuration(start_time, end_time) << " seconds..." << endl;
 }
 
-Precomputation::Precomputation() {}
+Precomputation::Precomputation() {
+  SetIndex(Index());
+}
 
 Precomputation::~Precomputation() {}
 
@@ -119,7 +125,7 @@ vector<int> Precomputation::AnnotatePattern(
 }
 
 void Precomputation::UpdateIndex(
-    const vector<tuple<int, int, int>>& matchings,
+    Index& index, const vector<tuple<int, int, int>>& matchings,
     const vector<vector<int>>& annotations,
     int max_rule_span, int min_gap_size, int max_rule_symbols) {
   // Select the leftmost subpattern.
@@ -188,16 +194,85 @@ void Precomputation::AppendCollocation(
   collocations.push_back(pos3);
 }
 
+void Precomputation::SetIndex(const Index& index) {
+  // Sort the entries, so equal indexes have equal flat arrays.
+  vector<pair<uint64_t, const Index::value_type*>> entries;
+  for (const auto& entry: index) {
+    const vector<int>& pattern = entry.first;
+    entries.push_back(make_pair(
+        FlatHash(pattern.data(), pattern.size() * sizeof(int)), &entry));
+  }
+  sort(entries.begin(), entries.end(),
+       [](const pair<uint64_t, const Index::value_type*>& a,
+          const pair<uint64_t, const Index::value_type*>& b) {
+    return a.first < b.first ||
+           (a.first == b.first && a.second->first < b.second->first);
+  });
+
+  vector<int> new_patterns, new_collocations;
+  vector<uint64_t> new_pattern_start(1), new_collocation_start(1), hashes;
+  for (const auto& entry: entries) {
+    const vector<int>& pattern = entry.second->first;
+    const vector<int>& pattern_collocations = entry.second->second;
+    new_patterns.insert(new_patterns.end(), pattern.begin(), pattern.end());
+    new_pattern_start.push_back(new_patterns.size());
+    new_collocations.insert(new_collocations.end(),
+                            pattern_collocations.begin(),
+                            pattern_collocations.end());
+    new_collocation_start.push_back(new_collocations.size());
+    hashes.push_back(entry.first);
+  }
+
+  patterns = move(new_patterns);
+  pattern_start = move(new_pattern_start);
+  collocations = move(new_collocations);
+  collocation_start = move(new_collocation_start);
+  pattern_index = FlatHashIndex(hashes);
+}
+
+int64_t Precomputation::Find(const vector<int>& pattern) const {
+  return pattern_index.Find(
+      FlatHash(pattern.data(), pattern.size() * sizeof(int)),
+      [this, &pattern](uint64_t i) {
+        return pattern_start[i + 1] - pattern_start[i] == pattern.size() &&
+               equal(pattern.begin(), pattern.end(),
+                     patterns.begin() + pattern_start[i]);
+      });
+}
+
 bool Precomputation::Contains(const vector<int>& pattern) const {
-  return index.count(pattern);
+  return Find(pattern) != -1;
 }
 
 vector<int> Precomputation::GetCollocations(const vector<int>& pattern) const {
-  return index.at(pattern);
+  int64_t i = Find(pattern);
+  if (i == -1) {
+    throw out_of_range("Pattern is not in the precomputed index");
+  }
+  return vector<int>(collocations.begin() + collocation_start[i],
+                     collocations.begin() + collocation_start[i + 1]);
 }
 
 bool Precomputation::operator==(const Precomputation& other) const {
-  return index == other.index;
+  return patterns == other.patterns && pattern_start == other.pattern_start &&
+         collocations == other.collocations &&
+         collocation_start == other.collocation_start;
+}
+
+void Precomputation::WriteFlat(FlatWriter& writer) const {
+  writer.Write(patterns);
+  writer.Write(pattern_start);
+  writer.Write(collocations);
+  writer.Write(collocation_start);
+  pattern_index.WriteFlat(writer);
+}
+
+void Precomputation::ReadFlat(FlatReader& reader) {
+  reader.Read(patterns);
+  reader.Read(pattern_start);
+  reader.Read(collocations);
+  reader.Read(collocation_start);
+  pattern_index.ReadFlat(reader);
 }
 
 } // namespace extractor
@@ -12,6 +12,9 @@
 #include <boost/serialization/utility.hpp>
 #include <boost/serialization/vector.hpp>
 
+#include "flat_array.h"
+#include "flat_file.h"
+
 using namespace std;
 
 namespace extractor {
@@ -55,6 +58,12 @@ class Precomputation {
 
   bool operator==(const Precomputation& other) const;
 
+  // Writes the index in the flat format (see flat_file.h).
+  void WriteFlat(FlatWriter& writer) const;
+
+  // Maps an index written by WriteFlat.
+  void ReadFlat(FlatReader& reader);
+
  private:
   // Finds the most frequent contiguous collocations.
   vector<vector<int>> FindMostFrequentPatterns(
@@ -70,7 +79,7 @@ class Precomputation {
   // it adds new entries to the index for each discontiguous collocation
   // matching the criteria specified in the class description.
   void UpdateIndex(
-      const vector<tuple<int, int, int>>& matchings,
+      Index& index, const vector<tuple<int, int, int>>& matchings,
       const vector<vector<int>>& annotations,
       int max_rule_span, int min_gap_size, int max_rule_symbols);
 
@@ -82,17 +91,29 @@ class Precomputation {
   // Adds an occurrence of a ternary collocation.
   void AppendCollocation(vector<int>& collocations, int pos1, int pos2, int pos3);
 
+  // Stores the entries of the index in flat arrays.
+  void SetIndex(const Index& index);
+
+  // Returns the position of a pattern in the flat arrays, or -1.
+  int64_t Find(const vector<int>& pattern) const;
+
   friend class boost::serialization::access;
 
   template<class Archive> void save(Archive& ar, unsigned int) const {
-    int num_entries = index.size();
+    int num_entries = pattern_start.size() - 1;
     ar << num_entries;
-    for (pair<vector<int>, vector<int>> entry: index) {
+    for (int i = 0; i < num_entries; ++i) {
+      pair<vector<int>, vector<int>> entry(
+          vector<int>(patterns.begin() + pattern_start[i],
+                      patterns.begin() + pattern_start[i + 1]),
+          vector<int>(collocations.begin() + collocation_start[i],
+                      collocations.begin() + collocation_start[i + 1]));
       ar << entry;
     }
   }
 
   template<class Archive> void load(Archive& ar, unsigned int) {
+    Index index;
     int num_entries;
     ar >> num_entries;
     for (size_t i = 0; i < num_entries; ++i) {
@@ -100,11 +121,20 @@ class Precomputation {
       ar >> entry;
       index.insert(entry);
     }
+    SetIndex(index);
   }
 
   BOOST_SERIALIZATION_SPLIT_MEMBER();
 
-  Index index;
+  // Entry i maps the pattern patterns[pattern_start[i]] up to
+  // patterns[pattern_start[i + 1]] to the collocations
+  // collocations[collocation_start[i]] up to
+  // collocations[collocation_start[i + 1]].
+  FlatArray<int> patterns;
+  FlatArray<uint64_t> pattern_start;
+  FlatArray<int> collocations;
+  FlatArray<uint64_t> collocation_start;
+  FlatHashIndex pattern_index;
 };
 
 } // namespace extractor
@@ -2,11 +2,13 @@
 
 #include <memory>
 #include <sstream>
+#include <string>
 #include <vector>
 
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 
+#include "flat_file.h"
 #include "mocks/mock_data_array.h"
 #include "mocks/mock_suffix_array.h"
 #include "mocks/mock_vocabulary.h"
@@ -147,6 +149,22 @@ TEST_F(PrecomputationTest, TestSerialization) {
   EXPECT_EQ(precomputation, precomputation_copy);
 }
 
+TEST_F(PrecomputationTest, TestFlatSerialization) {
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "Precomputation");
+  precomputation.WriteFlat(writer);
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "Precomputation");
+  Precomputation precomputation_copy;
+  precomputation_copy.ReadFlat(reader);
+
+  EXPECT_EQ(precomputation, precomputation_copy);
+  vector<int> key = {2, 3, -1, 2};
+  EXPECT_EQ(precomputation.GetCollocations(key),
+            precomputation_copy.GetCollocations(key));
+}
+
 } // namespace
 } // namespace extractor
 
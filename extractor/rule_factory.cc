@@ -10,6 +10,7 @@
 #include "matchings_finder.h"
 #include "phrase.h"
 #include "phrase_builder.h"
+#include "phrase_cache.h"
 #include "rule.h"
 #include "rule_extractor.h"
 #include "phrase_location_sampler.h"
@@ -53,7 +54,9 @@ HieroCachingRuleFactory::HieroCachingRuleFactory(
     int max_nonterminals,
     int max_rule_symbols,
     int max_samples,
-    bool require_tight_phrases) :
+    bool require_tight_phrases,
+    int phrase_cache_size,
+    int phrase_cache_memory) :
     vocabulary(vocabulary),
     scorer(scorer),
     min_gap_size(min_gap_size),
@@ -71,6 +74,10 @@ HieroCachingRuleFactory::HieroCachingRuleFactory(
       false, require_tight_phrases);
   sampler = make_shared<PhraseLocationSampler>(
       source_suffix_array, max_samples);
+  if (phrase_cache_size > 0) {
+    phrase_cache = make_shared<PhraseCache>(
+        phrase_cache_size, (size_t) phrase_cache_memory << 20);
+  }
 }
 
 HieroCachingRuleFactory::HieroCachingRuleFactory(
@@ -85,7 +92,8 @@ HieroCachingRuleFactory::HieroCachingRuleFactory(
     int max_rule_span,
     int max_nonterminals,
     int max_chunks,
-    int max_rule_symbols) :
+    int max_rule_symbols,
+    shared_ptr<PhraseCache> phrase_cache) :
     matchings_finder(finder),
     fast_intersector(fast_intersector),
     phrase_builder(phrase_builder),
@@ -93,6 +101,7 @@ HieroCachingRuleFactory::HieroCachingRuleFactory(
     vocabulary(vocabulary),
     sampler(sampler),
     scorer(scorer),
+    phrase_cache(phrase_cache),
     min_gap_size(min_gap_size),
     max_rule_span(max_rule_span),
     max_nonterminals(max_nonterminals),
@@ -155,8 +164,17 @@ Grammar HieroCachingRuleFactory::GetGrammar(
         next_node = make_shared<TrieNode>(
             next_suffix_link, next_phrase, next_suffix_link->matchings);
       } else {
+        // Reuse the occurrences (and possibly the rules) of the phrase from a
+        // previous sentence.
+        shared_ptr<const CachedPhrase> cached_phrase;
+        if (phrase_cache != NULL) {
+          cached_phrase = phrase_cache->Get(phrase);
+        }
+
         PhraseLocation phrase_location;
-        if (next_phrase.Arity() > 0) {
+        if (cached_phrase != NULL) {
+          phrase_location = cached_phrase->matchings;
+        } else if (next_phrase.Arity() > 0) {
           // For phrases containing a nonterminal, we use either the occurrences
           // of the prefix or the suffix to determine the occurrences of the
           // phrase.
@@ -179,12 +197,42 @@ Grammar HieroCachingRuleFactory::GetGrammar(
         }
 
         if (phrase_location.IsEmpty()) {
+          if (phrase_cache != NULL && cached_phrase == NULL) {
+            phrase_cache->Put(
+                phrase, make_shared<CachedPhrase>(phrase_location));
+          }
           continue;
         }
 
         // Create new trie node to store data about the current phrase.
         next_node = make_shared<TrieNode>(
             next_suffix_link, next_phrase, phrase_location);
+
+        Clock::time_point extract_start = Clock::now();
+        // The rules extracted while blacklisting some sentences are specific
+        // to those sentences, so they are neither reused nor cached.
+        bool reusable_rules = blacklisted_sentence_ids.empty();
+        if (reusable_rules && cached_phrase != NULL &&
+            cached_phrase->has_rules) {
+          rules.insert(rules.end(), cached_phrase->rules.begin(),
+                       cached_phrase->rules.end());
+        } else {
+          // Extract rules for the sampled set of occurrences.
+          PhraseLocation sample = sampler->Sample(
+              next_node->matchings, blacklisted_sentence_ids);
+          vector<Rule> new_rules =
+              rule_extractor->ExtractRules(next_phrase, sample);
+          rules.insert(rules.end(), new_rules.begin(), new_rules.end());
+          if (phrase_cache != NULL && reusable_rules) {
+            phrase_cache->Put(phrase, make_shared<CachedPhrase>(
+                phrase_location, new_rules));
+          } else if (phrase_cache != NULL && cached_phrase == NULL) {
+            phrase_cache->Put(
+                phrase, make_shared<CachedPhrase>(phrase_location));
+          }
+        }
+        Clock::time_point extract_stop = Clock::now();
+        total_extract_time += GetDuration(extract_start, extract_stop);
       }
       // Add the new trie node to the trie cache.
       node->AddChild(word_id, next_node);
@@ -193,18 +241,6 @@ Grammar HieroCachingRuleFactory::GetGrammar(
       // matchings from the prefix node.
       AddTrailingNonterminal(phrase, next_phrase, next_node,
                              state.starts_with_x);
-
-      Clock::time_point extract_start = Clock::now();
-      if (!state.starts_with_x) {
-        // Extract rules for the sampled set of occurrences.
-        PhraseLocation sample = sampler->Sample(
-            next_node->matchings, blacklisted_sentence_ids);
-        vector<Rule> new_rules =
-            rule_extractor->ExtractRules(next_phrase, sample);
-        rules.insert(rules.end(), new_rules.begin(), new_rules.end());
-      }
-      Clock::time_point extract_stop = Clock::now();
-      total_extract_time += GetDuration(extract_start, extract_stop);
     } else {
       next_node = node->GetChild(word_id);
     }
@@ -225,6 +261,11 @@ Grammar HieroCachingRuleFactory::GetGrammar(
     cerr << "Extract time = " << total_extract_time << " seconds" << endl;
     cerr << "Intersect time = " << total_intersect_time << " seconds" << endl;
     cerr << "Lookup time = " << total_lookup_time << " seconds" << endl;
+    if (phrase_cache != NULL) {
+      cerr << "Phrase cache hit rate = " << phrase_cache->GetHitRate() << " ("
+           << phrase_cache->GetNumHits() << " of "
+           << phrase_cache->GetNumLookups() << " lookups)" << endl;
+    }
   }
   return Grammar(rules, scorer->GetFeatureNames());
 }
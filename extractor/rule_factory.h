@@ -16,6 +16,7 @@ class DataArray;
 class FastIntersector;
 class Grammar;
 class MatchingsFinder;
+class PhraseCache;
 class PhraseBuilder;
 class Precomputation;
 class Rule;
@@ -35,7 +36,9 @@ class Vocabulary;
  * it finds all its occurrences in the source data and samples some of these
  * occurrences to extract aligned source-target phrase pairs. A trie cache is
  * used to avoid unnecessary computations if a source phrase can be constructed
- * more than once (e.g. some words occur more than once in the sentence).
+ * more than once (e.g. some words occur more than once in the sentence). The
+ * occurrences and the rules of the source phrases are also kept in a phrase
+ * cache shared by all the sentences, because documents repeat the same phrases.
  */
 class HieroCachingRuleFactory {
  public:
@@ -51,7 +54,9 @@ class HieroCachingRuleFactory {
       int max_nonterminals,
       int max_rule_symbols,
       int max_samples,
-      bool require_tight_phrases);
+      bool require_tight_phrases,
+      int phrase_cache_size,
+      int phrase_cache_memory);
 
   // For testing only.
   HieroCachingRuleFactory(
@@ -66,7 +71,8 @@ class HieroCachingRuleFactory {
       int max_rule_span,
       int max_nonterminals,
       int max_chunks,
-      int max_rule_symbols);
+      int max_rule_symbols,
+      shared_ptr<PhraseCache> phrase_cache = shared_ptr<PhraseCache>());
 
   virtual ~HieroCachingRuleFactory();
 
@@ -109,6 +115,7 @@ class HieroCachingRuleFactory {
   shared_ptr<Vocabulary> vocabulary;
   shared_ptr<Sampler> sampler;
   shared_ptr<Scorer> scorer;
+  shared_ptr<PhraseCache> phrase_cache;
   int min_gap_size;
   int max_rule_span;
   int max_nonterminals;
@@ -12,6 +12,7 @@
 #include "mocks/mock_scorer.h"
 #include "mocks/mock_vocabulary.h"
 #include "phrase_builder.h"
+#include "phrase_cache.h"
 #include "phrase_location.h"
 #include "rule_factory.h"
 
@@ -101,5 +102,31 @@ TEST_F(RuleFactoryTest, TestGetGrammarRepeatingWords) {
   EXPECT_EQ(28, grammar.GetRules().size());
 }
 
+TEST_F(RuleFactoryTest, TestGetGrammarPhraseCache) {
+  shared_ptr<PhraseCache> phrase_cache = make_shared<PhraseCache>(100, 1 << 20);
+  factory = make_shared<HieroCachingRuleFactory>(finder, fast_intersector,
+      phrase_builder, extractor, vocabulary, sampler, scorer, 1, 10, 2, 3, 5,
+      phrase_cache);
+
+  // The second sentence reuses the occurrences and the rules of the first.
+  EXPECT_CALL(*finder, Find(_, _, _))
+      .Times(6)
+      .WillRepeatedly(Return(PhraseLocation(0, 1)));
+
+  EXPECT_CALL(*fast_intersector, Intersect(_, _, _))
+      .Times(1)
+      .WillRepeatedly(Return(PhraseLocation(0, 1)));
+
+  vector<int> word_ids = {2, 3, 4};
+  unordered_set<int> blacklisted_sentence_ids;
+  Grammar grammar = factory->GetGrammar(word_ids, blacklisted_sentence_ids);
+  EXPECT_EQ(7, grammar.GetRules().size());
+  EXPECT_EQ(0, phrase_cache->GetNumHits());
+
+  grammar = factory->GetGrammar(word_ids, blacklisted_sentence_ids);
+  EXPECT_EQ(7, grammar.GetRules().size());
+  EXPECT_EQ(7, phrase_cache->GetNumHits());
+}
+
 } // namespace
 } // namespace extractor
@@ -26,6 +26,7 @@
 #include "features/target_given_source_coherent.h"
 #include "grammar.h"
 #include "grammar_extractor.h"
+#include "grammar_server.h"
 #include "precomputation.h"
 #include "rule.h"
 #include "scorer.h"
@@ -60,7 +61,12 @@ int main(int argc, char** argv) {
     ("target,e", po::value<string>(), "Target language corpus")
     ("bitext,b", po::value<string>(), "Parallel text (source ||| target)")
     ("alignment,a", po::value<string>()->required(), "Bitext word alignment")
-    ("grammars,g", po::value<string>()->required(), "Grammars output path")
+    ("grammars,g", po::value<string>(), "Grammars output path")
+    ("server", "Keep the data structures in memory and answer grammar "
+        "requests from stdin on stdout, see grammar_server.h")
+    ("socket", po::value<string>(),
+        "Keep the data structures in memory and answer grammar requests on "
+        "a unix domain socket created at this path")
     ("threads,t", po::value<int>()->default_value(1), threads_option.c_str())
     ("frequent", po::value<int>()->default_value(100),
         "Number of precomputed frequent patterns")
@@ -81,6 +87,11 @@ int main(int argc, char** argv) {
         "Maximum number of samples")
     ("tight_phrases", po::value<bool>()->default_value(true),
         "False if phrases may be loose (better, but slower)")
+    ("phrase_cache_size", po::value<int>()->default_value(10000),
+        "Number of source phrases whose occurrences and rules are cached "
+        "across sentences (0 disables the cache)")
+    ("phrase_cache_memory", po::value<int>()->default_value(512),
+        "Maximum memory (in MB) used by the phrase cache")
     ("leave_one_out", po::value<bool>()->zero_tokens(),
         "do leave-one-out estimation of grammars "
         "(e.g. for extracting grammars for the training set");
@@ -104,6 +115,13 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  const bool server_mode = vm.count("server") || vm.count("socket");
+  if (!server_mode && !vm.count("grammars")) {
+    cerr << "A grammars output path (-g) is required unless grammars are "
+         << "served with --server or --socket." << endl;
+    return 1;
+  }
+
   int num_threads = vm["threads"].as<int>();
   cerr << "Grammar extraction will use " << num_threads << " threads." << endl;
 
@@ -192,7 +210,7 @@ int main(int argc, char** argv) {
   shared_ptr<Scorer> scorer = make_shared<Scorer>(features);
 
   // Sets up the grammar extractor.
-  GrammarExtractor extractor(
+  shared_ptr<GrammarExtractor> extractor = make_shared<GrammarExtractor>(
       source_suffix_array,
       target_data_array,
       alignment,
@@ -204,7 +222,21 @@ int main(int argc, char** argv) {
       vm["max_nonterminals"].as<int>(),
       vm["max_rule_symbols"].as<int>(),
       vm["max_samples"].as<int>(),
-      vm["tight_phrases"].as<bool>());
+      vm["tight_phrases"].as<bool>(),
+      vm["phrase_cache_size"].as<int>(),
+      vm["phrase_cache_memory"].as<int>());
+
+  bool leave_one_out = vm.count("leave_one_out");
+  if (server_mode) {
+    // Answers requests until stdin is closed or, with --socket, until the
+    // process is stopped.
+    GrammarServer server(extractor, leave_one_out);
+    if (vm.count("socket")) {
+      return server.ServeSocket(vm["socket"].as<string>(), num_threads) ? 0 : 1;
+    }
+    server.Serve(cin, cout);
+    return 0;
+  }
 
   // Creates the grammars directory if it doesn't exist.
   fs::path grammar_path = vm["grammars"].as<string>();
@@ -221,7 +253,6 @@ int main(int argc, char** argv) {
   }
 
   // Extracts the grammar for each sentence and saves it to a file.
-  bool leave_one_out = vm.count("leave_one_out");
   vector<string> suffixes(sentences.size());
   #pragma omp parallel for schedule(dynamic) num_threads(num_threads)
   for (size_t i = 0; i < sentences.size(); ++i) {
@@ -237,7 +268,7 @@ int main(int argc, char** argv) {
     if (leave_one_out) {
       blacklisted_sentence_ids.insert(i);
     }
-    Grammar grammar = extractor.GetGrammar(
+    Grammar grammar = extractor->GetGrammar(
         sentences[i], blacklisted_sentence_ids);
     ofstream output(GetGrammarFilePath(grammar_path, i).c_str());
     output << grammar;
@@ -2,6 +2,8 @@
 #include <iostream>
 #include <string>
 
+#include <sys/resource.h>
+
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -9,6 +11,7 @@
 
 #include "alignment.h"
 #include "data_array.h"
+#include "flat_file.h"
 #include "precomputation.h"
 #include "suffix_array.h"
 #include "time_util.h"
@@ -89,9 +92,9 @@ int main(int argc, char** argv) {
   Clock::time_point start_write = Clock::now();
   string target_path = (output_dir / fs::path("target.bin")).string();
   config_stream << "target = " << target_path << endl;
-  ofstream target_fstream(target_path);
-  ar::binary_oarchive target_stream(target_fstream);
-  target_stream << *target_data_array;
+  ofstream target_fstream(target_path, ios_base::binary);
+  FlatWriter target_writer(target_fstream, "DataArray");
+  target_data_array->WriteFlat(target_writer);
   Clock::time_point stop_write = Clock::now();
   double write_duration = GetDuration(start_write, stop_write);
 
@@ -108,9 +111,9 @@ int main(int argc, char** argv) {
   start_write = Clock::now();
   string source_path = (output_dir / fs::path("source.bin")).string();
   config_stream << "source = " << source_path << endl;
-  ofstream source_fstream(source_path);
-  ar::binary_oarchive output_stream(source_fstream);
-  output_stream << *source_suffix_array;
+  ofstream source_fstream(source_path, ios_base::binary);
+  FlatWriter source_writer(source_fstream, "SuffixArray");
+  source_suffix_array->WriteFlat(source_writer);
   stop_write = Clock::now();
   write_duration += GetDuration(start_write, stop_write);
 
@@ -127,9 +130,9 @@ int main(int argc, char** argv) {
   start_write = Clock::now();
   string alignment_path = (output_dir / fs::path("alignment.bin")).string();
   config_stream << "alignment = " << alignment_path << endl;
-  ofstream alignment_fstream(alignment_path);
-  ar::binary_oarchive alignment_stream(alignment_fstream);
-  alignment_stream << *alignment;
+  ofstream alignment_fstream(alignment_path, ios_base::binary);
+  FlatWriter alignment_writer(alignment_fstream, "Alignment");
+  alignment->WriteFlat(alignment_writer);
   stop_write = Clock::now();
   write_duration += GetDuration(start_write, stop_write);
 
@@ -155,9 +158,9 @@ int main(int argc, char** argv) {
   start_write = Clock::now();
   string precomputation_path = (output_dir / fs::path("precomp.bin")).string();
   config_stream << "precomputation = " << precomputation_path << endl;
-  ofstream precomp_fstream(precomputation_path);
-  ar::binary_oarchive precomp_stream(precomp_fstream);
-  precomp_stream << precomputation;
+  ofstream precomp_fstream(precomputation_path, ios_base::binary);
+  FlatWriter precomp_writer(precomp_fstream, "Precomputation");
+  precomputation.WriteFlat(precomp_writer);
 
   string vocabulary_path = (output_dir / fs::path("vocab.bin")).string();
   config_stream << "vocabulary = " << vocabulary_path << endl;
@@ -178,9 +181,9 @@ int main(int argc, char** argv) {
   start_write = Clock::now();
   string table_path = (output_dir / fs::path("bilex.bin")).string();
   config_stream << "ttable = " << table_path << endl;
-  ofstream table_fstream(table_path);
-  ar::binary_oarchive table_stream(table_fstream);
-  table_stream << table;
+  ofstream table_fstream(table_path, ios_base::binary);
+  FlatWriter table_writer(table_fstream, "TranslationTable");
+  table.WriteFlat(table_writer);
   stop_write = Clock::now();
   write_duration += GetDuration(start_write, stop_write);
 
@@ -191,5 +194,11 @@ int main(int argc, char** argv) {
   cerr << "Total time spent writing: " << write_duration
        << " seconds" << endl;
 
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    // Linux reports the maximum resident set size in kilobytes.
+    cerr << "Peak memory usage: " << usage.ru_maxrss / 1024 << " MB" << endl;
+  }
+
   return 0;
 }
@@ -1,6 +1,6 @@
 #include "suffix_array.h"
 
-#include <cassert>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <string>
@@ -24,145 +24,219 @@ SuffixArray::SuffixArray() {}
 
 SuffixArray::~SuffixArray() {}
 
-void SuffixArray::BuildSuffixArray() {
-  vector<int> groups = data_array->GetData();
-  groups.reserve(groups.size() + 1);
-  groups.push_back(DataArray::NULL_WORD);
-  suffix_array.resize(groups.size());
-  word_start.resize(data_array->GetVocabularySize() + 1);
-
-  InitialBucketSort(groups);
-
-  int combined_group_size = 0;
-  for (size_t i = 1; i < word_start.size(); ++i) {
-    if (word_start[i] - word_start[i - 1] == 1) {
-      ++combined_group_size;
-      suffix_array[word_start[i] - combined_group_size] = -combined_group_size;
-    } else {
-      combined_group_size = 0;
-    }
+namespace {
+
+// Sets bucket[c] to the first position of the suffixes starting with c in the
+// suffix array.
+void GetBucketStarts(const vector<int>& counts, vector<int>& bucket) {
+  int sum = 0;
+  for (size_t c = 0; c < counts.size(); ++c) {
+    bucket[c] = sum;
+    sum += counts[c];
   }
+}
 
-  PrefixDoublingSort(groups);
-  cerr << "\tFinalizing sort..." << endl;
+// Sets bucket[c] to the position following the suffixes starting with c in the
+// suffix array.
+void GetBucketEnds(const vector<int>& counts, vector<int>& bucket) {
+  int sum = 0;
+  for (size_t c = 0; c < counts.size(); ++c) {
+    sum += counts[c];
+    bucket[c] = sum;
+  }
+}
 
-  for (size_t i = 0; i < groups.size(); ++i) {
-    suffix_array[groups[i]] = i;
+// Returns whether the i-th suffix is a leftmost S-type suffix.
+bool IsLMS(const vector<bool>& is_s_type, int i) {
+  return i > 0 && is_s_type[i] && !is_s_type[i - 1];
+}
+
+// Sorts the L-type suffixes and then the S-type suffixes from the sorted
+// LMS suffixes placed at the ends of their buckets.
+void InduceSort(const int* text, int* suffixes, int n,
+                const vector<bool>& is_s_type, const vector<int>& counts,
+                vector<int>& bucket) {
+  GetBucketStarts(counts, bucket);
+  for (int i = 0; i < n; ++i) {
+    int j = suffixes[i] - 1;
+    if (j >= 0 && !is_s_type[j]) {
+      suffixes[bucket[text[j]]++] = j;
+    }
+  }
+
+  GetBucketEnds(counts, bucket);
+  for (int i = n - 1; i >= 0; --i) {
+    int j = suffixes[i] - 1;
+    if (j >= 0 && is_s_type[j]) {
+      suffixes[--bucket[text[j]]] = j;
+    }
   }
 }
 
-void SuffixArray::InitialBucketSort(vector<int>& groups) {
-  Clock::time_point start_time = Clock::now();
-  for (size_t i = 0; i < groups.size(); ++i) {
-    ++word_start[groups[i]];
+// Sorts the suffixes of text, which has symbols in [0, alphabet_size) and ends
+// with a unique smallest symbol, using the SA-IS algorithm of Nong et al.
+// (2009). Needs no memory other than the suffixes, the types of the suffixes
+// and the buckets, besides half of that for the recursive call.
+void SortSuffixes(const int* text, int* suffixes, int n, int alphabet_size) {
+  if (n == 1) {
+    suffixes[0] = 0;
+    return;
   }
 
-  for (size_t i = 1; i < word_start.size(); ++i) {
-    word_start[i] += word_start[i - 1];
+  vector<bool> is_s_type(n);
+  is_s_type[n - 1] = true;
+  for (int i = n - 2; i >= 0; --i) {
+    is_s_type[i] = text[i] < text[i + 1] ||
+                   (text[i] == text[i + 1] && is_s_type[i + 1]);
   }
 
-  for (size_t i = 0; i < groups.size(); ++i) {
-    --word_start[groups[i]];
-    suffix_array[word_start[groups[i]]] = i;
+  vector<int> counts(alphabet_size), bucket(alphabet_size);
+  for (int i = 0; i < n; ++i) {
+    ++counts[text[i]];
   }
 
-  for (size_t i = 0; i < suffix_array.size(); ++i) {
-    groups[i] = word_start[groups[i] + 1] - 1;
+  // Sort the LMS substrings by inducing from the unsorted LMS suffixes.
+  fill(suffixes, suffixes + n, -1);
+  GetBucketEnds(counts, bucket);
+  for (int i = 1; i < n; ++i) {
+    if (IsLMS(is_s_type, i)) {
+      suffixes[--bucket[text[i]]] = i;
+    }
   }
-  Clock::time_point stop_time = Clock::now();
-  cerr << "\tBucket sort took " << GetDuration(start_time, stop_time)
-       << " seconds" << endl;
-}
+  InduceSort(text, suffixes, n, is_s_type, counts, bucket);
 
-void SuffixArray::PrefixDoublingSort(vector<int>& groups) {
-  int step = 1;
-  while (suffix_array[0] != -suffix_array.size()) {
-    int combined_group_size = 0;
-    int i = 0;
-    while (i < suffix_array.size()) {
-      if (suffix_array[i] < 0) {
-        int skip = -suffix_array[i];
-        combined_group_size += skip;
-        i += skip;
-        suffix_array[i - combined_group_size] = -combined_group_size;
-      } else {
-        combined_group_size = 0;
-        int j = groups[suffix_array[i]];
-        TernaryQuicksort(i, j, step, groups);
-        i = j + 1;
+  int num_lms = 0;
+  for (int i = 0; i < n; ++i) {
+    if (IsLMS(is_s_type, suffixes[i])) {
+      suffixes[num_lms++] = suffixes[i];
+    }
+  }
+
+  // Name the LMS substrings by their rank. No two LMS suffixes are adjacent,
+  // so the name of the LMS suffix at position i can be stored at
+  // num_lms + i / 2.
+  fill(suffixes + num_lms, suffixes + n, -1);
+  int num_names = 0, previous = -1;
+  for (int i = 0; i < num_lms; ++i) {
+    int position = suffixes[i];
+    bool is_new_name = previous == -1;
+    for (int d = 0; !is_new_name; ++d) {
+      if (text[position + d] != text[previous + d] ||
+          is_s_type[position + d] != is_s_type[previous + d]) {
+        is_new_name = true;
+      } else if (d > 0 && (IsLMS(is_s_type, position + d) ||
+                           IsLMS(is_s_type, previous + d))) {
+        break;
       }
     }
-    step *= 2;
+    if (is_new_name) {
+      ++num_names;
+      previous = position;
+    }
+    suffixes[num_lms + position / 2] = num_names - 1;
+  }
+  for (int i = n - 1, j = n - 1; i >= num_lms; --i) {
+    if (suffixes[i] >= 0) {
+      suffixes[j--] = suffixes[i];
+    }
   }
-}
 
-void SuffixArray::TernaryQuicksort(int left, int right, int step,
-    vector<int>& groups) {
-  if (left > right) {
-    return;
+  // Sort the LMS suffixes, recursively if their substrings are not unique.
+  int* reduced_text = suffixes + n - num_lms;
+  int* reduced_suffixes = suffixes;
+  if (num_names < num_lms) {
+    SortSuffixes(reduced_text, reduced_suffixes, num_lms, num_names);
+  } else {
+    for (int i = 0; i < num_lms; ++i) {
+      reduced_suffixes[reduced_text[i]] = i;
+    }
   }
 
-  int pivot = left + rand() % (right - left + 1);
-  int pivot_value = groups[suffix_array[pivot] + step];
-  swap(suffix_array[pivot], suffix_array[left]);
-  int mid_left = left, mid_right = left;
-  for (int i = left + 1; i <= right; ++i) {
-    if (groups[suffix_array[i] + step] < pivot_value) {
-      ++mid_right;
-      int temp = suffix_array[i];
-      suffix_array[i] = suffix_array[mid_right];
-      suffix_array[mid_right] = suffix_array[mid_left];
-      suffix_array[mid_left] = temp;
-      ++mid_left;
-    } else if (groups[suffix_array[i] + step] == pivot_value) {
-      ++mid_right;
-      int temp = suffix_array[i];
-      suffix_array[i] = suffix_array[mid_right];
-      suffix_array[mid_right] = temp;
+  // Sort all the suffixes by inducing from the sorted LMS suffixes.
+  for (int i = 1, j = 0; i < n; ++i) {
+    if (IsLMS(is_s_type, i)) {
+      reduced_text[j++] = i;
     }
   }
+  for (int i = 0; i < num_lms; ++i) {
+    reduced_suffixes[i] = reduced_text[reduced_suffixes[i]];
+  }
+  fill(suffixes + num_lms, suffixes + n, -1);
+  GetBucketEnds(counts, bucket);
+  for (int i = num_lms - 1; i >= 0; --i) {
+    int j = suffixes[i];
+    suffixes[i] = -1;
+    suffixes[--bucket[text[j]]] = j;
+  }
+  InduceSort(text, suffixes, n, is_s_type, counts, bucket);
+}
 
-  TernaryQuicksort(left, mid_left - 1, step, groups);
+} // namespace
 
-  if (mid_left == mid_right) {
-    groups[suffix_array[mid_left]] = mid_left;
-    suffix_array[mid_left] = -1;
-  } else {
-    for (int i = mid_left; i <= mid_right; ++i) {
-      groups[suffix_array[i]] = mid_right;
-    }
+void SuffixArray::BuildSuffixArray() {
+  Clock::time_point start_time = Clock::now();
+  vector<int> text = data_array->GetData();
+  text.reserve(text.size() + 1);
+  text.push_back(DataArray::NULL_WORD);
+  int vocabulary_size = data_array->GetVocabularySize();
+
+  vector<int> suffixes(text.size());
+  SortSuffixes(text.data(), suffixes.data(), text.size(), vocabulary_size);
+
+  vector<int> starts(vocabulary_size + 1);
+  for (int word_id: text) {
+    ++starts[word_id + 1];
+  }
+  for (size_t i = 1; i < starts.size(); ++i) {
+    starts[i] += starts[i - 1];
   }
 
-  TernaryQuicksort(mid_right + 1, right, step, groups);
+  suffix_array = move(suffixes);
+  word_start = move(starts);
+  Clock::time_point stop_time = Clock::now();
+  cerr << "\tSuffix sort took " << GetDuration(start_time, stop_time)
+       << " seconds" << endl;
 }
 
 vector<int> SuffixArray::BuildLCPArray() const {
   Clock::time_point start_time = Clock::now();
   cerr << "\tConstructing LCP array..." << endl;
 
-  vector<int> lcp(suffix_array.size());
-  vector<int> rank(suffix_array.size());
+  int n = suffix_array.size();
+  vector<int> lcp(n);
+  vector<int> rank(n);
   const vector<int>& data = data_array->GetData();
+  const int data_size = data.size();
 
-  for (size_t i = 0; i < suffix_array.size(); ++i) {
+  #pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
     rank[suffix_array[i]] = i;
   }
 
-  int prefix_len = 0;
-  for (size_t i = 0; i < suffix_array.size(); ++i) {
-    if (rank[i] == 0) {
-      lcp[rank[i]] = -1;
-    } else {
-      int j = suffix_array[rank[i] - 1];
-      while (i + prefix_len < data.size() && j + prefix_len < data.size()
-          && data[i + prefix_len] == data[j + prefix_len]) {
-        ++prefix_len;
+  // The suffixes are split into blocks of consecutive positions processed in
+  // parallel. The prefix length carried from one suffix to the next starts
+  // from 0 in each block, which only costs up to one longest common prefix per
+  // block.
+  const int block_size = 1 << 16;
+  #pragma omp parallel for schedule(dynamic)
+  for (int block_start = 0; block_start < n; block_start += block_size) {
+    int block_end = min(n, block_start + block_size);
+    int prefix_len = 0;
+    for (int i = block_start; i < block_end; ++i) {
+      if (rank[i] == 0) {
+        lcp[rank[i]] = -1;
+      } else {
+        int j = suffix_array[rank[i] - 1];
+        while (i + prefix_len < data_size && j + prefix_len < data_size
+            && data[i + prefix_len] == data[j + prefix_len]) {
+          ++prefix_len;
+        }
+        lcp[rank[i]] = prefix_len;
       }
-      lcp[rank[i]] = prefix_len;
-    }
 
-    if (prefix_len > 0) {
-      --prefix_len;
+      if (prefix_len > 0) {
+        --prefix_len;
+      }
     }
   }
 
@@ -223,4 +297,17 @@ bool SuffixArray::operator==(const SuffixArray& other) const {
          word_start == other.word_start;
 }
 
+void SuffixArray::WriteFlat(FlatWriter& writer) const {
+  data_array->WriteFlat(writer);
+  writer.Write(suffix_array);
+  writer.Write(word_start);
+}
+
+void SuffixArray::ReadFlat(FlatReader& reader) {
+  data_array = make_shared<DataArray>();
+  data_array->ReadFlat(reader);
+  reader.Read(suffix_array);
+  reader.Read(word_start);
+}
+
 } // namespace extractor
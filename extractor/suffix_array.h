@@ -9,6 +9,9 @@
 #include <boost/serialization/split_member.hpp>
 #include <boost/serialization/vector.hpp>
 
+#include "flat_array.h"
+#include "flat_file.h"
+
 using namespace std;
 
 namespace extractor {
@@ -33,7 +36,7 @@ class SuffixArray {
   virtual shared_ptr<DataArray> GetData() const;
 
   // Constructs the longest-common-prefix array using the algorithm of Kasai et
-  // al. (2001).
+  // al. (2001), in parallel.
   virtual vector<int> BuildLCPArray() const;
 
   // Returns the i-th suffix.
@@ -46,20 +49,17 @@ class SuffixArray {
 
   bool operator==(const SuffixArray& other) const;
 
- private:
-  // Constructs the suffix array using the algorithm of Larsson and Sadakane
-  // (1999).
-  void BuildSuffixArray();
-
-  // Bucket sort on the data array (used for initializing the construction of
-  // the suffix array.)
-  void InitialBucketSort(vector<int>& groups);
+  // Writes the suffix array and its data array in the flat format (see
+  // flat_file.h).
+  void WriteFlat(FlatWriter& writer) const;
 
-  void TernaryQuicksort(int left, int right, int step, vector<int>& groups);
+  // Maps a suffix array written by WriteFlat.
+  void ReadFlat(FlatReader& reader);
 
-  // Constructs the suffix array in log(n) steps by doubling the length of the
-  // suffixes at each step.
-  void PrefixDoublingSort(vector<int>& groups);
+ private:
+  // Constructs the suffix array in linear time using the SA-IS algorithm of
+  // Nong, Zhang and Chan (2009).
+  void BuildSuffixArray();
 
   // Given a [low, high) range in the suffix array in which all elements have
   // the first offset-1 values the same, it returns the first position where the
@@ -70,22 +70,27 @@ class SuffixArray {
 
   template<class Archive> void save(Archive& ar, unsigned int) const {
     ar << *data_array;
-    ar << suffix_array;
-    ar << word_start;
+    vector<int> values = suffix_array.ToVector();
+    ar << values;
+    values = word_start.ToVector();
+    ar << values;
   }
 
   template<class Archive> void load(Archive& ar, unsigned int) {
     data_array = make_shared<DataArray>();
     ar >> *data_array;
-    ar >> suffix_array;
-    ar >> word_start;
+    vector<int> values;
+    ar >> values;
+    suffix_array = move(values);
+    ar >> values;
+    word_start = move(values);
   }
 
   BOOST_SERIALIZATION_SPLIT_MEMBER();
 
   shared_ptr<DataArray> data_array;
-  vector<int> suffix_array;
-  vector<int> word_start;
+  FlatArray<int> suffix_array;
+  FlatArray<int> word_start;
 };
 
 } // namespace extractor
@@ -1,10 +1,15 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 
+#include "flat_file.h"
 #include "mocks/mock_data_array.h"
 #include "phrase_location.h"
 #include "suffix_array.h"
@@ -50,6 +55,49 @@ TEST_F(SuffixArrayTest, TestBuildLCP) {
   EXPECT_EQ(expected_lcp, suffix_array.BuildLCPArray());
 }
 
+TEST(SuffixArrayConstructionTest, TestRepetitiveData) {
+  // Repeated sentences with few distinct words make the suffix sort recurse.
+  vector<int> data;
+  for (int i = 0; i < 500; ++i) {
+    for (int j = 0; j < 3 + i % 7; ++j) {
+      data.push_back(2 + (i * j + j / 2) % 4);
+    }
+    data.push_back(1);
+  }
+  shared_ptr<MockDataArray> data_array = make_shared<MockDataArray>();
+  EXPECT_CALL(*data_array, GetData()).WillRepeatedly(Return(data));
+  EXPECT_CALL(*data_array, GetVocabularySize()).WillRepeatedly(Return(6));
+  SuffixArray suffix_array(data_array);
+
+  vector<int> text = data;
+  text.push_back(0);
+  vector<int> expected_suffix_array(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    expected_suffix_array[i] = i;
+  }
+  sort(expected_suffix_array.begin(), expected_suffix_array.end(),
+       [&text](int a, int b) {
+    return lexicographical_compare(text.begin() + a, text.end(),
+                                   text.begin() + b, text.end());
+  });
+  ASSERT_EQ(expected_suffix_array.size(), suffix_array.GetSize());
+  for (size_t i = 0; i < expected_suffix_array.size(); ++i) {
+    EXPECT_EQ(expected_suffix_array[i], suffix_array.GetSuffix(i));
+  }
+
+  vector<int> lcp = suffix_array.BuildLCPArray();
+  EXPECT_EQ(-1, lcp[0]);
+  for (size_t i = 1; i < lcp.size(); ++i) {
+    int a = expected_suffix_array[i - 1], b = expected_suffix_array[i];
+    int expected_lcp = 0;
+    while (b + expected_lcp < data.size() &&
+           text[a + expected_lcp] == text[b + expected_lcp]) {
+      ++expected_lcp;
+    }
+    EXPECT_EQ(expected_lcp, lcp[i]);
+  }
+}
+
 TEST_F(SuffixArrayTest, TestLookup) {
   for (size_t i = 0; i < data.size(); ++i) {
     EXPECT_CALL(*data_array, AtIndex(i)).WillRepeatedly(Return(data[i]));
@@ -86,5 +134,18 @@ TEST_F(SuffixArrayTest, TestSerialization) {
   EXPECT_EQ(suffix_array, suffix_array_copy);
 }
 
+TEST_F(SuffixArrayTest, TestFlatSerialization) {
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "SuffixArray");
+  suffix_array.WriteFlat(writer);
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "SuffixArray");
+  SuffixArray suffix_array_copy;
+  suffix_array_copy.ReadFlat(reader);
+
+  EXPECT_EQ(suffix_array, suffix_array_copy);
+}
+
 } // namespace
 } // namespace extractor
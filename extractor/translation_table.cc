@@ -1,5 +1,6 @@
 #include "translation_table.h"
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -61,6 +62,8 @@ TranslationTable::TranslationTable(shared_ptr<DataArray> source_data_array,
     }
   }
 
+  unordered_map<pair<int, int>, pair<double, double>, PairHash>
+      translation_probabilities;
   // Calculating:
   //   p(e | f) = count(e, f) / count(f)
   //   p(f | e) = count(e, f) / count(e)
@@ -71,12 +74,53 @@ TranslationTable::TranslationTable(shared_ptr<DataArray> source_data_array,
     double score2 = 1.0 * link_count.second / target_links_count[target_word];
     translation_probabilities[link_count.first] = make_pair(score1, score2);
   }
+  SetScores(translation_probabilities);
 }
 
 TranslationTable::TranslationTable() {}
 
 TranslationTable::~TranslationTable() {}
 
+namespace {
+
+uint64_t WordPair(int source_id, int target_id) {
+  return (uint64_t) (uint32_t) source_id << 32 | (uint32_t) target_id;
+}
+
+} // namespace
+
+void TranslationTable::SetScores(
+    const unordered_map<pair<int, int>, pair<double, double>, PairHash>&
+        translation_probabilities) {
+  vector<pair<uint64_t, pair<double, double>>> entries;
+  for (const auto& entry: translation_probabilities) {
+    entries.push_back(make_pair(
+        WordPair(entry.first.first, entry.first.second), entry.second));
+  }
+  sort(entries.begin(), entries.end());
+
+  vector<uint64_t> new_word_pairs, hashes;
+  vector<double> new_scores;
+  for (const auto& entry: entries) {
+    new_word_pairs.push_back(entry.first);
+    new_scores.push_back(entry.second.first);
+    new_scores.push_back(entry.second.second);
+    hashes.push_back(FlatHash(&entry.first, sizeof(entry.first)));
+  }
+
+  word_pairs = move(new_word_pairs);
+  scores = move(new_scores);
+  word_pair_index = FlatHashIndex(hashes);
+}
+
+int64_t TranslationTable::Find(int source_id, int target_id) const {
+  uint64_t word_pair = WordPair(source_id, target_id);
+  return word_pair_index.Find(FlatHash(&word_pair, sizeof(word_pair)),
+                              [this, word_pair](uint64_t i) {
+    return word_pairs[i] == word_pair;
+  });
+}
+
 void TranslationTable::IncrementLinksCount(
     unordered_map<int, int>& source_links_count,
     unordered_map<int, int>& target_links_count,
@@ -89,41 +133,61 @@ void TranslationTable::IncrementLinksCount(
 }
 
 double TranslationTable::GetTargetGivenSourceScore(
-    const string& source_word, const string& target_word) {
+    const string& source_word, const string& target_word) const {
   int source_id = source_data_array->GetWordId(source_word);
   int target_id = target_data_array->GetWordId(target_word);
   if (source_id == -1 || target_id == -1) {
     return -1;
   }
 
-  auto entry = make_pair(source_id, target_id);
-  auto it = translation_probabilities.find(entry);
-  if (it == translation_probabilities.end()) {
+  int64_t i = Find(source_id, target_id);
+  if (i == -1) {
     return 0;
   }
-  return it->second.first;
+  return scores[2 * i];
 }
 
 double TranslationTable::GetSourceGivenTargetScore(
-    const string& source_word, const string& target_word) {
+    const string& source_word, const string& target_word) const {
   int source_id = source_data_array->GetWordId(source_word);
   int target_id = target_data_array->GetWordId(target_word);
   if (source_id == -1 || target_id == -1) {
     return -1;
   }
 
-  auto entry = make_pair(source_id, target_id);
-  auto it = translation_probabilities.find(entry);
-  if (it == translation_probabilities.end()) {
+  int64_t i = Find(source_id, target_id);
+  if (i == -1) {
     return 0;
   }
-  return it->second.second;
+  return scores[2 * i + 1];
 }
 
 bool TranslationTable::operator==(const TranslationTable& other) const {
   return *source_data_array == *other.source_data_array &&
          *target_data_array == *other.target_data_array &&
-         translation_probabilities == other.translation_probabilities;
+         word_pairs == other.word_pairs && scores == other.scores;
+}
+
+void TranslationTable::WriteFlat(FlatWriter& writer) const {
+  source_data_array->WriteFlat(writer);
+  target_data_array->WriteFlat(writer);
+  writer.Write(word_pairs);
+  writer.Write(scores);
+  word_pair_index.WriteFlat(writer);
+}
+
+bool TranslationTable::IsMapped() const {
+  return word_pairs.IsMapped() && scores.IsMapped();
+}
+
+void TranslationTable::ReadFlat(FlatReader& reader) {
+  source_data_array = make_shared<DataArray>();
+  source_data_array->ReadFlat(reader);
+  target_data_array = make_shared<DataArray>();
+  target_data_array->ReadFlat(reader);
+  reader.Read(word_pairs);
+  reader.Read(scores);
+  word_pair_index.ReadFlat(reader);
 }
 
 } // namespace extractor
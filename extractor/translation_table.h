@@ -10,6 +10,9 @@
 #include <boost/serialization/split_member.hpp>
 #include <boost/serialization/utility.hpp>
 
+#include "flat_array.h"
+#include "flat_file.h"
+
 using namespace std;
 
 namespace extractor {
@@ -38,14 +41,24 @@ class TranslationTable {
 
   // Returns p(e | f).
   virtual double GetTargetGivenSourceScore(const string& source_word,
-                                           const string& target_word);
+                                           const string& target_word) const;
 
   // Returns p(f | e).
   virtual double GetSourceGivenTargetScore(const string& source_word,
-                                           const string& target_word);
+                                           const string& target_word) const;
 
   bool operator==(const TranslationTable& other) const;
 
+  // Writes the translation table and its data arrays in the flat format (see
+  // flat_file.h).
+  void WriteFlat(FlatWriter& writer) const;
+
+  // Maps a translation table written by WriteFlat.
+  void ReadFlat(FlatReader& reader);
+
+  // Returns whether the scores are a view of a memory mapped file.
+  bool IsMapped() const;
+
  private:
   // Increment links count for the given (f, e) word pair.
   void IncrementLinksCount(
@@ -55,14 +68,24 @@ class TranslationTable {
       int source_word_id,
       int target_word_id) const;
 
+  // Stores the (p(e | f), p(f | e)) scores of the word pairs in flat arrays.
+  void SetScores(const unordered_map<pair<int, int>, pair<double, double>,
+                                     PairHash>& translation_probabilities);
+
+  // Returns the position of the (f, e) word pair in the flat arrays, or -1.
+  int64_t Find(int source_id, int target_id) const;
+
   friend class boost::serialization::access;
 
   template<class Archive> void save(Archive& ar, unsigned int) const {
     ar << *source_data_array << *target_data_array;
 
-    int num_entries = translation_probabilities.size();
+    int num_entries = word_pairs.size();
     ar << num_entries;
-    for (auto entry: translation_probabilities) {
+    for (int i = 0; i < num_entries; ++i) {
+      pair<pair<int, int>, pair<double, double>> entry(
+          make_pair(word_pairs[i] >> 32, word_pairs[i] & 0xFFFFFFFF),
+          make_pair(scores[2 * i], scores[2 * i + 1]));
       ar << entry;
     }
   }
@@ -73,6 +96,8 @@ class TranslationTable {
     target_data_array = make_shared<DataArray>();
     ar >> *target_data_array;
 
+    unordered_map<pair<int, int>, pair<double, double>, PairHash>
+        translation_probabilities;
     int num_entries;
     ar >> num_entries;
     for (size_t i = 0; i < num_entries; ++i) {
@@ -80,14 +105,18 @@ class TranslationTable {
       ar >> entry;
       translation_probabilities.insert(entry);
     }
+    SetScores(translation_probabilities);
   }
 
   BOOST_SERIALIZATION_SPLIT_MEMBER();
 
   shared_ptr<DataArray> source_data_array;
   shared_ptr<DataArray> target_data_array;
-  unordered_map<pair<int, int>, pair<double, double>, PairHash>
-      translation_probabilities;
+  // The (f, e) word pairs, as f << 32 | e, in increasing order. The scores of
+  // word_pairs[i] are scores[2 * i] = p(e | f) and scores[2 * i + 1] = p(f | e).
+  FlatArray<uint64_t> word_pairs;
+  FlatArray<double> scores;
+  FlatHashIndex word_pair_index;
 };
 
 } // namespace extractor
@@ -8,6 +8,9 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 
+#include "alignment.h"
+#include "data_array.h"
+#include "flat_file.h"
 #include "mocks/mock_alignment.h"
 #include "mocks/mock_data_array.h"
 #include "translation_table.h"
@@ -97,5 +100,47 @@ TEST_F(TranslationTableTest, TestSerialization) {
   EXPECT_EQ(table, table_copy);
 }
 
+TEST_F(TranslationTableTest, TestFlatSerialization) {
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "TranslationTable");
+  table.WriteFlat(writer);
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "TranslationTable");
+  TranslationTable table_copy;
+  table_copy.ReadFlat(reader);
+
+  EXPECT_EQ(table, table_copy);
+}
+
+TEST(TranslationTableMappedTest, TestLookupsKeepMapping) {
+  shared_ptr<DataArray> source_data_array =
+      make_shared<DataArray>("sample_bitext.txt", SOURCE);
+  shared_ptr<DataArray> target_data_array =
+      make_shared<DataArray>("sample_bitext.txt", TARGET);
+  shared_ptr<Alignment> alignment =
+      make_shared<Alignment>("sample_alignment.txt");
+  TranslationTable table(source_data_array, target_data_array, alignment);
+
+  stringstream stream(ios_base::binary | ios_base::out | ios_base::in);
+  FlatWriter writer(stream, "TranslationTable");
+  table.WriteFlat(writer);
+
+  shared_ptr<string> buffer = make_shared<string>(stream.str());
+  FlatReader reader(buffer->data(), buffer->size(), buffer, "TranslationTable");
+  TranslationTable mapped_table;
+  mapped_table.ReadFlat(reader);
+  ASSERT_TRUE(mapped_table.IsMapped());
+
+  EXPECT_LT(0, mapped_table.GetTargetGivenSourceScore("ana", "anna"));
+  EXPECT_EQ(table.GetTargetGivenSourceScore("ana", "anna"),
+            mapped_table.GetTargetGivenSourceScore("ana", "anna"));
+  EXPECT_EQ(table.GetSourceGivenTargetScore("are", "has"),
+            mapped_table.GetSourceGivenTargetScore("are", "has"));
+  EXPECT_EQ(0, mapped_table.GetSourceGivenTargetScore("mere", "milk"));
+  // The lookups read the mapped scores in place.
+  EXPECT_TRUE(mapped_table.IsMapped());
+}
+
 } // namespace
 } // namespace extractor
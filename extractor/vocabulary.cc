@@ -5,19 +5,11 @@ namespace extractor {
 Vocabulary::~Vocabulary() {}
 
 int Vocabulary::GetTerminalIndex(const string& word) {
-  int word_id = -1;
-  #pragma omp critical (vocabulary)
-  {
-    auto it = dictionary.find(word);
-    if (it != dictionary.end()) {
-      word_id = it->second;
-    } else {
-      word_id = words.size();
-      dictionary[word] = word_id;
-      words.push_back(word);
-    }
-  }
-  return word_id;
+  return dictionary.Convert(word) - 1;
+}
+
+const string& Vocabulary::GetWord(int word_id) const {
+  return dictionary.Convert(word_id + 1);
 }
 
 int Vocabulary::GetNonterminalIndex(int position) {
@@ -29,14 +21,19 @@ bool Vocabulary::IsTerminal(int symbol) {
 }
 
 string Vocabulary::GetTerminalValue(int symbol) {
-  string word;
-  #pragma omp critical (vocabulary)
-  word = words[symbol];
-  return word;
+  return GetWord(symbol);
 }
 
 bool Vocabulary::operator==(const Vocabulary& other) const {
-  return words == other.words && dictionary == other.dictionary;
+  if (dictionary.max() != other.dictionary.max()) {
+    return false;
+  }
+  for (int i = 0; i < dictionary.max(); ++i) {
+    if (GetWord(i) != other.GetWord(i)) {
+      return false;
+    }
+  }
+  return true;
 }
 
 } // namespace extractor
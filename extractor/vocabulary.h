@@ -2,13 +2,14 @@
 #define _VOCABULARY_H_
 
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/string.hpp>
 #include <boost/serialization/vector.hpp>
 
+#include "dict.h"
+
 using namespace std;
 
 namespace extractor {
@@ -22,9 +23,9 @@ namespace extractor {
  * query time). Note that this is the single data structure that changes state
  * and needs to have thread safe read/write operations.
  *
- * Note: For an experiment using different vocabulary instances for each thread,
- * the running time did not improve implying that the critical regions do not
- * cause bottlenecks.
+ * The words are kept in a Dict (see utils/dict.h), so lookups of known words
+ * and ids do not lock; only adding a new word does. Word ids are the Dict ids
+ * minus one, since Dict reserves id 0.
  */
 class Vocabulary {
  public:
@@ -45,23 +46,29 @@ class Vocabulary {
   bool operator==(const Vocabulary& vocabulary) const;
 
  private:
+  const string& GetWord(int word_id) const;
+
   friend class boost::serialization::access;
 
   template<class Archive> void save(Archive& ar, unsigned int) const {
+    vector<string> words;
+    for (int i = 0; i < dictionary.max(); ++i) {
+      words.push_back(GetWord(i));
+    }
     ar << words;
   }
 
   template<class Archive> void load(Archive& ar, unsigned int) {
+    vector<string> words;
     ar >> words;
-    for (size_t i = 0; i < words.size(); ++i) {
-      dictionary[words[i]] = i;
+    for (const string& word: words) {
+      GetTerminalIndex(word);
     }
   }
 
   BOOST_SERIALIZATION_SPLIT_MEMBER();
 
-  unordered_map<string, int> dictionary;
-  vector<string> words;
+  Dict dictionary;
 };
 
 } // namespace extractor
@@ -25,6 +25,29 @@ TEST(VocabularyTest, TestIndexes) {
   EXPECT_EQ("one", vocabulary.GetTerminalValue(1));
 }
 
+TEST(VocabularyTest, TestConcurrentIndexes) {
+  Vocabulary vocabulary;
+  const int num_words = 20000;
+  vector<int> word_ids(2 * num_words);
+  // Each word is looked up twice, possibly by different threads, while the
+  // vocabulary grows.
+  #pragma omp parallel for num_threads(8)
+  for (int i = 0; i < 2 * num_words; ++i) {
+    string word = "word" + to_string(i % num_words);
+    word_ids[i] = vocabulary.GetTerminalIndex(word);
+    EXPECT_EQ(word, vocabulary.GetTerminalValue(word_ids[i]));
+  }
+
+  vector<bool> seen(num_words);
+  for (int i = 0; i < num_words; ++i) {
+    EXPECT_EQ(word_ids[i], word_ids[i + num_words]);
+    ASSERT_LE(0, word_ids[i]);
+    ASSERT_GT(num_words, word_ids[i]);
+    EXPECT_FALSE(seen[word_ids[i]]);
+    seen[word_ids[i]] = true;
+  }
+}
+
 TEST(VocabularyTest, TestSerialization) {
   Vocabulary vocabulary;
   EXPECT_EQ(0, vocabulary.GetTerminalIndex("zero"));
@@ -40,15 +40,15 @@ struct KBestGetter : public HypSampler
   KBestUnique(const Hypergraph& forest)
   {
     s_.clear(); sz_ = f_count_ = 0;
-    KBest::KBestDerivations<vector<WordID>, ESentenceTraversal,
-      KBest::FilterUnique, prob_t, EdgeProb> kbest(forest, k_);
+    typedef KBest::KBestDerivations<KBest::EYield, KBest::EYieldTraversal,
+      KBest::FilterUniqueEYield, prob_t, EdgeProb> K;
+    K kbest(forest, k_);
     for (unsigned i = 0; i < k_; ++i) {
-      const KBest::KBestDerivations<vector<WordID>, ESentenceTraversal, KBest::FilterUnique,
-              prob_t, EdgeProb>::Derivation* d =
+      const K::Derivation* d =
             kbest.LazyKthBest(forest.nodes_.size() - 1, i);
       if (!d) break;
       ScoredHyp h;
-      h.w = d->yield;
+      d->yield.Words(&h.w);
       h.f = d->feature_values;
       h.model = log(d->score);
       h.rank = i;
@@ -63,13 +63,14 @@ struct KBestGetter : public HypSampler
   KBestNoFilter(const Hypergraph& forest)
   {
     s_.clear(); sz_ = f_count_ = 0;
-    KBest::KBestDerivations<vector<WordID>, ESentenceTraversal> kbest(forest, k_);
+    typedef KBest::KBestDerivations<KBest::EYield, KBest::EYieldTraversal> K;
+    K kbest(forest, k_);
     for (unsigned i = 0; i < k_; ++i) {
-      const KBest::KBestDerivations<vector<WordID>, ESentenceTraversal>::Derivation* d =
+      const K::Derivation* d =
             kbest.LazyKthBest(forest.nodes_.size() - 1, i);
       if (!d) break;
       ScoredHyp h;
-      h.w = d->yield;
+      d->yield.Words(&h.w);
       h.f = d->feature_values;
       h.model = log(d->score);
       h.rank = i;
@@ -158,30 +158,35 @@ void CandidateSet::Dedup() {
 }
 
 void CandidateSet::AddKBestCandidates(const Hypergraph& hg, size_t kbest_size, const SegmentEvaluator* scorer) {
-  KBest::KBestDerivations<vector<WordID>, ESentenceTraversal> kbest(hg, kbest_size);
+  typedef KBest::KBestDerivations<KBest::EYield, KBest::EYieldTraversal> K;
+  K kbest(hg, kbest_size);
 
+  vector<WordID> words;
   for (unsigned i = 0; i < kbest_size; ++i) {
-    const KBest::KBestDerivations<vector<WordID>, ESentenceTraversal>::Derivation* d =
+    const K::Derivation* d =
       kbest.LazyKthBest(hg.nodes_.size() - 1, i);
     if (!d) break;
-    cs.push_back(Candidate(d->yield, d->feature_values));
+    d->yield.Words(&words);
+    cs.push_back(Candidate(words, d->feature_values));
     if (scorer)
-      scorer->Evaluate(d->yield, &cs.back().eval_feats);
+      scorer->Evaluate(words, &cs.back().eval_feats);
   }
   Dedup();
 }
 
 void CandidateSet::AddUniqueKBestCandidates(const Hypergraph& hg, size_t kbest_size, const SegmentEvaluator* scorer) {
-  typedef KBest::KBestDerivations<vector<WordID>, ESentenceTraversal, KBest::FilterUnique> K;
+  typedef KBest::KBestDerivations<KBest::EYield, KBest::EYieldTraversal, KBest::FilterUniqueEYield> K;
   K kbest(hg, kbest_size);
 
+  vector<WordID> words;
   for (unsigned i = 0; i < kbest_size; ++i) {
     const K::Derivation* d =
       kbest.LazyKthBest(hg.nodes_.size() - 1, i);
     if (!d) break;
-    cs.push_back(Candidate(d->yield, d->feature_values));
+    d->yield.Words(&words);
+    cs.push_back(Candidate(words, d->feature_values));
     if (scorer)
-      scorer->Evaluate(d->yield, &cs.back().eval_feats);
+      scorer->Evaluate(words, &cs.back().eval_feats);
   }
   Dedup();
 }
@@ -0,0 +1,42 @@
+/*
+  converts a grammar from the text format into the memory mapped binary
+  format read by CompiledGrammar. cdec recognizes compiled grammars
+  automatically, so the output can be passed to --grammar (or used as a
+  per-sentence grammar) instead of the text grammar.
+ */
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+#include "compiled_grammar.h"
+#include "filelib.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+void InitCommandLine(int argc, char** argv, po::variables_map* conf) {
+  po::options_description opts("Configuration options");
+  opts.add_options()
+        ("input,i", po::value<string>()->default_value("-"), "Input grammar (text format, may be gzipped)")
+        ("output,o", po::value<string>(), "Output file")
+        ("help,h", "Print this help message and exit");
+  po::options_description dcmdline_options;
+  dcmdline_options.add(opts);
+
+  po::store(parse_command_line(argc, argv, dcmdline_options), *conf);
+  po::notify(*conf);
+
+  if (conf->count("help") || conf->count("output") == 0) {
+    cerr << "\nUsage: grammar_compile -i grammar.gz -o grammar.bin\n\nConverts an SCFG (in Hiero format) into a compiled grammar that is loaded with mmap.\n";
+    cerr << dcmdline_options << endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  po::variables_map conf;
+  InitCommandLine(argc, argv, &conf);
+  ReadFile rf(conf["input"].as<string>());
+  CompiledGrammar::Compile(rf.stream(), conf["output"].as<string>());
+  return 0;
+}
@@ -1,8 +1,77 @@
 #include "dict.h"
 
+#include <cstdlib>
+#include <iostream>
 #include <string>
 #include <vector>
 
+static const size_t kINITIAL_TABLE_SIZE = 1 << 10;
+
+Dict::HashTable::HashTable(size_t size) : mask(size - 1), ids(new std::atomic<WordID>[size]) {
+  for (size_t i = 0; i < size; ++i)
+    ids[i].store(0, std::memory_order_relaxed);
+}
+
+Dict::Dict() : b0_("<bad0>"), chunks_(new std::atomic<std::string*>[kMAX_CHUNKS]), num_words_(0) {
+  for (int i = 0; i < kMAX_CHUNKS; ++i)
+    chunks_[i].store(NULL, std::memory_order_relaxed);
+  tables_.push_back(boost::shared_ptr<HashTable>(new HashTable(kINITIAL_TABLE_SIZE)));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+Dict::~Dict() {
+  for (int i = 0; i < kMAX_CHUNKS; ++i)
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+}
+
+void Dict::clear() {
+  for (int i = 0; i < kMAX_CHUNKS; ++i) {
+    delete[] chunks_[i].load(std::memory_order_relaxed);
+    chunks_[i].store(NULL, std::memory_order_relaxed);
+  }
+  num_words_.store(0, std::memory_order_release);
+  tables_.clear();
+  tables_.push_back(boost::shared_ptr<HashTable>(new HashTable(kINITIAL_TABLE_SIZE)));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+WordID Dict::Add(const std::string& word, size_t hash) {
+  const int n = num_words_.load(std::memory_order_relaxed);
+  const int chunk = n >> kCHUNK_BITS;
+  if (chunk >= kMAX_CHUNKS) {
+    std::cerr << "Dict is limited to " << kMAX_CHUNKS * kCHUNK_SIZE << " words\n";
+    abort();
+  }
+  std::string* words = chunks_[chunk].load(std::memory_order_relaxed);
+  if (!words) {
+    words = new std::string[kCHUNK_SIZE];
+    chunks_[chunk].store(words, std::memory_order_release);
+  }
+  words[n & (kCHUNK_SIZE - 1)] = word;
+  num_words_.store(n + 1, std::memory_order_release);
+  const WordID id = n + 1;
+
+  // the table is kept at most half full, so lookups stay short
+  HashTable* table = table_.load(std::memory_order_relaxed);
+  if (2 * static_cast<size_t>(id) > table->mask + 1) {
+    tables_.push_back(boost::shared_ptr<HashTable>(new HashTable(2 * (table->mask + 1))));
+    table = tables_.back().get();
+    for (WordID i = 1; i <= id; ++i)
+      Insert(table, i, std::hash<std::string>()(Word(i)));
+    table_.store(table, std::memory_order_release);
+  } else {
+    Insert(table, id, hash);
+  }
+  return id;
+}
+
+void Dict::Insert(HashTable* table, WordID id, size_t hash) {
+  size_t i = hash & table->mask;
+  while (table->ids[i].load(std::memory_order_relaxed))
+    i = (i + 1) & table->mask;
+  table->ids[i].store(id, std::memory_order_release);
+}
+
 void TokenizeStringSeparator(
           const std::string& str,
           const std::string& separator,
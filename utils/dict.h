@@ -5,22 +5,30 @@
 #include <cassert>
 #include <cstring>
 
+#include <atomic>
+#include <functional>
 #include <string>
 #include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include "hash.h"
 #include "wordid.h"
 
+// Dict may be used from several decoding threads. Words are only ever added,
+// so lookups of known words and ids don't lock: the words are stored in
+// chunks that are never moved (references returned by Convert(WordID) stay
+// valid as the dictionary grows), and the ids in an open addressing hash
+// table that is replaced by a larger copy when it fills up. Only adding a new
+// word takes the mutex.
 class Dict {
- typedef
- //HASH_MAP<std::string, WordID, boost::hash<std::string> > Map;
- HASH_MAP<std::string, WordID> Map;
  public:
-  Dict() : b0_("<bad0>") {
-    HASH_MAP_EMPTY(d_,"<bad1>");
-    words_.reserve(1000);
-  }
+  Dict();
+  ~Dict();
 
-  inline int max() const { return words_.size(); }
+  inline int max() const {
+    return num_words_.load(std::memory_order_acquire);
+  }
 
   static bool is_ws(char x) {
     return (x == ' ' || x == '\t');
@@ -47,16 +55,13 @@ class Dict {
   }
 
   inline WordID Convert(const std::string& word, bool frozen = false) {
-    Map::iterator i = d_.find(word);
-    if (i == d_.end()) {
-      if (frozen)
-        return 0;
-      words_.push_back(word);
-      d_[word] = words_.size();
-      return words_.size();
-    } else {
-      return i->second;
-    }
+    const size_t hash = std::hash<std::string>()(word);
+    WordID id = Find(word, hash);
+    if (id || frozen) return id;
+    boost::mutex::scoped_lock lock(mutex_);
+    // another thread may have added the word in the meantime
+    id = Find(word, hash);
+    return id ? id : Add(word, hash);
   }
 
   inline WordID Convert(const std::vector<std::string>& words, bool frozen = false)
@@ -74,18 +79,55 @@ class Dict {
 
   inline const std::string& Convert(const WordID& id) const {
     if (id == 0) return b0_;
-    assert(id <= (int)words_.size());
-    return words_[id-1];
+    assert(id <= max());
+    return Word(id);
   }
 
   void AsVector(const WordID& id, std::vector<std::string>* results) const;
 
-  void clear() { words_.clear(); d_.clear(); }
+  // may not be called while other threads use the dictionary
+  void clear();
 
  private:
+  // the ids of the words (0 in empty slots) in the slots following their hashes
+  struct HashTable {
+    explicit HashTable(size_t size);
+    size_t mask;
+    boost::scoped_array<std::atomic<WordID> > ids;
+  };
+
+  // the id of word, 0 if it is not in the dictionary
+  inline WordID Find(const std::string& word, size_t hash) const {
+    // ids are stored after their words, so an id read from the table always
+    // refers to a stored word
+    const HashTable* table = table_.load(std::memory_order_acquire);
+    for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask) {
+      const WordID id = table->ids[i].load(std::memory_order_acquire);
+      if (!id || Word(id) == word) return id;
+    }
+  }
+
+  inline const std::string& Word(WordID id) const {
+    return chunks_[(id - 1) >> kCHUNK_BITS].load(std::memory_order_acquire)[(id - 1) & (kCHUNK_SIZE - 1)];
+  }
+
+  // adds a new word, requires mutex_
+  WordID Add(const std::string& word, size_t hash);
+  static void Insert(HashTable* table, WordID id, size_t hash);
+
+  static const int kCHUNK_BITS = 14;
+  static const int kCHUNK_SIZE = 1 << kCHUNK_BITS;
+  static const int kMAX_CHUNKS = 1 << 14;
+
   const std::string b0_;
-  std::vector<std::string> words_;
-  Map d_;
+  // the word with id i is chunks_[(i - 1) / kCHUNK_SIZE][(i - 1) % kCHUNK_SIZE]
+  boost::scoped_array<std::atomic<std::string*> > chunks_;
+  std::atomic<int> num_words_;
+  std::atomic<HashTable*> table_;
+  // all hash tables, including the ones replaced by larger copies, which may
+  // still be read by concurrent lookups
+  std::vector<boost::shared_ptr<HashTable> > tables_;
+  boost::mutex mutex_;
 };
 
 #endif
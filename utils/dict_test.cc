@@ -3,6 +3,10 @@
 #include "fdict.h"
 
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #define BOOST_TEST_MODULE CrpTest
 #include <boost/test/unit_test.hpp>
 #include <boost/test/floating_point_comparison.hpp>
@@ -22,6 +26,37 @@ BOOST_AUTO_TEST_CASE(Convert) {
   BOOST_CHECK_EQUAL(d.Convert(b), "bar");
 }
 
+static void ConvertWords(Dict* d, int thread, vector<WordID>* ids) {
+  for (int i = 0; i < 20000; ++i) {
+    ostringstream os;
+    os << "w" << (i * 7 + thread) % 5000;
+    const WordID id = d->Convert(os.str());
+    if (d->Convert(id) != os.str()) ids->push_back(-1);
+    if (i < 5000) ids->push_back(id);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentConvert) {
+  Dict d;
+  const WordID a = d.Convert("a");
+  vector<vector<WordID> > ids(4);
+  boost::thread_group threads;
+  for (int t = 0; t < 4; ++t)
+    threads.create_thread(boost::bind(&ConvertWords, &d, t, &ids[t]));
+  threads.join_all();
+  BOOST_CHECK_EQUAL(d.max(), 5001);
+  BOOST_CHECK_EQUAL(d.Convert("a"), a);
+  for (int t = 0; t < 4; ++t) {
+    BOOST_REQUIRE_EQUAL(ids[t].size(), 5000);
+    for (int i = 0; i < 5000; ++i) {
+      ostringstream os;
+      os << "w" << (i * 7 + t) % 5000;
+      BOOST_CHECK_EQUAL(d.Convert(os.str(), true), ids[t][i]);
+    }
+  }
+  BOOST_CHECK_EQUAL(d.Convert("missing", true), 0);
+}
+
 BOOST_AUTO_TEST_CASE(FDictTest) {
   int fid = FD::Convert("First");
   assert(fid > 0);
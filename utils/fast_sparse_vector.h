@@ -6,6 +6,12 @@
 // fast operations when the sizes are large.
 // important: indexes are integers
 // important: iterators may return elements in any order
+//
+// Up to LOCAL_MAX elements are stored inside the object, up to FLAT_MAX in a
+// contiguous array on the heap, and larger vectors use a hash map. The array
+// covers the typical decoder case of a few dozen features firing on every
+// edge, which would otherwise require a hash map per edge and make dot
+// products with the weight vector slow.
 
 #include <cmath>
 #include <cstring>
@@ -14,6 +20,7 @@
 #include <cassert>
 #include <vector>
 #include <limits>
+#include <new>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -68,7 +75,7 @@ class FastSparseVector {
   struct iterator {
     iterator(FastSparseVector<T>& v, const bool is_end) : local_(!v.is_remote_) {
       if (local_) {
-        local_it_ = &v.data_.local[is_end ? v.local_size_ : 0];
+        local_it_ = &v.local_data()[is_end ? v.local_size_ : 0];
       } else {
         if (is_end)
           remote_it_ = v.data_.rbmap->end();
@@ -79,8 +86,8 @@ class FastSparseVector {
     iterator(FastSparseVector<T>& v, const bool, const unsigned k) : local_(!v.is_remote_) {
       if (local_) {
         unsigned i = 0;
-        while(i < v.local_size_ && v.data_.local[i].first() != k) { ++i; }
-        local_it_ = &v.data_.local[i];
+        while(i < v.local_size_ && v.local_data()[i].first() != k) { ++i; }
+        local_it_ = &v.local_data()[i];
       } else {
         remote_it_ = v.data_.rbmap->find(k);
       }
@@ -122,7 +129,7 @@ class FastSparseVector {
   struct const_iterator {
     const_iterator(const FastSparseVector<T>& v, const bool is_end) : local_(!v.is_remote_) {
       if (local_) {
-        local_it_ = &v.data_.local[is_end ? v.local_size_ : 0];
+        local_it_ = &v.local_data()[is_end ? v.local_size_ : 0];
       } else {
         if (is_end)
           remote_it_ = v.data_.rbmap->end();
@@ -133,8 +140,8 @@ class FastSparseVector {
     const_iterator(const FastSparseVector<T>& v, const bool, const unsigned k) : local_(!v.is_remote_) {
       if (local_) {
         unsigned i = 0;
-        while(i < v.local_size_ && v.data_.local[i].first() != k) { ++i; }
-        local_it_ = &v.data_.local[i];
+        while(i < v.local_size_ && v.local_data()[i].first() != k) { ++i; }
+        local_it_ = &v.local_data()[i];
       } else {
         remote_it_ = v.data_.rbmap->find(k);
       }
@@ -174,20 +181,29 @@ class FastSparseVector {
     }
   };
  public:
-  FastSparseVector() : local_size_(0), is_remote_(false) { std::memset(&data_, 0, sizeof(data_)); }
+  static const unsigned FLAT_MAX = 64;
+
+  FastSparseVector() : local_size_(0), is_remote_(false), is_flat_(false) { std::memset(&data_, 0, sizeof(data_)); }
   ~FastSparseVector() {
     clear();
   }
   FastSparseVector(const FastSparseVector& other) {
     std::memcpy(this, &other, sizeof(FastSparseVector));
     if (is_remote_) data_.rbmap = new SPARSE_HASH_MAP<unsigned, T>(*data_.rbmap);
+    if (is_flat_) copy_flat();
   }
   FastSparseVector(std::pair<unsigned, T>* first, std::pair<unsigned, T>* last) {
     const ptrdiff_t n = last - first;
-    if (n <= LOCAL_MAX) {
+    is_flat_ = false;
+    if (n <= FLAT_MAX) {
       is_remote_ = false;
       local_size_ = n;
-      std::memcpy(data_.local, first, sizeof(std::pair<unsigned, T>) * n);
+      if (n > LOCAL_MAX) {
+        is_flat_ = true;
+        data_.flat.ptr = alloc_flat(n);
+        data_.flat.capacity = n;
+      }
+      std::memcpy(local_data(), first, sizeof(std::pair<unsigned, T>) * n);
     } else {
       is_remote_ = true;
       data_.rbmap = new SPARSE_HASH_MAP<unsigned, T>(first, last);
@@ -198,11 +214,12 @@ class FastSparseVector {
     if (is_remote_) {
       data_.rbmap->erase(k);
     } else {
+      PairIntT<T>* local = local_data();
       for (unsigned i = 0; i < local_size_; ++i) {
-        if (data_.local[i].first() == k) {
+        if (local[i].first() == k) {
           for (unsigned j = i+1; j < local_size_; ++j) {
-            data_.local[j-1].first() = data_.local[j].first();
-            data_.local[j-1].second() = data_.local[j].second();
+            local[j-1].first() = local[j].first();
+            local[j-1].second() = local[j].second();
           }
         }
       }
@@ -218,6 +235,7 @@ class FastSparseVector {
       // TODO: do i need to set_deleted on a copy?
       HASH_MAP_DELETED(*data_.rbmap, std::numeric_limits<unsigned>::max());
     }
+    if (is_flat_) copy_flat();
     return *this;
   }
   T const& get_singleton() const {
@@ -244,8 +262,9 @@ class FastSparseVector {
       typename SPARSE_HASH_MAP<unsigned, T>::const_iterator it = data_.rbmap->find(k);
       if (it != data_.rbmap->end()) return it->second;
     } else {
+      const PairIntT<T>* local = local_data();
       for (unsigned i = 0; i < local_size_; ++i) {
-        const PairIntT<T>& p = data_.local[i];
+        const PairIntT<T>& p = local[i];
         if (p.first() == k) return p.second();
       }
     }
@@ -288,7 +307,9 @@ class FastSparseVector {
   }
   inline void clear() {
     if (is_remote_) delete data_.rbmap;
+    if (is_flat_) ::operator delete(data_.flat.ptr);
     is_remote_ = false;
+    is_flat_ = false;
     local_size_ = 0;
   }
   inline bool empty() const {
@@ -330,8 +351,9 @@ class FastSparseVector {
       for (typename SPARSE_HASH_MAP<unsigned, T>::iterator it = data_.rbmap->begin(); it != end; ++it)
         it->second *= scalar;
     } else {
+      PairIntT<T>* local = local_data();
       for (int i = 0; i < local_size_; ++i)
-        data_.local[i].second() *= scalar;
+        local[i].second() *= scalar;
     }
     return *this;
   }
@@ -341,8 +363,9 @@ class FastSparseVector {
       for (typename SPARSE_HASH_MAP<unsigned, T>::iterator it = data_.rbmap->begin(); it != end; ++it)
         it->second /= scalar;
     } else {
+      PairIntT<T>* local = local_data();
       for (int i = 0; i < local_size_; ++i)
-        data_.local[i].second() /= scalar;
+        local[i].second() /= scalar;
     }
     return *this;
   }
@@ -381,6 +404,20 @@ class FastSparseVector {
   }
   T dot(const std::vector<T>& v) const {
     T res = T();
+    if (!is_remote_) {
+      // contiguous elements, avoid the iterator
+      const PairIntT<T>* local = local_data();
+      const unsigned n = v.size();
+      for (unsigned i = 0; i < local_size_; ++i) {
+        const unsigned k = local[i].first();
+#if FP_FAST_FMA
+        if (k < n) res = std::fma(local[i].second(), v[k], res);
+#else
+        if (k < n) res += local[i].second() * v[k];
+#endif
+      }
+      return res;
+    }
     for (const_iterator it = begin(), e = end(); it != e; ++it)
 #if FP_FAST_FMA
       if (static_cast<unsigned>(it->first) < v.size()) res = std::fma(it->second, v[it->first], res);
@@ -409,6 +446,7 @@ class FastSparseVector {
   void swap(FastSparseVector<T>& other) {
     char t[sizeof(data_)];
     std::swap(other.is_remote_, is_remote_);
+    std::swap(other.is_flat_, is_flat_);
     std::swap(other.local_size_, local_size_);
     std::memcpy(t, &other.data_, sizeof(data_));
     std::memcpy(&other.data_, &data_, sizeof(data_));
@@ -420,17 +458,47 @@ class FastSparseVector {
       v.resize(i+1);
     return v[i];
   }
+  PairIntT<T>* local_data() {
+    return is_flat_ ? data_.flat.ptr : data_.local;
+  }
+  const PairIntT<T>* local_data() const {
+    return is_flat_ ? data_.flat.ptr : data_.local;
+  }
+  static PairIntT<T>* alloc_flat(unsigned n) {
+    return static_cast<PairIntT<T>*>(::operator new(n * sizeof(PairIntT<T>)));
+  }
+  // replaces data_.flat.ptr (shared with another vector after a memcpy) with
+  // a copy
+  void copy_flat() {
+    PairIntT<T>* p = alloc_flat(data_.flat.capacity);
+    std::memcpy(p, data_.flat.ptr, local_size_ * sizeof(PairIntT<T>));
+    data_.flat.ptr = p;
+  }
+  // moves the local elements to a larger array on the heap
+  void grow_flat() {
+    unsigned capacity = 2 * (is_flat_ ? data_.flat.capacity : LOCAL_MAX + 1);
+    if (capacity > FLAT_MAX) capacity = FLAT_MAX;
+    PairIntT<T>* p = alloc_flat(capacity);
+    std::memcpy(p, local_data(), local_size_ * sizeof(PairIntT<T>));
+    if (is_flat_) ::operator delete(data_.flat.ptr);
+    data_.flat.ptr = p;
+    data_.flat.capacity = capacity;
+    is_flat_ = true;
+  }
   inline T& get_or_create_bin(unsigned k) {
     if (is_remote_) {
       return (*data_.rbmap)[k];
     } else {
+      PairIntT<T>* local = local_data();
       for (unsigned i = 0; i < local_size_; ++i)
-        if (data_.local[i].first() == k) return data_.local[i].second();
+        if (local[i].first() == k) return local[i].second();
     }
     assert(!is_remote_);
     // currently local!
-    if (local_size_ < LOCAL_MAX) {
-      PairIntT<T>& p = data_.local[local_size_];
+    const unsigned capacity = is_flat_ ? data_.flat.capacity : LOCAL_MAX;
+    if (local_size_ == capacity && capacity < FLAT_MAX) grow_flat();
+    if (local_size_ < FLAT_MAX) {
+      PairIntT<T>& p = local_data()[local_size_];
       ++local_size_;
       p.first() = k;
       p.second() = T();
@@ -453,21 +521,30 @@ class FastSparseVector {
       }
       is_remote_ = false;
     } else { // data is local, move to rbmap
+      PairIntT<T>* local = local_data();
       SPARSE_HASH_MAP<unsigned, T>* m = new SPARSE_HASH_MAP<unsigned, T>(
-         reinterpret_cast<std::pair<unsigned, T>*>(&data_.local[0]),
-         reinterpret_cast<std::pair<unsigned, T>*>(&data_.local[local_size_]), local_size_ * 1.5 + 1);
+         reinterpret_cast<std::pair<unsigned, T>*>(&local[0]),
+         reinterpret_cast<std::pair<unsigned, T>*>(&local[local_size_]), local_size_ * 1.5 + 1);
       HASH_MAP_DELETED(*m, std::numeric_limits<unsigned>::max());
+      if (is_flat_) ::operator delete(data_.flat.ptr);
       data_.rbmap = m;
       is_remote_ = true;
+      is_flat_ = false;
     }
   }
 
+  struct FlatArray {
+    PairIntT<T>* ptr;
+    unsigned capacity;
+  };
   union {
     PairIntT<T> local[LOCAL_MAX];
+    FlatArray flat;
     SPARSE_HASH_MAP<unsigned, T>* rbmap;
   } data_;
   unsigned char local_size_;
   bool is_remote_;
+  bool is_flat_;
 
  private:
   friend class boost::serialization::access;
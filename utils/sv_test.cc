@@ -64,3 +64,34 @@ BOOST_AUTO_TEST_CASE(Serialization) {
   }
 }
 
+
+BOOST_AUTO_TEST_CASE(LargeVectors) {
+  // exercises the in-object, flat array and hash map representations
+  for (unsigned n = 1; n < 2 * SparseVector<double>::FLAT_MAX; ++n) {
+    SparseVector<double> x;
+    vector<double> w(n + 1, 0.0);
+    double expected = 0;
+    for (unsigned i = 1; i <= n; ++i) {
+      x.set_value(i, 0.5 * i);
+      w[i] = i % 3;
+      expected += 0.5 * i * (i % 3);
+    }
+    BOOST_CHECK_EQUAL(x.size(), n);
+    BOOST_CHECK_CLOSE(x.dot(w), expected, 1e-9);
+    SparseVector<double> y(x);
+    BOOST_CHECK(x == y);
+    y.add_value(n, 1.0);
+    BOOST_CHECK_CLOSE(y.get(n), x.get(n) + 1.0, 1e-9);
+    x = y;
+    BOOST_CHECK(x == y);
+    x *= 2;
+    BOOST_CHECK_CLOSE(x.dot(w), 2 * y.dot(w), 1e-9);
+    x.swap(y);
+    BOOST_CHECK_CLOSE(y.dot(w), 2 * x.dot(w), 1e-9);
+    double sum = 0;
+    const SparseVector<double>& cx = x;
+    for (SparseVector<double>::const_iterator it = cx.begin(); it != cx.end(); ++it)
+      sum += it->second;
+    BOOST_CHECK_CLOSE(sum, 0.25 * n * (n + 1) + 1.0, 1e-9);
+  }
+}
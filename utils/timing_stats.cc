@@ -1,6 +1,7 @@
 #include "timing_stats.h"
 
 #include <iostream>
+#include <boost/thread/mutex.hpp>
 #include "time.h" //cygwin needs
 
 #include "verbose.h"
@@ -9,16 +10,26 @@ using namespace std;
 
 map<string, TimerInfo> Timer::stats;
 
-Timer::Timer(const string& timername) : start_t(clock()), cur(stats[timername]) {}
+// timers may be started and stopped by several decoding threads
+static boost::mutex stats_mutex;
+
+static TimerInfo& GetTimerInfo(map<string, TimerInfo>& stats, const string& timername) {
+  boost::mutex::scoped_lock lock(stats_mutex);
+  return stats[timername];
+}
+
+Timer::Timer(const string& timername) : start_t(clock()), cur(GetTimerInfo(stats, timername)) {}
 
 Timer::~Timer() {
-  ++cur.calls;
   const clock_t end_t = clock();
   const double elapsed = (end_t - start_t) / 1000000.0;
+  boost::mutex::scoped_lock lock(stats_mutex);
+  ++cur.calls;
   cur.total_time += elapsed;
 }
 
 void Timer::Summarize() {
+  boost::mutex::scoped_lock lock(stats_mutex);
   if (!SILENT) {
     for (map<string, TimerInfo>::iterator it = stats.begin(); it != stats.end(); ++it) {
       cerr << it->first << ": " << it->second.total_time << " secs (" << it->second.calls << " calls)\n";